@@ -0,0 +1,594 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file async.hpp
+ * Executor for asynchronous worksheet functions.
+ *
+ * An asynchronous function returns void and receives an async call handle
+ * (type X). It copies its arguments into a job, submits the job to a thread
+ * pool and returns immediately; the result is passed back to Excel with
+ * xlAsyncReturn when the job completes.
+ *
+ * \code
+ * XLL_EXPORT void __stdcall fetch_curve(xll::variant *name, xll::handle *h)
+ * {
+ *     xll::async_executor::submit(h, [](const xll::variant& name) {
+ *         return load_curve(name);
+ *     }, name);
+ * }
+ *
+ * XLL_EXPORT int __stdcall on_calculation_canceled()
+ * {
+ *     xll::async_executor::cancel();
+ *     return 1;
+ * }
+ *
+ * // xlAutoOpen
+ * xll::register_event(L"on_calculation_canceled", xll::xleventCalculationCanceled);
+ *
+ * // xlAutoClose
+ * xll::async_executor::stop();
+ * \endcode
+ *
+ * Calls of a pure function submitted with submit_coalesced() share one job
+ * per distinct argument list while the job is in flight.
+ *
+ * When many asynchronous cells complete together, results can be returned in
+ * batches by starting async_completion_queue, which passes arrays of handles
+ * and values to a single xlAsyncReturn call.
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/functions.hpp>
+#include <xll/tracer.hpp>
+#include <xll/xloper.hpp>
+#include <xll/detail/marshal.hpp>
+#include <xll/detail/thread_pool.hpp>
+#include <xll/detail/type_traits.hpp>
+#include <xll/detail/variant_hash.hpp>
+#include <xll/log.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace xll {
+namespace detail {
+
+// Arguments passed by Excel are only valid for the duration of the call, so
+// pointers are copied into owned values before a job is queued.
+template<class T, class E = void>
+struct async_capture
+{
+    using type = std::decay_t<T>;
+    static type copy(T&& x) { return std::forward<T>(x); }
+};
+
+template<class T>
+struct async_capture<T, std::enable_if_t<std::is_pointer_v<std::decay_t<T>> &&
+    std::is_base_of_v<variant_common_type, std::remove_cv_t<std::remove_pointer_t<std::decay_t<T>>>>>>
+{
+    using type = std::remove_cv_t<std::remove_pointer_t<std::decay_t<T>>>;
+    static type copy(T x)
+    {
+        if constexpr (std::is_pointer_v<std::remove_reference_t<T>>) {
+            if (x == nullptr)
+                return type();
+        }
+        type result(*x);
+        result.clear_flags(); // DLL-owned copy
+        return result;
+    }
+};
+
+template<class T>
+struct async_capture<T, std::enable_if_t<
+    std::is_same_v<std::decay_t<T>, const wchar_t *> || std::is_same_v<std::decay_t<T>, wchar_t *>>>
+{
+    using type = std::wstring;
+    static type copy(T x)
+    {
+        if constexpr (std::is_pointer_v<std::remove_reference_t<T>>)
+            return x ? std::wstring(x) : std::wstring();
+        else
+            return std::wstring(x); // string literal
+    }
+};
+
+template<class T>
+struct async_capture<T, std::enable_if_t<
+    std::is_same_v<std::decay_t<T>, const char *> || std::is_same_v<std::decay_t<T>, char *>>>
+{
+    using type = std::string;
+    static type copy(T x)
+    {
+        if constexpr (std::is_pointer_v<std::remove_reference_t<T>>)
+            return x ? std::string(x) : std::string();
+        else
+            return std::string(x); // string literal
+    }
+};
+
+template<class T>
+using async_capture_t = typename async_capture<T>::type;
+
+// An in-flight call which other calls with equal arguments can attach to.
+// waiters is guarded by the mutex of the async_executor shard holding the call.
+struct async_call_base
+{
+    virtual ~async_call_base() = default;
+    virtual const void *type() const noexcept = 0;
+    virtual bool same_arguments(const async_call_base& other) const noexcept = 0;
+
+    std::uint64_t hash = 0;
+    std::uint64_t generation = 0;
+    std::vector<xlbigdata> waiters;
+};
+
+template<class F, class Tuple>
+struct async_call : async_call_base
+{
+    async_call(F f, Tuple args) : fn(std::move(f)), values(std::move(args))
+    {
+        hash = std::apply([this](const auto&... x) {
+            std::uint64_t h = mix_hash(reinterpret_cast<uintptr_t>(type()));
+            if constexpr (std::is_pointer_v<F>)
+                h = hash_combine(h, reinterpret_cast<uintptr_t>(fn));
+            ((h = hash_combine(h, hash_argument(x))), ...);
+            return h;
+        }, values);
+    }
+
+    const void *type() const noexcept override
+    {
+        static const char tag = 0;
+        return &tag;
+    }
+
+    bool same_arguments(const async_call_base& other) const noexcept override
+    {
+        if (other.type() != type())
+            return false;
+        const auto& rhs = static_cast<const async_call&>(other);
+        if constexpr (std::is_pointer_v<F>) {
+            if (fn != rhs.fn)
+                return false;
+        }
+        return equal(rhs, std::make_index_sequence<std::tuple_size_v<Tuple>>());
+    }
+
+    template<std::size_t... Is>
+    bool equal(const async_call& rhs, std::index_sequence<Is...>) const noexcept
+        { return (equal_argument(std::get<Is>(values), std::get<Is>(rhs.values)) && ...); }
+
+    F fn;
+    Tuple values;
+};
+
+} // namespace detail
+
+/// Collects results of asynchronous functions and returns them to Excel in
+/// batches of at most batch_size from a single thread. A batch is flushed when
+/// it is full, or when its oldest result has waited for latency.
+///
+/// Array results cannot be nested in the xltypeMulti passed to xlAsyncReturn,
+/// so async_executor returns them individually.
+struct async_completion_queue
+{
+    static void start(std::size_t batch_size = 1024,
+        std::chrono::microseconds latency = std::chrono::milliseconds(2))
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        batch_size_ = std::max<std::size_t>(batch_size, 1);
+        latency_ = latency;
+        if (!thread_.joinable()) {
+            stop_ = false;
+            thread_ = std::thread(run);
+        }
+        running_.store(true, std::memory_order_release);
+    }
+
+    /// Returns pending results and stops the flushing thread.
+    static void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_.store(false, std::memory_order_release);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (thread_.joinable() && thread_.get_id() != std::this_thread::get_id())
+            thread_.join();
+    }
+
+    static bool running() noexcept
+        { return running_.load(std::memory_order_acquire); }
+
+    /// Queues the result for the call identified by h.
+    static void push(const xlbigdata& h, variant&& value)
+    {
+        bool notify;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (entries_.empty())
+                oldest_ = std::chrono::steady_clock::now();
+            entries_.push_back({ h, std::move(value) });
+            notify = (entries_.size() == 1 || entries_.size() >= batch_size_);
+        }
+        if (notify)
+            cv_.notify_one();
+    }
+
+    /// Discards pending results. Excel has invalidated the handles of a
+    /// canceled calculation.
+    static std::size_t clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::size_t count = entries_.size();
+        entries_.clear();
+        return count;
+    }
+
+    static std::size_t pending()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.size();
+    }
+
+private:
+    struct entry
+    {
+        xlbigdata handle;
+        variant value;
+    };
+
+    static void run()
+    {
+        std::vector<entry> batch;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            cv_.wait(lock, []() { return stop_ || !entries_.empty(); });
+            if (!stop_) {
+                cv_.wait_until(lock, oldest_ + latency_, []() {
+                    return stop_ || entries_.size() >= batch_size_;
+                });
+            }
+            if (entries_.size() <= batch_size_) {
+                batch.swap(entries_);
+            }
+            else {
+                // Remaining results are older than the new batch; oldest_ is
+                // left unchanged so they are flushed without further delay.
+                auto last = entries_.begin() + static_cast<std::ptrdiff_t>(batch_size_);
+                batch.assign(std::make_move_iterator(entries_.begin()), std::make_move_iterator(last));
+                entries_.erase(entries_.begin(), last);
+            }
+            lock.unlock();
+            if (!batch.empty())
+                flush(batch);
+            batch.clear();
+            lock.lock();
+            if (stop_ && entries_.empty())
+                return;
+        }
+    }
+
+    static void flush(std::vector<entry>& batch)
+    {
+        bool rc;
+        if (batch.size() == 1) {
+            handle h(batch.front().handle);
+            rc = async_return(h, batch.front().value);
+        }
+        else {
+            const auto n = static_cast<unsigned>(batch.size());
+            xlmulti handles(n, 1);
+            xlmulti values(n, 1);
+            for (unsigned i = 0; i < n; ++i) {
+                handles[i] = batch[i].handle;
+                values[i] = std::move(batch[i].value);
+            }
+            variant h(std::move(handles));
+            variant v(std::move(values));
+            rc = async_return(h, v);
+        }
+        if (!rc)
+            xll::log()->debug("xlAsyncReturn failed for {} results", batch.size());
+    }
+
+    static inline std::mutex mutex_;
+    static inline std::condition_variable cv_;
+    static inline std::thread thread_;
+    static inline std::vector<entry> entries_;
+    static inline std::chrono::steady_clock::time_point oldest_;
+    static inline std::chrono::microseconds latency_{ 0 };
+    static inline std::size_t batch_size_ = 1;
+    static inline std::atomic<bool> running_{ false };
+    static inline bool stop_ = false;
+};
+
+/// Runs asynchronous worksheet function jobs on a shared thread pool and
+/// returns their results with xlAsyncReturn.
+///
+/// Each job records the calculation generation at submission. cancel()
+/// advances the generation and drops queued jobs; jobs already running finish,
+/// but their results are discarded since Excel has invalidated the handles.
+struct async_executor
+{
+    /// Starts the thread pool. Called implicitly by the first submit() with
+    /// one thread per hardware thread. Returns false while stop() is joining
+    /// the workers.
+    static bool start(std::size_t threads = 0)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_)
+            return false;
+        if (!pool_)
+            pool_ = std::make_unique<detail::thread_pool>(threads);
+        current_.store(pool_.get(), std::memory_order_release);
+        return true;
+    }
+
+    /// Drops queued jobs and joins the worker threads. Call from xlAutoClose.
+    /// Jobs still running may submit more work, which is dropped.
+    static void stop()
+    {
+        std::unique_ptr<detail::thread_pool> pool;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopping_)
+                return;
+            stopping_ = true;
+            generation_.fetch_add(1, std::memory_order_acq_rel);
+            current_.store(nullptr, std::memory_order_release);
+            pool = std::move(pool_);
+        }
+        // Joined without the lock, since running jobs may call submit().
+        if (pool) {
+            pool->clear();
+            pool.reset();
+        }
+        clear_calls();
+        async_completion_queue::stop();
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = false;
+    }
+
+    /// Drops queued and in-flight work. Call from an xleventCalculationCanceled
+    /// event handler.
+    static void cancel()
+    {
+        generation_.fetch_add(1, std::memory_order_acq_rel);
+        if (auto *pool = current_.load(std::memory_order_acquire)) {
+            std::size_t count = pool->clear();
+            if (count > 0)
+                xll::log()->debug("Canceled {} queued async jobs", count);
+        }
+        clear_calls();
+        async_completion_queue::clear();
+    }
+
+    /// Returns true if a job submitted in generation `g` should still complete.
+    static bool current(std::uint64_t g) noexcept
+        { return generation_.load(std::memory_order_acquire) == g; }
+
+    static std::uint64_t generation() noexcept
+        { return generation_.load(std::memory_order_acquire); }
+
+    /// Number of queued jobs which have not started.
+    static std::size_t pending() noexcept
+    {
+        auto *pool = current_.load(std::memory_order_acquire);
+        return pool ? pool->pending() : 0;
+    }
+
+    /// Copies args and queues fn(args...) for the call identified by h. The
+    /// result of fn is converted to a variant and returned with xlAsyncReturn,
+    /// through async_completion_queue if it is running; exceptions are
+    /// returned as #VALUE!.
+    template<class F, class... Args>
+    static void submit(handle *h, F&& fn, Args&&... args)
+    {
+        if (h == nullptr)
+            return;
+        auto *pool = executor_pool();
+        if (pool == nullptr)
+            return;
+
+        using captured = std::tuple<detail::async_capture_t<Args>...>;
+        auto job = std::make_shared<std::tuple<xlbigdata, std::decay_t<F>, captured, std::uint64_t>>(
+            h->value(), std::forward<F>(fn),
+            captured(detail::async_capture<Args>::copy(std::forward<Args>(args))...),
+            generation());
+
+        pool->submit([job, queued = tracer::timestamp()]() {
+            tracer::async_scope span(queued);
+            auto& [bd, fn, values, g] = *job;
+            if (!current(g))
+                return;
+            variant result = invoke(fn, values);
+            if (current(g))
+                complete(&bd, 1, result);
+        });
+    }
+
+    /// As submit(), but a call with the same function and arguments as a job
+    /// still in flight in this calculation is attached to that job, and the
+    /// one result is returned to every waiting handle. fn must be a function
+    /// pointer or a stateless function object, and must not depend on
+    /// anything but its arguments.
+    template<class F, class... Args>
+    static void submit_coalesced(handle *h, F&& fn, Args&&... args)
+    {
+        using function_type = std::decay_t<F>;
+        static_assert(std::is_pointer_v<function_type> || std::is_empty_v<function_type>,
+            "coalesced async functions must be stateless");
+
+        if (h == nullptr)
+            return;
+        auto *pool = executor_pool();
+        if (pool == nullptr)
+            return;
+
+        using captured = std::tuple<detail::async_capture_t<Args>...>;
+        using call_type = detail::async_call<function_type, captured>;
+        auto call = std::make_shared<call_type>(std::forward<F>(fn),
+            captured(detail::async_capture<Args>::copy(std::forward<Args>(args))...));
+        call->generation = generation();
+
+        {
+            auto& s = shard(call->hash);
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto range = s.calls.equal_range(call->hash);
+            for (auto it = range.first; it != range.second; ++it) {
+                auto& other = *it->second;
+                if (other.generation == call->generation && other.same_arguments(*call)) {
+                    other.waiters.push_back(h->value());
+                    return;
+                }
+            }
+            call->waiters.push_back(h->value());
+            s.calls.emplace(call->hash, call);
+        }
+
+        pool->submit([call, queued = tracer::timestamp()]() {
+            tracer::async_scope span(queued);
+            const std::uint64_t g = call->generation;
+            variant result;
+            if (current(g))
+                result = invoke(call->fn, call->values);
+            std::vector<xlbigdata> waiters;
+            {
+                auto& s = shard(call->hash);
+                std::lock_guard<std::mutex> lock(s.mutex);
+                auto range = s.calls.equal_range(call->hash);
+                for (auto it = range.first; it != range.second; ++it) {
+                    if (it->second.get() == call.get()) {
+                        s.calls.erase(it);
+                        break;
+                    }
+                }
+                waiters.swap(call->waiters);
+            }
+            if (current(g) && !waiters.empty())
+                complete(waiters.data(), waiters.size(), result);
+        });
+    }
+
+    /// Number of distinct coalesced calls in flight.
+    static std::size_t in_flight()
+    {
+        std::size_t count = 0;
+        for (auto& s : shards_) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            count += s.calls.size();
+        }
+        return count;
+    }
+
+private:
+    struct alignas(64) shard_type
+    {
+        std::mutex mutex;
+        std::unordered_multimap<std::uint64_t, std::shared_ptr<detail::async_call_base>> calls;
+    };
+
+    static shard_type& shard(std::uint64_t hash) noexcept
+        { return shards_[hash % shards_.size()]; }
+
+    static void clear_calls()
+    {
+        for (auto& s : shards_) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.calls.clear();
+        }
+    }
+
+    // Returns the running pool, starting it if needed, or null while the
+    // executor is stopping.
+    static detail::thread_pool *executor_pool()
+    {
+        auto *pool = current_.load(std::memory_order_acquire);
+        if (pool == nullptr && start())
+            pool = current_.load(std::memory_order_acquire);
+        if (pool == nullptr)
+            xll::log()->debug("Dropped async job submitted while stopping");
+        return pool;
+    }
+
+    template<class F, class Tuple>
+    static variant invoke(F& fn, Tuple& values) noexcept
+    {
+        variant result;
+        try {
+            detail::to_variant(result, std::apply(fn, values));
+        }
+        catch (const std::exception& e) {
+            xll::log()->error("Caught exception: {}", e.what());
+            result.emplace<xlerr>(error::xlerrValue);
+        }
+        catch (...) {
+            result.emplace<xlerr>(error::xlerrValue);
+        }
+        return result;
+    }
+
+    // Returns one result to each of n handles.
+    static void complete(const xlbigdata *handles, std::size_t n, variant& result)
+    {
+        const bool scalar = result.xltype() != xltypeMulti;
+        if (scalar && async_completion_queue::running()) {
+            for (std::size_t i = 0; i + 1 < n; ++i)
+                async_completion_queue::push(handles[i], variant(result));
+            async_completion_queue::push(handles[n - 1], std::move(result));
+        }
+        else if (scalar && n > 1) {
+            xlmulti h(static_cast<unsigned>(n), 1);
+            xlmulti v(static_cast<unsigned>(n), 1);
+            for (std::size_t i = 0; i < n; ++i) {
+                h[i] = handles[i];
+                v[i] = result;
+            }
+            variant hv(std::move(h));
+            variant vv(std::move(v));
+            async_return(hv, vv);
+        }
+        else {
+            for (std::size_t i = 0; i < n; ++i) {
+                handle h(handles[i]);
+                async_return(h, result);
+            }
+        }
+    }
+
+    static inline std::mutex mutex_;
+    static inline std::unique_ptr<detail::thread_pool> pool_;
+    static inline bool stopping_ = false;
+    static inline std::atomic<detail::thread_pool *> current_{ nullptr };
+    static inline std::atomic<std::uint64_t> generation_{ 0 };
+    static inline std::array<shard_type, 16> shards_;
+};
+
+} // namespace xll
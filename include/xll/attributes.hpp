@@ -19,6 +19,7 @@ struct volatile_ {};
 struct cluster_safe {};
 struct thread_safe {};
 struct macro_sheet_equivalent {};
+struct pure {}; // results cached by memo_cache; export_function only
 
 } // namespace tag
 
@@ -27,6 +28,7 @@ template<> struct attribute<tag::volatile_> {};
 template<> struct attribute<tag::cluster_safe> {};
 template<> struct attribute<tag::thread_safe> {};
 template<> struct attribute<tag::macro_sheet_equivalent> {};
+template<> struct attribute<tag::pure> {};
 
 template<class... Tags>
 struct attribute_set
@@ -10,6 +10,7 @@
 #include <xll/config.hpp>
 
 #include <xll/constants.hpp>
+#include <xll/tracer.hpp>
 #include <xll/detail/assert.hpp>
 #include <xll/detail/callback.hpp>
 #include <xll/detail/variant.hpp>
@@ -42,7 +43,14 @@ inline int Excel12v(int xlfn, R *result, std::array<V*, N>& opers, std::size_t c
         return XLRET::xlretFailed;
     }
 
-    int rc = (pfn)(xlfn, static_cast<int>(count), opers.data(), result);
+    int rc;
+    if (BOOST_LIKELY(!tracer::active()))
+        rc = (pfn)(xlfn, static_cast<int>(count), opers.data(), result);
+    else {
+        const std::uint64_t begin = tracer::now();
+        rc = (pfn)(xlfn, static_cast<int>(count), opers.data(), result);
+        tracer::record(trace_event_kind::callback, nullptr, begin, tracer::now(), static_cast<std::uint32_t>(xlfn));
+    }
     if (rc != XLRET::xlretSuccess) {
         xll::log()->error("Callback failed: xlfn {}, return code {:#06x}", xlfn, rc);
         return rc;
@@ -67,16 +75,11 @@ inline int Excel12(int xlfn, R *result)
     return Excel12v(xlfn, result, opers);
 }
 
-#if BOOST_COMP_CLANG
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wunused-value"
-#endif
-
 template<class R, class... Args>
 inline int Excel12(int xlfn, R *result, Args*... args)
 {
     std::array<detail::variant_common_type *, sizeof...(Args)> opers =
-        {( static_cast<detail::variant_common_type *>(args), ... )};
+        { static_cast<detail::variant_common_type *>(args)... };
     return Excel12v(xlfn, result, opers);
 }
 
@@ -84,12 +87,8 @@ template<class... Args>
 inline int Excel12(int xlfn, std::nullptr_t, Args*... args)
 {
     std::array<detail::variant_common_type *, sizeof...(Args)> opers =
-        {( static_cast<detail::variant_common_type *>(args), ... )};
+        { static_cast<detail::variant_common_type *>(args)... };
     return Excel12v<detail::variant_common_type>(xlfn, nullptr, opers);
 }
 
-#if BOOST_COMP_CLANG
-#pragma clang diagnostic pop
-#endif
-
 } // namespace xll
\ No newline at end of file
@@ -0,0 +1,793 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file cluster.hpp
+ * Local cluster runtime which runs functions in worker processes.
+ *
+ * Excel passes cluster-safe functions (tag::cluster_safe) to the cluster
+ * connector configured in its options, and the add-in itself runs on the
+ * compute nodes. cluster_connector provides the same model on one machine
+ * without a connector: worker processes are started from a separate worker
+ * executable, calls are sent to them over Unix domain sockets, and results
+ * are streamed back as they complete. Long-running functions are moved out
+ * of the Excel process, and are not limited by the number of calculation
+ * threads.
+ *
+ * \code
+ * // Worker executable
+ * int main()
+ * {
+ *     xll::cluster_functions::define<&simulate>(L"simulate");
+ *     return xll::cluster_worker::run();
+ * }
+ *
+ * // Add-in
+ * XLL_EXPORT void __stdcall xl_simulate(double spot, double vol, double paths, xll::handle *h)
+ * {
+ *     connector.submit(h, L"simulate", spot, vol, paths);
+ * }
+ *
+ * // xlAutoOpen
+ * connector.open("/opt/addin/simulate_worker", 8);
+ *
+ * // xlAutoClose
+ * connector.close();
+ * \endcode
+ *
+ * The Excel process is never forked: it has many threads, and a forked copy
+ * may only call async-signal-safe functions until it executes a new program.
+ * Workers are started with posix_spawn() instead, with their socket as
+ * descriptor 3, and define their functions in cluster_functions before
+ * calling cluster_worker::run(). Functions are called by name.
+ *
+ * Arguments and results are copied with the value encoding of serialize.hpp,
+ * so only values (numbers, strings, booleans, errors and arrays of these)
+ * cross the process boundary, which is the same restriction that Excel
+ * places on cluster-safe functions. Functions run in workers must not call
+ * back into Excel.
+ *
+ * Return codes are XLHPCRET values: xlHpcRetSessionIdInvalid when the
+ * connector is not open, and xlHpcRetCallFailed when a call cannot be sent or
+ * its worker exits before replying.
+ *
+ * Workers are started with posix_spawn(), so the connector is available on
+ * POSIX systems only.
+ */
+
+#include <xll/config.hpp>
+
+#if !BOOST_OS_WINDOWS
+
+#include <xll/async.hpp>
+#include <xll/constants.hpp>
+#include <xll/functions.hpp>
+#include <xll/serialize.hpp>
+#include <xll/xloper.hpp>
+#include <xll/detail/marshal.hpp>
+#include <xll/detail/type_traits.hpp>
+#include <xll/log.hpp>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#if BOOST_OS_MACOS
+#include <crt_externs.h>
+#else
+extern char **environ;
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace xll {
+
+/// Exception stored in the futures returned by cluster_connector::call
+/// when a call fails. code() is an XLHPCRET value.
+class cluster_error : public std::runtime_error
+{
+public:
+    explicit cluster_error(int code)
+        : std::runtime_error(code == xlHpcRetSessionIdInvalid
+            ? "cluster session is not open" : "cluster call failed"), code_(code) {}
+
+    int code() const noexcept { return code_; }
+
+private:
+    int code_;
+};
+
+namespace detail {
+
+// Converts an argument of a worker function from the variant received.
+template<class T>
+inline decltype(auto) cluster_argument(const variant& v)
+{
+    if constexpr (std::is_same_v<T, variant>)
+        return v;
+    else
+        return from_variant<T>(v);
+}
+
+template<class F>
+struct cluster_invoker;
+
+template<class R, class... Args>
+struct cluster_invoker<R (*)(Args...)>
+{
+    static_assert(!std::is_void_v<R>, "cluster functions must return a value");
+
+    template<auto Fn>
+    static variant invoke(const variant *args, std::size_t n)
+    {
+        if (n != sizeof...(Args))
+            throw std::invalid_argument("invalid number of arguments");
+        return invoke<Fn>(args, std::index_sequence_for<Args...>());
+    }
+
+    template<auto Fn, std::size_t... Is>
+    static variant invoke(const variant *args, std::index_sequence<Is...>)
+    {
+        variant result;
+        to_variant(result, Fn(cluster_argument<remove_cvref_t<Args>>(args[Is])...));
+        return result;
+    }
+};
+
+template<class R, class... Args>
+struct cluster_invoker<R (*)(Args...) noexcept> : cluster_invoker<R (*)(Args...)> {};
+
+// Copies an argument of cluster_connector::call or submit into a variant
+// owned by the DLL.
+template<class T>
+inline variant cluster_value(T&& x)
+{
+    using U = remove_cvref_t<T>;
+    variant v;
+    if constexpr (std::is_same_v<U, variant *> || std::is_same_v<U, const variant *>) {
+        if (x != nullptr) {
+            v = *x;
+            v.clear_flags();
+        }
+        else
+            v.emplace<xlmissing>();
+    }
+    else if constexpr (std::is_same_v<U, variant>) {
+        v = std::forward<T>(x);
+        v.clear_flags();
+    }
+    else if constexpr (std::is_same_v<U, wchar_t *> || std::is_same_v<U, const wchar_t *>)
+        to_variant(v, std::wstring_view(x ? x : L""));
+    else
+        to_variant(v, std::forward<T>(x));
+    return v;
+}
+
+//
+// Framing: uint32 payload size, then the payload.
+//
+//   request   uint64 call id, encoded function name, uint32 argument count,
+//             encoded arguments
+//   response  uint64 call id, int32 XLHPCRET, encoded result
+//
+
+constexpr std::uint32_t cluster_max_frame = std::uint32_t(1) << 30;
+
+inline bool cluster_send(int fd, const unsigned char *p, std::size_t n) noexcept
+{
+    while (n > 0) {
+        const ssize_t k = ::send(fd, p, n, MSG_NOSIGNAL);
+        if (k < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += k;
+        n -= static_cast<std::size_t>(k);
+    }
+    return true;
+}
+
+inline bool cluster_recv(int fd, unsigned char *p, std::size_t n) noexcept
+{
+    while (n > 0) {
+        const ssize_t k = ::recv(fd, p, n, 0);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k <= 0)
+            return false;
+        p += k;
+        n -= static_cast<std::size_t>(k);
+    }
+    return true;
+}
+
+inline bool cluster_recv_frame(int fd, std::vector<unsigned char>& buffer)
+{
+    unsigned char header[4];
+    if (!cluster_recv(fd, header, sizeof(header)))
+        return false;
+    std::uint32_t n;
+    binary_reader(header, sizeof(header)).read(n);
+    if (n > cluster_max_frame)
+        return false;
+    buffer.resize(n);
+    return cluster_recv(fd, buffer.data(), n);
+}
+
+inline char **cluster_environment() noexcept
+{
+#if BOOST_OS_MACOS
+    return *::_NSGetEnviron();
+#else
+    return environ;
+#endif
+}
+
+} // namespace detail
+
+/// Functions which may be called in worker processes, defined by the worker
+/// executable before it calls cluster_worker::run().
+struct cluster_functions
+{
+    using function_type = std::function<variant(const variant *args, std::size_t n)>;
+
+    static constexpr std::uint32_t npos = std::numeric_limits<std::uint32_t>::max();
+
+    /// Defines a function taking an array of arguments. Returns its index.
+    static std::uint32_t define(std::wstring name, function_type fn)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = std::find_if(functions_.begin(), functions_.end(),
+            [&](const auto& f) { return f.first == name; });
+        if (it != functions_.end()) {
+            it->second = std::move(fn);
+            return static_cast<std::uint32_t>(it - functions_.begin());
+        }
+        functions_.emplace_back(std::move(name), std::move(fn));
+        return static_cast<std::uint32_t>(functions_.size() - 1);
+    }
+
+    /// Defines the C++ function Fn. Arguments are converted from variants
+    /// with detail::from_variant and the result with detail::to_variant.
+    template<auto Fn>
+    static std::uint32_t define(std::wstring name)
+    {
+        return define(std::move(name), [](const variant *args, std::size_t n) {
+            return detail::cluster_invoker<decltype(Fn)>::template invoke<Fn>(args, n);
+        });
+    }
+
+    /// Returns the index of the function, or npos.
+    static std::uint32_t find(std::wstring_view name)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = std::find_if(functions_.begin(), functions_.end(),
+            [&](const auto& f) { return f.first == name; });
+        return it != functions_.end() ? static_cast<std::uint32_t>(it - functions_.begin()) : npos;
+    }
+
+    static std::size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return functions_.size();
+    }
+
+    static void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        functions_.clear();
+    }
+
+private:
+    friend struct cluster_worker;
+
+    // Returns a copy, so that the function runs without the mutex.
+    static function_type get(std::wstring_view name)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = std::find_if(functions_.begin(), functions_.end(),
+            [&](const auto& f) { return f.first == name; });
+        return it != functions_.end() ? it->second : function_type();
+    }
+
+    static inline std::mutex mutex_;
+    static inline std::vector<std::pair<std::wstring, function_type>> functions_;
+};
+
+/// Main loop of a worker executable.
+struct cluster_worker
+{
+    /// Descriptor of the socket to the coordinator in a worker started by
+    /// cluster_connector::open().
+    static constexpr int socket_fd = 3;
+
+    /// Runs calls in the order received until the coordinator closes the
+    /// socket. Exceptions thrown by functions are returned as #VALUE!.
+    /// Returns the exit status of the worker: 1 if fd is not a socket, as
+    /// when the executable is not started by a connector, otherwise 0.
+    static int run(int fd = socket_fd) noexcept
+    {
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || !S_ISSOCK(st.st_mode)) {
+            xll::log()->error("Cluster worker started without a coordinator socket");
+            return 1;
+        }
+        try {
+            std::vector<unsigned char> request, response;
+            std::vector<variant> args;
+            while (detail::cluster_recv_frame(fd, request)) {
+                detail::binary_reader r(request.data(), request.size());
+                std::uint64_t id = 0;
+                std::uint32_t n = 0;
+                variant name;
+                r.read(id);
+                const bool valid = detail::decode(r, name) && name.xltype() == xltypeStr;
+                r.read(n);
+
+                std::int32_t rc = xlHpcRetSuccess;
+                variant result;
+                cluster_functions::function_type fn;
+                if (valid)
+                    fn = cluster_functions::get(std::wstring_view(name.get<xlstr>()));
+                // Each argument takes at least two bytes.
+                if (r.failed() || !fn || n > r.remaining() / 2)
+                    rc = xlHpcRetCallFailed;
+                else {
+                    try {
+                        args.resize(n);
+                        for (auto& x : args) {
+                            if (!detail::decode(r, x)) {
+                                rc = xlHpcRetCallFailed;
+                                break;
+                            }
+                        }
+                        if (rc == xlHpcRetSuccess)
+                            result = fn(args.data(), args.size());
+                    }
+                    catch (...) {
+                        result.emplace<xlerr>(error::xlerrValue);
+                    }
+                }
+                if (rc != xlHpcRetSuccess)
+                    result.emplace<xlnil>();
+
+                const std::size_t size = 8 + 4 + detail::encoded_size(result);
+                response.resize(4 + size);
+                detail::binary_writer w(response.data());
+                w.write(static_cast<std::uint32_t>(size));
+                w.write(id);
+                w.write(rc);
+                detail::encode(w, result);
+                if (!detail::cluster_send(fd, response.data(), response.size()))
+                    break;
+            }
+        }
+        catch (const std::exception& e) {
+            xll::log()->error("Caught exception in cluster worker: {}", e.what());
+            return 1;
+        }
+        return 0;
+    }
+};
+
+/// Coordinator of a pool of worker processes.
+///
+/// execute() sends a call to the worker with the fewest calls outstanding and
+/// returns without waiting. A reader thread for each worker receives results
+/// in the order they complete and invokes the callback of each call.
+class cluster_connector
+{
+public:
+    /// Receives an XLHPCRET code and, on success, the result of the call.
+    using callback_type = std::function<void(int rc, variant&& result)>;
+
+    cluster_connector() = default;
+    ~cluster_connector() { close(); }
+
+    cluster_connector(const cluster_connector&) = delete;
+    cluster_connector& operator=(const cluster_connector&) = delete;
+
+    /// Starts a session with the given number of workers, by default one per
+    /// hardware thread, each running the worker executable at path with the
+    /// given arguments and the environment of the add-in.
+    int open(const std::string& path, std::size_t workers = 0, const std::vector<std::string>& args = {})
+    {
+        std::unique_lock<std::shared_mutex> lock(state_mutex_);
+        if (open_)
+            return xlHpcRetSuccess;
+        if (workers == 0)
+            workers = std::max(1u, std::thread::hardware_concurrency());
+
+        std::vector<char *> argv;
+        argv.push_back(const_cast<char *>(path.c_str()));
+        for (const auto& arg : args)
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        argv.push_back(nullptr);
+
+        std::vector<std::unique_ptr<worker>> started;
+        for (std::size_t i = 0; i < workers; ++i) {
+            int fd = -1;
+            const pid_t pid = spawn(path, argv.data(), fd);
+            if (pid < 0)
+                break;
+            auto w = std::make_unique<worker>();
+            w->pid = pid;
+            w->fd = fd;
+            w->alive = true;
+            started.push_back(std::move(w));
+        }
+
+        if (started.empty())
+            return xlHpcRetCallFailed;
+
+        workers_ = std::move(started);
+        for (auto& w : workers_)
+            w->reader = std::thread([this, p = w.get()]() { read(*p); });
+        ++session_;
+        open_ = true;
+        return xlHpcRetSuccess;
+    }
+
+    /// Ends the session. With drain, workers finish the calls already sent
+    /// and their results are delivered; otherwise workers are killed and
+    /// outstanding calls fail with xlHpcRetCallFailed. Callbacks must not
+    /// call open() or close().
+    void close(bool drain = true)
+    {
+        std::vector<std::unique_ptr<worker>> workers;
+        {
+            std::unique_lock<std::shared_mutex> lock(state_mutex_);
+            if (!open_)
+                return;
+            open_ = false;
+            workers.swap(workers_);
+        }
+        for (auto& w : workers) {
+            if (drain)
+                ::shutdown(w->fd, SHUT_WR);
+            else
+                ::kill(w->pid, SIGKILL);
+        }
+        for (auto& w : workers) {
+            w->reader.join();
+            ::close(w->fd);
+            int status;
+            while (::waitpid(w->pid, &status, 0) < 0 && errno == EINTR) {}
+        }
+    }
+
+    bool is_open() const
+    {
+        std::shared_lock<std::shared_mutex> lock(state_mutex_);
+        return open_;
+    }
+
+    /// Identifier of the current or last session; incremented by open().
+    std::uint64_t session() const
+    {
+        std::shared_lock<std::shared_mutex> lock(state_mutex_);
+        return session_;
+    }
+
+    /// Number of workers which have not exited.
+    std::size_t workers() const
+    {
+        std::shared_lock<std::shared_mutex> lock(state_mutex_);
+        return static_cast<std::size_t>(std::count_if(workers_.begin(), workers_.end(),
+            [](const auto& w) { return w->alive.load(std::memory_order_relaxed); }));
+    }
+
+    /// Process identifiers of the workers.
+    std::vector<pid_t> worker_ids() const
+    {
+        std::shared_lock<std::shared_mutex> lock(state_mutex_);
+        std::vector<pid_t> result;
+        for (const auto& w : workers_)
+            result.push_back(w->pid);
+        return result;
+    }
+
+    /// Number of calls sent whose results have not been received.
+    std::size_t pending() const
+    {
+        std::lock_guard<std::mutex> lock(calls_mutex_);
+        return calls_.size();
+    }
+
+    /// Sends a call of the named function. If the return code is
+    /// xlHpcRetSuccess, callback is invoked exactly once, on a reader thread,
+    /// when the call completes or fails; otherwise it is not invoked. Calls
+    /// of functions the workers do not define fail with xlHpcRetCallFailed.
+    int execute(std::wstring_view name, const variant *args, std::size_t n, callback_type callback)
+    {
+        std::shared_lock<std::shared_mutex> lock(state_mutex_);
+        if (!open_)
+            return xlHpcRetSessionIdInvalid;
+        if (n > std::numeric_limits<std::uint32_t>::max())
+            return xlHpcRetCallFailed;
+
+        variant function;
+        to_variant(function, name);
+        std::size_t size = 8 + detail::encoded_size(function) + 4;
+        for (std::size_t i = 0; i < n; ++i)
+            size += detail::encoded_size(args[i]);
+        if (size > detail::cluster_max_frame)
+            return xlHpcRetCallFailed;
+
+        const std::uint64_t id = next_id_.fetch_add(1, std::memory_order_relaxed);
+        std::vector<unsigned char> buffer(4 + size);
+        detail::binary_writer w(buffer.data());
+        w.write(static_cast<std::uint32_t>(size));
+        w.write(id);
+        detail::encode(w, function);
+        w.write(static_cast<std::uint32_t>(n));
+        for (std::size_t i = 0; i < n; ++i)
+            detail::encode(w, args[i]);
+
+        for (;;) {
+            worker *target = least_loaded();
+            if (target == nullptr)
+                return xlHpcRetCallFailed;
+            {
+                std::lock_guard<std::mutex> calls_lock(calls_mutex_);
+                if (!target->alive.load(std::memory_order_relaxed))
+                    continue; // exited since it was chosen
+                calls_.emplace(id, pending_call{ std::move(callback), target });
+                target->load.fetch_add(1, std::memory_order_relaxed);
+            }
+            bool sent;
+            {
+                std::lock_guard<std::mutex> write_lock(target->write_mutex);
+                sent = detail::cluster_send(target->fd, buffer.data(), buffer.size());
+            }
+            if (sent)
+                return xlHpcRetSuccess;
+            // The reader fails the call when the worker's socket is closed,
+            // unless the call is withdrawn here first.
+            std::lock_guard<std::mutex> calls_lock(calls_mutex_);
+            auto it = calls_.find(id);
+            if (it == calls_.end())
+                return xlHpcRetSuccess;
+            it->second.target->load.fetch_sub(1, std::memory_order_relaxed);
+            calls_.erase(it);
+            return xlHpcRetCallFailed;
+        }
+    }
+
+    /// Sends a call of the named function and returns a future for its
+    /// result. Failures are reported by a cluster_error exception.
+    template<class... Args>
+    std::future<variant> call(std::wstring_view name, Args&&... args)
+    {
+        std::array<variant, sizeof...(Args)> values = { detail::cluster_value(std::forward<Args>(args))... };
+        auto promise = std::make_shared<std::promise<variant>>();
+        std::future<variant> future = promise->get_future();
+        int rc = execute(name, values.data(), values.size(), [promise](int rc, variant&& result) {
+            if (rc == xlHpcRetSuccess)
+                promise->set_value(std::move(result));
+            else
+                promise->set_exception(std::make_exception_ptr(cluster_error(rc)));
+        });
+        if (rc != xlHpcRetSuccess)
+            promise->set_exception(std::make_exception_ptr(cluster_error(rc)));
+        return future;
+    }
+
+    /// Sends a call of the named function on behalf of the asynchronous
+    /// function call h. The result is returned with xlAsyncReturn, through
+    /// async_completion_queue if it is running, unless the calculation is
+    /// canceled with async_executor::cancel() first. Failed calls return
+    /// #N/A.
+    template<class... Args>
+    void submit(handle *h, std::wstring_view name, Args&&... args)
+    {
+        if (h == nullptr)
+            return;
+        std::array<variant, sizeof...(Args)> values = { detail::cluster_value(std::forward<Args>(args))... };
+        const xlbigdata bd = h->value();
+        const std::uint64_t g = async_executor::generation();
+        auto complete = [bd, g](int rc, variant&& result) {
+            if (!async_executor::current(g))
+                return;
+            if (rc != xlHpcRetSuccess)
+                result.emplace<xlerr>(error::xlerrNA);
+            if (async_completion_queue::running())
+                async_completion_queue::push(bd, std::move(result));
+            else {
+                handle hv(bd);
+                async_return(hv, result);
+            }
+        };
+        if (int rc = execute(name, values.data(), values.size(), complete); rc != xlHpcRetSuccess)
+            complete(rc, variant());
+    }
+
+private:
+    struct worker
+    {
+        pid_t pid = -1;
+        int fd = -1;
+        std::atomic<bool> alive{ false }; // cleared under calls_mutex_
+        std::atomic<std::size_t> load{ 0 };
+        std::mutex write_mutex;
+        std::thread reader;
+    };
+
+    struct pending_call
+    {
+        callback_type callback;
+        worker *target;
+    };
+
+    // Requires state_mutex_.
+    worker *least_loaded() const noexcept
+    {
+        worker *result = nullptr;
+        std::size_t best = std::numeric_limits<std::size_t>::max();
+        for (const auto& w : workers_) {
+            if (!w->alive.load(std::memory_order_relaxed))
+                continue;
+            const std::size_t load = w->load.load(std::memory_order_relaxed);
+            if (load < best) {
+                best = load;
+                result = w.get();
+            }
+        }
+        return result;
+    }
+
+    // Reader thread: delivers results until the worker closes its socket,
+    // then fails the calls still outstanding on that worker.
+    void read(worker& w)
+    {
+        std::vector<unsigned char> buffer;
+        while (detail::cluster_recv_frame(w.fd, buffer)) {
+            detail::binary_reader r(buffer.data(), buffer.size());
+            std::uint64_t id = 0;
+            std::int32_t rc = xlHpcRetCallFailed;
+            variant result;
+            r.read(id);
+            r.read(rc);
+            if (r.failed() || !detail::decode(r, result))
+                break;
+
+            callback_type callback;
+            {
+                std::lock_guard<std::mutex> lock(calls_mutex_);
+                auto it = calls_.find(id);
+                if (it == calls_.end())
+                    continue;
+                callback = std::move(it->second.callback);
+                calls_.erase(it);
+                w.load.fetch_sub(1, std::memory_order_relaxed);
+            }
+            deliver(callback, rc, std::move(result));
+        }
+
+        std::vector<callback_type> failed;
+        {
+            std::lock_guard<std::mutex> lock(calls_mutex_);
+            w.alive.store(false, std::memory_order_relaxed);
+            for (auto it = calls_.begin(); it != calls_.end();) {
+                if (it->second.target == &w) {
+                    failed.push_back(std::move(it->second.callback));
+                    it = calls_.erase(it);
+                }
+                else
+                    ++it;
+            }
+            w.load.store(0, std::memory_order_relaxed);
+        }
+        if (!failed.empty())
+            xll::log()->error("Cluster worker {} exited with {} calls outstanding", w.pid, failed.size());
+        for (auto& callback : failed)
+            deliver(callback, xlHpcRetCallFailed, variant());
+    }
+
+    static void deliver(callback_type& callback, int rc, variant&& result) noexcept
+    {
+        try {
+            callback(rc, std::move(result));
+        }
+        catch (const std::exception& e) {
+            xll::log()->error("Caught exception in cluster callback: {}", e.what());
+        }
+        catch (...) {
+            xll::log()->error("Caught unknown exception in cluster callback");
+        }
+    }
+
+    // Starts a worker with its end of a new socket pair as socket_fd, and
+    // returns its process identifier and the coordinator's end in fd, or -1.
+    // Both ends are close-on-exec, so that workers do not inherit the
+    // sockets of other workers.
+    static pid_t spawn(const std::string& path, char *const *argv, int& fd) noexcept
+    {
+        int fds[2];
+#ifdef SOCK_CLOEXEC
+        const int rc = ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+#else
+        const int rc = ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        if (rc == 0) {
+            ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+            ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        }
+#endif
+        if (rc != 0) {
+            xll::log()->error("Failed to create cluster worker socket: errno {}", errno);
+            return -1;
+        }
+        // dup2() onto the same descriptor would leave it close-on-exec.
+        if (fds[1] == cluster_worker::socket_fd) {
+            const int moved = ::fcntl(fds[1], F_DUPFD_CLOEXEC, cluster_worker::socket_fd + 1);
+            ::close(fds[1]);
+            fds[1] = moved;
+        }
+
+        pid_t pid = -1;
+        int error = fds[1] < 0 ? errno : 0;
+        if (error == 0) {
+            posix_spawn_file_actions_t actions;
+            error = ::posix_spawn_file_actions_init(&actions);
+            if (error == 0) {
+                error = ::posix_spawn_file_actions_adddup2(&actions, fds[1], cluster_worker::socket_fd);
+                if (error == 0)
+                    error = ::posix_spawn(&pid, path.c_str(), &actions, nullptr, argv, detail::cluster_environment());
+                ::posix_spawn_file_actions_destroy(&actions);
+            }
+            ::close(fds[1]);
+        }
+        if (error != 0) {
+            xll::log()->error("Failed to start cluster worker {}: errno {}", path, error);
+            ::close(fds[0]);
+            return -1;
+        }
+        fd = fds[0];
+        return pid;
+    }
+
+    mutable std::shared_mutex state_mutex_;
+    std::vector<std::unique_ptr<worker>> workers_;
+    bool open_ = false;
+    std::uint64_t session_ = 0;
+
+    mutable std::mutex calls_mutex_;
+    std::unordered_map<std::uint64_t, pending_call> calls_;
+    std::atomic<std::uint64_t> next_id_{ 0 };
+};
+
+} // namespace xll
+
+#endif // !BOOST_OS_WINDOWS
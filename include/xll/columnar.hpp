@@ -0,0 +1,361 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file columnar.hpp
+ * Typed columns of an xlmulti.
+ *
+ * to_columnar() splits the cells of an xlmulti by type into contiguous
+ * arrays, for numeric kernels which would otherwise branch on the type of
+ * every 32-byte cell:
+ *
+ *  - numbers as doubles, NaN where the cell is not a number;
+ *  - strings as offsets into one buffer, UTF-8 (columnar) or the wide
+ *    characters of Excel (wcolumnar);
+ *  - booleans as bits;
+ *  - error codes as bytes, 0 where the cell is not an error;
+ *
+ * each with a bitmap of the cells which hold that type. Arrays are in
+ * column-major order, so that column j of the worksheet range is the slice
+ * [j * rows, (j + 1) * rows).
+ *
+ * \code
+ * xll::columnar c = xll::to_columnar(prices);
+ * const double *close = c.number_column(3);
+ * for (std::size_t i = 0; i < c.rows; ++i)
+ *     if (c.has_number[c.index(i, 3)])
+ *         ...;
+ * xll::xlmulti back = xll::to_xlmulti(c);
+ * \endcode
+ *
+ * xltypeInt cells become numbers. Missing, nil, references and nested arrays
+ * have no column and come back as nil.
+ *
+ * Each cell is read once, and the bits of the bitmaps are accumulated in a
+ * register and stored a word at a time. Strings take a second pass, after
+ * their lengths are summed into offsets, which writes each one in place.
+ * Arrays of at least parallel_threshold cells are split into chunks of whole
+ * bitmap words which run on a shared pool of threads; to_xlmulti() converts
+ * back in the same way. The pool is started by the first parallel conversion
+ * and joined by columnar_stop(), to call from xlAutoClose.
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/xloper.hpp>
+#include <xll/detail/bits.hpp>
+#include <xll/detail/parallel.hpp>
+
+#include <boost/nowide/utf/utf.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace xll {
+
+/// Fixed-size sequence of bits.
+class bitmap
+{
+public:
+    bitmap() = default;
+
+    explicit bitmap(std::size_t n)
+        : words_((n + 63) / 64), size_(n) {}
+
+    bool operator[](std::size_t i) const noexcept
+        { return words_[i / 64] >> (i % 64) & 1; }
+
+    void set(std::size_t i, bool value = true) noexcept
+    {
+        const std::uint64_t bit = std::uint64_t(1) << (i % 64);
+        if (value)
+            words_[i / 64] |= bit;
+        else
+            words_[i / 64] &= ~bit;
+    }
+
+    /// The number of bits set.
+    std::size_t count() const noexcept
+    {
+        std::size_t n = 0;
+        for (std::uint64_t w : words_)
+            n += detail::popcount(w);
+        return n;
+    }
+
+    std::size_t size() const noexcept { return size_; }
+
+    /// Bit i is bit i % 64 of word i / 64.
+    std::uint64_t * words() noexcept { return words_.data(); }
+    const std::uint64_t * words() const noexcept { return words_.data(); }
+
+private:
+    std::vector<std::uint64_t> words_;
+    std::size_t size_ = 0;
+};
+
+struct columnar_options
+{
+    std::size_t threads = 0;                  // 0 for one per hardware thread
+    std::size_t parallel_threshold = 1 << 16; // cells
+};
+
+template<class CharT>
+struct basic_columnar
+{
+    using char_type = CharT;
+    using string_view = std::basic_string_view<CharT>;
+
+    std::size_t rows = 0;
+    std::size_t columns = 0;
+
+    std::vector<double> numbers;
+    bitmap has_number;
+
+    std::vector<std::uint32_t> string_offsets; // size() + 1
+    std::vector<CharT> string_data;
+    bitmap has_string;
+
+    bitmap bools;
+    bitmap has_bool;
+
+    std::vector<std::uint8_t> errors;
+    bitmap has_error;
+
+    std::size_t size() const noexcept
+        { return rows * columns; }
+
+    /// Position of row i, column j in the arrays.
+    std::size_t index(std::size_t i, std::size_t j) const noexcept
+        { return j * rows + i; }
+
+    const double * number_column(std::size_t j) const noexcept
+        { return numbers.data() + j * rows; }
+
+    /// String k, empty if it is not a string.
+    string_view string(std::size_t k) const noexcept
+    {
+        return string_view(string_data.data() + string_offsets[k],
+            string_offsets[k + 1] - string_offsets[k]);
+    }
+
+    error::excel_error error(std::size_t k) const noexcept
+        { return static_cast<error::excel_error>(errors[k]); }
+};
+
+using columnar = basic_columnar<char>;     // UTF-8
+using wcolumnar = basic_columnar<wchar_t>; // as in Excel
+
+namespace detail {
+
+// Code units of s in the encoding of To, up to whole code points which fit
+// in limit. Invalid sequences count as U+FFFD.
+template<class To, class From>
+inline std::size_t utf_length(const From *s, std::size_t n, std::size_t limit) noexcept
+{
+    if constexpr (sizeof(To) == sizeof(From))
+        return std::min(n, limit);
+    else {
+        using namespace boost::nowide::utf;
+        std::size_t len = 0;
+        const From *e = s + n;
+        while (s != e) {
+            std::size_t w = 1;
+            if (static_cast<std::make_unsigned_t<From>>(*s) < 0x80)
+                ++s;
+            else {
+                code_point c = utf_traits<From>::decode(s, e);
+                if (c == illegal || c == incomplete)
+                    c = 0xFFFD;
+                w = static_cast<std::size_t>(utf_traits<To>::width(c));
+            }
+            if (len + w > limit)
+                break;
+            len += w;
+        }
+        return len;
+    }
+}
+
+// Writes the first len code units of s in the encoding of To, as measured
+// by utf_length.
+template<class To, class From>
+inline void utf_convert(const From *s, std::size_t n, To *out, std::size_t len) noexcept
+{
+    if constexpr (sizeof(To) == sizeof(From))
+        std::copy_n(s, len, out);
+    else {
+        using namespace boost::nowide::utf;
+        const From *e = s + n;
+        To *last = out + len;
+        while (out != last) {
+            if (static_cast<std::make_unsigned_t<From>>(*s) < 0x80)
+                *out++ = static_cast<To>(*s++);
+            else {
+                code_point c = utf_traits<From>::decode(s, e);
+                if (c == illegal || c == incomplete)
+                    c = 0xFFFD;
+                out = utf_traits<To>::encode(c, out);
+            }
+        }
+    }
+}
+
+} // namespace detail
+
+/// Splits m into typed columns.
+template<class CharT = char>
+inline basic_columnar<CharT> to_columnar(const xlmulti& m, const columnar_options& opts = {})
+{
+    basic_columnar<CharT> c;
+    c.rows = m.size1();
+    c.columns = m.size2();
+    const std::size_t n = c.size();
+    c.numbers.resize(n);
+    c.has_number = bitmap(n);
+    c.string_offsets.resize(n + 1);
+    c.has_string = bitmap(n);
+    c.bools = bitmap(n);
+    c.has_bool = bitmap(n);
+    c.errors.resize(n);
+    c.has_error = bitmap(n);
+    const std::size_t threads = n >= opts.parallel_threshold ? opts.threads : 1;
+    constexpr double nan = std::numeric_limits<double>::quiet_NaN();
+
+    // Values, bitmaps and string lengths, in string_offsets[k + 1]
+    detail::parallel_for(n, threads, 64, [&](std::size_t first, std::size_t last) {
+        std::uint64_t number = 0, string = 0, boolean = 0, has_bool = 0, error = 0;
+        std::size_t i = first % c.rows, j = first / c.rows;
+        for (std::size_t k = first; k < last; ++k) {
+            const auto& v = m[i * c.columns + j];
+            const std::uint64_t bit = std::uint64_t(1) << (k % 64);
+            double x = nan;
+            switch (v.xltype()) {
+            case xltypeNum:
+                x = v.template get<xlnum>();
+                number |= bit;
+                break;
+            case xltypeInt:
+                x = v.template get<xlint>().w;
+                number |= bit;
+                break;
+            case xltypeStr: {
+                const xlstr& s = v.template get<xlstr>();
+                c.string_offsets[k + 1] = static_cast<std::uint32_t>(
+                    detail::utf_length<CharT>(s.data(), s.size(), std::numeric_limits<std::uint32_t>::max()));
+                string |= bit;
+                break;
+            }
+            case xltypeBool:
+                if (v.template get<xlbool>())
+                    boolean |= bit;
+                has_bool |= bit;
+                break;
+            case xltypeErr:
+                c.errors[k] = static_cast<std::uint8_t>(
+                    static_cast<error::excel_error>(v.template get<xlerr>()));
+                error |= bit;
+                break;
+            default:
+                break;
+            }
+            c.numbers[k] = x;
+            if (k % 64 == 63 || k + 1 == last) {
+                const std::size_t w = k / 64;
+                c.has_number.words()[w] = number;
+                c.has_string.words()[w] = string;
+                c.bools.words()[w] = boolean;
+                c.has_bool.words()[w] = has_bool;
+                c.has_error.words()[w] = error;
+                number = string = boolean = has_bool = error = 0;
+            }
+            if (++i == c.rows) {
+                i = 0;
+                ++j;
+            }
+        }
+    });
+
+    std::uint64_t total = 0;
+    for (std::size_t k = 1; k <= n; ++k) {
+        total += c.string_offsets[k];
+        if (total > std::numeric_limits<std::uint32_t>::max())
+            throw std::length_error("columnar strings too long");
+        c.string_offsets[k] = static_cast<std::uint32_t>(total);
+    }
+    if (total == 0)
+        return c;
+
+    c.string_data.resize(static_cast<std::size_t>(total));
+    detail::parallel_for(n, threads, 64, [&](std::size_t first, std::size_t last) {
+        std::size_t i = first % c.rows, j = first / c.rows;
+        for (std::size_t k = first; k < last; ++k) {
+            if (c.has_string[k]) {
+                const xlstr& s = m[i * c.columns + j].template get<xlstr>();
+                detail::utf_convert(s.data(), s.size(), c.string_data.data() + c.string_offsets[k],
+                    c.string_offsets[k + 1] - c.string_offsets[k]);
+            }
+            if (++i == c.rows) {
+                i = 0;
+                ++j;
+            }
+        }
+    });
+    return c;
+}
+
+/// Rebuilds an xlmulti from typed columns. A cell takes the first of number,
+/// string, boolean and error which it has, and is nil if none. Strings are
+/// truncated to the 32767 characters of Excel.
+template<class CharT>
+inline xlmulti to_xlmulti(const basic_columnar<CharT>& c, const columnar_options& opts = {})
+{
+    xlmulti m(static_cast<unsigned>(c.rows), static_cast<unsigned>(c.columns));
+    const std::size_t n = c.size();
+    const std::size_t threads = n >= opts.parallel_threshold ? opts.threads : 1;
+    detail::parallel_for(n, threads, 64, [&](std::size_t first, std::size_t last) {
+        std::size_t i = first % c.rows, j = first / c.rows;
+        for (std::size_t k = first; k < last; ++k) {
+            auto& v = m[i * c.columns + j];
+            if (c.has_number[k])
+                v.template emplace<xlnum>(c.numbers[k]);
+            else if (c.has_string[k]) {
+                const auto s = c.string(k);
+                const std::size_t len = detail::utf_length<wchar_t>(s.data(), s.size(), 32767);
+                xlstr str(nullptr, static_cast<xlstr::size_type>(len)); // uninitialized
+                detail::utf_convert(s.data(), s.size(), str.data(), len);
+                v.template emplace<xlstr>(std::move(str));
+            }
+            else if (c.has_bool[k])
+                v.template emplace<xlbool>(c.bools[k]);
+            else if (c.has_error[k])
+                v.template emplace<xlerr>(c.error(k));
+            if (++i == c.rows) {
+                i = 0;
+                ++j;
+            }
+        }
+    });
+    return m;
+}
+
+/// Joins the threads shared by parallel conversions. Call from xlAutoClose,
+/// when no conversion is running.
+inline void columnar_stop()
+{
+    detail::parallel_pool::stop();
+}
+
+} // namespace xll
@@ -10,9 +10,11 @@
 // Boost Dependencies:
 // - Boost.Assert
 // - Boost.Config
+// - Boost.Endian
 // - Boost.MP11
 // - Boost.NoWide
 // - Boost.Predef
+// - Boost.Preprocessor
 // - Boost.WinAPI
 // - Boost.uBLAS
 
@@ -0,0 +1,373 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file date.hpp
+ * Excel serial dates.
+ *
+ * Dates are passed to and from Excel as serial numbers: days since a base
+ * date, with the time of day as the fraction. In the 1900 date system serial
+ * 1 is 1900-01-01, and serial 60 is 1900-02-29, a date which does not exist
+ * but which Excel keeps for compatibility with Lotus 1-2-3, so serials from
+ * 61 (1900-03-01) are one more than the days since 1899-12-31. In the 1904
+ * date system serial 0 is 1904-01-01. Serials run to 9999-12-31.
+ *
+ * Civil dates use the proleptic Gregorian calendar. to_civil(60) gives
+ * 1900-02-29 as Excel displays it, while time points, which cannot hold
+ * that date, take serial 60 as 1900-03-01.
+ *
+ * \code
+ * double today = xll::to_serial(xll::civil_date{ 2024, 3, 15 }); // 45366
+ * xll::business_calendar cal(xll::to_serial({ 2024, 1, 1 }), xll::to_serial({ 2034, 12, 31 }), holidays);
+ * double settle = cal.add_business_days(today, 2);                 // WORKDAY(today, 2, holidays)
+ * \endcode
+ *
+ * The conversions are branch-light integer arithmetic (H. Hinnant's
+ * days_from_civil and civil_from_days), and the batch overloads are plain
+ * loops over contiguous arrays which the compiler can vectorize.
+ * business_calendar precomputes a bitset of business days with running
+ * counts, so that WORKDAY and NETWORKDAYS take a binary search and a few
+ * population counts rather than a walk over the days.
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/fp12.hpp>
+#include <xll/xloper.hpp>
+#include <xll/detail/bits.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace xll {
+
+enum class date_system
+{
+    excel1900,
+    excel1904
+};
+
+struct civil_date
+{
+    int year = 0;
+    unsigned month = 0;
+    unsigned day = 0;
+
+    friend constexpr bool operator==(const civil_date& x, const civil_date& y) noexcept
+        { return x.year == y.year && x.month == y.month && x.day == y.day; }
+    friend constexpr bool operator!=(const civil_date& x, const civil_date& y) noexcept
+        { return !(x == y); }
+};
+
+/// Date and time, in microseconds since 1970-01-01 00:00 UTC.
+using date_time = std::chrono::time_point<std::chrono::system_clock, std::chrono::microseconds>;
+
+/// Largest serial of each date system: 9999-12-31.
+constexpr int max_serial_1900 = 2958465;
+constexpr int max_serial_1904 = max_serial_1900 - 1462;
+
+namespace detail {
+
+constexpr int unix_serial_1900 = 25569;   // 1970-01-01
+constexpr int unix_serial_1904 = 24107;
+constexpr int march_1_1900 = -25508;      // days from 1970-01-01 to 1900-03-01
+constexpr double microseconds_per_day = 86400e6;
+
+} // namespace detail
+
+/// Days since 1970-01-01 of a civil date.
+constexpr int days_from_civil(int y, unsigned m, unsigned d) noexcept
+{
+    y -= m <= 2;
+    const int era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int>(doe) - 719468;
+}
+
+/// Civil date of days since 1970-01-01.
+constexpr civil_date civil_from_days(int z) noexcept
+{
+    z += 719468;
+    const int era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = static_cast<unsigned>(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    const unsigned d = doy - (153 * mp + 2) / 5 + 1;
+    const unsigned m = mp < 10 ? mp + 3 : mp - 9;
+    return { static_cast<int>(yoe) + era * 400 + (m <= 2), m, d };
+}
+
+/// Day of the week of days since 1970-01-01: 0 for Sunday to 6 for Saturday.
+constexpr unsigned weekday_from_days(int z) noexcept
+{
+    return static_cast<unsigned>(z >= -4 ? (z + 4) % 7 : (z + 5) % 7 + 6);
+}
+
+/// Days since 1970-01-01 of a whole serial.
+constexpr int serial_to_days(int serial, date_system ds = date_system::excel1900) noexcept
+{
+    if (ds == date_system::excel1904)
+        return serial - detail::unix_serial_1904;
+    return serial - detail::unix_serial_1900 + (serial < 61);
+}
+
+/// Whole serial of days since 1970-01-01.
+constexpr int days_to_serial(int days, date_system ds = date_system::excel1900) noexcept
+{
+    if (ds == date_system::excel1904)
+        return days + detail::unix_serial_1904;
+    return days + detail::unix_serial_1900 - (days < detail::march_1_1900);
+}
+
+/// True if serial is a date of the date system.
+constexpr bool valid_serial(double serial, date_system ds = date_system::excel1900) noexcept
+{
+    return serial >= 0.0 && serial < (ds == date_system::excel1904 ? max_serial_1904 : max_serial_1900) + 1.0;
+}
+
+/// Civil date of a serial, ignoring the time of day. The serial must be
+/// valid.
+constexpr civil_date to_civil(double serial, date_system ds = date_system::excel1900) noexcept
+{
+    const int whole = static_cast<int>(serial); // non-negative
+    if (ds == date_system::excel1900 && whole == 60)
+        return { 1900, 2, 29 };
+    return civil_from_days(serial_to_days(whole, ds));
+}
+
+/// Serial of a civil date. 1900-02-29 is serial 60 in the 1900 date system.
+constexpr double to_serial(const civil_date& date, date_system ds = date_system::excel1900) noexcept
+{
+    if (ds == date_system::excel1900 && date == civil_date{ 1900, 2, 29 })
+        return 60.0;
+    return days_to_serial(days_from_civil(date.year, date.month, date.day), ds);
+}
+
+/// Time point of a serial, to the nearest microsecond. The serial must be
+/// valid.
+inline date_time to_time_point(double serial, date_system ds = date_system::excel1900) noexcept
+{
+    const double whole = std::floor(serial);
+    const auto days = static_cast<std::int64_t>(serial_to_days(static_cast<int>(whole), ds));
+    const auto us = static_cast<std::int64_t>(std::llround((serial - whole) * detail::microseconds_per_day));
+    return date_time(std::chrono::microseconds(days * 86400000000LL + us));
+}
+
+/// Serial of a time point.
+inline double to_serial(date_time t, date_system ds = date_system::excel1900) noexcept
+{
+    const std::int64_t us = t.time_since_epoch().count();
+    std::int64_t days = us / 86400000000LL;
+    std::int64_t rem = us % 86400000000LL;
+    if (rem < 0) {
+        --days;
+        rem += 86400000000LL;
+    }
+    return days_to_serial(static_cast<int>(days), ds) + static_cast<double>(rem) / detail::microseconds_per_day;
+}
+
+//
+// Batch conversions. Invalid serials give a zero civil_date, and civil
+// dates with a zero month give NaN (#NUM!).
+//
+
+inline void to_civil(const double *serials, std::size_t n, civil_date *out,
+    date_system ds = date_system::excel1900) noexcept
+{
+    for (std::size_t i = 0; i < n; ++i)
+        out[i] = valid_serial(serials[i], ds) ? to_civil(serials[i], ds) : civil_date{};
+}
+
+inline void to_serial(const civil_date *dates, std::size_t n, double *out,
+    date_system ds = date_system::excel1900) noexcept
+{
+    for (std::size_t i = 0; i < n; ++i)
+        out[i] = dates[i].month != 0 ? to_serial(dates[i], ds) : std::numeric_limits<double>::quiet_NaN();
+}
+
+inline std::vector<civil_date> to_civil(fp12_view serials, date_system ds = date_system::excel1900)
+{
+    std::vector<civil_date> out(serials.size());
+    to_civil(serials.begin(), serials.size(), out.data(), ds);
+    return out;
+}
+
+/// Converts serials between date systems in place. Serials which are not
+/// valid in the target system become NaN (#NUM!).
+inline void convert_date_system(double *serials, std::size_t n, date_system from, date_system to) noexcept
+{
+    if (from == to)
+        return;
+    for (std::size_t i = 0; i < n; ++i) {
+        const double s = serials[i];
+        if (!valid_serial(s, from)) {
+            serials[i] = std::numeric_limits<double>::quiet_NaN();
+            continue;
+        }
+        const double whole = std::floor(s);
+        const double t = days_to_serial(serial_to_days(static_cast<int>(whole), from), to) + (s - whole);
+        serials[i] = valid_serial(t, to) ? t : std::numeric_limits<double>::quiet_NaN();
+    }
+}
+
+inline void convert_date_system(mutable_fp12_view serials, date_system from, date_system to) noexcept
+{
+    convert_date_system(serials.begin(), serials.size(), from, to);
+}
+
+/// Converts the numbers of m between date systems in place; other cells
+/// are unchanged, and numbers which are not valid dates become #NUM!.
+inline void convert_date_system(xlmulti& m, date_system from, date_system to)
+{
+    if (from == to)
+        return;
+    for (auto& v : m) {
+        if (v.xltype() != xltypeNum)
+            continue;
+        double s = static_cast<double>(v.get<xlnum>());
+        convert_date_system(&s, 1, from, to);
+        if (std::isnan(s))
+            v.emplace<xlerr>(error::xlerrNum);
+        else
+            v.emplace<xlnum>(s);
+    }
+}
+
+/// Business days between two serials, from a precomputed bitset.
+///
+/// The weekend is a mask of the days of the week which are not worked, bit 0
+/// for Monday to bit 6 for Sunday as in the weekend string of WORKDAY.INTL;
+/// the default is Saturday and Sunday. Serials outside [first, last] throw
+/// std::out_of_range.
+class business_calendar
+{
+public:
+    static constexpr unsigned saturday_sunday = 0x60;
+
+    template<class Holidays = std::vector<double>>
+    business_calendar(double first, double last, const Holidays& holidays = {},
+        unsigned weekend = saturday_sunday, date_system ds = date_system::excel1900)
+        : ds_(ds)
+    {
+        if (!valid_serial(first, ds) || !valid_serial(last, ds) || last < first)
+            throw std::out_of_range("invalid calendar range");
+        first_ = serial_to_days(static_cast<int>(first), ds);
+        last_ = serial_to_days(static_cast<int>(last), ds);
+        const std::size_t n = static_cast<std::size_t>(last_ - first_) + 1;
+        bits_.assign((n + 63) / 64, 0);
+        for (std::size_t i = 0; i < n; ++i) {
+            const unsigned iso = (weekday_from_days(first_ + static_cast<int>(i)) + 6) % 7; // Monday 0
+            if (!(weekend >> iso & 1))
+                bits_[i / 64] |= std::uint64_t(1) << (i % 64);
+        }
+        for (double h : holidays) {
+            if (!valid_serial(h, ds))
+                continue;
+            const int d = serial_to_days(static_cast<int>(h), ds);
+            if (d >= first_ && d <= last_) {
+                const auto i = static_cast<std::size_t>(d - first_);
+                bits_[i / 64] &= ~(std::uint64_t(1) << (i % 64));
+            }
+        }
+        rank_.resize(bits_.size() + 1);
+        rank_[0] = 0;
+        for (std::size_t w = 0; w < bits_.size(); ++w)
+            rank_[w + 1] = rank_[w] + detail::popcount(bits_[w]);
+    }
+
+    bool is_business_day(double serial) const
+        { return test(index(serial)); }
+
+    /// WORKDAY(serial, n, holidays): the n-th business day after serial, or
+    /// before it if n is negative.
+    double add_business_days(double serial, int n) const
+    {
+        const std::size_t i = index(serial);
+        if (n == 0)
+            return std::floor(serial);
+        // Business days in [first, i) and [first, i].
+        const std::int64_t before = rank(i);
+        const std::int64_t target = n > 0 ? before + test(i) + n - 1 : before + n;
+        if (target < 0 || target >= static_cast<std::int64_t>(rank_.back()))
+            throw std::out_of_range("date beyond calendar");
+        return days_to_serial(first_ + static_cast<int>(select(static_cast<std::uint64_t>(target))), ds_);
+    }
+
+    /// NETWORKDAYS(start, end, holidays): business days from start to end,
+    /// both included, negative if end is before start.
+    int business_days(double start, double end) const
+    {
+        const std::size_t i = index(start), j = index(end);
+        if (j < i)
+            return -business_days(end, start);
+        return static_cast<int>(rank(j) + test(j) - rank(i));
+    }
+
+    /// add_business_days over an array in place.
+    void add_business_days(mutable_fp12_view serials, int n) const
+    {
+        for (double& s : serials)
+            s = add_business_days(s, n);
+    }
+
+    double first() const noexcept { return days_to_serial(first_, ds_); }
+    double last() const noexcept { return days_to_serial(last_, ds_); }
+
+private:
+    std::size_t index(double serial) const
+    {
+        if (!valid_serial(serial, ds_))
+            throw std::out_of_range("invalid date");
+        const int d = serial_to_days(static_cast<int>(serial), ds_);
+        if (d < first_ || d > last_)
+            throw std::out_of_range("date beyond calendar");
+        return static_cast<std::size_t>(d - first_);
+    }
+
+    bool test(std::size_t i) const noexcept
+        { return bits_[i / 64] >> (i % 64) & 1; }
+
+    // Business days before day i.
+    std::int64_t rank(std::size_t i) const noexcept
+    {
+        const std::uint64_t below = (std::uint64_t(1) << (i % 64)) - 1;
+        return rank_[i / 64] + detail::popcount(bits_[i / 64] & below);
+    }
+
+    // Day of business day k, counting from 0.
+    std::size_t select(std::uint64_t k) const noexcept
+    {
+        const auto w = static_cast<std::size_t>(
+            std::upper_bound(rank_.begin(), rank_.end(), k) - rank_.begin() - 1);
+        std::uint64_t word = bits_[w];
+        for (std::uint64_t r = k - rank_[w]; r > 0; --r)
+            word &= word - 1; // clear lowest set bit
+        std::size_t b = 0;
+        while (!(word >> b & 1))
+            ++b;
+        return w * 64 + b;
+    }
+
+    date_system ds_;
+    int first_ = 0;
+    int last_ = 0;
+    std::vector<std::uint64_t> bits_;
+    std::vector<std::uint64_t> rank_; // business days before each word
+};
+
+} // namespace xll
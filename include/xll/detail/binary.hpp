@@ -0,0 +1,334 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <xll/config.hpp>
+
+#include <xll/xloper.hpp>
+
+#include <boost/endian/conversion.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+namespace xll {
+namespace detail {
+
+// Little-endian writer over a buffer sized in advance; no bounds checks.
+class binary_writer
+{
+public:
+    explicit binary_writer(unsigned char *p) noexcept : p_(p) {}
+
+    template<class T>
+    void write(T value) noexcept
+    {
+        static_assert(std::is_arithmetic_v<T>, "invalid type");
+        if constexpr (std::is_floating_point_v<T>) {
+            using U = std::conditional_t<sizeof(T) == 8, std::uint64_t, std::uint32_t>;
+            U bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            write(bits);
+        }
+        else {
+            value = boost::endian::native_to_little(value);
+            std::memcpy(p_, &value, sizeof(T));
+            p_ += sizeof(T);
+        }
+    }
+
+    // Writes UTF-16 code units.
+    void write_chars(const wchar_t *s, std::size_t n) noexcept
+    {
+        if constexpr (sizeof(wchar_t) == 2 && boost::endian::order::native == boost::endian::order::little) {
+            std::memcpy(p_, s, n * 2);
+            p_ += n * 2;
+        }
+        else {
+            for (std::size_t i = 0; i < n; ++i)
+                write(static_cast<std::uint16_t>(s[i]));
+        }
+    }
+
+    // Reserves n bytes to be written later with write_at().
+    unsigned char *skip(std::size_t n) noexcept
+    {
+        unsigned char *p = p_;
+        p_ += n;
+        return p;
+    }
+
+    template<class T>
+    static void write_at(unsigned char *p, T value) noexcept
+    {
+        binary_writer w(p);
+        w.write(value);
+    }
+
+    unsigned char *data() const noexcept { return p_; }
+
+private:
+    unsigned char *p_;
+};
+
+// Reads a little-endian value from p without bounds checks.
+template<class T>
+inline T load_little(const unsigned char *p) noexcept
+{
+    static_assert(std::is_arithmetic_v<T>, "invalid type");
+    if constexpr (std::is_floating_point_v<T>) {
+        using U = std::conditional_t<sizeof(T) == 8, std::uint64_t, std::uint32_t>;
+        const U bits = load_little<U>(p);
+        T value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    else {
+        T value;
+        std::memcpy(&value, p, sizeof(T));
+        return boost::endian::little_to_native(value);
+    }
+}
+
+// Little-endian reader with bounds checks. Reads past the end fail and set
+// the reader to a failed state.
+class binary_reader
+{
+public:
+    binary_reader(const unsigned char *p, std::size_t n) noexcept
+        : p_(p), end_(p + n) {}
+
+    template<class T>
+    bool read(T& value) noexcept
+    {
+        static_assert(std::is_arithmetic_v<T>, "invalid type");
+        if (!require(sizeof(T)))
+            return false;
+        if constexpr (std::is_floating_point_v<T>) {
+            using U = std::conditional_t<sizeof(T) == 8, std::uint64_t, std::uint32_t>;
+            U bits;
+            read(bits);
+            std::memcpy(&value, &bits, sizeof(bits));
+        }
+        else {
+            std::memcpy(&value, p_, sizeof(T));
+            value = boost::endian::little_to_native(value);
+            p_ += sizeof(T);
+        }
+        return true;
+    }
+
+    // Reads n UTF-16 code units.
+    bool read_chars(wchar_t *s, std::size_t n) noexcept
+    {
+        if (!require(n * 2))
+            return false;
+        for (std::size_t i = 0; i < n; ++i) {
+            std::uint16_t c = 0;
+            read(c);
+            s[i] = static_cast<wchar_t>(c);
+        }
+        return true;
+    }
+
+    bool require(std::size_t n) noexcept
+    {
+        if (failed_ || static_cast<std::size_t>(end_ - p_) < n) {
+            failed_ = true;
+            return false;
+        }
+        return true;
+    }
+
+    bool skip(std::size_t n) noexcept
+    {
+        if (!require(n))
+            return false;
+        p_ += n;
+        return true;
+    }
+
+    const unsigned char *data() const noexcept { return p_; }
+    std::size_t remaining() const noexcept { return static_cast<std::size_t>(end_ - p_); }
+    bool failed() const noexcept { return failed_; }
+
+private:
+    const unsigned char *p_;
+    const unsigned char *end_;
+    bool failed_ = false;
+};
+
+// Encoding of a variant: xltype as uint16, then the value. The size of every
+// encoding is even, so that strings are 2-byte aligned in an aligned buffer.
+// References, flow control and big data are not values and are encoded as
+// #N/A.
+//
+//   xltypeNum    float64
+//   xltypeStr    uint32 length, UTF-16 code units
+//   xltypeBool   uint16
+//   xltypeErr    int32
+//   xltypeInt    int32
+//   xltypeMulti  uint32 rows, uint32 columns, uint64 size of the values in
+//                bytes, values in row-major order
+//   xltypeMissing, xltypeNil: no value
+//
+// Arrays may be nested up to binary_max_depth levels.
+
+constexpr int binary_max_depth = 8;
+constexpr std::size_t binary_multi_header = 2 + 4 + 4 + 8;
+
+inline std::size_t encoded_size(const variant& v) noexcept
+{
+    switch (v.xltype()) {
+    case xltypeNum: return 2 + 8;
+    case xltypeStr: return 2 + 4 + 2 * static_cast<std::size_t>(v.get<xlstr>().size());
+    case xltypeBool: return 2 + 2;
+    case xltypeInt: return 2 + 4;
+    case xltypeMissing:
+    case xltypeNil: return 2;
+    case xltypeMulti: {
+        std::size_t n = binary_multi_header;
+        for (const auto& x : v.get<xlmulti>())
+            n += encoded_size(x);
+        return n;
+    }
+    default: return 2 + 4; // xltypeErr
+    }
+}
+
+// Writes the encoding of v, of encoded_size(v) bytes. The size of an array
+// is written after its values, so each value is visited once.
+inline void encode(binary_writer& w, const variant& v) noexcept
+{
+    switch (v.xltype()) {
+    case xltypeNum:
+        w.write(static_cast<std::uint16_t>(xltypeNum));
+        w.write(static_cast<double>(v.get<xlnum>()));
+        break;
+    case xltypeStr: {
+        const auto& s = v.get<xlstr>();
+        w.write(static_cast<std::uint16_t>(xltypeStr));
+        w.write(static_cast<std::uint32_t>(s.size()));
+        w.write_chars(s.data(), s.size());
+        break;
+    }
+    case xltypeBool:
+        w.write(static_cast<std::uint16_t>(xltypeBool));
+        w.write(static_cast<std::uint16_t>(static_cast<bool>(v.get<xlbool>())));
+        break;
+    case xltypeErr:
+        w.write(static_cast<std::uint16_t>(xltypeErr));
+        w.write(static_cast<std::int32_t>(v.get<xlerr>().err));
+        break;
+    case xltypeInt:
+        w.write(static_cast<std::uint16_t>(xltypeInt));
+        w.write(static_cast<std::int32_t>(v.get<xlint>().w));
+        break;
+    case xltypeMissing:
+    case xltypeNil:
+        w.write(static_cast<std::uint16_t>(v.xltype()));
+        break;
+    case xltypeMulti: {
+        const auto& m = v.get<xlmulti>();
+        w.write(static_cast<std::uint16_t>(xltypeMulti));
+        w.write(static_cast<std::uint32_t>(m.size1()));
+        w.write(static_cast<std::uint32_t>(m.size2()));
+        unsigned char *size = w.skip(8);
+        const unsigned char *first = w.data();
+        for (const auto& x : m)
+            encode(w, x);
+        binary_writer::write_at(size, static_cast<std::uint64_t>(w.data() - first));
+        break;
+    }
+    default:
+        w.write(static_cast<std::uint16_t>(xltypeErr));
+        w.write(static_cast<std::int32_t>(error::xlerrNA));
+        break;
+    }
+}
+
+// Decodes one value into v. Returns false if the input is truncated or
+// malformed; v is then unspecified.
+inline bool decode(binary_reader& r, variant& v, int depth = 0)
+{
+    std::uint16_t xltype;
+    if (!r.read(xltype))
+        return false;
+    switch (xltype) {
+    case xltypeNum: {
+        double x;
+        if (!r.read(x))
+            return false;
+        v.emplace<xlnum>(x);
+        return true;
+    }
+    case xltypeStr: {
+        std::uint32_t n;
+        if (!r.read(n) || !r.require(std::size_t(n) * 2) || n > 32767)
+            return false;
+        std::wstring s(n, L'\0');
+        r.read_chars(s.data(), n);
+        v.emplace<xlstr>(s);
+        return true;
+    }
+    case xltypeBool: {
+        std::uint16_t x;
+        if (!r.read(x))
+            return false;
+        v.emplace<xlbool>(x != 0);
+        return true;
+    }
+    case xltypeErr: {
+        std::int32_t x;
+        if (!r.read(x))
+            return false;
+        v.emplace<xlerr>(static_cast<error::excel_error>(x));
+        return true;
+    }
+    case xltypeInt: {
+        std::int32_t x;
+        if (!r.read(x))
+            return false;
+        v.emplace<xlint>(x);
+        return true;
+    }
+    case xltypeMissing:
+        v.emplace<xlmissing>();
+        return true;
+    case xltypeNil:
+        v.emplace<xlnil>();
+        return true;
+    case xltypeMulti: {
+        std::uint32_t rows, cols;
+        std::uint64_t size;
+        if (depth >= binary_max_depth || !r.read(rows) || !r.read(cols) || !r.read(size))
+            return false;
+        // Each element takes at least two bytes.
+        if (size > r.remaining() || (rows != 0 && cols > size / 2 / rows))
+            return false;
+        const std::size_t remaining = r.remaining();
+        xlmulti m(rows, cols);
+        for (auto& x : m) {
+            if (!decode(r, x, depth + 1))
+                return false;
+        }
+        if (remaining - r.remaining() != size)
+            return false;
+        v.emplace<xlmulti>(std::move(m));
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+} // namespace detail
+} // namespace xll
@@ -0,0 +1,30 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <xll/config.hpp>
+
+#include <cstdint>
+
+namespace xll {
+namespace detail {
+
+inline unsigned popcount(std::uint64_t x) noexcept
+{
+#if BOOST_COMP_GNUC || BOOST_COMP_CLANG
+    return static_cast<unsigned>(__builtin_popcountll(x));
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return static_cast<unsigned>((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+} // namespace detail
+} // namespace xll
@@ -9,6 +9,8 @@
 
 #include <xll/config.hpp>
 
+#include <atomic>
+
 #if BOOST_OS_WINDOWS
 #include <boost/winapi/dll.hpp>
 #else
@@ -26,8 +28,9 @@ namespace detail {
 template<class R = void, class V = void>
 using EXCEL12PROC = int (__stdcall *)(int xlfn, int coper, V **rgpvalue12, R *value12Res);
 
+// Entry point of the host application.
 template<class R = void, class V = void>
-BOOST_FORCEINLINE EXCEL12PROC<R, V> MdCallBack12()
+BOOST_FORCEINLINE EXCEL12PROC<R, V> HostCallBack12()
 {
 #if BOOST_OS_WINDOWS
     static auto hmodule = boost::winapi::get_module_handle("");
@@ -39,6 +42,22 @@ BOOST_FORCEINLINE EXCEL12PROC<R, V> MdCallBack12()
     return pfn;
 }
 
+// Entry point used in place of the host's when set, by call_recorder and
+// trace_replayer.
+inline std::atomic<EXCEL12PROC<>>& callback_override() noexcept
+{
+    static std::atomic<EXCEL12PROC<>> pfn{ nullptr };
+    return pfn;
+}
+
+template<class R = void, class V = void>
+BOOST_FORCEINLINE EXCEL12PROC<R, V> MdCallBack12()
+{
+    if (auto pfn = callback_override().load(std::memory_order_acquire))
+        return reinterpret_cast<EXCEL12PROC<R, V>>(pfn);
+    return HostCallBack12<R, V>();
+}
+
 // LPenHelper symbol from Excel 2010 SDK; not present in Excel 2013 SDK.
 using LPENHELPERPROC = long (__stdcall *)(int wCode, void *lpv);
 
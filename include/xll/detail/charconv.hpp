@@ -0,0 +1,20 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <xll/config.hpp>
+
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+
+// Floating-point std::to_chars and std::from_chars (P0067R5): GCC 11,
+// Visual Studio 2019 16.4.
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L && !defined(XLL_NO_FLOAT_CHARCONV)
+#define XLL_HAS_FLOAT_CHARCONV
+#endif
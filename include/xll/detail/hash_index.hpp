@@ -0,0 +1,165 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <xll/config.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace xll {
+namespace detail {
+
+// Finalizer from SplitMix64. Spreads aligned pointers and short string hashes
+// over the low bits used to index a power-of-two table.
+inline std::size_t mix_hash(std::uint64_t x) noexcept
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return static_cast<std::size_t>(x);
+}
+
+// Open-addressing hash index over externally owned values.
+//
+// Lookups are wait-free: one acquire load of the table pointer followed by a
+// bounded linear probe. Insertions and erasures must be serialized by the
+// caller. An erased value leaves a tombstone, so that probes for other keys
+// still pass its slot, and tombstones are dropped when the table grows. The
+// table doubles when half its slots are used; superseded tables are retired
+// rather than freed, so a reader holding a stale table pointer always sees
+// valid memory. Retired tables are released by clear(), which requires that
+// no readers are active.
+//
+// KeyOf must provide:
+//   static std::size_t hash(const K&) noexcept;
+//   static std::size_t hash(const T&) noexcept;
+//   static bool equal(const T&, const K&) noexcept;
+
+template<class T, class KeyOf>
+class hash_index
+{
+    struct table
+    {
+        explicit table(std::size_t n)
+            : mask(n - 1), slots(new std::atomic<T *>[n])
+        {
+            for (std::size_t i = 0; i < n; ++i)
+                slots[i].store(nullptr, std::memory_order_relaxed);
+        }
+
+        std::size_t capacity() const noexcept
+            { return mask + 1; }
+
+        std::size_t mask;
+        std::atomic<std::size_t> count{ 0 }; // values and tombstones
+        std::unique_ptr<std::atomic<T *>[]> slots;
+        std::unique_ptr<table> retired;
+    };
+
+    std::atomic<table *> current_{ nullptr };
+    std::unique_ptr<table> owner_;
+    std::atomic<std::size_t> size_{ 0 };
+
+    static inline const char tombstone_tag = 0;
+
+    // Marks an erased slot; never dereferenced.
+    static T * tombstone() noexcept
+        { return reinterpret_cast<T *>(const_cast<char *>(&tombstone_tag)); }
+
+    static void insert_slot(table& t, T *value) noexcept
+    {
+        std::size_t i = KeyOf::hash(*value) & t.mask;
+        while (t.slots[i].load(std::memory_order_relaxed) != nullptr)
+            i = (i + 1) & t.mask;
+        t.slots[i].store(value, std::memory_order_release);
+        t.count.store(t.count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    void grow()
+    {
+        const std::size_t n = owner_ ? owner_->capacity() * 2 : 16;
+        auto next = std::make_unique<table>(n);
+        if (owner_) {
+            for (std::size_t i = 0; i < owner_->capacity(); ++i) {
+                T *p = owner_->slots[i].load(std::memory_order_relaxed);
+                if (p != nullptr && p != tombstone())
+                    insert_slot(*next, p);
+            }
+        }
+        next->retired = std::move(owner_);
+        owner_ = std::move(next);
+        current_.store(owner_.get(), std::memory_order_release);
+    }
+
+public:
+    hash_index() = default;
+    hash_index(const hash_index&) = delete;
+    hash_index& operator=(const hash_index&) = delete;
+
+    template<class K>
+    T * find(const K& key) const noexcept
+    {
+        const table *t = current_.load(std::memory_order_acquire);
+        if (t == nullptr)
+            return nullptr;
+        for (std::size_t i = KeyOf::hash(key) & t->mask;; i = (i + 1) & t->mask) {
+            T *p = t->slots[i].load(std::memory_order_acquire);
+            if (p == nullptr)
+                return nullptr;
+            if (p != tombstone() && KeyOf::equal(*p, key))
+                return p;
+        }
+    }
+
+    // Caller must serialize writers and ensure the key is not already present.
+    void insert(T *value)
+    {
+        if (!owner_ || (owner_->count.load(std::memory_order_relaxed) + 1) * 2 > owner_->capacity())
+            grow();
+        insert_slot(*owner_, value);
+        size_.fetch_add(1, std::memory_order_release);
+    }
+
+    // Removes value, which must be in the index. Caller must serialize
+    // writers; value itself must stay valid for readers which found it.
+    void erase(const T *value) noexcept
+    {
+        if (!owner_)
+            return;
+        table& t = *owner_;
+        for (std::size_t i = KeyOf::hash(*value) & t.mask;; i = (i + 1) & t.mask) {
+            T *p = t.slots[i].load(std::memory_order_relaxed);
+            if (p == nullptr)
+                return;
+            if (p == value) {
+                t.slots[i].store(tombstone(), std::memory_order_release);
+                size_.fetch_sub(1, std::memory_order_release);
+                return;
+            }
+        }
+    }
+
+    std::size_t size() const noexcept
+        { return size_.load(std::memory_order_acquire); }
+
+    // Not safe while readers are active.
+    void clear() noexcept
+    {
+        current_.store(nullptr, std::memory_order_release);
+        owner_.reset();
+        size_.store(0, std::memory_order_release);
+    }
+};
+
+} // namespace detail
+} // namespace xll
@@ -0,0 +1,41 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <xll/config.hpp>
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+namespace xll {
+namespace detail {
+
+// Appends s as a quoted JSON string. s is UTF-8.
+inline void append_json_string(std::string& out, std::string_view s)
+{
+    out += '"';
+    for (char c : s) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            }
+            else
+                out += c;
+        }
+    }
+    out += '"';
+}
+
+} // namespace detail
+} // namespace xll
@@ -0,0 +1,99 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <xll/config.hpp>
+
+#if BOOST_OS_WINDOWS
+#include <boost/winapi/dll.hpp>
+#else
+#include <boost/nowide/convert.hpp>
+#include <dlfcn.h>
+#endif
+
+#include <string>
+#include <utility>
+
+namespace xll {
+namespace detail {
+
+// Owning handle to a shared library loaded with LoadLibraryW or dlopen.
+
+class shared_library
+{
+public:
+#if BOOST_OS_WINDOWS
+    using native_handle_type = boost::winapi::HMODULE_;
+#else
+    using native_handle_type = void *;
+#endif
+
+    shared_library() = default;
+
+    explicit shared_library(const std::wstring& path)
+    {
+#if BOOST_OS_WINDOWS
+        handle_ = boost::winapi::load_library(path.c_str());
+#else
+        handle_ = dlopen(boost::nowide::narrow(path).c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+    }
+
+    ~shared_library()
+        { close(); }
+
+    shared_library(const shared_library&) = delete;
+    shared_library& operator=(const shared_library&) = delete;
+
+    shared_library(shared_library&& other) noexcept
+        : handle_(std::exchange(other.handle_, nullptr)) {}
+
+    shared_library& operator=(shared_library&& other) noexcept
+    {
+        if (this != &other) {
+            close();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    bool is_loaded() const noexcept
+        { return handle_ != nullptr; }
+
+    native_handle_type native_handle() const noexcept
+        { return handle_; }
+
+    void * symbol(const char *name) const noexcept
+    {
+        if (handle_ == nullptr)
+            return nullptr;
+#if BOOST_OS_WINDOWS
+        return reinterpret_cast<void *>(boost::winapi::get_proc_address(handle_, name));
+#else
+        return dlsym(handle_, name);
+#endif
+    }
+
+    void close() noexcept
+    {
+        if (handle_ == nullptr)
+            return;
+#if BOOST_OS_WINDOWS
+        boost::winapi::FreeLibrary(handle_);
+#else
+        dlclose(handle_);
+#endif
+        handle_ = nullptr;
+    }
+
+private:
+    native_handle_type handle_ = nullptr;
+};
+
+} // namespace detail
+} // namespace xll
@@ -0,0 +1,461 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file marshal.hpp
+ * Conversions between natural C++ argument and return types and the extern
+ * "C" types passed by Excel. Each argument type selects the cheapest type text
+ * that preserves its meaning:
+ *
+ * | C++ type                           | Code | Conversion                 |
+ * |------------------------------------|------|----------------------------|
+ * | double, float                      | B    | none                       |
+ * | bool                               | A    | none                       |
+ * | signed integral (<= 32 bit), enum  | J    | static_cast                |
+ * | unsigned 32 bit, 64 bit integral   | B    | range checked, or #NUM!    |
+ * | std::wstring_view                  | C%   | none (view)                |
+ * | std::wstring, std::string(_view)   | C%   | copy / UTF-16 to UTF-8     |
+ * | xll::fp12_view                     | K%   | none (view)                |
+ * | std::vector<double>                | K%   | copy                       |
+ * | std::optional<T>, xll::variant     | Q    | per element                |
+ * | xll::range_ref                     | U    | on demand                  |
+ *
+ * Return values use the same codes, except that bool and J integral and enum
+ * results are returned as Q so that a failure can be reported as #VALUE!.
+ * std::optional, std::tuple (as a single row), xll::variant and
+ * xll::error::excel_error are also returned as Q. Failures in functions
+ * returning B, C% or K% are reported as #NUM!. Results are built in
+ * thread-local buffers which Excel copies on return, so repeated calls on a
+ * thread do not allocate once the buffers have grown.
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/error.hpp>
+#include <xll/fp12.hpp>
+#include <xll/range.hpp>
+#include <xll/xloper.hpp>
+#include <xll/detail/memory.hpp>
+#include <xll/detail/type_traits.hpp>
+#include <xll/detail/variant.hpp>
+
+#include <boost/nowide/convert.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cwchar>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace xll {
+namespace detail {
+
+template<class T> struct is_optional : std::false_type {};
+template<class T> struct is_optional<std::optional<T>> : std::true_type {};
+
+template<class T> struct is_tuple : std::false_type {};
+template<class... Ts> struct is_tuple<std::tuple<Ts...>> : std::true_type {};
+template<class T1, class T2> struct is_tuple<std::pair<T1, T2>> : std::true_type {};
+
+template<class T>
+using is_wide_string = std::disjunction<
+    std::is_same<T, std::wstring>,
+    std::is_same<T, std::wstring_view>>;
+
+template<class T>
+using is_narrow_string = std::disjunction<
+    std::is_same<T, std::string>,
+    std::is_same<T, std::string_view>>;
+
+// Integral and enum types whose values all fit in int32_t, passed as J.
+template<class T, class N = safe_underlying_type_t<T>>
+using is_small_integral = std::bool_constant<
+    std::is_integral_v<N> && !std::is_same_v<N, bool> &&
+    (sizeof(N) < sizeof(int32_t) || (sizeof(N) == sizeof(int32_t) && std::is_signed_v<N>))>;
+
+// Other integral and enum types, passed as B.
+template<class T, class N = safe_underlying_type_t<T>>
+using is_large_integral = std::bool_constant<
+    std::is_integral_v<N> && !std::is_same_v<N, bool> && !is_small_integral<T>::value>;
+
+// Converts a number from Excel to an integral type, truncating toward zero.
+// Throws #NUM! as a std::system_error if x is NaN or out of range, where
+// static_cast would be undefined.
+template<class N>
+inline N integral_cast(double x)
+{
+    constexpr double lo = static_cast<double>(std::numeric_limits<N>::min());
+    const double end = std::ldexp(1.0, std::numeric_limits<N>::digits);
+    if (!(x < end && (x >= lo || x > lo - 1.0)))
+        throw std::system_error(error::xlerrNum, "integer argument out of range");
+    return static_cast<N>(x);
+}
+
+//
+// Variant element conversions, used for Q arguments and return values.
+//
+
+template<class T>
+inline T from_variant(const variant& v)
+{
+    using N = safe_underlying_type_t<T>;
+    switch (v.xltype()) {
+    case xltypeNum:
+        if constexpr (std::is_floating_point_v<N> || std::is_same_v<N, bool>)
+            return static_cast<T>(static_cast<N>(static_cast<double>(v.get<xlnum>())));
+        else if constexpr (std::is_integral_v<N>)
+            return static_cast<T>(integral_cast<N>(v.get<xlnum>()));
+        break;
+    case xltypeInt:
+        if constexpr (std::is_arithmetic_v<N>)
+            return static_cast<T>(static_cast<N>(static_cast<int32_t>(v.get<xlint>())));
+        break;
+    case xltypeBool:
+        if constexpr (std::is_arithmetic_v<T>)
+            return static_cast<T>(static_cast<bool>(v.get<xlbool>()));
+        break;
+    case xltypeStr:
+        if constexpr (std::is_same_v<T, std::wstring_view>)
+            return std::wstring_view(v.get<xlstr>());
+        else if constexpr (is_wide_string<T>::value || is_narrow_string<T>::value)
+            return static_cast<std::basic_string<typename T::value_type>>(v.get<xlstr>());
+        break;
+    default:
+        break;
+    }
+    throw std::invalid_argument("invalid argument type");
+}
+
+template<class T>
+inline void to_variant(variant& v, T&& value)
+{
+    using U = remove_cvref_t<T>;
+    if constexpr (std::is_same_v<U, variant>)
+        v = std::forward<T>(value);
+    else if constexpr (std::is_same_v<U, error::excel_error>)
+        v.emplace<xlerr>(value);
+    else if constexpr (std::is_same_v<U, bool>)
+        v.emplace<xlbool>(value);
+    else if constexpr (std::is_arithmetic_v<U> || std::is_enum_v<U>)
+        v.emplace<xlnum>(static_cast<double>(value));
+    else if constexpr (is_wide_string<U>::value)
+        v.emplace<xlstr>(std::wstring_view(value).data(), static_cast<xlstr::size_type>(value.size()));
+    else if constexpr (is_narrow_string<U>::value)
+        v.emplace<xlstr>(std::string(value));
+    else if constexpr (is_optional<U>::value) {
+        if (value.has_value())
+            to_variant(v, *std::forward<T>(value));
+        else
+            v.emplace<xlerr>(error::xlerrNA);
+    }
+    else
+        static_assert(sizeof(U) == 0, "unsupported element type");
+}
+
+//
+// Argument marshalling. Each specialization defines the extern "C" type
+// received from Excel and a default-constructible holder which converts it.
+// Holders live on the stack of the trampoline for the duration of the call.
+//
+
+template<class T, class E = void>
+struct arg_marshal
+{
+    static_assert(sizeof(T) == 0, "unsupported argument type");
+};
+
+template<class T>
+struct arg_marshal<T, std::enable_if_t<std::is_floating_point_v<T>>>
+{
+    using extern_type = double;
+    struct holder { T get(double x) const noexcept { return static_cast<T>(x); } };
+};
+
+template<>
+struct arg_marshal<bool>
+{
+    using extern_type = bool;
+    struct holder { bool get(bool x) const noexcept { return x; } };
+};
+
+template<class T>
+struct arg_marshal<T, std::enable_if_t<is_small_integral<T>::value>>
+{
+    using extern_type = int32_t;
+    struct holder { T get(int32_t x) const noexcept { return static_cast<T>(x); } };
+};
+
+template<class T>
+struct arg_marshal<T, std::enable_if_t<is_large_integral<T>::value>>
+{
+    using extern_type = double;
+    struct holder {
+        T get(double x) const { return static_cast<T>(integral_cast<safe_underlying_type_t<T>>(x)); }
+    };
+};
+
+template<>
+struct arg_marshal<std::wstring_view>
+{
+    using extern_type = const wchar_t *;
+    struct holder {
+        std::wstring_view get(const wchar_t *s) const noexcept
+            { return s ? std::wstring_view(s) : std::wstring_view(); }
+    };
+};
+
+template<>
+struct arg_marshal<std::wstring>
+{
+    using extern_type = const wchar_t *;
+    struct holder {
+        std::wstring get(const wchar_t *s) const
+            { return s ? std::wstring(s) : std::wstring(); }
+    };
+};
+
+template<class T>
+struct arg_marshal<T, std::enable_if_t<is_narrow_string<T>::value>>
+{
+    using extern_type = const wchar_t *;
+    struct holder {
+        std::string value;
+        T get(const wchar_t *s)
+        {
+            if (s != nullptr)
+            {
+                value = boost::nowide::narrow(s, std::wcslen(s));
+                count_allocation(value);
+            }
+            if constexpr (std::is_same_v<T, std::string>)
+                return std::move(value);
+            else
+                return value;
+        }
+    };
+};
+
+template<>
+struct arg_marshal<fp12_view>
+{
+    using extern_type = const fp12 *;
+    struct holder { fp12_view get(const fp12 *p) const noexcept { return fp12_view(p); } };
+};
+
+template<>
+struct arg_marshal<std::vector<double>>
+{
+    using extern_type = const fp12 *;
+    struct holder {
+        std::vector<double> get(const fp12 *p) const
+        {
+            fp12_view view(p);
+            return std::vector<double>(view.begin(), view.end());
+        }
+    };
+};
+
+template<>
+struct arg_marshal<variant>
+{
+    using extern_type = variant *;
+    struct holder { variant& get(variant *p) const noexcept { return *p; } };
+};
+
+template<>
+struct arg_marshal<range_ref>
+{
+    using extern_type = range_ref *;
+    struct holder { range_ref& get(range_ref *p) const noexcept { return *p; } };
+};
+
+template<class T>
+struct arg_marshal<std::optional<T>>
+{
+    using extern_type = variant *;
+    struct holder {
+        std::optional<T> get(variant *p) const
+        {
+            if (p == nullptr || p->xltype() == xltypeMissing || p->xltype() == xltypeNil)
+                return std::nullopt;
+            return from_variant<T>(*p);
+        }
+    };
+};
+
+template<class T>
+using arg_extern_t = typename arg_marshal<remove_cvref_t<T>>::extern_type;
+
+template<class T>
+using arg_holder_t = typename arg_marshal<remove_cvref_t<T>>::holder;
+
+//
+// Return value marshalling. Each specialization defines the extern "C" return
+// type, a conversion from the C++ value, and the value returned on failure.
+//
+
+template<class T, class E = void>
+struct result_marshal
+{
+    using extern_type = variant *;
+
+    template<class U>
+    static variant * convert(U&& value)
+    {
+        thread_local variant result;
+        if constexpr (is_tuple<T>::value) {
+            constexpr std::size_t N = std::tuple_size_v<T>;
+            xlmulti m(1, static_cast<unsigned>(N));
+            std::apply([&m](auto&&... xs) {
+                std::size_t i = 0;
+                (to_variant(m[i++], std::forward<decltype(xs)>(xs)), ...);
+            }, std::forward<U>(value));
+            result.emplace<xlmulti>(std::move(m));
+        }
+        else {
+            to_variant(result, std::forward<U>(value));
+        }
+        return &result;
+    }
+
+    static variant * failure(error::excel_error err = error::xlerrValue)
+    {
+        thread_local variant result;
+        result.emplace<xlerr>(err);
+        return &result;
+    }
+};
+
+// Quiet NaN is displayed as #NUM!.
+template<class T>
+struct result_marshal<T, std::enable_if_t<std::is_floating_point_v<T> || is_large_integral<T>::value>>
+{
+    using extern_type = double;
+    static double convert(T value) noexcept { return static_cast<double>(value); }
+    static double failure(error::excel_error = error::xlerrNum) noexcept
+        { return std::numeric_limits<double>::quiet_NaN(); }
+};
+
+template<>
+struct result_marshal<bool>
+{
+    using extern_type = variant *;
+    static variant * convert(bool value)
+    {
+        thread_local variant result;
+        result.emplace<xlbool>(value);
+        return &result;
+    }
+    static variant * failure(error::excel_error err = error::xlerrValue)
+        { return result_marshal<variant>::failure(err); }
+};
+
+template<class T>
+struct result_marshal<T, std::enable_if_t<is_small_integral<T>::value>>
+{
+    using extern_type = variant *;
+    static variant * convert(T value)
+    {
+        thread_local variant result;
+        result.emplace<xlnum>(static_cast<double>(value));
+        return &result;
+    }
+    static variant * failure(error::excel_error err = error::xlerrValue)
+        { return result_marshal<variant>::failure(err); }
+};
+
+// Excel copies the null-terminated string on return. A null pointer is
+// displayed as #NUM!.
+template<class T>
+struct result_marshal<T, std::enable_if_t<is_wide_string<T>::value || is_narrow_string<T>::value>>
+{
+    using extern_type = const wchar_t *;
+
+    template<class U>
+    static const wchar_t * convert(U&& value)
+    {
+        thread_local std::wstring buffer;
+        if constexpr (std::is_same_v<remove_cvref_t<U>, std::wstring> && !std::is_lvalue_reference_v<U>)
+            buffer = std::move(value);
+        else if constexpr (is_wide_string<T>::value)
+            buffer.assign(value.data(), value.size());
+        else {
+            std::wstring wide = boost::nowide::widen(value.data(), value.size());
+            count_allocation(wide);
+            buffer = std::move(wide);
+        }
+        return buffer.c_str();
+    }
+
+    static const wchar_t * failure(error::excel_error = error::xlerrNum) noexcept
+        { return nullptr; }
+};
+
+// Returned in a thread-local FP12 buffer which grows as required.
+template<class T>
+struct result_marshal<T, std::enable_if_t<
+    std::is_same_v<T, std::vector<double>> || std::is_same_v<T, fp12_view>>>
+{
+    using extern_type = fp12 *;
+
+    static fp12 * allocate(std::size_t rows, std::size_t cols)
+    {
+        thread_local std::unique_ptr<double[]> buffer;
+        thread_local std::size_t capacity = 0;
+        const std::size_t n = std::max<std::size_t>(rows * cols, 1) + 1; // header
+        if (n > capacity) {
+            buffer.reset(new double[n]);
+            capacity = n;
+        }
+        auto *p = reinterpret_cast<fp12 *>(buffer.get());
+        p->rows = static_cast<int32_t>(rows);
+        p->columns = static_cast<int32_t>(cols);
+        return p;
+    }
+
+    static fp12 * convert(const T& value)
+    {
+        if constexpr (std::is_same_v<T, fp12_view>) {
+            fp12 *p = allocate(value.rows(), value.columns());
+            std::copy(value.begin(), value.end(), p->array);
+            return p;
+        }
+        else {
+            if (value.empty())
+                return failure(error::xlerrNA);
+            fp12 *p = allocate(value.size(), 1); // column vector
+            std::copy(value.begin(), value.end(), p->array);
+            return p;
+        }
+    }
+
+    static fp12 * failure(error::excel_error = error::xlerrNum)
+    {
+        fp12 *p = allocate(1, 1);
+        p->array[0] = std::numeric_limits<double>::quiet_NaN();
+        return p;
+    }
+};
+
+template<class T>
+using result_extern_t = typename result_marshal<remove_cvref_t<T>>::extern_type;
+
+} // namespace detail
+} // namespace xll
@@ -9,9 +9,11 @@
 
 #include <xll/config.hpp>
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <new>
+#include <string>
 #include <type_traits>
 
 #if BOOST_COMP_MSVC
@@ -51,6 +53,56 @@ BOOST_FORCEINLINE std::uintptr_t stack_limit()
 }
 #endif // BOOST_COMP_MSVC
 
+// Allocations made by the exported function running on this thread. Set by
+// profiler::invoke while the profiler is enabled, otherwise null.
+struct alloc_counters
+{
+    std::uint64_t count = 0;
+    std::uint64_t bytes = 0;
+};
+
+inline alloc_counters *& current_alloc_counters() noexcept
+{
+    thread_local alloc_counters *counters = nullptr;
+    return counters;
+}
+
+BOOST_FORCEINLINE void count_allocation(std::size_t bytes) noexcept
+{
+    if (alloc_counters *c = current_alloc_counters()) {
+        ++c->count;
+        c->bytes += bytes;
+    }
+}
+
+// Temporary strings of a character set conversion.
+template<class CharT>
+BOOST_FORCEINLINE void count_allocation(const std::basic_string<CharT>& s) noexcept
+{
+    if (s.capacity() > std::basic_string<CharT>().capacity()) // not SSO
+        count_allocation((s.capacity() + 1) * sizeof(CharT));
+}
+
+// std::allocator which counts its allocations.
+template<class T>
+struct counting_allocator : std::allocator<T>
+{
+    template<class U>
+    struct rebind { using other = counting_allocator<U>; };
+
+    counting_allocator() = default;
+
+    template<class U>
+    counting_allocator(const counting_allocator<U>&) noexcept {}
+
+    T *allocate(std::size_t n)
+    {
+        T *p = std::allocator<T>::allocate(n);
+        count_allocation(n * sizeof(T));
+        return p;
+    }
+};
+
 // Used for empty base optimization.
 template<class Allocator>
 struct alloc_holder : private Allocator
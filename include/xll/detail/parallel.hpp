@@ -0,0 +1,122 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <xll/config.hpp>
+
+#include <xll/detail/thread_pool.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace xll {
+namespace detail {
+
+// Worker threads shared by parallel_for, started by its first parallel call
+// with one thread fewer than the hardware, since the calling thread also
+// runs chunks. stop() joins them; a later call starts them again.
+struct parallel_pool
+{
+    static thread_pool& get()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!pool_)
+            pool_ = std::make_unique<thread_pool>(std::max(2u, std::thread::hardware_concurrency()) - 1);
+        return *pool_;
+    }
+
+    static void stop()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pool_.reset();
+    }
+
+private:
+    static inline std::mutex mutex_;
+    static inline std::unique_ptr<thread_pool> pool_;
+};
+
+// Calls f(first, last) over [0, n) in at most threads contiguous chunks, and
+// no more than the shared workers and the calling thread can run at once.
+// Chunk boundaries are multiples of grain, so that chunks writing whole words
+// of a bitmap do not share one. The calling thread takes chunks as well, so a
+// busy pool or a nested call only reduces the parallelism. The first
+// exception thrown by f is rethrown after all chunks have finished.
+
+template<class F>
+inline void parallel_for(std::size_t n, std::size_t threads, std::size_t grain, F&& f)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    std::size_t chunks = std::min(threads, (n + grain - 1) / grain);
+    if (chunks <= 1) {
+        if (n > 0)
+            f(std::size_t(0), n);
+        return;
+    }
+    thread_pool& pool = parallel_pool::get();
+    chunks = std::min(chunks, pool.size() + 1);
+    const std::size_t per = ((n + chunks - 1) / chunks + grain - 1) / grain * grain;
+    chunks = (n + per - 1) / per;
+
+    // Shared with the helper tasks, which may start after the call returns
+    // when every chunk was taken by another thread.
+    struct state_type
+    {
+        std::atomic<std::size_t> next{ 0 };
+        std::size_t done = 0;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    auto state = std::make_shared<state_type>();
+
+    auto run = [state, chunks, per, n, &f]() {
+        for (;;) {
+            const std::size_t c = state->next.fetch_add(1, std::memory_order_relaxed);
+            if (c >= chunks)
+                return;
+            std::exception_ptr error;
+            try {
+                f(c * per, std::min(n, (c + 1) * per));
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (error && !state->error)
+                state->error = error;
+            if (++state->done == chunks)
+                state->finished.notify_one();
+        }
+    };
+
+    for (std::size_t i = 1; i < chunks; ++i) {
+        try {
+            pool.submit(run);
+        }
+        catch (...) {
+            break; // the remaining chunks run on this thread
+        }
+    }
+    run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&]() { return state->done == chunks; });
+    if (state->error)
+        std::rethrow_exception(state->error);
+}
+
+} // namespace detail
+} // namespace xll
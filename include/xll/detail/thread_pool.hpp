@@ -0,0 +1,175 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <xll/config.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace xll {
+namespace detail {
+
+// Work-stealing thread pool. Each worker owns a deque; tasks submitted from a
+// worker go to its own deque and are taken LIFO for locality, while idle
+// workers steal FIFO from the others. External submissions are distributed
+// round-robin. Queues are guarded by per-worker mutexes, so contention is
+// limited to a thief and an owner touching the same deque.
+
+class thread_pool
+{
+public:
+    using task_type = std::function<void()>;
+
+    explicit thread_pool(std::size_t threads = 0)
+    {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        queues_.reserve(threads);
+        for (std::size_t i = 0; i < threads; ++i)
+            queues_.push_back(std::make_unique<queue>());
+        threads_.reserve(threads);
+        for (std::size_t i = 0; i < threads; ++i)
+            threads_.emplace_back([this, i]() { run(i); });
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            stop_ = true;
+        }
+        sleep_cv_.notify_all();
+        for (auto& t : threads_)
+            t.join();
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    void submit(task_type task)
+    {
+        std::size_t i = (worker_index() != npos && owner() == this)
+            ? worker_index()
+            : next_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+        // Counted before it is queued, so that a worker which takes the task
+        // at once never decrements pending_ below the number queued.
+        pending_.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(queues_[i]->mutex);
+            queues_[i]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+        }
+        sleep_cv_.notify_one();
+    }
+
+    // Discards queued tasks which have not started. Returns the number dropped.
+    std::size_t clear()
+    {
+        std::size_t count = 0;
+        for (auto& q : queues_) {
+            std::lock_guard<std::mutex> lock(q->mutex);
+            count += q->tasks.size();
+            q->tasks.clear();
+        }
+        pending_.fetch_sub(count, std::memory_order_acq_rel);
+        return count;
+    }
+
+    std::size_t pending() const noexcept
+        { return pending_.load(std::memory_order_acquire); }
+
+    std::size_t size() const noexcept
+        { return threads_.size(); }
+
+private:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    struct alignas(64) queue
+    {
+        std::mutex mutex;
+        std::deque<task_type> tasks;
+    };
+
+    static std::size_t& worker_index() noexcept
+    {
+        thread_local std::size_t index = npos;
+        return index;
+    }
+
+    static const thread_pool *& owner() noexcept
+    {
+        thread_local const thread_pool *pool = nullptr;
+        return pool;
+    }
+
+    bool pop(std::size_t index, task_type& task)
+    {
+        {
+            auto& q = *queues_[index];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (!q.tasks.empty()) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                return true;
+            }
+        }
+        for (std::size_t k = 1; k < queues_.size(); ++k) {
+            auto& q = *queues_[(index + k) % queues_.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (!q.tasks.empty()) {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(std::size_t index)
+    {
+        worker_index() = index;
+        owner() = this;
+        for (;;) {
+            task_type task;
+            if (pop(index, task)) {
+                pending_.fetch_sub(1, std::memory_order_acq_rel);
+                task();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            sleep_cv_.wait(lock, [this]() {
+                return stop_ || pending_.load(std::memory_order_acquire) > 0;
+            });
+            if (stop_)
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<std::size_t> next_{ 0 };
+    std::atomic<std::size_t> pending_{ 0 };
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cv_;
+    bool stop_ = false;
+};
+
+} // namespace detail
+} // namespace xll
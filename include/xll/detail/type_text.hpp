@@ -32,6 +32,9 @@
 #include <type_traits>
 
 namespace xll {
+
+struct range_ref;
+
 namespace detail {
 
 template<typename T>
@@ -40,6 +43,12 @@ struct is_array_type : std::false_type {};
 template<std::size_t N>
 struct is_array_type<static_fp12<N> *> : std::true_type {};
 
+template<>
+struct is_array_type<fp12 *> : std::true_type {};
+
+template<>
+struct is_array_type<const fp12 *> : std::true_type {};
+
 // Variable-type worksheet values and arrays (XLOPER12)
 template<class T, class U = void>
 struct type_text_arg {
@@ -52,6 +61,12 @@ struct type_text_arg<T, std::enable_if_t<std::is_same_v<T, variant *>>> {
     static constexpr std::array<wchar_t, 1> value = { L'Q' };
 };
 
+// Range reference or value (XLOPER12)
+template<class T>
+struct type_text_arg<T, std::enable_if_t<std::is_same_v<T, range_ref *>>> {
+    static constexpr std::array<wchar_t, 1> value = { L'U' };
+};
+
 // Asynchronous call handle (XLOPER12, xlTypeBigData)
 template<class T>
 struct type_text_arg<T, std::enable_if_t<std::is_same_v<T, handle *>>> {
@@ -187,6 +202,9 @@ struct attribute_text_arg<tag::macro_sheet_equivalent> {
 //   - Cannot be combined with Thread Safe or Cluster Safe
 //   - Handled as Volatile when using type 'R' or type 'U' arguments.
 //   - Add '#' to end of type text
+// - Pure
+//   - Not an Excel attribute; results are cached by the trampoline of
+//     XLL_EXPORT_PURE_FUNCTION, so the tag is rejected here
 
 template<class Result, class... Args, class... Tags>
 constexpr auto type_text_impl(attribute_set<Tags...>)
@@ -199,6 +217,8 @@ constexpr auto type_text_impl(attribute_set<Tags...>)
     using is_cluster_safe = mp_contains<mp_list<Tags...>, tag::cluster_safe>;
     using is_thread_safe = mp_contains<mp_list<Tags...>, tag::thread_safe>;
     using is_macro_sheet_equivalent = mp_contains<mp_list<Tags...>, tag::macro_sheet_equivalent>;
+    using is_pure = mp_contains<mp_list<Tags...>, tag::pure>;
+    using has_range_ref = mp_contains<mp_list<Args...>, range_ref *>;
 
     static_assert(!mp_any<std::is_void<Args>...>::value,
         "arguments cannot be void");
@@ -208,10 +228,14 @@ constexpr auto type_text_impl(attribute_set<Tags...>)
         "async functions must have void return type");
     static_assert(!mp_all<is_asynchronous, is_cluster_safe>::value,
         "async functions cannot be cluster-safe");
+    static_assert(!mp_all<has_range_ref, is_cluster_safe>::value,
+        "cluster-safe functions cannot take range references");
     static_assert(!mp_all<is_macro_sheet_equivalent, is_thread_safe>::value,
         "macro sheet equivalent functions cannot be thread-safe");
     static_assert(!mp_all<is_macro_sheet_equivalent, is_cluster_safe>::value,
         "macro sheet equivalent functions cannot be cluster-safe");
+    static_assert(!is_pure::value,
+        "tag::pure has no effect on registration; export the function with XLL_EXPORT_PURE_FUNCTION");
 
     // Construct tuple using std::tuple_cat specialization for std:array.
     constexpr auto tuple = std::tuple_cat(
@@ -342,14 +342,14 @@ public:
     constexpr variant_base& operator=(const variant_base& rhs) noexcept(mp11::mp_all<std::is_nothrow_copy_constructible<Ts>...>::value)
     {
         this->destroy();
-        mp11::mp_with_index<sizeof...(Ts)>(rhs.index(), copy_construct_impl{*this, rhs});
+        mp11::mp_with_index<sizeof...(Ts)>(rhs.index(), copy_construct_impl{this, rhs});
         return *this;
     }
 
     constexpr variant_base& operator=(variant_base&& rhs) noexcept
     {
         this->destroy();
-        mp11::mp_with_index<sizeof...(Ts)>(rhs.index(), move_construct_impl{*this, rhs});
+        mp11::mp_with_index<sizeof...(Ts)>(rhs.index(), move_construct_impl{this, rhs});
         return *this;
     }
 
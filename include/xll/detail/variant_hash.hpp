@@ -0,0 +1,204 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <xll/config.hpp>
+
+#include <xll/xloper.hpp>
+#include <xll/detail/hash_index.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace xll {
+namespace detail {
+
+inline std::uint64_t hash_combine(std::uint64_t seed, std::uint64_t value) noexcept
+{
+    return mix_hash(seed ^ (value + 0x9E3779B97F4A7C15ULL + (seed << 6) + (seed >> 2)));
+}
+
+// FNV-1a over the code units of a string.
+template<class CharT>
+inline std::uint64_t hash_chars(const CharT *p, std::size_t n) noexcept
+{
+    std::uint64_t h = 0xCBF29CE484222325ULL;
+    for (std::size_t i = 0; i < n; ++i) {
+        h ^= static_cast<std::uint64_t>(static_cast<std::make_unsigned_t<CharT>>(p[i]));
+        h *= 0x100000001B3ULL;
+    }
+    return h;
+}
+
+inline std::uint64_t hash_double(double x) noexcept
+{
+    if (x == 0.0)
+        x = 0.0; // -0.0 == 0.0
+    std::uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return bits;
+}
+
+// Hash of an XLOPER12 value by content. Strings and arrays are hashed
+// element-wise, references by sheet and area; flag bits are ignored.
+struct variant_hash
+{
+    std::size_t operator()(const variant& v) const noexcept
+        { return static_cast<std::size_t>(hash(v)); }
+
+    static std::uint64_t hash(const variant& v) noexcept
+    {
+        std::uint64_t h = mix_hash(v.xltype());
+        switch (v.xltype()) {
+        case xltypeNum:
+            return hash_combine(h, hash_double(v.get<xlnum>()));
+        case xltypeStr: {
+            const auto& s = v.get<xlstr>();
+            return hash_combine(h, hash_chars(s.data(), s.size()));
+        }
+        case xltypeBool:
+            return hash_combine(h, static_cast<bool>(v.get<xlbool>()));
+        case xltypeErr:
+            return hash_combine(h, static_cast<std::uint64_t>(v.get<xlerr>().err));
+        case xltypeInt:
+            return hash_combine(h, static_cast<std::uint64_t>(v.get<xlint>().w));
+        case xltypeSRef: {
+            const auto& r = v.get<xlsref>().ref;
+            h = hash_combine(h, static_cast<uint32_t>(r.rwFirst));
+            h = hash_combine(h, static_cast<uint32_t>(r.rwLast));
+            h = hash_combine(h, static_cast<uint32_t>(r.colFirst));
+            return hash_combine(h, static_cast<uint32_t>(r.colLast));
+        }
+        case xltypeRef: {
+            const auto& r = v.get<xlref>();
+            h = hash_combine(h, r.idSheet);
+            if (r.lpmref == nullptr)
+                return h;
+            for (uint16_t i = 0; i < r.lpmref->count; ++i) {
+                const auto& a = r.lpmref->reftbl[i];
+                h = hash_combine(h, static_cast<uint32_t>(a.rwFirst));
+                h = hash_combine(h, static_cast<uint32_t>(a.rwLast));
+                h = hash_combine(h, static_cast<uint32_t>(a.colFirst));
+                h = hash_combine(h, static_cast<uint32_t>(a.colLast));
+            }
+            return h;
+        }
+        case xltypeMulti: {
+            const auto& m = v.get<xlmulti>();
+            h = hash_combine(h, m.size1());
+            h = hash_combine(h, m.size2());
+            for (const auto& x : m)
+                h = hash_combine(h, hash(x));
+            return h;
+        }
+        case xltypeBigData: {
+            const auto& b = v.get<xlbigdata>();
+            return hash_combine(hash_combine(h, reinterpret_cast<uintptr_t>(b.h)), b.cbData);
+        }
+        default:
+            return h;
+        }
+    }
+};
+
+// Equality of XLOPER12 values by content, consistent with variant_hash.
+struct variant_equal
+{
+    bool operator()(const variant& lhs, const variant& rhs) const noexcept
+    {
+        if (lhs.xltype() != rhs.xltype())
+            return false;
+        switch (lhs.xltype()) {
+        case xltypeNum:
+            return static_cast<double>(lhs.get<xlnum>()) == static_cast<double>(rhs.get<xlnum>());
+        case xltypeStr: {
+            const auto& a = lhs.get<xlstr>();
+            const auto& b = rhs.get<xlstr>();
+            return std::wstring_view(a.data(), a.size()) == std::wstring_view(b.data(), b.size());
+        }
+        case xltypeBool:
+            return static_cast<bool>(lhs.get<xlbool>()) == static_cast<bool>(rhs.get<xlbool>());
+        case xltypeErr:
+            return lhs.get<xlerr>().err == rhs.get<xlerr>().err;
+        case xltypeInt:
+            return lhs.get<xlint>().w == rhs.get<xlint>().w;
+        case xltypeSRef: {
+            const auto& a = lhs.get<xlsref>().ref;
+            const auto& b = rhs.get<xlsref>().ref;
+            return a.rwFirst == b.rwFirst && a.rwLast == b.rwLast &&
+                a.colFirst == b.colFirst && a.colLast == b.colLast;
+        }
+        case xltypeRef: {
+            const auto& a = lhs.get<xlref>();
+            const auto& b = rhs.get<xlref>();
+            if (a.idSheet != b.idSheet)
+                return false;
+            if (a.lpmref == nullptr || b.lpmref == nullptr)
+                return a.lpmref == b.lpmref;
+            if (a.lpmref->count != b.lpmref->count)
+                return false;
+            for (uint16_t i = 0; i < a.lpmref->count; ++i) {
+                const auto& x = a.lpmref->reftbl[i];
+                const auto& y = b.lpmref->reftbl[i];
+                if (x.rwFirst != y.rwFirst || x.rwLast != y.rwLast ||
+                    x.colFirst != y.colFirst || x.colLast != y.colLast)
+                    return false;
+            }
+            return true;
+        }
+        case xltypeMulti: {
+            const auto& a = lhs.get<xlmulti>();
+            const auto& b = rhs.get<xlmulti>();
+            if (a.size1() != b.size1() || a.size2() != b.size2())
+                return false;
+            for (std::size_t i = 0; i < a.size(); ++i) {
+                if (!(*this)(a[i], b[i]))
+                    return false;
+            }
+            return true;
+        }
+        case xltypeBigData: {
+            const auto& a = lhs.get<xlbigdata>();
+            const auto& b = rhs.get<xlbigdata>();
+            return a.h == b.h && a.cbData == b.cbData;
+        }
+        default:
+            return true;
+        }
+    }
+};
+
+// Hash and equality of copied function arguments: variants by content, other
+// types with std::hash and operator==.
+template<class T>
+inline std::uint64_t hash_argument(const T& x) noexcept
+{
+    if constexpr (std::is_base_of_v<variant, T>)
+        return variant_hash::hash(x);
+    else if constexpr (std::is_floating_point_v<T>)
+        return hash_double(static_cast<double>(x));
+    else
+        return mix_hash(std::hash<T>()(x));
+}
+
+template<class T>
+inline bool equal_argument(const T& lhs, const T& rhs) noexcept
+{
+    if constexpr (std::is_base_of_v<variant, T>)
+        return variant_equal()(lhs, rhs);
+    else
+        return lhs == rhs;
+}
+
+} // namespace detail
+} // namespace xll
@@ -0,0 +1,186 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file export.hpp
+ * Generates extern "C" trampolines for functions with natural C++ signatures.
+ *
+ * \code
+ * std::tuple<double, double> stats(const std::vector<double>& x, std::optional<double> scale);
+ *
+ * XLL_EXPORT_FUNCTION(xl_stats, stats, 2)
+ *
+ * // xlAutoOpen
+ * xll::register_function(xl_stats, L"xl_stats", L"STATS");
+ * \endcode
+ *
+ * The export is declared with the extern "C" types chosen by
+ * detail::arg_marshal and detail::result_marshal, so the type text generated
+ * by register_function is the cheapest one for each argument. Exceptions
+ * thrown by the function are logged and returned as an Excel error.
+ *
+ * XLL_EXPORT_PURE_FUNCTION defines a trampoline which caches results in
+ * memo_cache; see memoize.hpp.
+ *
+ * Both macros add the export to replay_functions, record its calls while
+ * call_recorder is active (see record.hpp), and define its function_profile
+ * (see profile.hpp).
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/attributes.hpp>
+#include <xll/memoize.hpp>
+#include <xll/profile.hpp>
+#include <xll/record.hpp>
+#include <xll/detail/marshal.hpp>
+#include <xll/detail/type_traits.hpp>
+#include <xll/log.hpp>
+
+#include <boost/mp11/algorithm.hpp>
+#include <boost/mp11/list.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/repetition/enum.hpp>
+#include <boost/preprocessor/repetition/enum_params.hpp>
+#include <boost/preprocessor/repetition/enum_trailing_params.hpp>
+
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace xll {
+namespace detail {
+
+// Type of a result cached by a pure function. A string view may point into
+// argument memory owned by Excel, so a copy of the string is cached instead.
+template<class T>
+struct memo_result { using type = T; };
+
+template<class CharT>
+struct memo_result<std::basic_string_view<CharT>> { using type = std::basic_string<CharT>; };
+
+template<auto Fn, class F, class... Tags>
+struct export_function_impl;
+
+template<auto Fn, class R, class... Args, class... Tags>
+struct export_function_impl<Fn, R (*)(Args...), Tags...>
+{
+    static_assert(!std::is_void_v<R>, "exported functions must return a value");
+
+    using value_type = remove_cvref_t<R>;
+    using result_marshal_type = result_marshal<value_type>;
+    using result_type = typename result_marshal_type::extern_type;
+
+    template<std::size_t I>
+    using arg_type = arg_extern_t<boost::mp11::mp_at_c<boost::mp11::mp_list<Args...>, I>>;
+
+    static constexpr std::size_t arity = sizeof...(Args);
+
+    static constexpr bool is_pure = boost::mp11::mp_contains<boost::mp11::mp_list<Tags...>, tag::pure>::value;
+
+    static_assert(!is_pure || !std::is_same_v<value_type, fp12_view>,
+        "pure functions cannot return views");
+    using memo_type = typename memo_result<value_type>::type;
+    static_assert(!is_pure || !boost::mp11::mp_contains<boost::mp11::mp_list<arg_extern_t<Args>...>, range_ref *>::value,
+        "pure functions cannot take range references");
+
+    static result_type invoke(arg_extern_t<Args>... args) noexcept
+    {
+        try {
+            if constexpr (is_pure) {
+                auto value = memo_cache::get_or_create<memo_type>(
+                    reinterpret_cast<const void *>(Fn),
+                    [&]() { return std::make_shared<const memo_type>(
+                        call(std::index_sequence_for<Args...>(), args...)); },
+                    args...);
+                return result_marshal_type::convert(*value);
+            }
+            else {
+                return result_marshal_type::convert(
+                    call(std::index_sequence_for<Args...>(), args...));
+            }
+        }
+        catch (const std::system_error& e) {
+            xll::log()->error("Caught exception: {}", e.what());
+            if (e.code().category() == error::excel_category)
+                return result_marshal_type::failure(static_cast<error::excel_error>(e.code().value()));
+        }
+        catch (const std::exception& e) {
+            xll::log()->error("Caught exception: {}", e.what());
+        }
+        catch (...) {
+            xll::log()->error("Caught unknown exception");
+        }
+        return result_marshal_type::failure();
+    }
+
+    /// Names the results of Fn cached in memo_cache, so that they can be
+    /// exported. Returns false if they cannot.
+    static bool define_memo(std::wstring name)
+    {
+        return memo_cache::define<memo_type, arg_extern_t<Args>...>(
+            std::move(name), reinterpret_cast<const void *>(Fn));
+    }
+
+private:
+    template<std::size_t... Is>
+    static R call(std::index_sequence<Is...>, arg_extern_t<Args>... args)
+    {
+        std::tuple<arg_holder_t<Args>...> holders;
+        auto values = std::forward_as_tuple(args...);
+        return Fn(std::get<Is>(holders).get(std::get<Is>(values))...);
+    }
+};
+
+template<auto Fn, class R, class... Args, class... Tags>
+struct export_function_impl<Fn, R (*)(Args...) noexcept, Tags...>
+    : export_function_impl<Fn, R (*)(Args...), Tags...> {};
+
+} // namespace detail
+
+/// Marshalling trampoline for the function Fn. invoke() has the extern "C"
+/// argument and result types expected by Excel. With tag::pure, results are
+/// cached in memo_cache.
+template<auto Fn, class... Tags>
+struct export_function : detail::export_function_impl<Fn, decltype(Fn), Tags...> {};
+
+} // namespace xll
+
+#define XLL_EXPORT_FUNCTION_PARAM(z, n, fn) \
+    ::xll::export_function<&fn>::arg_type<n> BOOST_PP_CAT(a, n)
+
+/// Defines an exported function `name` forwarding to the C++ function `fn`,
+/// which takes `nargs` arguments.
+#define XLL_EXPORT_FUNCTION(name, fn, nargs) \
+    XLL_EXPORT_FUNCTION_IMPL(name, fn, nargs, ::xll::export_function<&fn>)
+
+/// As XLL_EXPORT_FUNCTION, for a function without side effects whose results
+/// are cached in memo_cache.
+#define XLL_EXPORT_PURE_FUNCTION(name, fn, nargs) \
+    [[maybe_unused]] static const bool BOOST_PP_CAT(xll_memo_, name) = \
+        ::xll::export_function<&fn, ::xll::tag::pure>::define_memo(L"" #name); \
+    XLL_EXPORT_FUNCTION_IMPL(name, fn, nargs, ::xll::export_function<&fn, ::xll::tag::pure>)
+
+#define XLL_EXPORT_FUNCTION_IMPL(name, fn, nargs, ...) \
+    static_assert(::xll::export_function<&fn>::arity == (nargs), "invalid arity for " #fn); \
+    [[maybe_unused]] static const bool BOOST_PP_CAT(xll_replay_, name) = \
+        ::xll::replay_functions::define<__VA_ARGS__>(L"" #name); \
+    static ::xll::function_profile BOOST_PP_CAT(xll_profile_, name){ L"" #name }; \
+    XLL_EXPORT ::xll::export_function<&fn>::result_type __stdcall name( \
+        BOOST_PP_ENUM(nargs, XLL_EXPORT_FUNCTION_PARAM, fn)) \
+    { \
+        return ::xll::profiler::invoke<__VA_ARGS__>(BOOST_PP_CAT(xll_profile_, name) \
+            BOOST_PP_ENUM_TRAILING_PARAMS(nargs, a)); \
+    }
@@ -0,0 +1,180 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file format.hpp
+ * Formatting of numbers as xlstr.
+ *
+ * number_format::shortest writes the shortest string which reads back as
+ * the same double, for keys and data exchange. number_format::general
+ * writes the text Excel gives a number coerced to a string, as in
+ * =A1&"": 15 significant digits without trailing zeros, in scientific
+ * notation from 1E+15 and below 1E-9.
+ *
+ * \code
+ * xll::xlstr s = xll::to_xlstr(0.1 + 0.2);                               // 0.30000000000000004
+ * xll::xlstr t = xll::to_xlstr(0.1 + 0.2, xll::number_format::general); // 0.3
+ * \endcode
+ *
+ * Digits come from std::to_chars (Ryu in the major standard libraries)
+ * into a stack buffer, and are widened straight into the buffer of the
+ * xlstr without an intermediate string or character set conversion.
+ * Without a floating-point std::to_chars the shortest digits are found
+ * with snprintf, which is slower.
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/xloper.hpp>
+#include <xll/detail/charconv.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace xll {
+
+enum class number_format
+{
+    shortest, // shortest round trip
+    general   // Excel text coercion: 15 significant digits
+};
+
+/// Upper bound of the characters written by format_number.
+constexpr std::size_t max_number_chars = 32;
+
+namespace detail {
+
+inline std::size_t format_shortest(double x, char *out) noexcept
+{
+#ifdef XLL_HAS_FLOAT_CHARCONV
+    return static_cast<std::size_t>(std::to_chars(out, out + max_number_chars, x).ptr - out);
+#else
+    int n = 0;
+    for (int precision = 1; precision <= 17; ++precision) {
+        n = std::snprintf(out, max_number_chars, "%.*g", precision, x);
+        if (std::strtod(out, nullptr) == x)
+            break;
+    }
+    return static_cast<std::size_t>(n);
+#endif
+}
+
+// x finite and non-zero.
+inline std::size_t format_general(double x, char *out) noexcept
+{
+    // d.dddddddddddddde[+-]XX, correctly rounded to 15 significant digits
+    char sci[max_number_chars];
+#ifdef XLL_HAS_FLOAT_CHARCONV
+    const char *end = std::to_chars(sci, sci + sizeof(sci), x, std::chars_format::scientific, 14).ptr;
+#else
+    const char *end = sci + std::snprintf(sci, sizeof(sci), "%.14e", x);
+#endif
+    const char *p = sci;
+    char *q = out;
+    if (*p == '-')
+        *q++ = *p++;
+
+    char digits[15];
+    int ndigits = 0;
+    for (; p != end && *p != 'e'; ++p) {
+        if (*p != '.')
+            digits[ndigits++] = *p;
+    }
+    const bool negative = p + 1 != end && p[1] == '-';
+    int exponent = 0;
+    for (p += 2; p < end; ++p) // not null-terminated
+        exponent = 10 * exponent + (*p - '0');
+    if (negative)
+        exponent = -exponent;
+    while (ndigits > 1 && digits[ndigits - 1] == '0')
+        --ndigits;
+
+    if (exponent >= 15 || exponent < -9) {
+        *q++ = digits[0];
+        if (ndigits > 1) {
+            *q++ = '.';
+            q = std::copy(digits + 1, digits + ndigits, q);
+        }
+        *q++ = 'E';
+        *q++ = exponent < 0 ? '-' : '+';
+        const int e = std::abs(exponent);
+        if (e >= 100)
+            *q++ = static_cast<char>('0' + e / 100);
+        *q++ = static_cast<char>('0' + e / 10 % 10);
+        *q++ = static_cast<char>('0' + e % 10);
+    }
+    else if (exponent < 0) {
+        *q++ = '0';
+        *q++ = '.';
+        q = std::fill_n(q, -exponent - 1, '0');
+        q = std::copy(digits, digits + ndigits, q);
+    }
+    else {
+        const int integral = exponent + 1;
+        for (int i = 0; i < integral; ++i)
+            *q++ = i < ndigits ? digits[i] : '0';
+        if (ndigits > integral) {
+            *q++ = '.';
+            q = std::copy(digits + integral, digits + ndigits, q);
+        }
+    }
+    return static_cast<std::size_t>(q - out);
+}
+
+inline std::size_t format_ascii(double x, char *out, number_format format) noexcept
+{
+    if (format == number_format::shortest)
+        return format_shortest(x, out);
+    if (!std::isfinite(x))
+        return static_cast<std::size_t>(std::copy_n("#NUM!", 5, out) - out);
+    if (x == 0.0) {
+        *out = '0'; // and -0
+        return 1;
+    }
+    return format_general(x, out);
+}
+
+} // namespace detail
+
+/// Writes x to out, which has room for max_number_chars characters, and
+/// returns the number of characters written. In general format NaN and
+/// infinities, which Excel does not have, are written as #NUM!.
+template<class CharT>
+inline std::size_t format_number(double x, CharT *out, number_format format = number_format::shortest) noexcept
+{
+    char buf[max_number_chars];
+    const std::size_t n = detail::format_ascii(x, buf, format);
+    std::copy_n(buf, n, out); // ASCII
+    return n;
+}
+
+/// x as a string.
+inline xlstr to_xlstr(double x, number_format format = number_format::shortest)
+{
+    char buf[max_number_chars];
+    const std::size_t n = detail::format_ascii(x, buf, format);
+    xlstr s(nullptr, static_cast<xlstr::size_type>(n)); // uninitialized
+    std::copy_n(buf, n, s.data());
+    return s;
+}
+
+/// Replaces the numbers of m with strings.
+inline void format_numbers(xlmulti& m, number_format format = number_format::shortest)
+{
+    for (auto& v : m) {
+        if (v.xltype() == xltypeNum)
+            v.emplace<xlstr>(to_xlstr(static_cast<double>(v.get<xlnum>()), format));
+    }
+}
+
+} // namespace xll
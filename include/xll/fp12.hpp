@@ -14,6 +14,10 @@
 #include <boost/numeric/ublas/matrix.hpp>
 #include <boost/numeric/ublas/storage.hpp>
 
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
 /**
  * \file fp12.hpp
  * FP12 structure from XLCALL.H adapted to C++.
@@ -30,6 +34,60 @@ struct fp12
     double array[1];
 };
 
+/// Non-owning, row-major view of the array in an FP12 structure.
+
+template<class T>
+struct basic_fp12_view
+{
+    static_assert(std::is_same_v<std::remove_const_t<T>, double>, "invalid element type");
+
+    using value_type = double;
+    using size_type = std::size_t;
+    using pointer = T*;
+    using reference = T&;
+    using iterator = pointer;
+    using const_iterator = const double*;
+
+    constexpr basic_fp12_view() noexcept = default;
+
+    constexpr basic_fp12_view(pointer data, size_type rows, size_type cols) noexcept
+        : data_(data), rows_(rows), cols_(cols) {}
+
+    template<class F, class E = std::enable_if_t<std::is_same_v<std::remove_const_t<F>, fp12> &&
+        (std::is_const_v<T> || !std::is_const_v<F>)>>
+    explicit basic_fp12_view(F *p) noexcept
+    {
+        if (p != nullptr && p->rows > 0 && p->columns > 0) {
+            data_ = p->array;
+            rows_ = static_cast<size_type>(p->rows);
+            cols_ = static_cast<size_type>(p->columns);
+        }
+    }
+
+    constexpr pointer data() const noexcept { return data_; }
+    constexpr size_type rows() const noexcept { return rows_; }
+    constexpr size_type columns() const noexcept { return cols_; }
+    constexpr size_type size() const noexcept { return rows_ * cols_; }
+    constexpr bool empty() const noexcept { return size() == 0; }
+
+    constexpr reference operator[](size_type n) const noexcept
+        { return data_[n]; }
+
+    constexpr reference operator()(size_type i, size_type j) const noexcept
+        { return data_[i * cols_ + j]; }
+
+    constexpr iterator begin() const noexcept { return data_; }
+    constexpr iterator end() const noexcept { return data_ + size(); }
+
+private:
+    pointer data_ = nullptr;
+    size_type rows_ = 0;
+    size_type cols_ = 0;
+};
+
+using fp12_view = basic_fp12_view<const double>;
+using mutable_fp12_view = basic_fp12_view<double>;
+
 /// uBLAS dense matrix adapted to the storage layout of the FP12 structure from
 /// XLCALL.H: INT32 rows, INT32 columns, double array[1].
 ///
@@ -54,15 +54,22 @@ inline int get_hwnd()
 /// Converts one type of XLOPER to another, if possible.
 /// \sa https://docs.microsoft.com/en-us/office/client-developer/excel/xlcoerce
 template<XLTYPE... Ts>
-inline variant coerce(const variant *source)
+inline variant coerce(const variant *source, int& rc)
 {
     variant result;
     constexpr int flags = (Ts | ...);
     xloper<xlint> types(flags);
-    Excel12(xlCoerce, &result, source, &types);
+    rc = Excel12(xlCoerce, &result, const_cast<variant *>(source), &types);
     return result; // xlFree (xltypeStr, xltypeMulti)
 }
 
+template<XLTYPE... Ts>
+inline variant coerce(const variant *source)
+{
+    int rc;
+    return coerce<Ts...>(source, rc);
+}
+
 /// Returns the ID of a named sheet.
 /// \sa https://docs.microsoft.com/en-us/office/client-developer/excel/xlsheetid
 //Excel12(xlSheetId, LPXLOPER12 pxRes, 1, LPXLOPER12 pxSheetName);
@@ -129,6 +136,18 @@ inline bool async_return(xloper<xlbigdata>& handle, variant& value)
     return static_cast<bool>(result.get<xlbool>());
 }
 
+/// Return the results of several asynchronous UDFs with one callback.
+/// \param[in] handles xltypeMulti array of xltypeBigData async handles.
+/// \param[in] values xltypeMulti array of results, of the same size.
+inline bool async_return(variant& handles, variant& values)
+{
+    variant result;
+    int rc = Excel12(xlAsyncReturn, &result, &handles, &values);
+    if (rc != XLRET::xlretSuccess || result.xltype() != xltypeBool)
+        return false;
+    return static_cast<bool>(result.get<xlbool>());
+}
+
 /// Registers an event handler function for an asynchronous UDF.
 /// \sa https://docs.microsoft.com/en-us/office/client-developer/excel/xleventregister
 inline bool register_event(const std::wstring& procedure, XLEVENT event)
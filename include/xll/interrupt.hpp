@@ -0,0 +1,144 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file interrupt.hpp
+ * Rate-limited polling for a user interrupt.
+ *
+ * check_interrupt() calls xlAbort on every invocation. An interrupt_token
+ * calls it at most once per interval, and publishes the result in an atomic
+ * flag which worker threads and async jobs can read for the cost of a relaxed
+ * load.
+ *
+ * \code
+ * double simulate(long paths)
+ * {
+ *     auto& token = xll::interrupt_token::global();
+ *     double sum = 0.0;
+ *     for (long i = 0; i < paths; ++i) {
+ *         if (token.poll())
+ *             throw std::runtime_error("interrupted");
+ *         sum += path();
+ *     }
+ *     return sum / paths;
+ * }
+ *
+ * XLL_EXPORT int __stdcall on_calculation_ended()
+ * {
+ *     xll::interrupt_token::global().reset();
+ *     return 1;
+ * }
+ *
+ * // xlAutoOpen
+ * xll::interrupt_token::global().set_owner();
+ * xll::register_event(L"on_calculation_ended", xll::xleventCalculationEnded);
+ * xll::register_event(L"on_calculation_ended", xll::xleventCalculationCanceled);
+ * \endcode
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/functions.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <thread>
+
+namespace xll {
+
+class interrupt_token
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit interrupt_token(std::chrono::microseconds interval = std::chrono::milliseconds(100)) noexcept
+        : interval_(interval.count()) {}
+
+    interrupt_token(const interrupt_token&) = delete;
+    interrupt_token& operator=(const interrupt_token&) = delete;
+
+    /// Token shared by all functions of the add-in.
+    static interrupt_token& global() noexcept
+    {
+        static interrupt_token token;
+        return token;
+    }
+
+    /// Polls xlAbort if the interval has elapsed since the last poll, and
+    /// returns true if an interrupt has been requested. Only the thread which
+    /// first polls the token calls xlAbort; other threads read the flag.
+    bool poll()
+    {
+        if (requested_.load(std::memory_order_relaxed))
+            return true;
+        if (!is_owner())
+            return false;
+        const std::int64_t now = clock::now().time_since_epoch().count();
+        if (now - last_poll_ < interval_ticks())
+            return false;
+        last_poll_ = now;
+        polls_.fetch_add(1, std::memory_order_relaxed);
+        if (check_interrupt()) {
+            requested_.store(true, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    /// Returns true if an interrupt has been requested. Safe to call from any
+    /// thread; never calls into Excel.
+    bool requested() const noexcept
+        { return requested_.load(std::memory_order_relaxed); }
+
+    /// Sets the flag, for example when calculation is canceled.
+    void request() noexcept
+        { requested_.store(true, std::memory_order_relaxed); }
+
+    /// Clears the flag. Call when calculation ends or is canceled.
+    void reset() noexcept
+        { requested_.store(false, std::memory_order_relaxed); }
+
+    /// Makes the calling thread the one which polls xlAbort. Call from
+    /// xlAutoOpen to poll from the main thread only.
+    void set_owner() noexcept
+        { owner_.store(std::this_thread::get_id(), std::memory_order_relaxed); }
+
+    void set_interval(std::chrono::microseconds interval) noexcept
+        { interval_.store(interval.count(), std::memory_order_relaxed); }
+
+    /// Number of calls to xlAbort.
+    std::uint64_t polls() const noexcept
+        { return polls_.load(std::memory_order_relaxed); }
+
+private:
+    bool is_owner() noexcept
+    {
+        const std::thread::id self = std::this_thread::get_id();
+        std::thread::id expected;
+        if (owner_.compare_exchange_strong(expected, self, std::memory_order_relaxed))
+            return true;
+        return expected == self;
+    }
+
+    std::int64_t interval_ticks() const noexcept
+    {
+        return std::chrono::duration_cast<clock::duration>(std::chrono::microseconds(
+            interval_.load(std::memory_order_relaxed))).count();
+    }
+
+    std::atomic<bool> requested_{ false };
+    std::atomic<std::chrono::microseconds::rep> interval_;
+    std::atomic<std::thread::id> owner_{};
+    std::atomic<std::uint64_t> polls_{ 0 };
+    std::int64_t last_poll_ = std::numeric_limits<std::int64_t>::min() / 2; // owner only
+};
+
+} // namespace xll
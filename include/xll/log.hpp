@@ -9,11 +9,63 @@
 
 /**
  * \file log.hpp
- * OutputDebugStringA logging using spdlog. Useful with Sysinternals DebugView.
+ * Logging using spdlog: OutputDebugStringA on Windows, useful with
+ * Sysinternals DebugView, and the asynchronous log file of log_file.hpp
+ * elsewhere.
  */
 
 #include <xll/config.hpp>
 
+#if BOOST_OS_WINDOWS
+#include <boost/winapi/get_current_process_id.hpp>
+#include <boost/winapi/get_current_thread_id.hpp>
+#else
+#include <pthread.h>
+#include <sys/types.h>
+#include <unistd.h>
+#if BOOST_OS_LINUX
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+namespace xll {
+namespace detail {
+
+inline int current_process_id()
+{
+#if BOOST_OS_WINDOWS
+    return static_cast<int>(boost::winapi::GetCurrentProcessId());
+#else
+    return static_cast<int>(::getpid());
+#endif
+}
+
+} // namespace detail
+
+/// Operating system identifier of the calling thread, as shown by debuggers
+/// and profilers.
+inline std::size_t thread_id()
+{
+#if BOOST_OS_WINDOWS
+    return static_cast<std::size_t>(boost::winapi::GetCurrentThreadId());
+#elif BOOST_OS_LINUX
+    return static_cast<std::size_t>(::syscall(SYS_gettid));
+#elif BOOST_OS_MACOS
+    std::uint64_t tid = 0;
+    pthread_threadid_np(nullptr, &tid);
+    return static_cast<std::size_t>(tid);
+#else
+    return std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+}
+
+} // namespace xll
+
 #ifndef XLL_USE_SPDLOG
 
 #include <memory>
@@ -46,12 +98,7 @@ inline auto log() {
 
 #if BOOST_OS_WINDOWS
 #include <boost/winapi/debugapi.hpp>
-#include <boost/winapi/get_current_process_id.hpp>
-#include <boost/winapi/get_current_thread_id.hpp>
 #else
-#include <sys/types.h>
-#include <unistd.h>
-#include <pthread.h>
 #include <iostream>
 #endif
 
@@ -60,7 +107,8 @@ inline auto log() {
 #if BOOST_OS_WINDOWS
 #include <spdlog/sinks/base_sink.h>
 #else
-#include <spdlog/sinks/syslog_sink.h>
+#include <xll/log_file.hpp>
+#include <spdlog/sinks/sink.h>
 #endif
 
 #include <memory>
@@ -145,28 +193,30 @@ protected:
 
 using debug_sink_mt = debug_sink<std::mutex>;
 
+#else
+
+// Queues messages to log_file without formatting them: the file format
+// decides the layout, so patterns and formatters are ignored.
+class log_file_sink final : public spdlog::sinks::sink
+{
+public:
+    void log(const spdlog::details::log_msg& msg) override
+    {
+        log_file::push(static_cast<log_level>(msg.level),
+            std::string_view(msg.payload.data(), msg.payload.size()), msg.thread_id, msg.time);
+    }
+    void flush() override { log_file::flush(); }
+    void set_pattern(const std::string&) override {}
+    void set_formatter(std::unique_ptr<spdlog::formatter>) override {}
+};
+
 #endif
 
 } // namespace sinks
 
 inline int process_id()
 {
-#if BOOST_OS_WINDOWS
-    return static_cast<int>(boost::winapi::GetCurrentProcessId());
-#else
-    return static_cast<int>(::getpid());
-#endif
-}
-
-inline std::size_t thread_id()
-{
-#if BOOST_OS_WINDOWS
-    return static_cast<std::size_t>(boost::winapi::GetCurrentThreadId());
-#else
-    uint64_t tid;
-    pthread_threadid_np(nullptr, &tid);
-    return static_cast<std::size_t>(tid);
-#endif
+    return detail::current_process_id();
 }
 
 inline auto log()
@@ -174,11 +224,15 @@ inline auto log()
 #if BOOST_OS_WINDOWS
     static auto sink = std::make_shared<sinks::debug_sink_mt>();
     static auto logger = std::make_shared<spdlog::logger>("xll", sink);
-#else    
-    static auto logger = spdlog::syslog_logger_mt("xll");
+#else
+    static auto logger = []() {
+        if (!log_file::active())
+            log_file::start();
+        return std::make_shared<spdlog::logger>("xll", std::make_shared<sinks::log_file_sink>());
+    }();
 #endif
 
-    std::once_flag flag;
+    static std::once_flag flag;
     std::call_once(flag, [](){
         logger->set_pattern("[%t] [%T.%e] [%l] %v"); // thread, time, level
         logger->set_level(spdlog::level::debug);
@@ -0,0 +1,563 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file log_file.hpp
+ * Asynchronous log file with rotation, in text, JSON lines or binary format.
+ *
+ * On non-Windows builds with XLL_USE_SPDLOG, log() writes to log_file. It is
+ * started with default options by the first call to log(), or explicitly:
+ *
+ * \code
+ * // xlAutoOpen
+ * xll::log_file_options opts;
+ * opts.path = "/var/log/xll/pricing.log";
+ * opts.format = xll::log_format::json;
+ * xll::log_file::start(opts);
+ *
+ * // xlAutoClose
+ * xll::log_file::stop();
+ * \endcode
+ *
+ * If stop() is not called, the log file is stopped and its queue written
+ * when the add-in is unloaded or the process exits.
+ *
+ * Messages are copied into a bounded lock-free multi-producer queue of
+ * 64-byte cells, and a background thread formats them and writes the file
+ * every interval. A message takes one cell for its header and up to 32
+ * bytes of text, and one cell for each further 56 bytes. Logging never
+ * blocks or allocates: a message which finds the queue full is dropped and
+ * counted, and a message longer than a quarter of the queue is truncated.
+ *
+ * When a file would grow beyond max_size it is renamed, keeping max_files
+ * files: xll.log is renamed xll.1.log, xll.1.log is renamed xll.2.log, and so
+ * on. Times are UTC.
+ *
+ * The binary format is a header of "XLLL", uint16 version and uint16
+ * reserved, followed by records of int64 nanoseconds since 1970, uint64
+ * thread, uint8 level, uint8 and uint16 reserved, uint32 length and the
+ * UTF-8 message, all little-endian. read_log() reads it back.
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/detail/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace xll {
+
+constexpr std::uint16_t log_file_version = 1;
+
+/// Severity of a message, in the order of spdlog::level.
+enum class log_level : std::uint8_t
+{
+    trace,
+    debug,
+    info,
+    warn,
+    error,
+    critical
+};
+
+enum class log_format
+{
+    text,   // 2024-01-02T03:04:05.678901Z [thread] [level] message
+    json,   // one object per line: time, thread, level, message
+    binary
+};
+
+struct log_file_options
+{
+    std::filesystem::path path;        // empty: xll.log in the temporary directory
+    log_format format = log_format::text;
+    std::uintmax_t max_size = 16 << 20; // bytes per file, 0 for no rotation
+    std::size_t max_files = 4;          // including the current file
+    std::size_t capacity = 8192;        // queue cells, rounded up to a power of two
+    std::chrono::milliseconds interval{ 100 };
+};
+
+/// A message of a binary log.
+struct log_record
+{
+    std::int64_t time = 0; // nanoseconds since 1970
+    std::uint64_t thread = 0;
+    log_level level = log_level::info;
+    std::string message;
+};
+
+namespace detail {
+
+constexpr std::size_t log_cell_data = 56;
+constexpr std::size_t log_cell_header = 24;
+constexpr std::size_t log_file_header = 8;
+
+struct alignas(64) log_cell
+{
+    std::atomic<std::uint64_t> sequence{ 0 };
+    unsigned char data[log_cell_data];
+};
+
+// Bounded multi-producer single-consumer queue of messages spanning
+// consecutive cells (D. Vyukov's bounded queue, reserving several cells at
+// once). Cell i is free for position i when its sequence is i, and holds a
+// message starting at position i when its sequence is i + 1.
+class log_queue
+{
+public:
+    explicit log_queue(std::size_t capacity)
+        : cells_(new log_cell[capacity]), capacity_(capacity), mask_(capacity - 1)
+    {
+        for (std::size_t i = 0; i < capacity; ++i)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    std::size_t capacity() const noexcept { return capacity_; }
+
+    bool push(std::int64_t time, std::uint64_t thread, log_level level, std::string_view message) noexcept
+    {
+        const std::size_t head_text = log_cell_data - log_cell_header;
+        const std::size_t max_text = head_text + (capacity_ / 4 - 1) * log_cell_data;
+        const std::size_t n = std::min(message.size(), max_text);
+        const std::uint64_t k = 1 + (n > head_text ? (n - head_text + log_cell_data - 1) / log_cell_data : 0);
+
+        std::uint64_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            // Cells are freed in order, so the earlier cells are free if the last one is.
+            const std::uint64_t last = pos + k - 1;
+            const std::uint64_t seq = cells_[last & mask_].sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::int64_t>(seq - last);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false; // full
+            else
+                pos = tail_.load(std::memory_order_relaxed);
+        }
+
+        log_cell& head = cells_[pos & mask_];
+        store(head.data, time);
+        store(head.data + 8, thread);
+        store(head.data + 16, static_cast<std::uint32_t>(n));
+        head.data[20] = static_cast<unsigned char>(level);
+        head.data[21] = 0;
+        store(head.data + 22, static_cast<std::uint16_t>(k));
+        const char *p = message.data();
+        std::size_t m = std::min(n, head_text);
+        std::memcpy(head.data + log_cell_header, p, m);
+        for (std::uint64_t i = 1; i < k; ++i) {
+            const std::size_t chunk = std::min(n - m, log_cell_data);
+            std::memcpy(cells_[(pos + i) & mask_].data, p + m, chunk);
+            m += chunk;
+        }
+        head.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Single consumer.
+    bool pop(log_record& r)
+    {
+        const log_cell& head = cells_[head_ & mask_];
+        if (head.sequence.load(std::memory_order_acquire) != head_ + 1)
+            return false;
+        r.time = load<std::int64_t>(head.data);
+        r.thread = load<std::uint64_t>(head.data + 8);
+        const std::size_t n = load<std::uint32_t>(head.data + 16);
+        r.level = static_cast<log_level>(head.data[20]);
+        const std::uint64_t k = load<std::uint16_t>(head.data + 22);
+        r.message.resize(n);
+        std::size_t m = std::min(n, log_cell_data - log_cell_header);
+        std::memcpy(&r.message[0], head.data + log_cell_header, m);
+        for (std::uint64_t i = 1; i < k; ++i) {
+            const std::size_t chunk = std::min(n - m, log_cell_data);
+            std::memcpy(&r.message[m], cells_[(head_ + i) & mask_].data, chunk);
+            m += chunk;
+        }
+        // Free the last cell last: producers test only the last cell.
+        for (std::uint64_t i = 0; i < k; ++i)
+            cells_[(head_ + i) & mask_].sequence.store(head_ + i + capacity_, std::memory_order_release);
+        head_ += k;
+        return true;
+    }
+
+private:
+    template<class T>
+    static void store(unsigned char *p, T value) noexcept
+        { std::memcpy(p, &value, sizeof(T)); }
+
+    template<class T>
+    static T load(const unsigned char *p) noexcept
+    {
+        T value;
+        std::memcpy(&value, p, sizeof(T));
+        return value;
+    }
+
+    std::unique_ptr<log_cell[]> cells_;
+    const std::size_t capacity_;
+    const std::size_t mask_;
+    alignas(64) std::atomic<std::uint64_t> tail_{ 0 };
+    alignas(64) std::uint64_t head_ = 0;
+};
+
+inline const char *log_level_name(log_level level) noexcept
+{
+    switch (level) {
+    case log_level::trace: return "trace";
+    case log_level::debug: return "debug";
+    case log_level::info: return "info";
+    case log_level::warn: return "warning";
+    case log_level::error: return "error";
+    case log_level::critical: return "critical";
+    default: return "unknown";
+    }
+}
+
+// ISO 8601 UTC time with microseconds.
+inline void append_log_time(std::string& out, std::int64_t ns)
+{
+    std::int64_t secs = ns / 1000000000;
+    std::int64_t rem = ns % 1000000000;
+    if (rem < 0) {
+        --secs;
+        rem += 1000000000;
+    }
+    const std::time_t t = static_cast<std::time_t>(secs);
+    std::tm tm{};
+#if BOOST_OS_WINDOWS
+    ::gmtime_s(&tm, &t);
+#else
+    ::gmtime_r(&t, &tm);
+#endif
+    char buf[96]; // seven ints of up to 11 characters each, as far as the compiler knows
+    std::snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d.%06dZ", tm.tm_year + 1900,
+        tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, static_cast<int>(rem / 1000));
+    out += buf;
+}
+
+inline void append_little(std::string& out, std::uint64_t value, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i)
+        out += static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+} // namespace detail
+
+/// The asynchronous log file of the process.
+struct log_file
+{
+    /// Starts writing to the file of options, appending to an existing file.
+    /// Returns false if the log file is active or cannot be opened.
+    static bool start(const log_file_options& options = {})
+    {
+        std::lock_guard<std::mutex> control(control_mutex_);
+        if (active())
+            return false;
+
+        log_file_options opts = options;
+        if (opts.path.empty()) {
+            std::error_code ec;
+            opts.path = std::filesystem::temp_directory_path(ec) / "xll.log";
+        }
+        opts.max_files = std::max<std::size_t>(opts.max_files, 1);
+        std::size_t n = 16;
+        while (n < opts.capacity)
+            n *= 2;
+        opts.capacity = n;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        options_ = opts;
+        if (!open(false))
+            return false;
+
+        // Producers may still hold an earlier queue, so queues are retired
+        // rather than destroyed.
+        detail::log_queue *q = queue_.load(std::memory_order_relaxed);
+        if (q == nullptr || q->capacity() != opts.capacity) {
+            queues_.push_back(std::make_unique<detail::log_queue>(opts.capacity));
+            queue_.store(queues_.back().get(), std::memory_order_release);
+        }
+        dropped_.store(0, std::memory_order_relaxed);
+        written_.store(0, std::memory_order_relaxed);
+        stop_ = false;
+        active_.store(true, std::memory_order_release);
+        writer_.thread = std::thread(&run);
+        return true;
+    }
+
+    /// Writes the queued messages and closes the file. Returns false if a
+    /// write failed.
+    static bool stop()
+    {
+        std::lock_guard<std::mutex> control(control_mutex_);
+        if (!active())
+            return true;
+        active_.store(false, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        writer_.thread.join();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        drain();
+        stream_.close();
+        const bool ok = !failed_ && !stream_.fail();
+        stream_ = std::ofstream();
+        return ok;
+    }
+
+    static bool active() noexcept
+        { return active_.load(std::memory_order_relaxed); }
+
+    /// Queues a message. Never blocks; returns false if the log file is not
+    /// active or the queue is full.
+    static bool push(log_level level, std::string_view message, std::uint64_t thread,
+        std::chrono::system_clock::time_point time = std::chrono::system_clock::now()) noexcept
+    {
+        if (!active())
+            return false;
+        detail::log_queue *q = queue_.load(std::memory_order_acquire);
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+        if (q == nullptr || !q->push(static_cast<std::int64_t>(ns), thread, level, message)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    /// Writes the queued messages now, blocking the caller. Returns false if
+    /// a write failed.
+    static bool flush()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!stream_.is_open())
+            return false;
+        drain();
+        stream_.flush();
+        return !failed_ && !stream_.fail();
+    }
+
+    /// Number of messages dropped because the queue was full.
+    static std::uint64_t dropped() noexcept
+        { return dropped_.load(std::memory_order_relaxed); }
+
+    /// Number of messages written since start().
+    static std::uint64_t written() noexcept
+        { return written_.load(std::memory_order_relaxed); }
+
+    /// Path of file i of the rotation, 0 being the current file.
+    static std::filesystem::path rotated_path(const std::filesystem::path& path, std::size_t i)
+    {
+        if (i == 0)
+            return path;
+        std::filesystem::path name = path.stem();
+        name += "." + std::to_string(i);
+        name += path.extension();
+        return path.parent_path() / name;
+    }
+
+private:
+    static void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_) {
+            cv_.wait_for(lock, options_.interval, []() { return stop_; });
+            drain();
+            stream_.flush();
+        }
+    }
+
+    // Called with mutex_ held.
+    static bool open(bool truncate)
+    {
+        const auto mode = std::ios::binary | (truncate ? std::ios::trunc : std::ios::app);
+        std::ofstream stream(options_.path, mode);
+        if (!stream)
+            return false;
+        std::error_code ec;
+        size_ = truncate ? 0 : std::filesystem::file_size(options_.path, ec);
+        if (ec)
+            size_ = 0;
+        if (options_.format == log_format::binary && size_ == 0) {
+            std::string header("XLLL");
+            detail::append_little(header, log_file_version, 2);
+            detail::append_little(header, 0, 2);
+            stream.write(header.data(), static_cast<std::streamsize>(header.size()));
+            size_ = header.size();
+        }
+        stream_ = std::move(stream);
+        failed_ = false;
+        return true;
+    }
+
+    static void rotate()
+    {
+        stream_.close();
+        std::error_code ec;
+        const std::filesystem::path& path = options_.path;
+        for (std::size_t i = options_.max_files - 1; i > 0; --i) {
+            const auto from = rotated_path(path, i - 1);
+            if (std::filesystem::exists(from, ec))
+                std::filesystem::rename(from, rotated_path(path, i), ec);
+        }
+        if (!open(true))
+            failed_ = true;
+    }
+
+    static void format(std::string& out, const log_record& r)
+    {
+        switch (options_.format) {
+        case log_format::text: {
+            detail::append_log_time(out, r.time);
+            out += " [";
+            out += std::to_string(r.thread);
+            out += "] [";
+            out += detail::log_level_name(r.level);
+            out += "] ";
+            out += r.message;
+            out += '\n';
+            break;
+        }
+        case log_format::json:
+            out += "{\"time\":\"";
+            detail::append_log_time(out, r.time);
+            out += "\",\"thread\":";
+            out += std::to_string(r.thread);
+            out += ",\"level\":\"";
+            out += detail::log_level_name(r.level);
+            out += "\",\"message\":";
+            detail::append_json_string(out, r.message);
+            out += "}\n";
+            break;
+        case log_format::binary:
+            detail::append_little(out, static_cast<std::uint64_t>(r.time), 8);
+            detail::append_little(out, r.thread, 8);
+            detail::append_little(out, static_cast<std::uint64_t>(r.level), 4);
+            detail::append_little(out, r.message.size(), 4);
+            out += r.message;
+            break;
+        }
+    }
+
+    // Called with mutex_ held: the only consumer of the queue.
+    static void drain()
+    {
+        detail::log_queue *q = queue_.load(std::memory_order_acquire);
+        if (q == nullptr || !stream_.is_open())
+            return;
+        std::string out, line;
+        std::uint64_t count = 0;
+        auto write = [&]() {
+            stream_.write(out.data(), static_cast<std::streamsize>(out.size()));
+            size_ += out.size();
+            out.clear();
+        };
+        while (q->pop(record_)) {
+            line.clear();
+            format(line, record_);
+            const std::uintmax_t header = options_.format == log_format::binary ? detail::log_file_header : 0;
+            if (options_.max_size > 0 && size_ + out.size() > header &&
+                size_ + out.size() + line.size() > options_.max_size) {
+                write();
+                rotate();
+            }
+            out += line;
+            ++count;
+        }
+        write();
+        written_.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    static inline std::mutex control_mutex_; // start and stop
+    static inline std::mutex mutex_;         // consumer and file
+    static inline std::condition_variable cv_;
+    static inline std::ofstream stream_;
+    static inline log_file_options options_;
+    static inline log_record record_;
+    static inline std::uintmax_t size_ = 0;
+    static inline bool failed_ = false;
+    static inline bool stop_ = false;
+    static inline std::vector<std::unique_ptr<detail::log_queue>> queues_;
+    static inline std::atomic<detail::log_queue *> queue_{ nullptr };
+    static inline std::atomic<bool> active_{ false };
+    static inline std::atomic<std::uint64_t> dropped_{ 0 };
+    static inline std::atomic<std::uint64_t> written_{ 0 };
+
+    // Stops the log file at exit or unload if stop() was not called, since
+    // destroying a joinable std::thread terminates the process.
+    struct writer
+    {
+        std::thread thread;
+        ~writer() { if (thread.joinable()) log_file::stop(); }
+    };
+
+    static inline writer writer_; // defined last, so destroyed first
+};
+
+/// Reads the records of a binary log file. Returns false if the file
+/// cannot be read or is not a binary log; records read before an error are
+/// kept.
+inline bool read_log(const std::filesystem::path& path, std::vector<log_record>& records)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream)
+        return false;
+    const std::string data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    const auto *p = reinterpret_cast<const unsigned char *>(data.data());
+    const std::size_t n = data.size();
+    auto little = [&](std::size_t at, std::size_t bytes) {
+        std::uint64_t value = 0;
+        for (std::size_t i = 0; i < bytes; ++i)
+            value |= static_cast<std::uint64_t>(p[at + i]) << (8 * i);
+        return value;
+    };
+    if (n < detail::log_file_header || std::memcmp(p, "XLLL", 4) != 0 || little(4, 2) != log_file_version)
+        return false;
+    std::size_t at = detail::log_file_header;
+    while (at < n) {
+        if (n - at < 24)
+            return false;
+        log_record r;
+        r.time = static_cast<std::int64_t>(little(at, 8));
+        r.thread = little(at + 8, 8);
+        r.level = static_cast<log_level>(p[at + 16]);
+        const std::size_t len = static_cast<std::size_t>(little(at + 20, 4));
+        at += 24;
+        if (n - at < len)
+            return false;
+        r.message.assign(data, at, len);
+        at += len;
+        records.push_back(std::move(r));
+    }
+    return true;
+}
+
+} // namespace xll
@@ -0,0 +1,819 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file memoize.hpp
+ * Result cache for pure worksheet functions.
+ *
+ * Functions exported with XLL_EXPORT_PURE_FUNCTION look up their arguments in
+ * memo_cache before calling the C++ function. The cache is keyed by a hash of
+ * the extern "C" arguments received from Excel, and entries keep a copy of
+ * the arguments so that hash collisions are never returned as hits.
+ *
+ * \code
+ * double price(double spot, double strike, double vol, double t);
+ *
+ * XLL_EXPORT_PURE_FUNCTION(xl_price, price, 4)
+ *
+ * XLL_EXPORT int __stdcall on_calculation_ended()
+ * {
+ *     xll::memo_cache::invalidate();
+ *     return 1;
+ * }
+ *
+ * // xlAutoOpen
+ * xll::memo_cache::configure(64 << 20, std::chrono::minutes(5));
+ * xll::register_function(xl_price, L"xl_price", L"PRICE", {},
+ *     xll::attribute_set<xll::tag::thread_safe>());
+ * xll::register_event(L"on_calculation_ended", xll::xleventCalculationEnded);
+ * \endcode
+ *
+ * Entries expire when invalidate() is called, typically once per calculation,
+ * or when they are older than the time to live. invalidate() also frees the
+ * expired entries; entries past their time to live are freed when next looked
+ * up, and the least recently used entries are evicted when the cache exceeds
+ * its memory limit.
+ *
+ * Caching is done by the exported trampoline, so tag::pure is not passed to
+ * register_function, which rejects it at compile time.
+ *
+ * XLL_EXPORT_PURE_FUNCTION also names the function in the cache, so that
+ * entries whose result is a number, string or variant can be listed with
+ * export_entries(), encoded in place, and decoded into new entries by
+ * import_entry() in a later session, which persistent_cache::save_memo() and
+ * load_memo() do through the workbook.
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/fp12.hpp>
+#include <xll/xloper.hpp>
+#include <xll/detail/binary.hpp>
+#include <xll/detail/marshal.hpp>
+#include <xll/detail/variant_hash.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cwchar>
+#include <exception>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace xll {
+
+/// Counters reported by memo_cache::stats().
+struct memo_stats
+{
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+    std::size_t entries = 0;
+    std::size_t bytes = 0;
+};
+
+namespace detail {
+
+// Approximate heap usage of cached values, used to enforce the memory limit.
+template<class T>
+inline std::size_t memo_size(const T&) noexcept { return sizeof(T); }
+
+template<class CharT>
+inline std::size_t memo_size(const std::basic_string<CharT>& s) noexcept
+    { return sizeof(s) + s.capacity() * sizeof(CharT); }
+
+template<class T>
+inline std::size_t memo_size(const std::vector<T>& v) noexcept
+    { return sizeof(v) + v.capacity() * sizeof(T); }
+
+template<class T>
+inline std::size_t memo_size(const std::optional<T>& x) noexcept
+    { return x ? memo_size(*x) : sizeof(x); }
+
+inline std::size_t memo_size(const variant& v) noexcept
+{
+    std::size_t n = sizeof(variant);
+    if (v.xltype() == xltypeStr)
+        n += (v.get<xlstr>().size() + 1) * sizeof(wchar_t);
+    else if (v.xltype() == xltypeMulti) {
+        for (const auto& x : v.get<xlmulti>())
+            n += memo_size(x);
+    }
+    return n;
+}
+
+template<class... Ts>
+inline std::size_t memo_size(const std::tuple<Ts...>& t) noexcept
+    { return std::apply([](const auto&... x) { return (std::size_t(0) + ... + memo_size(x)); }, t); }
+
+// Cached keys and results are written in the binary encoding of the variant
+// they convert to, as by encode(), directly from the cached copy. Strings
+// longer than Excel allows are truncated.
+
+constexpr std::size_t memo_max_chars = 32767;
+
+template<class T>
+inline std::size_t memo_number_size() noexcept
+    { return std::is_same_v<T, bool> ? 2 + 2 : 2 + 8; }
+
+template<class T>
+inline void memo_encode_number(binary_writer& w, T x) noexcept
+{
+    if constexpr (std::is_same_v<T, bool>) {
+        w.write(static_cast<std::uint16_t>(xltypeBool));
+        w.write(static_cast<std::uint16_t>(x));
+    }
+    else {
+        w.write(static_cast<std::uint16_t>(xltypeNum));
+        w.write(static_cast<double>(x));
+    }
+}
+
+// Reads a number or boolean. Numbers outside the range of an integral T fail.
+template<class T>
+inline bool memo_decode_number(binary_reader& r, T& x) noexcept
+{
+    std::uint16_t type;
+    if (!r.read(type))
+        return false;
+    if (type == xltypeBool) {
+        std::uint16_t b;
+        if (!r.read(b))
+            return false;
+        x = static_cast<T>(b != 0);
+        return true;
+    }
+    double d;
+    if (type != xltypeNum || !r.read(d))
+        return false;
+    if constexpr (std::is_same_v<T, bool>)
+        x = d != 0.0;
+    else if constexpr (std::is_integral_v<T>) {
+        if (!(d >= static_cast<double>(std::numeric_limits<T>::min()) &&
+              d < static_cast<double>(std::numeric_limits<T>::max()) + 1.0))
+            return false;
+        x = static_cast<T>(d);
+    }
+    else
+        x = static_cast<T>(d);
+    return true;
+}
+
+inline std::size_t memo_string_size(std::size_t n) noexcept
+    { return 2 + 4 + 2 * std::min(n, memo_max_chars); }
+
+inline void memo_encode_string(binary_writer& w, const wchar_t *s, std::size_t n) noexcept
+{
+    n = std::min(n, memo_max_chars);
+    w.write(static_cast<std::uint16_t>(xltypeStr));
+    w.write(static_cast<std::uint32_t>(n));
+    w.write_chars(s, n);
+}
+
+// Reads the rest of a string whose type has been read.
+inline bool memo_decode_chars(binary_reader& r, std::wstring& s)
+{
+    std::uint32_t n;
+    if (!r.read(n) || n > memo_max_chars || !r.require(std::size_t(n) * 2))
+        return false;
+    s.resize(n);
+    return r.read_chars(s.data(), n);
+}
+
+// Owned copy of an extern "C" argument stored with each cache entry, with
+// hash and comparison against the argument of a later call. encode() and
+// decode() write and read the copy, same() compares two copies, and rehash()
+// returns the hash of the argument a copy was stored from.
+template<class T, class E = void>
+struct memo_key
+{
+    static_assert(sizeof(T) == 0, "unsupported argument type for a pure function");
+};
+
+template<class T>
+struct memo_key<T, std::enable_if_t<std::is_arithmetic_v<T>>>
+{
+    using type = T;
+    static type store(T x) noexcept { return x; }
+    static bool equal(const type& lhs, T rhs) noexcept { return lhs == rhs; }
+    static bool same(const type& x, const type& y) noexcept { return x == y; }
+    static std::uint64_t hash(T x) noexcept
+    {
+        if constexpr (std::is_floating_point_v<T>)
+            return hash_double(x);
+        else
+            return static_cast<std::uint64_t>(x);
+    }
+    static std::uint64_t rehash(const type& x) noexcept { return hash(x); }
+    static std::size_t encoded_size(const type&) noexcept { return memo_number_size<T>(); }
+    static void encode(binary_writer& w, const type& x) noexcept { memo_encode_number(w, x); }
+    static bool decode(binary_reader& r, type& x) noexcept { return memo_decode_number(r, x); }
+};
+
+template<>
+struct memo_key<const wchar_t *>
+{
+    using type = std::optional<std::wstring>;
+    static type store(const wchar_t *s)
+        { return s ? type(s) : std::nullopt; }
+    static bool equal(const type& lhs, const wchar_t *rhs) noexcept
+        { return rhs ? (lhs && *lhs == rhs) : !lhs; }
+    static bool same(const type& x, const type& y) noexcept
+        { return x == y; }
+    static std::uint64_t hash(const wchar_t *s) noexcept
+        { return s ? hash_chars(s, std::wcslen(s)) : 0; }
+    static std::uint64_t rehash(const type& s) noexcept
+        { return s ? hash_chars(s->data(), s->size()) : 0; }
+
+    // A null pointer is xltypeMissing.
+    static std::size_t encoded_size(const type& s) noexcept
+        { return s ? memo_string_size(s->size()) : 2; }
+    static void encode(binary_writer& w, const type& s) noexcept
+    {
+        if (s)
+            memo_encode_string(w, s->data(), s->size());
+        else
+            w.write(static_cast<std::uint16_t>(xltypeMissing));
+    }
+    static bool decode(binary_reader& r, type& s)
+    {
+        std::uint16_t t;
+        if (!r.read(t))
+            return false;
+        if (t == xltypeMissing) {
+            s.reset();
+            return true;
+        }
+        return t == xltypeStr && memo_decode_chars(r, s.emplace());
+    }
+};
+
+template<>
+struct memo_key<const fp12 *>
+{
+    struct type
+    {
+        std::size_t rows = 0;
+        std::size_t columns = 0;
+        std::vector<double> values;
+    };
+
+    static type store(const fp12 *p)
+    {
+        fp12_view v(p);
+        return { v.rows(), v.columns(), std::vector<double>(v.begin(), v.end()) };
+    }
+
+    static bool equal(const type& lhs, const fp12 *rhs) noexcept
+    {
+        fp12_view v(rhs);
+        return lhs.rows == v.rows() && lhs.columns == v.columns() &&
+            same_values(lhs.values.begin(), v.begin(), v.size());
+    }
+
+    static bool same(const type& x, const type& y) noexcept
+    {
+        return x.rows == y.rows && x.columns == y.columns &&
+            same_values(x.values.begin(), y.values.begin(), x.values.size());
+    }
+
+    static std::uint64_t hash(const fp12 *p) noexcept
+    {
+        fp12_view v(p);
+        return hash(v.rows(), v.columns(), v.begin(), v.end());
+    }
+
+    static std::uint64_t rehash(const type& k) noexcept
+        { return hash(k.rows, k.columns, k.values.begin(), k.values.end()); }
+
+    // An xltypeMulti of numbers.
+    static std::size_t encoded_size(const type& k) noexcept
+        { return binary_multi_header + k.values.size() * memo_number_size<double>(); }
+
+    static void encode(binary_writer& w, const type& k) noexcept
+    {
+        w.write(static_cast<std::uint16_t>(xltypeMulti));
+        w.write(static_cast<std::uint32_t>(k.rows));
+        w.write(static_cast<std::uint32_t>(k.columns));
+        w.write(static_cast<std::uint64_t>(k.values.size() * memo_number_size<double>()));
+        for (double x : k.values)
+            memo_encode_number(w, x);
+    }
+
+    static bool decode(binary_reader& r, type& k)
+    {
+        std::uint16_t t;
+        std::uint32_t rows, columns;
+        std::uint64_t size;
+        if (!r.read(t) || t != xltypeMulti || !r.read(rows) || !r.read(columns) || !r.read(size))
+            return false;
+        const std::size_t n = memo_number_size<double>();
+        if (size > r.remaining() || size % n != 0 || (rows != 0 && columns > size / n / rows) ||
+            std::uint64_t(rows) * columns * n != size)
+            return false;
+        k.rows = rows;
+        k.columns = columns;
+        k.values.resize(static_cast<std::size_t>(size / n));
+        for (double& x : k.values) {
+            std::uint16_t type;
+            if (!r.read(type) || type != xltypeNum || !r.read(x))
+                return false;
+        }
+        return true;
+    }
+
+private:
+    template<class It1, class It2>
+    static bool same_values(It1 x, It2 y, std::size_t n) noexcept
+    {
+        for (std::size_t i = 0; i < n; ++i, ++x, ++y) {
+            if (hash_double(*x) != hash_double(*y))
+                return false;
+        }
+        return true;
+    }
+
+    template<class It>
+    static std::uint64_t hash(std::size_t rows, std::size_t columns, It first, It last) noexcept
+    {
+        std::uint64_t h = hash_combine(rows, columns);
+        for (; first != last; ++first)
+            h = hash_combine(h, hash_double(*first));
+        return h;
+    }
+};
+
+inline std::size_t memo_size(const memo_key<const fp12 *>::type& k) noexcept
+    { return memo_size(k.values); }
+
+template<>
+struct memo_key<variant *>
+{
+    using type = variant;
+    static type store(variant *p)
+    {
+        type result(*p);
+        result.clear_flags(); // DLL-owned copy
+        return result;
+    }
+    static bool equal(const type& lhs, variant *rhs) noexcept
+        { return variant_equal()(lhs, *rhs); }
+    static bool same(const type& x, const type& y) noexcept
+        { return variant_equal()(x, y); }
+    static std::uint64_t hash(variant *p) noexcept
+        { return variant_hash::hash(*p); }
+    static std::uint64_t rehash(const type& v) noexcept
+        { return variant_hash::hash(v); }
+    static std::size_t encoded_size(const type& v) noexcept
+        { return detail::encoded_size(v); }
+    static void encode(binary_writer& w, const type& v) noexcept
+        { detail::encode(w, v); }
+    static bool decode(binary_reader& r, type& v)
+        { return detail::decode(r, v); }
+};
+
+// Encoding of cached results. Results of other types are not saved.
+template<class R>
+struct memo_value
+{
+    static constexpr bool persistent = std::is_arithmetic_v<R> ||
+        std::is_same_v<R, std::wstring> || std::is_same_v<R, std::string> || std::is_same_v<R, variant>;
+
+    static std::size_t encoded_size(const R& x)
+    {
+        if constexpr (std::is_arithmetic_v<R>)
+            return memo_number_size<R>();
+        else if constexpr (std::is_same_v<R, std::wstring>)
+            return memo_string_size(x.size());
+        else if constexpr (std::is_same_v<R, std::string>)
+            return memo_string_size(boost::nowide::widen(x).size());
+        else
+            return detail::encoded_size(x);
+    }
+
+    static void encode(binary_writer& w, const R& x)
+    {
+        if constexpr (std::is_arithmetic_v<R>)
+            memo_encode_number(w, x);
+        else if constexpr (std::is_same_v<R, std::wstring>)
+            memo_encode_string(w, x.data(), x.size());
+        else if constexpr (std::is_same_v<R, std::string>) {
+            const std::wstring wide = boost::nowide::widen(x);
+            memo_encode_string(w, wide.data(), wide.size());
+        }
+        else
+            detail::encode(w, x);
+    }
+
+    static std::shared_ptr<const R> decode(binary_reader& r)
+    {
+        if constexpr (std::is_arithmetic_v<R>) {
+            R x;
+            return memo_decode_number(r, x) ? std::make_shared<const R>(x) : nullptr;
+        }
+        else if constexpr (std::is_same_v<R, variant>) {
+            auto v = std::make_shared<variant>();
+            return detail::decode(r, *v) ? v : nullptr;
+        }
+        else {
+            std::uint16_t t;
+            auto s = std::make_shared<std::wstring>();
+            if (!r.read(t) || t != xltypeStr || !memo_decode_chars(r, *s))
+                return nullptr;
+            if constexpr (std::is_same_v<R, std::wstring>)
+                return s;
+            else
+                return std::make_shared<const std::string>(boost::nowide::narrow(*s));
+        }
+    }
+};
+
+struct memo_entry_base
+{
+    virtual ~memo_entry_base() = default;
+
+    // Size of the encoding written by encode(): uint32 argument count, then
+    // the arguments and the result.
+    virtual std::size_t encoded_size() const = 0;
+    virtual void encode(binary_writer& w) const = 0;
+
+    const void *function = nullptr;
+    std::uint64_t hash = 0;
+    std::uint64_t epoch = 0;
+    std::chrono::steady_clock::time_point created;
+    std::size_t bytes = 0;
+};
+
+template<class R, class... Args>
+struct memo_entry : memo_entry_base
+{
+    using key_type = std::tuple<typename memo_key<Args>::type...>;
+
+    memo_entry(key_type k, std::shared_ptr<const R> v)
+        : key(std::move(k)), value(std::move(v))
+        { bytes = sizeof(memo_entry) + memo_size(key) + memo_size(*value); }
+
+    std::size_t encoded_size() const override
+    {
+        if constexpr (memo_value<R>::persistent)
+            return 4 + key_size(std::index_sequence_for<Args...>()) + memo_value<R>::encoded_size(*value);
+        else
+            return 0;
+    }
+
+    void encode(binary_writer& w) const override
+    {
+        if constexpr (memo_value<R>::persistent) {
+            w.write(static_cast<std::uint32_t>(sizeof...(Args)));
+            encode_key(w, std::index_sequence_for<Args...>());
+            memo_value<R>::encode(w, *value);
+        }
+    }
+
+    template<std::size_t... Is>
+    std::size_t key_size(std::index_sequence<Is...>) const noexcept
+        { return (std::size_t(0) + ... + memo_key<Args>::encoded_size(std::get<Is>(key))); }
+
+    template<std::size_t... Is>
+    void encode_key(binary_writer& w, std::index_sequence<Is...>) const noexcept
+        { (memo_key<Args>::encode(w, std::get<Is>(key)), ...); }
+
+    key_type key;
+    std::shared_ptr<const R> value;
+};
+
+using memo_lru_list = std::list<std::shared_ptr<memo_entry_base>>;
+
+struct alignas(64) memo_shard
+{
+    std::mutex mutex;
+    memo_lru_list lru; // most recently used first
+    std::unordered_multimap<std::uint64_t, memo_lru_list::iterator> index;
+    std::size_t bytes = 0;
+    memo_stats stats;
+
+    // Removes pos from the index; the caller removes it from lru.
+    void unlink(memo_lru_list::iterator pos) noexcept
+    {
+        auto range = index.equal_range((*pos)->hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == pos) {
+                index.erase(it);
+                break;
+            }
+        }
+        bytes -= (*pos)->bytes;
+    }
+
+    void erase(memo_lru_list::iterator pos)
+    {
+        unlink(pos);
+        lru.erase(pos);
+    }
+
+    void evict(std::size_t limit)
+    {
+        while (bytes > limit && !lru.empty()) {
+            erase(std::prev(lru.end()));
+            ++stats.evictions;
+        }
+    }
+};
+
+} // namespace detail
+
+/// Current entry of a named function, shared with memo_cache.
+struct memo_record
+{
+    std::wstring function;
+    std::shared_ptr<const detail::memo_entry_base> entry;
+};
+
+/// Sharded LRU cache of pure function results. Each shard is guarded by its
+/// own mutex, so calls evaluated in parallel during multi-threaded
+/// recalculation contend only when they hash to the same shard.
+struct memo_cache
+{
+    /// Sets the memory limit in bytes and the time to live of entries. A zero
+    /// time to live keeps entries until invalidate() or eviction.
+    static void configure(std::size_t max_bytes,
+        std::chrono::milliseconds ttl = std::chrono::milliseconds::zero())
+    {
+        max_bytes_.store(max_bytes, std::memory_order_relaxed);
+        ttl_.store(ttl.count(), std::memory_order_relaxed);
+        for (auto& s : shards_) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.evict(max_bytes / shards_.size());
+        }
+    }
+
+    /// Expires and frees all entries. Call when calculation ends to cache
+    /// results for one calculation cycle only. Results still referenced by a
+    /// running call are freed when it returns.
+    static void invalidate() noexcept
+    {
+        const std::uint64_t epoch = epoch_.fetch_add(1, std::memory_order_acq_rel) + 1;
+        for (auto& s : shards_) {
+            detail::memo_lru_list stale; // freed outside the lock
+            std::lock_guard<std::mutex> lock(s.mutex);
+            for (auto it = s.lru.begin(); it != s.lru.end();) {
+                auto pos = it++;
+                if ((*pos)->epoch != epoch) {
+                    s.unlink(pos);
+                    stale.splice(stale.end(), s.lru, pos);
+                }
+            }
+        }
+    }
+
+    /// Removes all entries and resets the counters.
+    static void clear()
+    {
+        for (auto& s : shards_) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.lru.clear();
+            s.index.clear();
+            s.bytes = 0;
+            s.stats = {};
+        }
+    }
+
+    static memo_stats stats()
+    {
+        memo_stats result;
+        for (auto& s : shards_) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            result.hits += s.stats.hits;
+            result.misses += s.stats.misses;
+            result.evictions += s.stats.evictions;
+            result.entries += s.lru.size();
+            result.bytes += s.bytes;
+        }
+        return result;
+    }
+
+    /// Returns the cached result of fn for args, or calls make() and caches
+    /// its result. make() must return a std::shared_ptr<const R>.
+    template<class R, class Make, class... Args>
+    static std::shared_ptr<const R> get_or_create(const void *fn, Make&& make, Args... args)
+    {
+        using entry_type = detail::memo_entry<R, Args...>;
+        using key_type = typename entry_type::key_type;
+
+        std::uint64_t h = detail::mix_hash(reinterpret_cast<uintptr_t>(fn));
+        ((h = detail::hash_combine(h, detail::memo_key<Args>::hash(args))), ...);
+
+        const std::uint64_t epoch = epoch_.load(std::memory_order_acquire);
+        const auto ttl = std::chrono::milliseconds(ttl_.load(std::memory_order_relaxed));
+        const auto now = std::chrono::steady_clock::now();
+        auto& s = shard(h);
+
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto range = s.index.equal_range(h);
+            for (auto it = range.first; it != range.second; ++it) {
+                auto pos = it->second;
+                auto& e = **pos;
+                if (e.function != fn)
+                    continue;
+                auto& entry = static_cast<entry_type&>(e);
+                if (!equal(entry.key, std::index_sequence_for<Args...>(), args...))
+                    continue;
+                if (e.epoch != epoch || (ttl.count() > 0 && now - e.created > ttl)) {
+                    s.erase(pos);
+                    break;
+                }
+                s.lru.splice(s.lru.begin(), s.lru, pos);
+                ++s.stats.hits;
+                return entry.value;
+            }
+            ++s.stats.misses;
+        }
+
+        std::shared_ptr<const R> value = make();
+        insert(std::make_unique<entry_type>(key_type(detail::memo_key<Args>::store(args)...), value),
+            fn, h, epoch, now);
+        return value;
+    }
+
+    /// Names the results of fn, called with the extern "C" arguments Args and
+    /// returning R, for export_entries() and import_entry(). Returns false
+    /// if results of type R are not exported. Called by
+    /// XLL_EXPORT_PURE_FUNCTION.
+    template<class R, class... Args>
+    static bool define(std::wstring name, const void *fn)
+    {
+        if constexpr (detail::memo_value<R>::persistent) {
+            std::lock_guard<std::mutex> lock(names_mutex_);
+            names_[fn] = name;
+            functions_[std::move(name)] = { fn, &decode_entry<R, Args...> };
+            return true;
+        }
+        else
+            return false;
+    }
+
+    /// Returns the current entries of named functions, excluding expired
+    /// ones. Only pointers are copied while the shards are locked; the
+    /// entries are shared with the cache and immutable.
+    static std::vector<memo_record> export_entries()
+    {
+        std::unordered_map<const void *, std::wstring> names;
+        {
+            std::lock_guard<std::mutex> lock(names_mutex_);
+            names = names_;
+        }
+        const std::uint64_t epoch = epoch_.load(std::memory_order_acquire);
+        const auto ttl = std::chrono::milliseconds(ttl_.load(std::memory_order_relaxed));
+        const auto now = std::chrono::steady_clock::now();
+
+        std::vector<std::shared_ptr<const detail::memo_entry_base>> entries;
+        for (auto& s : shards_) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            for (const auto& e : s.lru) {
+                if (e->epoch == epoch && (ttl.count() == 0 || now - e->created <= ttl))
+                    entries.push_back(e);
+            }
+        }
+
+        std::vector<memo_record> result;
+        result.reserve(entries.size());
+        for (auto& e : entries) {
+            auto it = names.find(e->function);
+            if (it != names.end())
+                result.push_back({ it->second, std::move(e) });
+        }
+        return result;
+    }
+
+    /// Reads an entry of the named function, as written by
+    /// memo_entry_base::encode(), into a new entry of the current
+    /// calculation which replaces one with the same arguments. Returns false
+    /// if the function is unknown or the data does not match its argument
+    /// and result types.
+    static bool import_entry(const std::wstring& function, detail::binary_reader& r)
+    {
+        function_info info;
+        {
+            std::lock_guard<std::mutex> lock(names_mutex_);
+            auto it = functions_.find(function);
+            if (it == functions_.end())
+                return false;
+            info = it->second;
+        }
+        return info.decode(info.function, r);
+    }
+
+private:
+    using shard_type = detail::memo_shard;
+
+    struct function_info
+    {
+        const void *function = nullptr;
+        bool (*decode)(const void *fn, detail::binary_reader& r) = nullptr;
+    };
+
+    static void insert(std::unique_ptr<detail::memo_entry_base> entry, const void *fn, std::uint64_t h,
+        std::uint64_t epoch, std::chrono::steady_clock::time_point now)
+    {
+        entry->function = fn;
+        entry->hash = h;
+        entry->epoch = epoch;
+        entry->created = now;
+
+        const std::size_t limit = max_bytes_.load(std::memory_order_relaxed) / shards_.size();
+        if (entry->bytes > limit)
+            return;
+
+        auto& s = shard(h);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.bytes += entry->bytes;
+        s.lru.push_front(std::move(entry));
+        s.index.emplace(h, s.lru.begin());
+        s.evict(limit);
+    }
+
+    template<class R, class... Args>
+    static bool decode_entry(const void *fn, detail::binary_reader& r)
+    {
+        using entry_type = detail::memo_entry<R, Args...>;
+        std::uint32_t argc;
+        if (!r.read(argc) || argc != sizeof...(Args))
+            return false;
+        typename entry_type::key_type key;
+        if (!decode_key<Args...>(r, key, std::index_sequence_for<Args...>()))
+            return false;
+        auto value = detail::memo_value<R>::decode(r);
+        if (!value)
+            return false;
+
+        std::uint64_t h = detail::mix_hash(reinterpret_cast<uintptr_t>(fn));
+        h = rehash<Args...>(h, key, std::index_sequence_for<Args...>());
+        auto& s = shard(h);
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto range = s.index.equal_range(h);
+            for (auto it = range.first; it != range.second; ++it) {
+                if ((*it->second)->function == fn && same_key<Args...>(
+                        static_cast<const entry_type&>(**it->second).key, key, std::index_sequence_for<Args...>())) {
+                    s.erase(it->second);
+                    break;
+                }
+            }
+        }
+        insert(std::make_unique<entry_type>(std::move(key), std::move(value)),
+            fn, h, epoch_.load(std::memory_order_acquire), std::chrono::steady_clock::now());
+        return true;
+    }
+
+    template<class... Args, class Key, std::size_t... Is>
+    static bool decode_key(detail::binary_reader& r, Key& key, std::index_sequence<Is...>)
+        { return (detail::memo_key<Args>::decode(r, std::get<Is>(key)) && ...); }
+
+    template<class... Args, class Key, std::size_t... Is>
+    static bool same_key(const Key& x, const Key& y, std::index_sequence<Is...>) noexcept
+        { return (detail::memo_key<Args>::same(std::get<Is>(x), std::get<Is>(y)) && ...); }
+
+    template<class... Args, class Key, std::size_t... Is>
+    static std::uint64_t rehash(std::uint64_t h, const Key& key, std::index_sequence<Is...>) noexcept
+    {
+        ((h = detail::hash_combine(h, detail::memo_key<Args>::rehash(std::get<Is>(key)))), ...);
+        return h;
+    }
+
+    template<class Key, std::size_t... Is, class... Args>
+    static bool equal(const Key& key, std::index_sequence<Is...>, Args... args) noexcept
+        { return (detail::memo_key<Args>::equal(std::get<Is>(key), args) && ...); }
+
+    static shard_type& shard(std::uint64_t hash) noexcept
+        { return shards_[hash % shards_.size()]; }
+
+    static inline std::atomic<std::size_t> max_bytes_{ std::size_t(64) << 20 };
+    static inline std::atomic<std::chrono::milliseconds::rep> ttl_{ 0 };
+    static inline std::atomic<std::uint64_t> epoch_{ 0 };
+    static inline std::array<shard_type, 16> shards_;
+
+    static inline std::mutex names_mutex_;
+    static inline std::unordered_map<const void *, std::wstring> names_;
+    static inline std::unordered_map<std::wstring, function_info> functions_;
+};
+
+} // namespace xll
@@ -0,0 +1,270 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file multi_view.hpp
+ * Strided views of the cells of an xlmulti.
+ *
+ * A multi_view is a pointer to the first cell with two extents and two
+ * strides, like a std::mdspan with a layout_stride mapping. Rows, columns,
+ * blocks and transposes are views of the same cells, so selecting a few
+ * columns of a wide table neither copies nor allocates.
+ *
+ * \code
+ * xll::multi_view table(m);
+ * xll::multi_view prices = table.block(1, 3, table.rows() - 1, 2); // skip the header
+ * for (const xll::variant& v : prices.column(0))
+ *     ...;
+ * return prices.as_xloper(); // nullptr: not contiguous, use copy()
+ * \endcode
+ *
+ * Iteration is in row-major order of the view. A view whose cells are
+ * contiguous in row-major order, such as whole rows of the table, can be
+ * returned to Excel without copying by as_xloper(); any other view must be
+ * copied to an xlmulti first.
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/constants.hpp>
+#include <xll/xloper.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+
+namespace xll {
+
+namespace detail {
+
+// XLOPER12 of type xltypeMulti which does not own its cells, with the layout
+// of variant: val.array at the start of the 24-byte val union, then xltype.
+struct alignas(variant) multi_ref
+{
+    const void *lparray;
+    std::int32_t rows;
+    std::int32_t columns;
+    unsigned char unused[24 - sizeof(void *) - 2 * sizeof(std::int32_t)];
+    std::uint32_t xltype;
+};
+
+static_assert(std::is_standard_layout_v<multi_ref>, "invalid multi_ref layout");
+static_assert(sizeof(multi_ref) == sizeof(variant), "invalid multi_ref size");
+static_assert(offsetof(multi_ref, xltype) == 24, "invalid multi_ref xltype offset");
+
+// val.array is an xlmulti, which the storage union of variant holds at offset 0.
+static_assert(std::is_standard_layout_v<xlmulti>, "invalid xlmulti layout");
+static_assert(offsetof(multi_ref, lparray) == offsetof(xlmulti, lparray), "invalid multi_ref lparray offset");
+static_assert(offsetof(multi_ref, rows) == offsetof(xlmulti, rows_), "invalid multi_ref rows offset");
+static_assert(offsetof(multi_ref, columns) == offsetof(xlmulti, cols_), "invalid multi_ref columns offset");
+
+} // namespace detail
+
+/// Row-major iterator over a strided view.
+template<class T>
+class multi_view_iterator
+{
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = std::remove_const_t<T>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T*;
+    using reference = T&;
+
+    constexpr multi_view_iterator() noexcept = default;
+
+    constexpr multi_view_iterator(pointer data, std::size_t cols, std::ptrdiff_t row_stride,
+        std::ptrdiff_t col_stride, std::size_t n) noexcept
+        : data_(data), cols_(cols), row_stride_(row_stride), col_stride_(col_stride), n_(n) {}
+
+    constexpr reference operator*() const noexcept
+        { return data_[offset(n_)]; }
+
+    constexpr pointer operator->() const noexcept
+        { return data_ + offset(n_); }
+
+    constexpr reference operator[](difference_type k) const noexcept
+        { return data_[offset(n_ + static_cast<std::size_t>(k))]; }
+
+    constexpr multi_view_iterator& operator++() noexcept { ++n_; return *this; }
+    constexpr multi_view_iterator& operator--() noexcept { --n_; return *this; }
+    constexpr multi_view_iterator operator++(int) noexcept { auto t = *this; ++n_; return t; }
+    constexpr multi_view_iterator operator--(int) noexcept { auto t = *this; --n_; return t; }
+
+    constexpr multi_view_iterator& operator+=(difference_type k) noexcept
+        { n_ += static_cast<std::size_t>(k); return *this; }
+    constexpr multi_view_iterator& operator-=(difference_type k) noexcept
+        { n_ -= static_cast<std::size_t>(k); return *this; }
+
+    friend constexpr multi_view_iterator operator+(multi_view_iterator it, difference_type k) noexcept
+        { return it += k; }
+    friend constexpr multi_view_iterator operator+(difference_type k, multi_view_iterator it) noexcept
+        { return it += k; }
+    friend constexpr multi_view_iterator operator-(multi_view_iterator it, difference_type k) noexcept
+        { return it -= k; }
+    friend constexpr difference_type operator-(const multi_view_iterator& x, const multi_view_iterator& y) noexcept
+        { return static_cast<difference_type>(x.n_) - static_cast<difference_type>(y.n_); }
+
+    friend constexpr bool operator==(const multi_view_iterator& x, const multi_view_iterator& y) noexcept
+        { return x.n_ == y.n_; }
+    friend constexpr bool operator!=(const multi_view_iterator& x, const multi_view_iterator& y) noexcept
+        { return x.n_ != y.n_; }
+    friend constexpr bool operator<(const multi_view_iterator& x, const multi_view_iterator& y) noexcept
+        { return x.n_ < y.n_; }
+    friend constexpr bool operator>(const multi_view_iterator& x, const multi_view_iterator& y) noexcept
+        { return x.n_ > y.n_; }
+    friend constexpr bool operator<=(const multi_view_iterator& x, const multi_view_iterator& y) noexcept
+        { return x.n_ <= y.n_; }
+    friend constexpr bool operator>=(const multi_view_iterator& x, const multi_view_iterator& y) noexcept
+        { return x.n_ >= y.n_; }
+
+private:
+    constexpr std::ptrdiff_t offset(std::size_t n) const noexcept
+    {
+        return static_cast<std::ptrdiff_t>(n / cols_) * row_stride_ +
+               static_cast<std::ptrdiff_t>(n % cols_) * col_stride_;
+    }
+
+    pointer data_ = nullptr;
+    std::size_t cols_ = 1;
+    std::ptrdiff_t row_stride_ = 0;
+    std::ptrdiff_t col_stride_ = 0;
+    std::size_t n_ = 0;
+};
+
+/// Non-owning, strided 2-D view of variant cells.
+template<class T>
+class basic_multi_view
+{
+    static_assert(std::is_same_v<std::remove_const_t<T>, variant>, "invalid element type");
+
+public:
+    using element_type = T;
+    using value_type = variant;
+    using size_type = std::size_t;
+    using index_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T*;
+    using reference = T&;
+    using iterator = multi_view_iterator<T>;
+
+    constexpr basic_multi_view() noexcept = default;
+
+    constexpr basic_multi_view(pointer data, size_type rows, size_type cols,
+        difference_type row_stride, difference_type col_stride) noexcept
+        : data_(data), rows_(rows), cols_(cols), row_stride_(row_stride), col_stride_(col_stride) {}
+
+    /// All the cells of m.
+    template<class M, class E = std::enable_if_t<std::is_same_v<std::remove_const_t<M>, xlmulti> &&
+        (std::is_const_v<T> || !std::is_const_v<M>)>>
+    basic_multi_view(M& m) noexcept
+        : data_(m.data()), rows_(m.size1()), cols_(m.size2()),
+          row_stride_(static_cast<difference_type>(m.size2())), col_stride_(1) {}
+
+    /// A mutable view as a read-only one.
+    template<class U, class E = std::enable_if_t<std::is_const_v<T> && std::is_same_v<U, variant>>>
+    constexpr basic_multi_view(const basic_multi_view<U>& v) noexcept
+        : data_(v.data()), rows_(v.rows()), cols_(v.columns()), row_stride_(v.stride(0)), col_stride_(v.stride(1)) {}
+
+    // mdspan
+
+    static constexpr std::size_t rank() noexcept { return 2; }
+    constexpr size_type extent(std::size_t r) const noexcept { return r == 0 ? rows_ : cols_; }
+    constexpr difference_type stride(std::size_t r) const noexcept { return r == 0 ? row_stride_ : col_stride_; }
+    constexpr pointer data_handle() const noexcept { return data_; }
+
+    constexpr pointer data() const noexcept { return data_; }
+    constexpr size_type rows() const noexcept { return rows_; }
+    constexpr size_type columns() const noexcept { return cols_; }
+    constexpr size_type size() const noexcept { return rows_ * cols_; }
+    constexpr bool empty() const noexcept { return size() == 0; }
+
+    constexpr reference operator()(size_type i, size_type j) const noexcept
+        { return data_[static_cast<difference_type>(i) * row_stride_ + static_cast<difference_type>(j) * col_stride_]; }
+
+    reference at(size_type i, size_type j) const
+    {
+        if (i >= rows_ || j >= cols_)
+            throw std::out_of_range("invalid multi_view subscript");
+        return operator()(i, j);
+    }
+
+    /// Cell n in row-major order of the view.
+    constexpr reference operator[](size_type n) const noexcept
+        { return operator()(n / cols_, n % cols_); }
+
+    iterator begin() const noexcept
+        { return iterator(data_, cols_ != 0 ? cols_ : 1, row_stride_, col_stride_, 0); }
+
+    iterator end() const noexcept
+        { return iterator(data_, cols_ != 0 ? cols_ : 1, row_stride_, col_stride_, size()); }
+
+    // Slicing. Arguments are not checked.
+
+    constexpr basic_multi_view row(size_type i) const noexcept
+        { return block(i, 0, 1, cols_); }
+
+    constexpr basic_multi_view column(size_type j) const noexcept
+        { return block(0, j, rows_, 1); }
+
+    /// rows x cols cells from row i, column j.
+    constexpr basic_multi_view block(size_type i, size_type j, size_type rows, size_type cols) const noexcept
+        { return basic_multi_view(rows * cols != 0 ? &operator()(i, j) : data_, rows, cols, row_stride_, col_stride_); }
+
+    constexpr basic_multi_view transpose() const noexcept
+        { return basic_multi_view(data_, cols_, rows_, col_stride_, row_stride_); }
+
+    /// True if the cells are adjacent in row-major order of the view, as in
+    /// an xlmulti.
+    constexpr bool is_contiguous() const noexcept
+    {
+        return size() <= 1 ||
+            ((cols_ == 1 || col_stride_ == 1) && (rows_ == 1 || row_stride_ == static_cast<difference_type>(cols_)));
+    }
+
+    /// The view as an xltypeMulti XLOPER12 referring to its cells, to return
+    /// to Excel, which copies it. Valid until the next call on this thread,
+    /// and only while the cells live. Returns nullptr if the view is not
+    /// contiguous or is empty.
+    variant * as_xloper() const noexcept
+    {
+        if (!is_contiguous() || empty())
+            return nullptr;
+        thread_local detail::multi_ref result;
+        result.lparray = data_;
+        result.rows = static_cast<std::int32_t>(rows_);
+        result.columns = static_cast<std::int32_t>(cols_);
+        result.xltype = xltypeMulti;
+        return reinterpret_cast<variant *>(&result);
+    }
+
+    /// Copies the cells to an xlmulti.
+    xlmulti copy() const
+    {
+        xlmulti m(static_cast<unsigned>(rows_), static_cast<unsigned>(cols_));
+        std::size_t k = 0;
+        for (const variant& v : *this)
+            m[k++] = v;
+        return m;
+    }
+
+private:
+    pointer data_ = nullptr;
+    size_type rows_ = 0;
+    size_type cols_ = 0;
+    difference_type row_stride_ = 0;
+    difference_type col_stride_ = 0;
+};
+
+using multi_view = basic_multi_view<const variant>;
+using mutable_multi_view = basic_multi_view<variant>;
+
+} // namespace xll
@@ -0,0 +1,455 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file object.hpp
+ * Store for C++ objects referenced from cells by handle strings.
+ *
+ * A function which builds a large object stores it and returns a handle such
+ * as "Curve:42#3" in place of the object's values. Functions in dependent
+ * cells take the handle as a string argument and resolve it to the object
+ * without copying.
+ *
+ * \code
+ * std::wstring make_curve(const std::vector<double>& tenors, const std::vector<double>& rates)
+ * {
+ *     return xll::object_store::create<curve>(L"Curve", tenors, rates);
+ * }
+ *
+ * double discount(std::wstring_view handle, double t)
+ * {
+ *     auto c = xll::object_store::find<curve>(handle);
+ *     if (!c)
+ *         throw std::invalid_argument("invalid curve handle");
+ *     return c->discount(t);
+ * }
+ *
+ * XLL_EXPORT int __stdcall on_calculation_ended()
+ * {
+ *     xll::object_store::sweep();
+ *     xll::object_store::collect();
+ *     return 1;
+ * }
+ * \endcode
+ *
+ * Each object is owned by the cell which created it, identified with
+ * xlfCaller. When the cell is recalculated, its new object replaces the old
+ * one in the same slot with the next generation, so stale handles no longer
+ * resolve and the replaced object is reclaimed.
+ *
+ * Excel does not tell the add-in when a formula is cleared or overwritten, so
+ * the object of such a cell stays live until sweep() finds that the cell no
+ * longer holds its handle, or until the sheet is erased.
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/callback.hpp>
+#include <xll/functions.hpp>
+#include <xll/range.hpp>
+#include <xll/xloper.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace xll {
+namespace detail {
+
+template<class T>
+inline const void *object_type_id() noexcept
+{
+    static const char id = 0;
+    return &id;
+}
+
+// Immutable once published; freed by object_store::collect().
+struct object_record
+{
+    std::shared_ptr<const void> object;
+    const void *type = nullptr;
+    std::uint32_t generation = 0;
+    std::wstring name;
+};
+
+struct object_slot
+{
+    std::atomic<const object_record *> record{ nullptr };
+    std::uint32_t generation = 0; // guarded by object_store::mutex_
+    bool has_owner = false;
+    range_key owner;
+};
+
+// Components of a handle string "Name:index#generation".
+struct object_handle
+{
+    std::wstring_view name;
+    std::uint32_t index = 0;
+    std::uint32_t generation = 0;
+
+    static bool parse(std::wstring_view s, object_handle& h) noexcept
+    {
+        const std::size_t colon = s.rfind(L':');
+        const std::size_t hash = s.rfind(L'#');
+        if (colon == std::wstring_view::npos || hash == std::wstring_view::npos || hash < colon)
+            return false;
+        h.name = s.substr(0, colon);
+        return parse_number(s.substr(colon + 1, hash - colon - 1), h.index) &&
+            parse_number(s.substr(hash + 1), h.generation);
+    }
+
+    static bool parse_number(std::wstring_view s, std::uint32_t& x) noexcept
+    {
+        if (s.empty() || s.size() > 10)
+            return false;
+        std::uint64_t n = 0;
+        for (wchar_t c : s) {
+            if (c < L'0' || c > L'9')
+                return false;
+            n = n * 10 + static_cast<std::uint64_t>(c - L'0');
+        }
+        if (n > UINT32_MAX)
+            return false;
+        x = static_cast<std::uint32_t>(n);
+        return true;
+    }
+};
+
+} // namespace detail
+
+/// Store of shared, immutable objects addressed by handle strings.
+///
+/// Lookups are lock-free: the slot is located from the index in the handle
+/// with two acquire loads, and the generation and type are compared with the
+/// published record. Creation and removal are serialized by a mutex. Records
+/// which are replaced or removed are retired, and freed by collect() once no
+/// function can be reading them.
+struct object_store
+{
+    static constexpr std::size_t chunk_size = 4096;
+    static constexpr std::size_t max_chunks = 1024;
+
+    /// Stores object and returns its handle. The object is owned by the
+    /// calling cell, if any; an object previously created by the same cell is
+    /// replaced.
+    template<class T>
+    static std::wstring insert(std::wstring_view name, std::shared_ptr<const T> object)
+    {
+        range_key owner;
+        const bool has_owner = caller(owner);
+        return insert_impl(name, std::move(object), detail::object_type_id<T>(),
+            has_owner ? &owner : nullptr);
+    }
+
+    /// Stores object owned by the cell identified by owner.
+    template<class T>
+    static std::wstring insert(std::wstring_view name, std::shared_ptr<const T> object, const range_key& owner)
+    {
+        return insert_impl(name, std::move(object), detail::object_type_id<T>(), &owner);
+    }
+
+    /// Constructs a T from args and stores it.
+    template<class T, class... Args>
+    static std::wstring create(std::wstring_view name, Args&&... args)
+    {
+        return insert<T>(name, std::make_shared<const T>(std::forward<Args>(args)...));
+    }
+
+    /// Returns the object for handle, or an empty pointer if the handle is
+    /// stale, invalid or refers to an object of another type.
+    template<class T>
+    static std::shared_ptr<const T> find(std::wstring_view handle) noexcept
+    {
+        const detail::object_record *r = lookup(handle);
+        if (r == nullptr || r->type != detail::object_type_id<T>())
+            return {};
+        return std::shared_ptr<const T>(r->object, static_cast<const T *>(r->object.get()));
+    }
+
+    /// Returns true if the handle refers to a live object.
+    static bool contains(std::wstring_view handle) noexcept
+        { return lookup(handle) != nullptr; }
+
+    /// Removes the object for handle. Returns false if the handle is stale.
+    static bool erase(std::wstring_view handle)
+    {
+        detail::object_handle h;
+        if (!detail::object_handle::parse(handle, h))
+            return false;
+        std::lock_guard<std::mutex> lock(mutex_);
+        detail::object_slot *s = slot(h.index);
+        if (s == nullptr)
+            return false;
+        const detail::object_record *r = s->record.load(std::memory_order_relaxed);
+        if (r == nullptr || r->generation != h.generation || r->name != h.name)
+            return false;
+        release(h.index, *s);
+        return true;
+    }
+
+    /// Removes objects owned by cells on the given sheet, for example when the
+    /// sheet is deleted.
+    static std::size_t erase_sheet(uintptr_t sheet)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<std::uint32_t> indices;
+        for (const auto& [key, index] : owners_) {
+            if (key.sheet == sheet)
+                indices.push_back(index);
+        }
+        for (std::uint32_t i : indices)
+            release(i, *slot(i));
+        return indices.size();
+    }
+
+    /// Removes objects whose owning cell no longer holds their handle, such
+    /// as when its formula was cleared. Reads the owning cells with xlCoerce,
+    /// so call from a command or an event handler, not from a worksheet
+    /// function. Cells which cannot be read, for example because they are not
+    /// yet calculated, are skipped. Returns the number of objects removed.
+    static std::size_t sweep()
+    {
+        struct owned
+        {
+            std::uint32_t index;
+            std::uint32_t generation;
+            range_key owner;
+            std::wstring handle;
+        };
+
+        std::vector<owned> candidates;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& [key, index] : owners_) {
+                const detail::object_record *r = slot(index)->record.load(std::memory_order_relaxed);
+                if (r != nullptr)
+                    candidates.push_back({ index, r->generation, key, make_handle(*r, index) });
+            }
+        }
+
+        // Excel is called without the lock, so recheck each slot before
+        // releasing it in case its cell was recalculated meanwhile.
+        std::vector<const owned *> orphans;
+        for (const owned& c : candidates) {
+            if (!holds(c.owner, c.handle))
+                orphans.push_back(&c);
+        }
+
+        std::size_t n = 0;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const owned *c : orphans) {
+            detail::object_slot& s = *slot(c->index);
+            const detail::object_record *r = s.record.load(std::memory_order_relaxed);
+            if (r != nullptr && r->generation == c->generation && s.has_owner && s.owner == c->owner) {
+                release(c->index, s);
+                ++n;
+            }
+        }
+        return n;
+    }
+
+    /// Frees replaced and removed objects. Call when no worksheet function can
+    /// be running, such as when calculation ends.
+    static std::size_t collect()
+    {
+        std::vector<std::unique_ptr<const detail::object_record>> retired;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            retired.swap(retired_);
+        }
+        return retired.size();
+    }
+
+    /// Number of live objects.
+    static std::size_t size() noexcept
+        { return live_.load(std::memory_order_relaxed); }
+
+    /// Removes and frees all objects. No function may be running.
+    static void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (std::uint32_t i = 0; i < next_; ++i) {
+            detail::object_slot *s = slot(i);
+            if (s->record.load(std::memory_order_relaxed) != nullptr)
+                release(i, *s);
+        }
+        owners_.clear();
+        retired_.clear();
+    }
+
+private:
+    using chunk_type = std::array<detail::object_slot, chunk_size>;
+
+    static bool caller(range_key& key)
+    {
+        variant result;
+        if (Excel12(xlfCaller, &result) != XLRET::xlretSuccess)
+            return false;
+        if (result.xltype() == xltypeRef && result.get<xlref>().lpmref != nullptr) {
+            const auto& r = result.get<xlref>();
+            const auto& a = r.lpmref->reftbl[0];
+            key = { r.idSheet, a.rwFirst, a.rwLast, a.colFirst, a.colLast };
+            return true;
+        }
+        return false;
+    }
+
+    // True unless the cells of owner can be read and none holds handle.
+    static bool holds(const range_key& owner, std::wstring_view handle)
+    {
+        std::remove_pointer_t<decltype(xlref::lpmref)> mref;
+        mref.count = 1;
+        mref.reftbl[0].rwFirst = owner.rwFirst;
+        mref.reftbl[0].rwLast = owner.rwLast;
+        mref.reftbl[0].colFirst = owner.colFirst;
+        mref.reftbl[0].colLast = owner.colLast;
+        xlref r;
+        r.lpmref = &mref;
+        r.idSheet = owner.sheet;
+        variant ref;
+        ref.emplace<xlref>(r);
+
+        int rc;
+        variant cells = coerce<xltypeMulti>(&ref, rc);
+        if (rc != XLRET::xlretSuccess || cells.xltype() != xltypeMulti)
+            return true;
+        const xlmulti& m = cells.get<xlmulti>();
+        for (std::size_t k = 0; k < m.size(); ++k) {
+            if (m[k].xltype() == xltypeStr) {
+                const auto& s = m[k].get<xlstr>();
+                if (std::wstring_view(s.data(), s.size()) == handle)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    static std::wstring make_handle(const detail::object_record& r, std::uint32_t index)
+    {
+        std::wstring handle = r.name;
+        handle += L':';
+        handle += std::to_wstring(index);
+        handle += L'#';
+        handle += std::to_wstring(r.generation);
+        return handle;
+    }
+
+    static detail::object_slot *slot(std::uint32_t index) noexcept
+    {
+        const std::size_t c = index / chunk_size;
+        if (c >= max_chunks)
+            return nullptr;
+        chunk_type *chunk = chunks_[c].load(std::memory_order_acquire);
+        return chunk ? &(*chunk)[index % chunk_size] : nullptr;
+    }
+
+    static const detail::object_record *lookup(std::wstring_view handle) noexcept
+    {
+        detail::object_handle h;
+        if (!detail::object_handle::parse(handle, h))
+            return nullptr;
+        const detail::object_slot *s = slot(h.index);
+        if (s == nullptr)
+            return nullptr;
+        const detail::object_record *r = s->record.load(std::memory_order_acquire);
+        if (r == nullptr || r->generation != h.generation || r->name != h.name)
+            return nullptr;
+        return r;
+    }
+
+    // Requires mutex_.
+    static std::uint32_t allocate()
+    {
+        if (!free_.empty()) {
+            std::uint32_t i = free_.back();
+            free_.pop_back();
+            return i;
+        }
+        const std::uint32_t i = next_;
+        const std::size_t c = i / chunk_size;
+        if (c >= max_chunks)
+            throw std::length_error("object store is full");
+        if (chunks_[c].load(std::memory_order_relaxed) == nullptr)
+            chunks_[c].store(new chunk_type(), std::memory_order_release);
+        ++next_;
+        return i;
+    }
+
+    // Requires mutex_. Retires the record and frees the slot.
+    static void release(std::uint32_t index, detail::object_slot& s)
+    {
+        const detail::object_record *r = s.record.exchange(nullptr, std::memory_order_acq_rel);
+        if (r != nullptr) {
+            retired_.emplace_back(r);
+            live_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        if (s.has_owner) {
+            owners_.erase(s.owner);
+            s.has_owner = false;
+        }
+        free_.push_back(index);
+    }
+
+    static std::wstring insert_impl(std::wstring_view name, std::shared_ptr<const void> object,
+        const void *type, const range_key *owner)
+    {
+        auto record = std::make_unique<detail::object_record>();
+        record->object = std::move(object);
+        record->type = type;
+        record->name.assign(name.data(), name.size());
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        std::uint32_t index;
+        auto it = owner ? owners_.find(*owner) : owners_.end();
+        if (it != owners_.end()) {
+            index = it->second;
+        }
+        else {
+            index = allocate();
+            if (owner)
+                owners_.emplace(*owner, index);
+        }
+
+        detail::object_slot& s = *slot(index);
+        record->generation = ++s.generation;
+        s.has_owner = owner != nullptr;
+        if (owner)
+            s.owner = *owner;
+
+        const detail::object_record *old = s.record.exchange(record.get(), std::memory_order_acq_rel);
+        if (old != nullptr)
+            retired_.emplace_back(old);
+        else
+            live_.fetch_add(1, std::memory_order_relaxed);
+
+        std::wstring handle = make_handle(*record, index);
+        record.release(); // owned by the slot
+        return handle;
+    }
+
+    static inline std::mutex mutex_;
+    static inline std::array<std::atomic<chunk_type *>, max_chunks> chunks_{};
+    static inline std::uint32_t next_ = 0;
+    static inline std::vector<std::uint32_t> free_;
+    static inline std::unordered_map<range_key, std::uint32_t, range_key_hash> owners_;
+    static inline std::vector<std::unique_ptr<const detail::object_record>> retired_;
+    static inline std::atomic<std::size_t> live_{ 0 };
+};
+
+} // namespace xll
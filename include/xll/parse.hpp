@@ -0,0 +1,221 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file parse.hpp
+ * Conversion of numbers stored as text to xlnum.
+ *
+ * parse_numbers() converts in place the string cells of an xlmulti which
+ * hold numbers, such as data pasted from other applications, and reports the
+ * cells which do not.
+ *
+ * \code
+ * xll::number_locale loc = xll::number_locale::excel(); // separators of Excel
+ * xll::parse_result r = xll::parse_numbers(values, loc);
+ * for (const auto& e : r.errors)
+ *     ...; // e.row, e.column, e.status
+ * \endcode
+ *
+ * Numbers are accepted as VALUE() accepts them: surrounding spaces, a sign
+ * or enclosing parentheses for negatives, thousands separators between the
+ * digits of the integer part, a decimal separator, an exponent and a
+ * trailing percent sign. Each cell is validated and narrowed to ASCII in a
+ * single pass into a stack buffer, without allocation, and the digits are
+ * converted with std::from_chars (Eisel-Lemire in the major standard
+ * libraries). Numbers longer than max_parse_chars characters are invalid.
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/callback.hpp>
+#include <xll/xloper.hpp>
+#include <xll/detail/charconv.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+namespace xll {
+
+constexpr std::size_t max_parse_chars = 128;
+
+/// Separators of numbers.
+struct number_locale
+{
+    wchar_t decimal = L'.';
+    wchar_t thousands = L','; // 0 for none
+
+    /// The separators of the running instance of Excel, from
+    /// GET.WORKSPACE(37), or the defaults if they cannot be read.
+    static number_locale excel()
+    {
+        number_locale loc;
+        variant result, type(37.0);
+        if (Excel12(xlfGetWorkspace, &result, &type) != xlretSuccess || result.xltype() != xltypeMulti)
+            return loc;
+        const auto& m = result.get<xlmulti>();
+        auto separator = [&](std::size_t i, wchar_t& c) {
+            if (m.size() > i && m[i].xltype() == xltypeStr && m[i].get<xlstr>().size() == 1)
+                c = m[i].get<xlstr>().data()[0];
+        };
+        separator(2, loc.decimal);
+        separator(3, loc.thousands);
+        if (loc.thousands == loc.decimal)
+            loc.thousands = 0;
+        return loc;
+    }
+};
+
+enum class parse_status : std::uint8_t
+{
+    ok,
+    empty,        // blank or spaces only
+    invalid,      // not a number
+    out_of_range  // beyond the range of double
+};
+
+struct parse_error
+{
+    std::uint32_t row;
+    std::uint32_t column;
+    parse_status status;
+};
+
+struct parse_result
+{
+    std::size_t converted = 0;
+    std::vector<parse_error> errors; // string cells which were not converted, in row-major order
+};
+
+/// Parses the n characters of s as a number.
+inline parse_status parse_number(const wchar_t *s, std::size_t n, double& value,
+    const number_locale& loc = {}) noexcept
+{
+    auto space = [](wchar_t c) { return c == L' ' || c == L'\t' || c == L'\u00a0'; };
+    std::size_t first = 0, last = n;
+    while (first < last && space(s[first]) && s[first] != loc.thousands)
+        ++first;
+    while (last > first && space(s[last - 1]) && s[last - 1] != loc.thousands)
+        --last;
+    if (first == last)
+        return parse_status::empty;
+
+    bool negative = false;
+    bool percent = false;
+    if (s[first] == L'(' && s[last - 1] == L')') {
+        negative = true;
+        ++first;
+        --last;
+    }
+    if (first < last && s[last - 1] == L'%') {
+        percent = true;
+        --last;
+    }
+    if (first < last && (s[first] == L'+' || s[first] == L'-')) {
+        if (s[first] == L'-') {
+            if (negative)
+                return parse_status::invalid;
+            negative = true;
+        }
+        ++first;
+    }
+
+    enum { integral, fraction, exponent } part = integral;
+    char buf[max_parse_chars + 1]; // and a terminator for strtod
+    std::size_t k = 0;
+    bool digits = false;          // in the mantissa
+    bool exponent_digits = false;
+    for (std::size_t i = first; i < last; ++i) {
+        const wchar_t c = s[i];
+        char a;
+        if (c >= L'0' && c <= L'9') {
+            a = static_cast<char>(c);
+            if (part == exponent)
+                exponent_digits = true;
+            else
+                digits = true;
+        }
+        else if (c == loc.thousands && loc.thousands != 0 && part == integral && i > first &&
+                 i + 1 < last && s[i - 1] >= L'0' && s[i - 1] <= L'9' && s[i + 1] >= L'0' && s[i + 1] <= L'9')
+            continue;
+        else if (c == loc.decimal && part == integral) {
+            part = fraction;
+            a = '.';
+        }
+        else if ((c == L'e' || c == L'E') && digits && part != exponent) {
+            part = exponent;
+            a = 'e';
+            if (i + 1 < last && (s[i + 1] == L'+' || s[i + 1] == L'-')) {
+                if (k + 1 >= max_parse_chars)
+                    return parse_status::invalid;
+                buf[k++] = a;
+                a = static_cast<char>(s[++i]);
+            }
+        }
+        else
+            return parse_status::invalid;
+        if (k == max_parse_chars)
+            return parse_status::invalid;
+        buf[k++] = a;
+    }
+    if (!digits || (part == exponent && !exponent_digits))
+        return parse_status::invalid;
+
+    double x = 0.0;
+#ifdef XLL_HAS_FLOAT_CHARCONV
+    const auto r = std::from_chars(buf, buf + k, x);
+    if (r.ec == std::errc::result_out_of_range) {
+        // Underflow is zero, overflow is an error.
+        buf[k] = '\0';
+        if (std::isinf(x = std::strtod(buf, nullptr)))
+            return parse_status::out_of_range;
+    }
+    else if (r.ec != std::errc() || r.ptr != buf + k)
+        return parse_status::invalid;
+#else
+    buf[k] = '\0';
+    char *end = nullptr;
+    x = std::strtod(buf, &end); // "C" locale
+    if (end != buf + k)
+        return parse_status::invalid;
+    if (std::isinf(x))
+        return parse_status::out_of_range;
+#endif
+    if (percent)
+        x /= 100.0;
+    value = negative ? -x : x;
+    return parse_status::ok;
+}
+
+/// Converts the string cells of m which hold numbers to xlnum.
+inline parse_result parse_numbers(xlmulti& m, const number_locale& loc = {})
+{
+    parse_result result;
+    const std::size_t cols = m.size2();
+    for (std::size_t i = 0; i < m.size(); ++i) {
+        variant& v = m[i];
+        if (v.xltype() != xltypeStr)
+            continue;
+        const xlstr& s = v.get<xlstr>();
+        double x;
+        const parse_status status = parse_number(s.data(), s.size(), x, loc);
+        if (status == parse_status::ok) {
+            v.emplace<xlnum>(x);
+            ++result.converted;
+        }
+        else
+            result.errors.push_back({ static_cast<std::uint32_t>(i / cols),
+                static_cast<std::uint32_t>(i % cols), status });
+    }
+    return result;
+}
+
+} // namespace xll
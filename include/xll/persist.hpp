@@ -0,0 +1,392 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file persist.hpp
+ * Result cache saved in the workbook with xlDefineBinaryName.
+ *
+ * Values inserted in persistent_cache are written to a named binary blob in
+ * the workbook by save(), and read back by load() when the workbook is
+ * opened, so that expensive results need not be recomputed.
+ *
+ * \code
+ * xll::variant calibrate(const std::wstring& curve);
+ *
+ * XLL_EXPORT xll::variant * __stdcall xl_calibrate(const wchar_t *curve)
+ * {
+ *     thread_local xll::variant result;
+ *     result = *xll::persistent_cache::get_or_create(L"calibration/" + std::wstring(curve),
+ *         [&]() { return calibrate(curve); });
+ *     return &result;
+ * }
+ *
+ * // Auto_Open macro or command
+ * xll::persistent_cache::load();
+ * xll::persistent_cache::load_memo();
+ *
+ * // command run before the workbook is saved
+ * xll::persistent_cache::save();
+ * xll::persistent_cache::save_memo();
+ * \endcode
+ *
+ * save_memo() and load_memo() do the same for the current entries of
+ * memo_cache, in a binary name of their own.
+ *
+ * xlDefineBinaryName and xlGetBinaryName act on the active workbook, and may
+ * only be called from commands and macro sheet equivalent functions.
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/functions.hpp>
+#include <xll/memoize.hpp>
+#include <xll/serialize.hpp>
+#include <xll/xloper.hpp>
+#include <xll/log.hpp>
+
+#if BOOST_OS_WINDOWS
+#include <boost/winapi/basic_types.hpp>
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if BOOST_OS_WINDOWS
+extern "C" {
+BOOST_WINAPI_IMPORT boost::winapi::LPVOID_ BOOST_WINAPI_WINAPI_CC GlobalLock(boost::winapi::HANDLE_ hMem);
+BOOST_WINAPI_IMPORT boost::winapi::BOOL_ BOOST_WINAPI_WINAPI_CC GlobalUnlock(boost::winapi::HANDLE_ hMem);
+}
+#endif
+
+namespace xll {
+namespace detail {
+
+// Maps the data of a handle returned by xlGetBinaryName. Excel returns a
+// global memory handle on Windows; other hosts return the data pointer.
+class binary_name_data
+{
+public:
+    explicit binary_name_data(const xlbigdata& bd) noexcept
+        : handle_(bd.h), size_(bd.cbData > 0 ? static_cast<std::size_t>(bd.cbData) : 0)
+    {
+#if BOOST_OS_WINDOWS
+        data_ = handle_ ? static_cast<const unsigned char *>(::GlobalLock(handle_)) : nullptr;
+#else
+        data_ = static_cast<const unsigned char *>(handle_);
+#endif
+    }
+
+    ~binary_name_data()
+    {
+#if BOOST_OS_WINDOWS
+        if (data_ != nullptr)
+            ::GlobalUnlock(handle_);
+#endif
+    }
+
+    binary_name_data(const binary_name_data&) = delete;
+    binary_name_data& operator=(const binary_name_data&) = delete;
+
+    const unsigned char *data() const noexcept { return data_; }
+    std::size_t size() const noexcept { return data_ ? size_ : 0; }
+
+private:
+    void *handle_;
+    const unsigned char *data_ = nullptr;
+    std::size_t size_;
+};
+
+} // namespace detail
+
+/// Named values saved in the workbook.
+///
+/// Format (little-endian):
+///
+///   char[4] "XLLP", uint16 version, uint16 reserved, uint32 count,
+///   then for each entry: uint32 key length, UTF-16 key, encoded value.
+///
+/// Values are encoded as by serialize(), without its header. Version 2
+/// follows the value encoding of serialization version 1.
+struct persistent_cache
+{
+    using value_type = std::shared_ptr<const variant>;
+
+    static constexpr std::uint16_t version = 2;
+    static constexpr const wchar_t *default_name = L"XLL.CACHE";
+    static constexpr const wchar_t *memo_name = L"XLL.MEMO";
+
+    static value_type find(std::wstring_view key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = map_.find(std::wstring(key));
+        return it != map_.end() ? it->second : value_type();
+    }
+
+    /// Inserts or replaces the value for key. The value is copied with flags
+    /// cleared so that it is owned by the DLL.
+    static value_type insert(std::wstring key, const variant& value)
+    {
+        auto owned = std::make_shared<variant>(value);
+        owned->clear_flags();
+        std::lock_guard<std::mutex> lock(mutex_);
+        map_[std::move(key)] = owned;
+        dirty_ = true;
+        return owned;
+    }
+
+    /// Returns the value for key, or computes it with make() and inserts it.
+    template<class F>
+    static value_type get_or_create(std::wstring key, F&& make)
+    {
+        if (auto value = find(key))
+            return value;
+        return insert(std::move(key), std::forward<F>(make)());
+    }
+
+    static bool erase(std::wstring_view key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool erased = map_.erase(std::wstring(key)) > 0;
+        dirty_ |= erased;
+        return erased;
+    }
+
+    static void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dirty_ |= !map_.empty();
+        map_.clear();
+    }
+
+    static std::size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return map_.size();
+    }
+
+    /// Returns true if the cache changed since the last save() or load().
+    static bool dirty()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return dirty_;
+    }
+
+    /// Encodes all entries into one buffer of the exact size required.
+    static std::vector<unsigned char> serialize()
+    {
+        std::vector<std::pair<std::wstring, value_type>> entries;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            entries.assign(map_.begin(), map_.end());
+        }
+
+        std::size_t n = 12;
+        for (const auto& [key, value] : entries)
+            n += 4 + 2 * key.size() + detail::encoded_size(*value);
+
+        std::vector<unsigned char> buffer(n);
+        detail::binary_writer w(buffer.data());
+        for (char c : { 'X', 'L', 'L', 'P' })
+            w.write(static_cast<std::uint8_t>(c));
+        w.write(version);
+        w.write(std::uint16_t(0));
+        w.write(static_cast<std::uint32_t>(entries.size()));
+        for (const auto& [key, value] : entries) {
+            w.write(static_cast<std::uint32_t>(key.size()));
+            w.write_chars(key.data(), key.size());
+            detail::encode(w, *value);
+        }
+        return buffer;
+    }
+
+    /// Decodes entries from p and inserts them, replacing existing values.
+    /// Returns the number of entries read, or 0 if the data is invalid.
+    static std::size_t deserialize(const unsigned char *p, std::size_t n)
+    {
+        detail::binary_reader r(p, n);
+        std::uint8_t magic[4] = {};
+        for (auto& c : magic)
+            r.read(c);
+        std::uint16_t ver = 0, reserved;
+        std::uint32_t count = 0;
+        r.read(ver);
+        r.read(reserved);
+        r.read(count);
+        if (r.failed() || magic[0] != 'X' || magic[1] != 'L' || magic[2] != 'L' || magic[3] != 'P') {
+            xll::log()->error("Invalid persistent cache data");
+            return 0;
+        }
+        if (ver != version) {
+            xll::log()->error("Unsupported persistent cache version {}", ver);
+            return 0;
+        }
+
+        std::vector<std::pair<std::wstring, value_type>> entries;
+        for (std::uint32_t i = 0; i < count; ++i) {
+            std::uint32_t len;
+            if (!r.read(len) || !r.require(std::size_t(len) * 2))
+                break;
+            std::wstring key(len, L'\0');
+            r.read_chars(key.data(), len);
+            auto value = std::make_shared<variant>();
+            if (!detail::decode(r, *value))
+                break;
+            entries.emplace_back(std::move(key), std::move(value));
+        }
+        if (entries.size() != count)
+            xll::log()->error("Persistent cache data truncated after {} of {} entries", entries.size(), count);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& [key, value] : entries)
+            map_[std::move(key)] = std::move(value);
+        return entries.size();
+    }
+
+    /// Writes all entries to the binary name in the active workbook.
+    static bool save(const std::wstring& name = default_name)
+    {
+        if (!write(name, serialize()))
+            return false;
+        std::lock_guard<std::mutex> lock(mutex_);
+        dirty_ = false;
+        return true;
+    }
+
+    /// Reads entries from the binary name in the active workbook. Returns the
+    /// number of entries read. Does not change dirty(): entries inserted
+    /// since the last save() are still unsaved.
+    static std::size_t load(const std::wstring& name = default_name)
+    {
+        detail::binary_name_data data(get_binary_name(name));
+        if (data.size() == 0)
+            return 0;
+        return deserialize(data.data(), data.size());
+    }
+
+    /// Encodes the entries exported by memo_cache. The format is that of
+    /// serialize() with the magic "XLLM", and for each entry: uint32 name
+    /// length, UTF-16 function name, uint64 size of the rest of the entry,
+    /// uint32 argument count, encoded arguments, encoded result. Entries are
+    /// encoded in place from the cache.
+    static std::vector<unsigned char> serialize_memo()
+    {
+        const std::vector<memo_record> records = memo_cache::export_entries();
+
+        std::vector<std::size_t> sizes;
+        sizes.reserve(records.size());
+        std::size_t n = 12;
+        for (const auto& record : records) {
+            sizes.push_back(record.entry->encoded_size());
+            n += 4 + 2 * record.function.size() + 8 + sizes.back();
+        }
+
+        std::vector<unsigned char> buffer(n);
+        detail::binary_writer w(buffer.data());
+        for (char c : { 'X', 'L', 'L', 'M' })
+            w.write(static_cast<std::uint8_t>(c));
+        w.write(version);
+        w.write(std::uint16_t(0));
+        w.write(static_cast<std::uint32_t>(records.size()));
+        for (std::size_t i = 0; i < records.size(); ++i) {
+            const auto& record = records[i];
+            w.write(static_cast<std::uint32_t>(record.function.size()));
+            w.write_chars(record.function.data(), record.function.size());
+            w.write(static_cast<std::uint64_t>(sizes[i]));
+            record.entry->encode(w);
+        }
+        return buffer;
+    }
+
+    /// Decodes entries encoded by serialize_memo() directly into memo_cache.
+    /// Entries of unknown functions, or which do not match the types of the
+    /// function, are skipped. Returns the number of entries imported.
+    static std::size_t deserialize_memo(const unsigned char *p, std::size_t n)
+    {
+        detail::binary_reader r(p, n);
+        std::uint8_t magic[4] = {};
+        for (auto& c : magic)
+            r.read(c);
+        std::uint16_t ver = 0, reserved;
+        std::uint32_t count = 0;
+        r.read(ver);
+        r.read(reserved);
+        r.read(count);
+        if (r.failed() || magic[0] != 'X' || magic[1] != 'L' || magic[2] != 'L' || magic[3] != 'M') {
+            xll::log()->error("Invalid memo cache data");
+            return 0;
+        }
+        if (ver != version) {
+            xll::log()->error("Unsupported memo cache version {}", ver);
+            return 0;
+        }
+
+        std::size_t imported = 0;
+        std::uint32_t i = 0;
+        std::wstring function;
+        for (; i < count; ++i) {
+            std::uint32_t len;
+            std::uint64_t size;
+            if (!r.read(len) || !r.require(std::size_t(len) * 2))
+                break;
+            function.resize(len);
+            r.read_chars(function.data(), len);
+            if (!r.read(size) || size > r.remaining())
+                break;
+            detail::binary_reader entry(r.data(), static_cast<std::size_t>(size));
+            r.skip(static_cast<std::size_t>(size));
+            imported += memo_cache::import_entry(function, entry);
+        }
+        if (i != count)
+            xll::log()->error("Memo cache data truncated after {} of {} entries", i, count);
+        return imported;
+    }
+
+    /// Writes the current entries of memo_cache to the binary name in the
+    /// active workbook.
+    static bool save_memo(const std::wstring& name = memo_name)
+        { return write(name, serialize_memo()); }
+
+    /// Imports entries of memo_cache from the binary name in the active
+    /// workbook. They are valid until the next memo_cache::invalidate().
+    /// Returns the number of entries imported.
+    static std::size_t load_memo(const std::wstring& name = memo_name)
+    {
+        detail::binary_name_data data(get_binary_name(name));
+        if (data.size() == 0)
+            return 0;
+        return deserialize_memo(data.data(), data.size());
+    }
+
+private:
+    static bool write(const std::wstring& name, std::vector<unsigned char> buffer)
+    {
+        xlbigdata bd;
+        bd.h = buffer.data(); // lpbData; copied by Excel
+        bd.cbData = static_cast<long>(buffer.size());
+        int rc = define_binary_name(name, bd);
+        if (rc != XLRET::xlretSuccess) {
+            xll::log()->error("Failed to save persistent cache: return code {:#06x}", rc);
+            return false;
+        }
+        return true;
+    }
+
+    static inline std::mutex mutex_;
+    static inline std::unordered_map<std::wstring, value_type> map_;
+    static inline bool dirty_ = false;
+};
+
+} // namespace xll
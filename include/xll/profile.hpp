@@ -0,0 +1,435 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file profile.hpp
+ * Per-function latency profiles of exported functions.
+ *
+ * Every function exported with XLL_EXPORT_FUNCTION has a function_profile.
+ * While the profiler is enabled, each call adds its latency to a histogram
+ * with logarithmic buckets, and counts its errors and the size of its
+ * arguments. The statistics are returned by the worksheet function
+ * XLL.STATS(), one row per function in decreasing order of total time.
+ *
+ * \code
+ * // xlAutoOpen
+ * xll::profiler::enable();
+ * xll::profiler::register_stats();
+ * \endcode
+ *
+ * Counters are kept in cache-line aligned shards, one per calculation
+ * thread up to profile_shards, and are allocated by the first call of a
+ * function on each thread; a call updates its shard with relaxed atomic
+ * additions. When the profiler is disabled a call pays for one relaxed load.
+ * The same trampoline records the calls in the timeline of tracer.hpp.
+ *
+ * Latencies are measured in nanoseconds. Bucket 2k of a histogram counts
+ * latencies in [2^k, 1.5 * 2^k) and bucket 2k + 1 those in
+ * [1.5 * 2^k, 2^(k + 1)). Percentiles are the upper bound of their bucket, so
+ * overstate the latency by at most 50%. A call fails if it returns an error
+ * value, NaN (#NUM!) or a null string.
+ *
+ * The profiler also counts the heap allocations made during each call: the
+ * strings and arrays of xlstr and xlmulti, the temporaries of UTF-8/UTF-16
+ * conversions, and any allocation reported with profiler::count_allocation
+ * or made through profiled_allocator. Allocations are attributed to the
+ * innermost exported function on the calling thread.
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/attributes.hpp>
+#include <xll/fp12.hpp>
+#include <xll/record.hpp>
+#include <xll/registry.hpp>
+#include <xll/tracer.hpp>
+#include <xll/xloper.hpp>
+#include <xll/detail/memory.hpp>
+#include <xll/log.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cwchar>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace xll {
+
+constexpr std::size_t profile_shards = 32;
+constexpr std::size_t profile_buckets = 2 * 40; // to 2^40 ns, about 18 minutes
+
+namespace detail {
+
+// Histogram bucket of a latency in nanoseconds: two per power of two.
+inline std::size_t profile_bucket(std::uint64_t ns) noexcept
+{
+    if (ns < 2)
+        return 0;
+    std::size_t log2 = 0;
+    for (std::size_t shift = 32; shift > 0; shift /= 2) {
+        if (ns >> (log2 + shift))
+            log2 += shift;
+    }
+    const std::size_t b = 2 * log2 + ((ns >> (log2 - 1)) & 1);
+    return std::min(b, profile_buckets - 1);
+}
+
+// Exclusive upper bound of bucket b in nanoseconds.
+inline double profile_bucket_limit(std::size_t b) noexcept
+{
+    const double lower = std::ldexp(1.0, static_cast<int>(b / 2));
+    return b % 2 == 0 ? 1.5 * lower : 2.0 * lower;
+}
+
+// Size in bytes of the data of an extern "C" argument.
+template<class T>
+inline std::uint64_t profile_argument_size(T x) noexcept
+{
+    if constexpr (std::is_convertible_v<T, const variant *>) {
+        if (x == nullptr)
+            return 0;
+        switch (x->xltype()) {
+        case xltypeStr: return sizeof(variant) + 2 * static_cast<std::uint64_t>(x->template get<xlstr>().size());
+        case xltypeMulti: return sizeof(variant) * (1 + static_cast<std::uint64_t>(x->template get<xlmulti>().size()));
+        default: return sizeof(variant);
+        }
+    }
+    else if constexpr (std::is_convertible_v<T, const wchar_t *>)
+        return x != nullptr ? 2 * static_cast<std::uint64_t>(std::wcslen(x)) : 0;
+    else if constexpr (std::is_convertible_v<T, const fp12 *>)
+        return x != nullptr ? sizeof(double) * static_cast<std::uint64_t>(x->rows) * x->columns : 0;
+    else
+        return sizeof(T);
+}
+
+// True if an extern "C" result reports an error.
+template<class T>
+inline bool profile_error(T x) noexcept
+{
+    if constexpr (std::is_convertible_v<T, const variant *>)
+        return x == nullptr || x->xltype() == xltypeErr;
+    else if constexpr (std::is_floating_point_v<T>)
+        return std::isnan(x);
+    else if constexpr (std::is_convertible_v<T, const fp12 *>)
+        return x == nullptr || (x->rows == 1 && x->columns == 1 && std::isnan(x->array[0]));
+    else if constexpr (std::is_pointer_v<T>)
+        return x == nullptr;
+    else
+        return false;
+}
+
+struct alignas(64) profile_shard
+{
+    std::atomic<std::uint64_t> calls{ 0 };
+    std::atomic<std::uint64_t> errors{ 0 };
+    std::atomic<std::uint64_t> total_ns{ 0 };
+    std::atomic<std::uint64_t> max_ns{ 0 };
+    std::atomic<std::uint64_t> argument_bytes{ 0 };
+    std::atomic<std::uint64_t> allocations{ 0 };
+    std::atomic<std::uint64_t> allocated_bytes{ 0 };
+    std::array<std::atomic<std::uint64_t>, profile_buckets> buckets{};
+};
+
+inline std::size_t profile_thread_shard() noexcept
+{
+    static std::atomic<std::size_t> next{ 0 };
+    thread_local const std::size_t shard = next.fetch_add(1, std::memory_order_relaxed) % profile_shards;
+    return shard;
+}
+
+} // namespace detail
+
+/// Allocator of user containers whose allocations are counted by the
+/// profiler.
+template<class T>
+using profiled_allocator = detail::counting_allocator<T>;
+
+/// Aggregated statistics of a function.
+struct function_stats
+{
+    std::wstring name;
+    std::uint64_t calls = 0;
+    std::uint64_t errors = 0;
+    std::uint64_t total_ns = 0;
+    std::uint64_t max_ns = 0;
+    std::uint64_t argument_bytes = 0;
+    std::uint64_t allocations = 0;
+    std::uint64_t allocated_bytes = 0;
+    std::array<std::uint64_t, profile_buckets> histogram{};
+
+    double mean_ns() const noexcept
+        { return calls > 0 ? static_cast<double>(total_ns) / static_cast<double>(calls) : 0.0; }
+
+    /// Upper bound of the latency of fraction q of the calls, in nanoseconds.
+    double percentile_ns(double q) const noexcept
+    {
+        if (calls == 0)
+            return 0.0;
+        const double rank = std::max(1.0, std::ceil(q * static_cast<double>(calls)));
+        double seen = 0.0;
+        for (std::size_t b = 0; b < histogram.size(); ++b) {
+            seen += static_cast<double>(histogram[b]);
+            if (seen >= rank)
+                return std::min(detail::profile_bucket_limit(b), static_cast<double>(max_ns));
+        }
+        return static_cast<double>(max_ns);
+    }
+};
+
+/// Counters of an exported function. Instances are created by
+/// XLL_EXPORT_FUNCTION and live for the lifetime of the add-in.
+class function_profile
+{
+public:
+    explicit function_profile(const wchar_t *name) noexcept : name_(name)
+    {
+        // Profiles are constructed during static initialization.
+        function_profile *head = head_.load(std::memory_order_relaxed);
+        do {
+            next_ = head;
+        } while (!head_.compare_exchange_weak(head, this, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    function_profile(const function_profile&) = delete;
+    function_profile& operator=(const function_profile&) = delete;
+
+    ~function_profile()
+    {
+        for (auto& s : shards_)
+            delete s.load(std::memory_order_relaxed);
+    }
+
+    const wchar_t *name() const noexcept { return name_; }
+
+    void record(std::uint64_t ns, std::uint64_t argument_bytes, bool error,
+        const detail::alloc_counters& allocs = {}) noexcept
+    {
+        detail::profile_shard *s = shard();
+        if (s == nullptr)
+            return;
+        s->calls.fetch_add(1, std::memory_order_relaxed);
+        if (error)
+            s->errors.fetch_add(1, std::memory_order_relaxed);
+        s->total_ns.fetch_add(ns, std::memory_order_relaxed);
+        s->argument_bytes.fetch_add(argument_bytes, std::memory_order_relaxed);
+        s->allocations.fetch_add(allocs.count, std::memory_order_relaxed);
+        s->allocated_bytes.fetch_add(allocs.bytes, std::memory_order_relaxed);
+        s->buckets[detail::profile_bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+        std::uint64_t max = s->max_ns.load(std::memory_order_relaxed);
+        while (ns > max && !s->max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+    }
+
+    /// Sums the shards. Concurrent calls may be partially counted.
+    function_stats stats() const
+    {
+        function_stats r;
+        r.name = name_;
+        for (const auto& p : shards_) {
+            const detail::profile_shard *s = p.load(std::memory_order_acquire);
+            if (s == nullptr)
+                continue;
+            r.calls += s->calls.load(std::memory_order_relaxed);
+            r.errors += s->errors.load(std::memory_order_relaxed);
+            r.total_ns += s->total_ns.load(std::memory_order_relaxed);
+            r.max_ns = std::max(r.max_ns, s->max_ns.load(std::memory_order_relaxed));
+            r.argument_bytes += s->argument_bytes.load(std::memory_order_relaxed);
+            r.allocations += s->allocations.load(std::memory_order_relaxed);
+            r.allocated_bytes += s->allocated_bytes.load(std::memory_order_relaxed);
+            for (std::size_t b = 0; b < profile_buckets; ++b)
+                r.histogram[b] += s->buckets[b].load(std::memory_order_relaxed);
+        }
+        return r;
+    }
+
+    void reset() noexcept
+    {
+        for (auto& p : shards_) {
+            detail::profile_shard *s = p.load(std::memory_order_acquire);
+            if (s == nullptr)
+                continue;
+            s->calls.store(0, std::memory_order_relaxed);
+            s->errors.store(0, std::memory_order_relaxed);
+            s->total_ns.store(0, std::memory_order_relaxed);
+            s->max_ns.store(0, std::memory_order_relaxed);
+            s->argument_bytes.store(0, std::memory_order_relaxed);
+            s->allocations.store(0, std::memory_order_relaxed);
+            s->allocated_bytes.store(0, std::memory_order_relaxed);
+            for (auto& b : s->buckets)
+                b.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /// Invokes fn(const function_profile&) for each profile.
+    template<class Fn>
+    static void for_each(Fn&& fn)
+    {
+        for (auto p = head_.load(std::memory_order_acquire); p != nullptr; p = p->next_)
+            fn(*p);
+    }
+
+private:
+    detail::profile_shard *shard() noexcept
+    {
+        auto& p = shards_[detail::profile_thread_shard()];
+        detail::profile_shard *s = p.load(std::memory_order_acquire);
+        if (BOOST_LIKELY(s != nullptr))
+            return s;
+        auto *created = new (std::nothrow) detail::profile_shard();
+        if (created == nullptr)
+            return nullptr;
+        if (!p.compare_exchange_strong(s, created, std::memory_order_acq_rel)) {
+            delete created;
+            return s;
+        }
+        return created;
+    }
+
+    const wchar_t *name_;
+    function_profile *next_ = nullptr;
+    std::array<std::atomic<detail::profile_shard *>, profile_shards> shards_{};
+
+    static inline std::atomic<function_profile *> head_{ nullptr };
+};
+
+XLL_EXPORT inline variant * __stdcall xll_profile_stats();
+
+/// Switches profiling of exported functions and reports their statistics.
+struct profiler
+{
+    using clock = std::chrono::steady_clock;
+
+    static void enable(bool on = true) noexcept
+        { enabled_.store(on, std::memory_order_relaxed); }
+
+    static bool enabled() noexcept
+        { return enabled_.load(std::memory_order_relaxed); }
+
+    /// Clears the counters of every function.
+    static void reset() noexcept
+        { function_profile::for_each([](function_profile& p) { p.reset(); }); }
+
+    /// Statistics of the functions which have been called, in decreasing
+    /// order of total time.
+    static std::vector<function_stats> stats()
+    {
+        std::vector<function_stats> result;
+        function_profile::for_each([&](const function_profile& p) {
+            function_stats s = p.stats();
+            if (s.calls > 0)
+                result.push_back(std::move(s));
+        });
+        std::sort(result.begin(), result.end(), [](const auto& x, const auto& y) {
+            return x.total_ns > y.total_ns || (x.total_ns == y.total_ns && x.name < y.name);
+        });
+        return result;
+    }
+
+    /// Table of stats() with a header row: function, calls, errors, total
+    /// (ms), mean, p50, p90, p99 and max (us), mean argument size in bytes,
+    /// and mean allocations and allocated bytes per call.
+    static variant table()
+    {
+        static const wchar_t *header[] = { L"Function", L"Calls", L"Errors", L"Total (ms)",
+            L"Mean (us)", L"P50 (us)", L"P90 (us)", L"P99 (us)", L"Max (us)", L"Argument bytes",
+            L"Allocations", L"Allocated bytes" };
+        constexpr unsigned cols = static_cast<unsigned>(std::size(header));
+
+        const std::vector<function_stats> rows = stats();
+        xlmulti m(static_cast<unsigned>(rows.size() + 1), cols);
+        for (unsigned j = 0; j < cols; ++j)
+            m(0, j).emplace<xlstr>(header[j]);
+        for (std::size_t i = 0; i < rows.size(); ++i) {
+            const function_stats& s = rows[i];
+            const unsigned r = static_cast<unsigned>(i + 1);
+            m(r, 0).emplace<xlstr>(s.name);
+            m(r, 1) = static_cast<double>(s.calls);
+            m(r, 2) = static_cast<double>(s.errors);
+            m(r, 3) = static_cast<double>(s.total_ns) * 1e-6;
+            m(r, 4) = s.mean_ns() * 1e-3;
+            m(r, 5) = s.percentile_ns(0.50) * 1e-3;
+            m(r, 6) = s.percentile_ns(0.90) * 1e-3;
+            m(r, 7) = s.percentile_ns(0.99) * 1e-3;
+            m(r, 8) = static_cast<double>(s.max_ns) * 1e-3;
+            m(r, 9) = static_cast<double>(s.argument_bytes) / static_cast<double>(s.calls);
+            m(r, 10) = static_cast<double>(s.allocations) / static_cast<double>(s.calls);
+            m(r, 11) = static_cast<double>(s.allocated_bytes) / static_cast<double>(s.calls);
+        }
+        return variant(std::move(m));
+    }
+
+    /// Registers XLL.STATS() under function_text, returning table(). Call
+    /// from xlAutoOpen. Returns the register ID, or 0 on failure.
+    static double register_stats(const std::wstring& function_text = L"XLL.STATS")
+    {
+        function_options opts;
+        opts.category = L"XLL";
+        opts.function_help = L"Latency statistics of the functions of the add-in";
+        return register_function(&xll_profile_stats, L"xll_profile_stats", function_text, opts,
+            attribute_set<tag::volatile_, tag::thread_safe>());
+    }
+
+    /// Counts a heap allocation of the calling thread in the profile of the
+    /// running exported function, if any. For allocations which do not use
+    /// xlstr, xlmulti or profiled_allocator.
+    static void count_allocation(std::size_t bytes) noexcept
+        { detail::count_allocation(bytes); }
+
+    /// Calls the exported function of export_function E, and records the call
+    /// in profile if the profiler is enabled and in the timeline if the
+    /// tracer is active. Used by XLL_EXPORT_FUNCTION.
+    template<class E, class... Args>
+    static typename E::result_type invoke(function_profile& profile, Args... args) noexcept
+    {
+        if (BOOST_LIKELY(!enabled() && !tracer::active()))
+            return call_recorder::invoke<E>(profile.name(), args...);
+        const bool profiling = enabled();
+        detail::alloc_counters allocs;
+        detail::alloc_counters *outer = detail::current_alloc_counters();
+        if (profiling)
+            detail::current_alloc_counters() = &allocs;
+        const std::uint64_t begin = tracer::timestamp();
+        const auto start = clock::now();
+        auto result = call_recorder::invoke<E>(profile.name(), args...);
+        const auto ns = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+        detail::current_alloc_counters() = outer;
+        if (begin != 0)
+            tracer::record(trace_event_kind::function, profile.name(), begin, begin + ns);
+        if (profiling) {
+            std::uint64_t bytes = 0;
+            ((bytes += detail::profile_argument_size(args)), ...);
+            profile.record(ns, bytes, detail::profile_error(result), allocs);
+        }
+        return result;
+    }
+
+private:
+    static inline std::atomic<bool> enabled_{ false };
+};
+
+XLL_EXPORT inline variant * __stdcall xll_profile_stats()
+{
+    thread_local variant result;
+    try {
+        result = profiler::table();
+    }
+    catch (...) {
+        result.emplace<xlerr>(error::xlerrValue);
+    }
+    return &result;
+}
+
+} // namespace xll
@@ -9,6 +9,8 @@
 
 #include <xll/config.hpp>
 
+#include <xll/detail/memory.hpp>
+
 #include <boost/mp11/utility.hpp>
 #include <boost/nowide/convert.hpp> // Boost 1.73.0
 
@@ -194,6 +196,7 @@ protected:
     {
         std::size_t nbytes = (n + 1) * sizeof(CharT);
         data_ = static_cast<CharT *>(::operator new (nbytes)); // allocate
+        detail::count_allocation(nbytes);
         data_[0] = n;
         if (s != nullptr && n > 0)
             std::copy_n(s, n, &data_[1]);
@@ -224,7 +227,7 @@ protected:
     inline void destroy()
     {
         if (data_ != nullptr) {
-            delete data_;
+            ::operator delete(data_);
             data_ = nullptr;
         }
     }
@@ -286,6 +289,7 @@ public:
         const size_type nchars = static_cast<size_type>(
             std::char_traits<FromCharT>::length(s)); // truncate
         std::basic_string<CharT> wide = boost::nowide::widen(s, nchars);
+        detail::count_allocation(wide);
         internal_copy(wide);
     }
 
@@ -297,6 +301,7 @@ public:
         const size_type nchars = static_cast<size_type>(
             std::char_traits<FromCharT>::length(cs)); // truncate
         std::basic_string<CharT> wide = boost::nowide::widen(cs, nchars);
+        detail::count_allocation(wide);
         internal_copy(wide);
     }
 
@@ -307,6 +312,7 @@ public:
         const size_type nchars = static_cast<size_type>(
             std::char_traits<FromCharT>::length(s)); // truncate
         std::basic_string<CharT> narrow = boost::nowide::narrow(s, nchars);
+        detail::count_allocation(narrow);
         internal_copy(narrow);
     }
 
@@ -318,6 +324,7 @@ public:
         const size_type nchars = static_cast<size_type>(
             std::char_traits<FromCharT>::length(cs)); // truncate
         std::basic_string<CharT> narrow = boost::nowide::narrow(cs, nchars);
+        detail::count_allocation(narrow);
         internal_copy(narrow);
     }
 
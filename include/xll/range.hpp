@@ -0,0 +1,327 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file range.hpp
+ * Lazy range reference arguments (type U).
+ *
+ * Arguments registered as type Q are coerced by Excel before the call, which
+ * copies every cell of a range. A range_ref argument receives the reference
+ * itself, and values are read with xlCoerce only when requested: either a
+ * single cell with cell(), or the whole area with values().
+ *
+ * xlCoerce fails with xlretUncalced when a referenced cell has not been
+ * calculated yet. The function must then return at once; Excel discards the
+ * result and calls it again once the cell is calculated:
+ *
+ * \code
+ * int rc;
+ * auto v = range.values(&rc);
+ * if (rc == xll::xlretUncalced)
+ *     return nullptr;
+ * \endcode
+ *
+ * Coerced areas can be shared between calls within one calculation. Caching
+ * is disabled by default; an add-in which enables it must invalidate the cache
+ * when calculation ends or is canceled:
+ *
+ * \code
+ * XLL_EXPORT int __stdcall on_calculation_ended()
+ * {
+ *     xll::range_cache::invalidate();
+ *     return 1;
+ * }
+ *
+ * // xlAutoOpen
+ * xll::range_cache::enable();
+ * xll::register_event(L"on_calculation_ended", xll::xleventCalculationEnded);
+ * xll::register_event(L"on_calculation_ended", xll::xleventCalculationCanceled);
+ * \endcode
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/constants.hpp>
+#include <xll/callback.hpp>
+#include <xll/functions.hpp>
+#include <xll/xloper.hpp>
+#include <xll/detail/hash_index.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+
+namespace xll {
+
+/// Identifies a single rectangular area on a sheet.
+struct range_key
+{
+    uintptr_t sheet = 0;
+    int32_t rwFirst = 0;
+    int32_t rwLast = 0;
+    int32_t colFirst = 0;
+    int32_t colLast = 0;
+
+    friend bool operator==(const range_key& lhs, const range_key& rhs) noexcept
+    {
+        return lhs.sheet == rhs.sheet &&
+            lhs.rwFirst == rhs.rwFirst && lhs.rwLast == rhs.rwLast &&
+            lhs.colFirst == rhs.colFirst && lhs.colLast == rhs.colLast;
+    }
+};
+
+struct range_key_hash
+{
+    std::size_t operator()(const range_key& k) const noexcept
+    {
+        std::uint64_t h = static_cast<std::uint64_t>(k.sheet);
+        h = h * 31 + static_cast<uint32_t>(k.rwFirst);
+        h = h * 31 + static_cast<uint32_t>(k.rwLast);
+        h = h * 31 + static_cast<uint32_t>(k.colFirst);
+        h = h * 31 + static_cast<uint32_t>(k.colLast);
+        return detail::mix_hash(h);
+    }
+};
+
+/// Cache of coerced range values, valid for one calculation. Lock-striped so
+/// that functions evaluated in parallel during multi-threaded recalculation
+/// contend only when they hash to the same shard.
+struct range_cache
+{
+    using value_type = std::shared_ptr<const variant>;
+
+    static void enable(bool value = true) noexcept
+        { enabled_.store(value, std::memory_order_release); }
+
+    static bool enabled() noexcept
+        { return enabled_.load(std::memory_order_acquire); }
+
+    static value_type find(const range_key& key)
+    {
+        auto& s = shard(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.map.find(key);
+        return it != s.map.end() ? it->second : value_type();
+    }
+
+    static void insert(const range_key& key, value_type value)
+    {
+        auto& s = shard(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.map.emplace(key, std::move(value));
+    }
+
+    /// Discards all cached values. Call when calculation ends or is canceled.
+    static void invalidate()
+    {
+        for (auto& s : shards_) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.map.clear();
+        }
+    }
+
+private:
+    struct alignas(64) shard_type
+    {
+        std::mutex mutex;
+        std::unordered_map<range_key, value_type, range_key_hash> map;
+    };
+
+    static shard_type& shard(const range_key& key) noexcept
+        { return shards_[range_key_hash()(key) % shards_.size()]; }
+
+    static inline std::atomic<bool> enabled_{ false };
+    static inline std::array<shard_type, 16> shards_;
+};
+
+/// Range reference or value argument (type U). Layout-compatible with
+/// XLOPER12; Excel passes a pointer to this type.
+struct range_ref : variant
+{
+    using variant::variant;
+
+    range_ref() = default;
+
+    /// Returns true if the argument is a reference rather than a value.
+    bool is_reference() const noexcept
+        { return xltype() == xltypeSRef || xltype() == xltypeRef; }
+
+    /// Returns the number of areas in the reference.
+    std::size_t area_count() const noexcept
+    {
+        if (xltype() == xltypeSRef)
+            return 1;
+        if (xltype() == xltypeRef && get<xlref>().lpmref != nullptr)
+            return get<xlref>().lpmref->count;
+        return 0;
+    }
+
+    /// Number of rows in the first area, or of the value, without coercion.
+    unsigned rows() const noexcept
+    {
+        if (is_reference()) {
+            area a = first_area();
+            return static_cast<unsigned>(a.rwLast - a.rwFirst + 1);
+        }
+        if (xltype() == xltypeMulti)
+            return get<xlmulti>().size1();
+        return 1;
+    }
+
+    /// Number of columns in the first area, or of the value, without coercion.
+    unsigned columns() const noexcept
+    {
+        if (is_reference()) {
+            area a = first_area();
+            return static_cast<unsigned>(a.colLast - a.colFirst + 1);
+        }
+        if (xltype() == xltypeMulti)
+            return get<xlmulti>().size2();
+        return 1;
+    }
+
+    /// Returns the values of a single-area reference as xltypeMulti, or the
+    /// value itself if the argument is not a reference. Coerced values are
+    /// owned by the DLL and may be shared with other calls through
+    /// range_cache. If rc is not null it receives the return code of
+    /// xlCoerce; when coercion fails the result is #VALUE! and is not cached.
+    std::shared_ptr<const variant> values(int *rc = nullptr) const
+    {
+        if (rc != nullptr)
+            *rc = XLRET::xlretSuccess;
+        if (!is_reference())
+            return std::shared_ptr<const variant>(std::shared_ptr<void>(), this);
+
+        range_key key;
+        const bool cacheable = range_cache::enabled() && make_key(key);
+        if (cacheable) {
+            if (auto cached = range_cache::find(key))
+                return cached;
+        }
+
+        int ret;
+        variant result = coerce<xltypeMulti>(this, ret);
+        if (rc != nullptr)
+            *rc = ret;
+        if (ret != XLRET::xlretSuccess)
+            return std::make_shared<const variant>(error::xlerrValue);
+        auto owned = std::make_shared<variant>(result); // copy from Excel memory
+        owned->clear_flags();
+        if (cacheable && owned->xltype() == xltypeMulti)
+            range_cache::insert(key, owned);
+        return owned;
+    }
+
+    /// Returns the value of the cell at (i, j), relative to the top left cell
+    /// of the first area, or of the value if the argument is not a
+    /// reference. Coerces only that cell unless the area is cached. Returns
+    /// #REF! if (i, j) is outside rows() and columns(). If rc is not null it
+    /// receives the return code of xlCoerce; when coercion fails the result
+    /// is #VALUE!.
+    variant cell(unsigned i, unsigned j, int *rc = nullptr) const
+    {
+        if (rc != nullptr)
+            *rc = XLRET::xlretSuccess;
+        if (i >= rows() || j >= columns())
+            return variant(error::xlerrRef);
+        if (!is_reference()) {
+            if (xltype() == xltypeMulti)
+                return get<xlmulti>()(i, j);
+            return *this;
+        }
+
+        range_key key;
+        if (range_cache::enabled() && make_key(key)) {
+            if (auto cached = range_cache::find(key))
+                return cached->get<xlmulti>()(i, j);
+        }
+
+        area a = first_area();
+        const int32_t rw = a.rwFirst + static_cast<int32_t>(i);
+        const int32_t col = a.colFirst + static_cast<int32_t>(j);
+
+        variant ref;
+        std::remove_pointer_t<decltype(xlref::lpmref)> mref;
+        if (xltype() == xltypeSRef) {
+            xlsref sref;
+            sref.ref.rwFirst = sref.ref.rwLast = rw;
+            sref.ref.colFirst = sref.ref.colLast = col;
+            ref.emplace<xlsref>(sref);
+        }
+        else {
+            mref.count = 1;
+            mref.reftbl[0].rwFirst = mref.reftbl[0].rwLast = rw;
+            mref.reftbl[0].colFirst = mref.reftbl[0].colLast = col;
+            xlref r;
+            r.lpmref = &mref;
+            r.idSheet = get<xlref>().idSheet;
+            ref.emplace<xlref>(r);
+        }
+
+        int ret;
+        variant result = coerce<xltypeNum, xltypeStr, xltypeBool, xltypeErr>(&ref, ret);
+        if (rc != nullptr)
+            *rc = ret;
+        if (ret != XLRET::xlretSuccess)
+            return variant(error::xlerrValue);
+        variant owned(result);
+        owned.clear_flags();
+        return owned;
+    }
+
+private:
+    struct area { int32_t rwFirst, rwLast, colFirst, colLast; };
+
+    area first_area() const noexcept
+    {
+        if (xltype() == xltypeSRef) {
+            const auto& r = get<xlsref>().ref;
+            return { r.rwFirst, r.rwLast, r.colFirst, r.colLast };
+        }
+        const auto *mref = get<xlref>().lpmref;
+        if (mref == nullptr || mref->count == 0)
+            return { 0, -1, 0, -1 }; // no cells
+        const auto& r = mref->reftbl[0];
+        return { r.rwFirst, r.rwLast, r.colFirst, r.colLast };
+    }
+
+    // Builds a cache key for a single-area reference. The sheet of an
+    // xltypeSRef is that of the calling cell, obtained with xlfCaller.
+    bool make_key(range_key& key) const
+    {
+        if (area_count() != 1)
+            return false;
+
+        if (xltype() == xltypeRef) {
+            key.sheet = get<xlref>().idSheet;
+        }
+        else {
+            variant caller;
+            if (Excel12(xlfCaller, &caller) != XLRET::xlretSuccess || caller.xltype() != xltypeRef)
+                return false;
+            key.sheet = caller.get<xlref>().idSheet;
+        }
+
+        area a = first_area();
+        key.rwFirst = a.rwFirst;
+        key.rwLast = a.rwLast;
+        key.colFirst = a.colFirst;
+        key.colLast = a.colLast;
+        return true;
+    }
+};
+
+static_assert(sizeof(range_ref) == sizeof(variant), "invalid sizeof(range_ref)");
+
+} // namespace xll
@@ -0,0 +1,719 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file record.hpp
+ * Recording of calls to and from Excel, and offline replay.
+ *
+ * While call_recorder is active, every callback made through Excel12v is
+ * written to a trace file with its arguments, result and return code, and so
+ * is every call of a function exported with XLL_EXPORT_FUNCTION, with its
+ * arguments, result and duration. trace_replayer calls the exported functions
+ * again from the trace without Excel, and answers their callbacks with the
+ * recorded results, so that a slow calculation captured on a user's machine
+ * can be reproduced and profiled on another host.
+ *
+ * \code
+ * // commands run by the user
+ * xll::call_recorder::start(path);
+ * xll::call_recorder::stop();
+ *
+ * // entry point called by a replay tool which loads the add-in
+ * XLL_EXPORT int __stdcall xll_replay(const char *path, int repeat)
+ * {
+ *     return xll::trace_replayer::main(path, repeat);
+ * }
+ * \endcode
+ *
+ * When the recorder is inactive, an exported function pays for one relaxed
+ * atomic load and a callback for one acquire load.
+ *
+ * Values are stored with the encoding of serialize.hpp. References are not
+ * values and are recorded as #N/A, so functions which read range_ref
+ * arguments or references returned by callbacks see #N/A in replay. The
+ * callbacks of a call are answered in the order in which they were made; a
+ * callback with another function number, or one made after the recorded ones
+ * are used up, fails with xlretFailed. Callbacks made outside exported
+ * functions, for example in xlAutoOpen, are recorded but not replayed, and
+ * xlFree is neither. Calls are replayed on one thread in the order in which
+ * they returned.
+ *
+ * Format:
+ *
+ *   char[4] "XLLT", uint16 version, uint16 reserved, records
+ *
+ *   record    uint16 kind, uint16 reserved, uint32 thread, uint64 time in
+ *             nanoseconds since start(), uint32 payload size, payload
+ *   callback  uint64 call id or 0, int32 xlfn, int32 return code, uint32
+ *             argument count, encoded arguments, encoded result
+ *   call      uint64 call id, uint64 duration in nanoseconds, uint32 name
+ *             length, UTF-16 name, uint32 argument count, encoded arguments,
+ *             encoded result
+ *
+ * with the encoding described in detail/binary.hpp.
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/constants.hpp>
+#include <xll/fp12.hpp>
+#include <xll/range.hpp>
+#include <xll/xloper.hpp>
+#include <xll/detail/binary.hpp>
+#include <xll/detail/callback.hpp>
+#include <xll/detail/marshal.hpp>
+#include <xll/log.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace xll {
+
+/// Version of the trace format written by call_recorder.
+constexpr std::uint16_t trace_version = 1;
+
+namespace detail {
+
+constexpr std::size_t trace_header = 8;
+constexpr std::size_t trace_record_header = 2 + 2 + 4 + 8 + 4;
+
+enum trace_kind : std::uint16_t { trace_callback = 1, trace_call = 2 };
+
+// Value recorded for an extern "C" argument or result. Returns the variant
+// itself for Q and U types, or a copy in temp.
+template<class T>
+inline const variant& trace_value(T x, variant& temp)
+{
+    if constexpr (std::is_convertible_v<T, const variant *>) {
+        if (x != nullptr)
+            return *x;
+        temp.emplace<xlmissing>();
+    }
+    else if constexpr (std::is_same_v<T, bool>)
+        temp.emplace<xlbool>(x);
+    else if constexpr (std::is_arithmetic_v<T>)
+        temp.emplace<xlnum>(static_cast<double>(x));
+    else if constexpr (std::is_convertible_v<T, const wchar_t *>) {
+        if (x != nullptr) {
+            const std::size_t n = std::min<std::size_t>(std::wcslen(x), 32767);
+            temp.emplace<xlstr>(x, static_cast<xlstr::size_type>(n));
+        }
+        else
+            temp.emplace<xlmissing>();
+    }
+    else if constexpr (std::is_convertible_v<T, const fp12 *>) {
+        if (x != nullptr && x->rows > 0 && x->columns > 0) {
+            xlmulti m(static_cast<unsigned>(x->rows), static_cast<unsigned>(x->columns));
+            for (std::size_t i = 0; i < m.size(); ++i)
+                m[i] = x->array[i];
+            temp.emplace<xlmulti>(std::move(m));
+        }
+        else
+            temp.emplace<xlmissing>();
+    }
+    else
+        temp.emplace<xlerr>(error::xlerrNA);
+    return temp;
+}
+
+// Converts a recorded value back to the extern "C" argument type T. The
+// holder owns any storage which the argument points to.
+template<class T, class E = void>
+struct replay_argument
+{
+    T get(const variant& v) const { return from_variant<T>(v); }
+};
+
+template<>
+struct replay_argument<const wchar_t *>
+{
+    std::wstring value;
+    const wchar_t * get(const variant& v)
+    {
+        if (v.xltype() == xltypeMissing)
+            return nullptr;
+        value = from_variant<std::wstring>(v);
+        return value.c_str();
+    }
+};
+
+template<>
+struct replay_argument<const fp12 *>
+{
+    std::vector<double> value;
+    const fp12 * get(const variant& v)
+    {
+        if (v.xltype() != xltypeMulti)
+            return nullptr;
+        const auto& m = v.get<xlmulti>();
+        value.assign(m.size() + 1, 0.0); // header
+        auto *p = reinterpret_cast<fp12 *>(value.data());
+        p->rows = static_cast<int32_t>(m.size1());
+        p->columns = static_cast<int32_t>(m.size2());
+        for (std::size_t i = 0; i < m.size(); ++i)
+            p->array[i] = from_variant<double>(m[i]);
+        return p;
+    }
+};
+
+template<>
+struct replay_argument<variant *>
+{
+    variant value;
+    variant * get(const variant& v) { value = v; return &value; }
+};
+
+template<>
+struct replay_argument<range_ref *>
+{
+    range_ref value;
+    range_ref * get(const variant& v) { static_cast<variant&>(value) = v; return &value; }
+};
+
+// Calls the exported function of export_function E with recorded arguments.
+template<class E, std::size_t... Is>
+inline variant replay_invoke(const variant *args, std::index_sequence<Is...>)
+{
+    std::tuple<replay_argument<typename E::template arg_type<Is>>...> holders;
+    variant temp;
+    variant result = trace_value(E::invoke(std::get<Is>(holders).get(args[Is])...), temp);
+    result.clear_flags();
+    return result;
+}
+
+} // namespace detail
+
+/// Exported functions which trace_replayer can call by name. Functions
+/// defined with XLL_EXPORT_FUNCTION are added when the add-in is loaded.
+struct replay_functions
+{
+    using function_type = variant (*)(const variant *args, std::size_t n);
+
+    /// Defines the exported function of export_function E under name.
+    template<class E>
+    static bool define(std::wstring name)
+    {
+        return define(std::move(name), [](const variant *args, std::size_t n) {
+            if (n != E::arity)
+                throw std::invalid_argument("invalid number of arguments");
+            return detail::replay_invoke<E>(args, std::make_index_sequence<E::arity>());
+        });
+    }
+
+    static bool define(std::wstring name, function_type fn)
+    {
+        auto& t = table();
+        std::lock_guard<std::mutex> lock(t.mutex);
+        t.functions[std::move(name)] = fn;
+        return true;
+    }
+
+    /// Returns the function, or nullptr.
+    static function_type find(const std::wstring& name)
+    {
+        auto& t = table();
+        std::lock_guard<std::mutex> lock(t.mutex);
+        auto it = t.functions.find(name);
+        return it != t.functions.end() ? it->second : nullptr;
+    }
+
+    static std::size_t size()
+    {
+        auto& t = table();
+        std::lock_guard<std::mutex> lock(t.mutex);
+        return t.functions.size();
+    }
+
+private:
+    struct table_type
+    {
+        std::mutex mutex;
+        std::unordered_map<std::wstring, function_type> functions;
+    };
+
+    // Functions are defined during static initialization of the add-in, so
+    // the table is constructed on first use.
+    static table_type& table()
+    {
+        static table_type t;
+        return t;
+    }
+};
+
+/// Records callbacks and calls of exported functions to a trace file.
+struct call_recorder
+{
+    using clock = std::chrono::steady_clock;
+
+    /// Starts recording to path, replacing the file. Returns false if the
+    /// recorder is already active, another entry point is installed, or the
+    /// file cannot be opened.
+    static bool start(const std::filesystem::path& path)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stream_.is_open())
+            return false;
+        detail::EXCEL12PROC<> expected = nullptr;
+        if (!detail::callback_override().compare_exchange_strong(expected, &entry)) {
+            xll::log()->error("Recording failed: another entry point is installed");
+            return false;
+        }
+        stream_.open(path, std::ios::binary | std::ios::trunc);
+        if (!stream_) {
+            stream_ = std::ofstream();
+            detail::callback_override().store(nullptr, std::memory_order_release);
+            xll::log()->error("Recording failed: cannot open {}", path.string());
+            return false;
+        }
+        unsigned char header[detail::trace_header];
+        detail::binary_writer w(header);
+        for (char c : { 'X', 'L', 'L', 'T' })
+            w.write(static_cast<std::uint8_t>(c));
+        w.write(trace_version);
+        w.write(std::uint16_t(0));
+        stream_.write(reinterpret_cast<const char *>(header), sizeof(header));
+        records_ = 0;
+        epoch_.store(clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        active_.store(true, std::memory_order_release);
+        return true;
+    }
+
+    /// Stops recording and closes the file. Returns false if a write failed.
+    static bool stop()
+    {
+        active_.store(false, std::memory_order_release);
+        detail::EXCEL12PROC<> expected = &entry;
+        detail::callback_override().compare_exchange_strong(expected, nullptr);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!stream_.is_open())
+            return true;
+        stream_.close();
+        const bool ok = !stream_.fail();
+        stream_ = std::ofstream();
+        return ok;
+    }
+
+    static bool active() noexcept
+        { return active_.load(std::memory_order_relaxed); }
+
+    /// Number of records written since start().
+    static std::uint64_t records()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return records_;
+    }
+
+    /// Calls the exported function of export_function E, and records the call
+    /// if the recorder is active. Used by XLL_EXPORT_FUNCTION.
+    template<class E, class... Args>
+    static typename E::result_type invoke(const wchar_t *name, Args... args) noexcept
+    {
+        if (BOOST_LIKELY(!active()))
+            return E::invoke(args...);
+
+        const std::uint64_t id = next_call_.fetch_add(1, std::memory_order_relaxed);
+        const std::uint64_t outer = std::exchange(call_id(), id);
+        const auto start = clock::now();
+        auto result = E::invoke(args...);
+        const auto duration = clock::now() - start;
+        call_id() = outer;
+
+        try {
+            variant temps[sizeof...(Args) + 1];
+            const variant *values[sizeof...(Args) + 1];
+            std::size_t i = 0;
+            ((values[i] = &detail::trace_value(args, temps[i]), ++i), ...);
+            const variant& value = detail::trace_value(result, temps[i]);
+
+            const std::size_t len = std::wcslen(name);
+            std::size_t size = 8 + 8 + 4 + 2 * len + 4 + detail::encoded_size(value);
+            for (std::size_t k = 0; k < sizeof...(Args); ++k)
+                size += detail::encoded_size(*values[k]);
+            write(detail::trace_call, size, [&](detail::binary_writer& w) {
+                w.write(id);
+                w.write(static_cast<std::uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()));
+                w.write(static_cast<std::uint32_t>(len));
+                w.write_chars(name, len);
+                w.write(static_cast<std::uint32_t>(sizeof...(Args)));
+                for (std::size_t k = 0; k < sizeof...(Args); ++k)
+                    detail::encode(w, *values[k]);
+                detail::encode(w, value);
+            });
+        }
+        catch (...) {
+            xll::log()->error("Recording failed: call not recorded");
+        }
+        return result;
+    }
+
+private:
+    // Installed in place of the host entry point while recording.
+    static int __stdcall entry(int xlfn, int coper, void **opers, void *result)
+    {
+        auto pfn = detail::HostCallBack12();
+        if (pfn == nullptr)
+            return xlretFailed;
+        const int rc = (pfn)(xlfn, coper, opers, result);
+        if (xlfn == xlFree || !active())
+            return rc;
+
+        try {
+            auto **args = reinterpret_cast<variant **>(opers);
+            const std::size_t n = coper > 0 ? static_cast<std::size_t>(coper) : 0;
+            std::vector<variant> temps(n + 1);
+            variant nil;
+            const variant& value = result != nullptr && rc == xlretSuccess
+                ? *static_cast<const variant *>(result) : nil;
+            std::size_t size = 8 + 4 + 4 + 4 + detail::encoded_size(value);
+            for (std::size_t i = 0; i < n; ++i)
+                size += detail::encoded_size(detail::trace_value(args[i], temps[i]));
+            write(detail::trace_callback, size, [&](detail::binary_writer& w) {
+                w.write(call_id());
+                w.write(static_cast<std::int32_t>(xlfn));
+                w.write(static_cast<std::int32_t>(rc));
+                w.write(static_cast<std::uint32_t>(n));
+                for (std::size_t i = 0; i < n; ++i)
+                    detail::encode(w, detail::trace_value(args[i], temps[i]));
+                detail::encode(w, value);
+            });
+        }
+        catch (...) {
+            xll::log()->error("Recording failed: callback not recorded");
+        }
+        return rc;
+    }
+
+    template<class F>
+    static void write(detail::trace_kind kind, std::size_t size, F&& fill)
+    {
+        thread_local std::vector<unsigned char> buffer;
+        buffer.resize(detail::trace_record_header + size);
+        detail::binary_writer w(buffer.data());
+        w.write(static_cast<std::uint16_t>(kind));
+        w.write(std::uint16_t(0));
+        w.write(thread_index());
+        const auto now = clock::now().time_since_epoch().count() - epoch_.load(std::memory_order_relaxed);
+        w.write(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock::duration(now)).count()));
+        w.write(static_cast<std::uint32_t>(size));
+        fill(w);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stream_.is_open()) {
+            stream_.write(reinterpret_cast<const char *>(buffer.data()),
+                static_cast<std::streamsize>(buffer.size()));
+            ++records_;
+        }
+    }
+
+    // Identifier of the exported function running on this thread, or 0.
+    static std::uint64_t& call_id() noexcept
+    {
+        thread_local std::uint64_t id = 0;
+        return id;
+    }
+
+    static std::uint32_t thread_index() noexcept
+    {
+        thread_local const std::uint32_t index = next_thread_.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+
+    static inline std::mutex mutex_;
+    static inline std::ofstream stream_;
+    static inline std::uint64_t records_ = 0;
+    static inline std::atomic<bool> active_{ false };
+    static inline std::atomic<clock::rep> epoch_{ 0 };
+    static inline std::atomic<std::uint64_t> next_call_{ 1 };
+    static inline std::atomic<std::uint32_t> next_thread_{ 1 };
+};
+
+/// Record of a trace file.
+struct trace_record
+{
+    detail::trace_kind kind = detail::trace_callback;
+    std::uint32_t thread = 0;
+    std::chrono::nanoseconds time{ 0 };
+    std::uint64_t call = 0;             // call id; 0 for callbacks outside calls
+    int xlfn = 0;                       // callbacks
+    int rc = xlretSuccess;              // callbacks
+    std::wstring name;                  // calls
+    std::chrono::nanoseconds duration{ 0 }; // calls
+    std::vector<variant> args;
+    variant result;
+};
+
+/// Reads a trace written by call_recorder. Returns false if the data is
+/// truncated, malformed or of another version.
+inline bool parse_trace(const unsigned char *p, std::size_t n, std::vector<trace_record>& records)
+{
+    detail::binary_reader r(p, n);
+    std::uint8_t magic[4] = {};
+    for (auto& c : magic)
+        r.read(c);
+    std::uint16_t version = 0, reserved;
+    r.read(version);
+    r.read(reserved);
+    if (r.failed() || std::memcmp(magic, "XLLT", 4) != 0 || version != trace_version)
+        return false;
+
+    records.clear();
+    while (r.remaining() > 0) {
+        std::uint16_t kind;
+        std::uint32_t thread, size;
+        std::uint64_t time;
+        r.read(kind);
+        r.read(reserved);
+        r.read(thread);
+        r.read(time);
+        if (!r.read(size) || !r.require(size))
+            return false;
+        detail::binary_reader payload(r.data(), size);
+        r.skip(size);
+        if (kind != detail::trace_callback && kind != detail::trace_call)
+            continue; // written by a later version
+
+        trace_record rec;
+        rec.kind = static_cast<detail::trace_kind>(kind);
+        rec.thread = thread;
+        rec.time = std::chrono::nanoseconds(time);
+        payload.read(rec.call);
+        if (rec.kind == detail::trace_callback) {
+            std::int32_t xlfn = 0, rc = 0;
+            payload.read(xlfn);
+            payload.read(rc);
+            rec.xlfn = xlfn;
+            rec.rc = rc;
+        }
+        else {
+            std::uint64_t duration = 0;
+            std::uint32_t len = 0;
+            payload.read(duration);
+            if (!payload.read(len) || !payload.require(std::size_t(len) * 2))
+                return false;
+            rec.duration = std::chrono::nanoseconds(duration);
+            rec.name.resize(len);
+            payload.read_chars(rec.name.data(), len);
+        }
+        std::uint32_t count = 0;
+        if (!payload.read(count) || count > payload.remaining() / 2)
+            return false;
+        rec.args.resize(count);
+        for (auto& x : rec.args) {
+            if (!detail::decode(payload, x))
+                return false;
+        }
+        if (!detail::decode(payload, rec.result) || payload.remaining() != 0)
+            return false;
+        records.push_back(std::move(rec));
+    }
+    return true;
+}
+
+inline bool read_trace(const std::filesystem::path& path, std::vector<trace_record>& records)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream)
+        return false;
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    return parse_trace(data.data(), data.size(), records);
+}
+
+/// Outcome of trace_replayer::run().
+struct replay_report
+{
+    std::size_t calls = 0;              // calls made
+    std::size_t mismatches = 0;         // calls with a result other than the recorded one
+    std::size_t missing = 0;            // calls of functions not in replay_functions
+    std::size_t failed_callbacks = 0;   // callbacks without a matching record
+    std::chrono::nanoseconds elapsed{ 0 };
+};
+
+/// Calls the exported functions recorded in a trace, answering their
+/// callbacks from the trace.
+class trace_replayer
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    trace_replayer() = default;
+    explicit trace_replayer(std::vector<trace_record> records) { assign(std::move(records)); }
+
+    trace_replayer(const trace_replayer&) = delete;
+    trace_replayer& operator=(const trace_replayer&) = delete;
+
+    bool load(const std::filesystem::path& path)
+    {
+        std::vector<trace_record> records;
+        if (!read_trace(path, records))
+            return false;
+        assign(std::move(records));
+        return true;
+    }
+
+    void assign(std::vector<trace_record> records)
+    {
+        records_ = std::move(records);
+        steps_.clear();
+        std::unordered_map<std::uint64_t, std::vector<const trace_record *>> callbacks;
+        for (const auto& rec : records_) {
+            if (rec.kind == detail::trace_callback) {
+                if (rec.call != 0)
+                    callbacks[rec.call].push_back(&rec);
+            }
+            else {
+                auto it = callbacks.find(rec.call);
+                steps_.push_back({ &rec, replay_functions::find(rec.name),
+                    it != callbacks.end() ? std::move(it->second) : std::vector<const trace_record *>() });
+            }
+        }
+    }
+
+    /// Number of calls in the trace.
+    std::size_t size() const noexcept { return steps_.size(); }
+
+    /// Replays every call repeat times. Returns an empty report if another
+    /// entry point is installed.
+    replay_report run(std::size_t repeat = 1)
+    {
+        replay_report report;
+        detail::EXCEL12PROC<> expected = nullptr;
+        if (!detail::callback_override().compare_exchange_strong(expected, &entry)) {
+            xll::log()->error("Replay failed: another entry point is installed");
+            return report;
+        }
+        active_ = this;
+        report_ = &report;
+
+        const auto start = clock::now();
+        for (std::size_t k = 0; k < repeat; ++k) {
+            for (const auto& step : steps_) {
+                if (step.fn == nullptr) {
+                    ++report.missing;
+                    continue;
+                }
+                current_ = &step;
+                next_ = 0;
+                variant result;
+                try {
+                    result = step.fn(step.call->args.data(), step.call->args.size());
+                }
+                catch (const std::exception& e) {
+                    xll::log()->error("Caught exception: {}", e.what());
+                    result.emplace<xlerr>(error::xlerrValue);
+                }
+                ++report.calls;
+                if (!same(result, step.call->result))
+                    ++report.mismatches;
+            }
+        }
+        report.elapsed = clock::now() - start;
+
+        current_ = nullptr;
+        report_ = nullptr;
+        active_ = nullptr;
+        detail::callback_override().store(nullptr, std::memory_order_release);
+        return report;
+    }
+
+    /// Replays the trace at path and logs a summary. Returns 0 if every call
+    /// was made and returned its recorded result, 1 if the trace cannot be
+    /// read and 2 otherwise.
+    static int main(const char *path, int repeat = 1)
+    {
+        trace_replayer replayer;
+        if (path == nullptr || !replayer.load(path)) {
+            xll::log()->error("Replay failed: cannot read {}", path ? path : "");
+            return 1;
+        }
+        const replay_report report = replayer.run(repeat > 0 ? static_cast<std::size_t>(repeat) : 1);
+        xll::log()->info("Replayed {} calls in {} ms: {} mismatched results, {} missing functions, {} failed callbacks",
+            report.calls, std::chrono::duration_cast<std::chrono::milliseconds>(report.elapsed).count(),
+            report.mismatches, report.missing, report.failed_callbacks);
+        return report.calls > 0 && report.mismatches == 0 && report.missing == 0 &&
+            report.failed_callbacks == 0 ? 0 : 2;
+    }
+
+private:
+    struct step
+    {
+        const trace_record *call;
+        replay_functions::function_type fn;
+        std::vector<const trace_record *> callbacks;
+    };
+
+    static bool same(const variant& x, const variant& y)
+    {
+        const std::size_t n = detail::encoded_size(x);
+        if (n != detail::encoded_size(y))
+            return false;
+        std::vector<unsigned char> a(n), b(n);
+        detail::binary_writer wa(a.data()), wb(b.data());
+        detail::encode(wa, x);
+        detail::encode(wb, y);
+        return a == b;
+    }
+
+    // Installed in place of the host entry point while replaying. Results
+    // are copies owned by the DLL, which xlFree destroys.
+    static int __stdcall entry(int xlfn, int coper, void **opers, void *result)
+    {
+        if (xlfn == xlFree) {
+            for (int i = 0; i < coper; ++i) {
+                if (auto *p = static_cast<variant *>(opers[i])) {
+                    p->reset_flags(xlbitXLFree);
+                    p->release();
+                }
+            }
+            return xlretSuccess;
+        }
+
+        trace_replayer *self = active_;
+        if (self == nullptr || self->current_ == nullptr)
+            return xlretFailed;
+        const auto& callbacks = self->current_->callbacks;
+        if (self->next_ >= callbacks.size() || callbacks[self->next_]->xlfn != xlfn) {
+            ++self->report_->failed_callbacks;
+            return xlretFailed;
+        }
+        const trace_record& rec = *callbacks[self->next_++];
+        if (result != nullptr && rec.rc == xlretSuccess)
+            *static_cast<variant *>(result) = rec.result;
+        return rec.rc;
+    }
+
+    std::vector<trace_record> records_;
+    std::vector<step> steps_;
+    const step *current_ = nullptr;
+    std::size_t next_ = 0;
+    replay_report *report_ = nullptr;
+
+    static inline trace_replayer *active_ = nullptr;
+};
+
+} // namespace xll
@@ -13,19 +13,23 @@
 #include <xll/constants.hpp>
 #include <xll/callback.hpp>
 #include <xll/functions.hpp>
+#include <xll/startup.hpp>
 #include <xll/xloper.hpp>
+#include <xll/detail/hash_index.hpp>
 #include <xll/detail/type_text.hpp>
 #include <xll/log.hpp>
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstdint>
 #include <functional>
-#include <map>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
 #include <type_traits>
-#include <typeindex>
-#include <typeinfo>
+#include <vector>
 
 namespace xll {
 
@@ -46,41 +50,206 @@ struct function_options
     std::vector<std::wstring> argument_help;
 };
 
-struct registry_map
+/// Registration record for a worksheet function or command. All fields other
+/// than the register id are immutable once the entry has been published.
+struct function_entry
 {
-    static std::map<std::type_index, double>& instance() {
-        static std::map<std::type_index, double> instance;
-        return instance;
-    }
+    const void *address = nullptr;
+    std::wstring export_name;
+    std::wstring function_text;
+    std::wstring type_text;
+    function_options options;
 
-private:
-    registry_map() = default;
-    ~registry_map() = default;
-    registry_map(const registry_map&) = delete;
-    registry_map& operator=(const registry_map&) = delete;
+    /// Register ID returned by xlfRegister; 0 if not currently registered.
+    std::atomic<double> id{ 0.0 };
+
+    /// Next entry in registration order.
+    std::atomic<function_entry *> next{ nullptr };
+
+    bool registered() const noexcept
+        { return id.load(std::memory_order_acquire) != 0.0; }
+};
+
+namespace detail {
+
+template<class F>
+inline const void * function_address(F ptr) noexcept
+{
+    static_assert(std::is_function_v<std::remove_pointer_t<F>>, "invalid function pointer");
+    return reinterpret_cast<const void *>(ptr); // conditionally-supported
+}
+
+struct entry_address_key
+{
+    static std::size_t hash(const void *p) noexcept
+        { return mix_hash(static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(p))); }
+    static std::size_t hash(const function_entry& e) noexcept
+        { return hash(e.address); }
+    static bool equal(const function_entry& e, const void *p) noexcept
+        { return e.address == p; }
+};
+
+struct entry_name_key
+{
+    static std::size_t hash(std::wstring_view s) noexcept
+        { return mix_hash(std::hash<std::wstring_view>()(s)); }
+    static std::size_t hash(const function_entry& e) noexcept
+        { return hash(std::wstring_view(e.export_name)); }
+    static bool equal(const function_entry& e, std::wstring_view s) noexcept
+        { return std::wstring_view(e.export_name) == s; }
 };
 
+} // namespace detail
+
+/// Registry of functions keyed by function address and export name.
+///
+/// Lookups and iteration are wait-free and may be performed from any thread,
+/// including worksheet functions during multi-threaded recalculation.
+/// Modifications are serialized and are expected on the main thread during
+/// xlAutoOpen and xlAutoClose. Entries are never freed before clear().
 struct registry
 {
     template<class F>
-    static bool add(F ptr, double id)
+    static const function_entry * add(F ptr, std::wstring_view export_name,
+        std::wstring_view function_text, std::wstring_view type_text,
+        const function_options& opts, double id)
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        auto index = std::type_index(typeid(ptr));
-        registry_map::instance()[index] = id;
-        return true;
+        const void *address = detail::function_address(ptr);
+
+        // Re-registration of an existing function updates the register ID.
+        function_entry *by_address = by_address_.find(address);
+        function_entry *by_name = by_name_.find(export_name);
+        if (by_address != nullptr && by_address == by_name) {
+            unregister_stale(by_address->id.exchange(id, std::memory_order_acq_rel), id);
+            return by_address;
+        }
+
+        // A function exported under a known name from a new address, such as
+        // a reloaded library, or under a new name, replaces the stale entry.
+        // Entries are immutable, so readers holding one keep a consistent
+        // copy until clear(). A registration under another ID would no longer
+        // be reachable by unregister_all(), so it is unregistered here.
+        for (function_entry *stale : { by_address, by_name }) {
+            if (stale != nullptr) {
+                unregister_stale(stale->id.exchange(0.0, std::memory_order_acq_rel), id); // superseded
+                by_address_.erase(stale);
+                by_name_.erase(stale);
+                unlink(stale);
+            }
+        }
+
+        auto entry = std::make_unique<function_entry>();
+        entry->address = address;
+        entry->export_name = export_name;
+        entry->function_text = function_text;
+        entry->type_text = type_text;
+        entry->options = opts;
+        entry->id.store(id, std::memory_order_relaxed);
+
+        function_entry *e = entry.get();
+        entries_.push_back(std::move(entry));
+        by_address_.insert(e);
+        by_name_.insert(e);
+
+        if (function_entry *tail = tail_.load(std::memory_order_relaxed))
+            tail->next.store(e, std::memory_order_release);
+        else
+            head_.store(e, std::memory_order_release);
+        tail_.store(e, std::memory_order_relaxed);
+        return e;
     }
 
+    /// Marks the function as unregistered. Returns false if it was not
+    /// registered. Does not call xlfUnregister.
     template<class F>
     static bool remove(F ptr)
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        auto index = std::type_index(typeid(ptr));
-        return registry_map::instance().erase(index);
+        function_entry *e = by_address_.find(detail::function_address(ptr));
+        if (e == nullptr)
+            return false;
+        return e->id.exchange(0.0, std::memory_order_acq_rel) != 0.0;
+    }
+
+    template<class F, class E = std::enable_if_t<std::is_function_v<std::remove_pointer_t<F>>>>
+    static const function_entry * find(F ptr) noexcept
+        { return by_address_.find(detail::function_address(ptr)); }
+
+    static const function_entry * find(std::wstring_view export_name) noexcept
+        { return by_name_.find(export_name); }
+
+    /// Invokes fn(const function_entry&) for each entry in registration order.
+    template<class Fn>
+    static void for_each(Fn&& fn)
+    {
+        for (const function_entry *e = head_.load(std::memory_order_acquire); e != nullptr;
+             e = e->next.load(std::memory_order_acquire))
+            fn(*e);
+    }
+
+    static std::size_t size() noexcept
+        { return by_address_.size(); }
+
+    /// Calls xlfUnregister for every registered function. Intended for use in
+    /// xlAutoClose. Returns the number of functions unregistered.
+    static std::size_t unregister_all()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::size_t count = 0;
+        for (auto& e : entries_) {
+            double id = e->id.exchange(0.0, std::memory_order_acq_rel);
+            if (id != 0.0 && unregister(id))
+                count++;
+        }
+        return count;
+    }
+
+    /// Releases all entries. Not safe while other threads may read the registry.
+    static void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        head_.store(nullptr, std::memory_order_release);
+        tail_.store(nullptr, std::memory_order_relaxed);
+        by_address_.clear();
+        by_name_.clear();
+        entries_.clear();
     }
 
 private:
-    static inline std::mutex mutex_; // C++17
+    // Calls xlfUnregister for the ID of a replaced registration, unless it is
+    // the ID of its replacement.
+    static void unregister_stale(double stale_id, double id)
+    {
+        if (stale_id != 0.0 && stale_id != id && !unregister(stale_id))
+            xll::log()->error("Failed to unregister replaced function {}", stale_id);
+    }
+
+    // Removes e from the list. Readers at e continue from its successor.
+    static void unlink(function_entry *e) noexcept
+    {
+        function_entry *prev = nullptr;
+        for (function_entry *p = head_.load(std::memory_order_relaxed); p != e;
+             p = p->next.load(std::memory_order_relaxed)) {
+            if (p == nullptr)
+                return;
+            prev = p;
+        }
+        function_entry *next = e->next.load(std::memory_order_relaxed);
+        if (prev != nullptr)
+            prev->next.store(next, std::memory_order_release);
+        else
+            head_.store(next, std::memory_order_release);
+        if (tail_.load(std::memory_order_relaxed) == e)
+            tail_.store(prev, std::memory_order_relaxed);
+    }
+
+    static inline std::mutex mutex_; // C++17, writers only
+    static inline std::vector<std::unique_ptr<function_entry>> entries_;
+    static inline detail::hash_index<function_entry, detail::entry_address_key> by_address_;
+    static inline detail::hash_index<function_entry, detail::entry_name_key> by_name_;
+    static inline std::atomic<function_entry *> head_{ nullptr };
+    static inline std::atomic<function_entry *> tail_{ nullptr };
 };
 
 // Index    Name                   Type         Alt. Type
@@ -102,18 +271,21 @@ inline double register_function(F ptr, const std::wstring& dll_alias,
     const std::wstring& function_text, const function_options& opts = {},
     attribute_set<Tags...> = {})
 {
+    using clock = startup_profiler::clock;
+    const auto t0 = clock::now();
+
     std::array<variant, 255> args;
 
     static xlstr dll = get_name();
     
     constexpr auto tt = make_wpstring_array(detail::type_text(F(), attribute_set<Tags...>()));
 
+    const auto t1 = clock::now();
     args[0].emplace<xlstr>(dll);
     args[1].emplace<xlstr>(dll_alias);
     args[2].emplace<xlstr>(tt);
     args[3].emplace<xlstr>(function_text);
     args[4].emplace<xlstr>(opts.argument_text);
-    args[5].emplace<xlint>(static_cast<int>(opts.type));
     args[6].emplace<xlstr>(opts.category);
     args[7].emplace<xlstr>(opts.shortcut_text);
     args[8].emplace<xlstr>(opts.help_topic);
@@ -128,6 +300,8 @@ inline double register_function(F ptr, const std::wstring& dll_alias,
             nargs++;
         }
     }
+    const auto t2 = clock::now();
+    args[5].emplace<xlint>(static_cast<int>(opts.type));
 
     std::array<variant *, 255> pargs;
     for (std::size_t i = 0; i < nargs; ++i) {
@@ -135,21 +309,57 @@ inline double register_function(F ptr, const std::wstring& dll_alias,
     }
     
     variant idvar;
+    const auto t3 = clock::now();
     int rc = Excel12v(xlfRegister, &idvar, pargs, nargs);
+    const auto t4 = clock::now();
+
+    const bool profiling = startup_profiler::active();
+    registration_timing timing;
+    if (profiling) {
+        timing.export_name = dll_alias;
+        timing.function_text = function_text;
+        timing.rc = rc;
+        timing.build_ns = startup_profiler::nanoseconds((t1 - t0) + (t3 - t2));
+        timing.strings_ns = startup_profiler::nanoseconds(t2 - t1);
+        timing.register_ns = startup_profiler::nanoseconds(t4 - t3);
+    }
+
     if (rc != XLRET::xlretSuccess || idvar.xltype() != xltypeNum) {
         xll::log()->error("Registration failed: return code {:#06x}", rc);
+        if (profiling)
+            startup_profiler::record(std::move(timing), t0);
         return 0.0;
     }
 
     double id = static_cast<double>(idvar.get<xlnum>());
-    registry::add(ptr, id);
+    registry::add(ptr, dll_alias, function_text,
+        std::wstring_view(tt.data(), tt.size()), opts, id);
+    if (profiling) {
+        timing.registered = true;
+        timing.registry_ns = startup_profiler::nanoseconds(clock::now() - t4);
+        startup_profiler::record(std::move(timing), t0);
+    }
     return id;
 }
 
+/// Unregisters a function previously registered with register_function.
 template<class F>
 inline bool unregister_function(F ptr)
 {
+    const function_entry *e = registry::find(ptr);
+    if (e == nullptr)
+        return false;
+    double id = e->id.load(std::memory_order_acquire);
+    if (id == 0.0 || !unregister(id))
+        return false;
     return registry::remove(ptr);
 }
 
+/// Unregisters all functions registered with register_function. Call from
+/// xlAutoClose.
+inline std::size_t unregister_functions()
+{
+    return registry::unregister_all();
+}
+
 } // namespace xll
\ No newline at end of file
@@ -0,0 +1,248 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file reload.hpp
+ * Hot reload of worksheet function implementations from a secondary shared
+ * library, without unregistering the exports.
+ *
+ * Each registered export is a thin trampoline which forwards to the current
+ * implementation through an immutable table of function pointers. reload()
+ * resolves every bound symbol from a newly loaded library, builds a new table
+ * and publishes it with a single atomic store, so a calculation sees either
+ * the old or the new set of implementations, never a mix.
+ *
+ * Each reload loads a private copy of the library from the temporary
+ * directory. The loader returns the library already loaded for a path, so
+ * reloading a rebuilt library from the same path would otherwise keep the
+ * old code; the copy also leaves the original free to be overwritten by the
+ * next build on Windows.
+ *
+ * \code
+ * double __stdcall price_builtin(double x);
+ *
+ * XLL_EXPORT double __stdcall price(double x)
+ * {
+ *     return xll::implementation<&price_builtin>::call(x);
+ * }
+ *
+ * // xlAutoOpen
+ * xll::implementations::bind<&price_builtin>("price_v2");
+ * xll::register_function(price, L"price", L"PRICE");
+ *
+ * // Later, from a macro command
+ * xll::implementations::reload(L"C:\\models\\pricing.dll");
+ * \endcode
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/detail/library.hpp>
+#include <xll/log.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace xll {
+
+/// Table of swappable implementations for exported worksheet functions.
+///
+/// Lookups are wait-free. Binding and reloading are serialized and expected on
+/// the main thread, outside of a recalculation. Libraries replaced by a reload
+/// are kept loaded until clear(), since a worker thread may still be executing
+/// code from them.
+struct implementations
+{
+    static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+    /// Binds the built-in implementation Fn to a symbol name exported by
+    /// replacement libraries. Returns the table index assigned to Fn.
+    template<auto Fn>
+    static std::size_t bind(const char *symbol);
+
+    /// Loads a copy of the library at path and publishes a table with every
+    /// bound symbol resolved from it. Symbols missing from the library fall
+    /// back to the built-in implementation. Returns false, leaving the current
+    /// table unchanged, if the library cannot be copied or loaded.
+    static bool reload(const std::wstring& path)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto library = load_copy(path);
+        if (!library)
+            return false;
+
+        auto next = std::make_unique<table>();
+        next->library = library;
+        next->functions.reserve(symbols_.size());
+        for (const auto& name : symbols_) {
+            void *p = library->library.symbol(name.c_str());
+            if (p == nullptr)
+                xll::log()->warn("Reload: symbol {} not found, using built-in", name);
+            next->functions.push_back(p);
+        }
+        publish(std::move(next));
+        return true;
+    }
+
+    /// Reverts every function to its built-in implementation.
+    static void reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        publish(std::make_unique<table>());
+    }
+
+    /// Returns the current implementation at index, or nullptr if the built-in
+    /// implementation should be used.
+    static void * get(std::size_t index) noexcept
+    {
+        const table *t = current_.load(std::memory_order_acquire);
+        if (t == nullptr || index >= t->functions.size())
+            return nullptr;
+        return t->functions[index];
+    }
+
+    /// Unloads all libraries and releases bindings. Not safe while worksheet
+    /// functions may be executing; call from xlAutoClose.
+    static void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        current_.store(nullptr, std::memory_order_release);
+        owner_.reset();
+        symbols_.clear();
+        for (auto *index : indices_)
+            index->store(npos, std::memory_order_release);
+        indices_.clear();
+    }
+
+private:
+    // Private copy of a replacement library, deleted once it is unloaded.
+    struct library_copy
+    {
+        detail::shared_library library;
+        std::filesystem::path path;
+
+        ~library_copy()
+        {
+            library.close();
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+        }
+    };
+
+    struct table
+    {
+        std::vector<void *> functions;
+        std::shared_ptr<library_copy> library;
+        std::unique_ptr<table> retired;
+    };
+
+    // Copies the library to a path unique to this process and generation and
+    // loads the copy. Requires mutex_.
+    static std::shared_ptr<library_copy> load_copy(const std::wstring& path)
+    {
+        std::error_code ec;
+        const std::filesystem::path source(path);
+        std::filesystem::path target = std::filesystem::temp_directory_path(ec);
+        if (ec) {
+            xll::log()->error("Reload failed: no temporary directory: {}", ec.message());
+            return nullptr;
+        }
+        target /= source.stem();
+        target += "." + std::to_string(detail::current_process_id()) + "." + std::to_string(++generation_);
+        target += source.extension();
+
+        auto copy = std::make_shared<library_copy>();
+        if (!std::filesystem::copy_file(source, target, std::filesystem::copy_options::overwrite_existing, ec)) {
+            xll::log()->error("Reload failed: unable to copy library: {}", ec.message());
+            return nullptr;
+        }
+        copy->path = target;
+        copy->library = detail::shared_library(target.wstring());
+        if (!copy->library.is_loaded()) {
+            xll::log()->error("Reload failed: unable to load library");
+            return nullptr;
+        }
+        return copy;
+    }
+
+    static void publish(std::unique_ptr<table> next)
+    {
+        if (!next->library && owner_)
+            next->library = owner_->library; // keep loaded until clear()
+        next->retired = std::move(owner_);
+        owner_ = std::move(next);
+        current_.store(owner_.get(), std::memory_order_release);
+    }
+
+    static inline std::mutex mutex_;
+    static inline std::size_t generation_ = 0;
+    static inline std::atomic<const table *> current_{ nullptr };
+    static inline std::unique_ptr<table> owner_;
+    static inline std::vector<std::string> symbols_;
+    static inline std::vector<std::atomic<std::size_t> *> indices_;
+
+    template<auto Fn> friend struct implementation;
+};
+
+/// Trampoline for the function bound to the built-in implementation Fn.
+template<auto Fn>
+struct implementation
+{
+    static_assert(std::is_function_v<std::remove_pointer_t<decltype(Fn)>>, "invalid function pointer");
+
+    using pointer = decltype(Fn);
+
+    /// Returns the current implementation of Fn.
+    static pointer get() noexcept
+    {
+        std::size_t index = index_.load(std::memory_order_relaxed);
+        if (index == implementations::npos)
+            return Fn;
+        void *p = implementations::get(index);
+        return p ? reinterpret_cast<pointer>(p) : Fn;
+    }
+
+    template<class... Args>
+    static decltype(auto) call(Args&&... args)
+    {
+        return (get())(std::forward<Args>(args)...);
+    }
+
+private:
+    static inline std::atomic<std::size_t> index_{ implementations::npos };
+
+    friend struct implementations;
+};
+
+template<auto Fn>
+inline std::size_t implementations::bind(const char *symbol)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& index = implementation<Fn>::index_;
+    std::size_t i = index.load(std::memory_order_relaxed);
+    if (i != npos) {
+        symbols_[i] = symbol;
+        return i;
+    }
+    i = symbols_.size();
+    symbols_.emplace_back(symbol);
+    indices_.push_back(&index);
+    index.store(i, std::memory_order_release);
+    return i;
+}
+
+} // namespace xll
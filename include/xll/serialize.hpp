@@ -0,0 +1,290 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file serialize.hpp
+ * Binary serialization of variants.
+ *
+ * serialize() writes a value, including strings and nested arrays, to a
+ * buffer of the exact size required, in one pass over the value. The data is
+ * little-endian on every platform.
+ *
+ * \code
+ * std::vector<unsigned char> data = xll::serialize(value);
+ *
+ * xll::variant copy;
+ * if (!xll::deserialize(data.data(), data.size(), copy))
+ *     throw std::runtime_error("invalid data");
+ *
+ * xll::serialized_view view;
+ * if (xll::serialized_view::parse(data.data(), data.size(), view)) {
+ *     for (xll::serialized_view x : view)
+ *         if (x.xltype() == xltypeStr)
+ *             consume(x.string_view()); // references data
+ * }
+ * \endcode
+ *
+ * deserialize() builds a variant which owns its values. serialized_view reads
+ * the data in place: the input is validated once by parse(), after which
+ * numbers are read directly from the buffer and strings reference it, so the
+ * buffer must outlive the view.
+ *
+ * Format:
+ *
+ *   char[4] "XLLV", uint16 version, uint16 reserved, encoded value
+ *
+ * with the encoding described in detail/binary.hpp.
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/xloper.hpp>
+#include <xll/detail/binary.hpp>
+
+#include <boost/endian/conversion.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace xll {
+
+/// Version of the serialization format written by serialize().
+constexpr std::uint16_t serialization_version = 1;
+
+namespace detail {
+
+constexpr std::size_t serialization_header = 8;
+
+inline void write_serialization_header(binary_writer& w) noexcept
+{
+    for (char c : { 'X', 'L', 'L', 'V' })
+        w.write(static_cast<std::uint8_t>(c));
+    w.write(serialization_version);
+    w.write(std::uint16_t(0));
+}
+
+inline bool read_serialization_header(binary_reader& r) noexcept
+{
+    std::uint8_t magic[4] = {};
+    for (auto& c : magic)
+        r.read(c);
+    std::uint16_t version = 0, reserved;
+    r.read(version);
+    r.read(reserved);
+    return !r.failed() && magic[0] == 'X' && magic[1] == 'L' && magic[2] == 'L' &&
+        magic[3] == 'V' && version == serialization_version;
+}
+
+// Returns the size of the encoded value at p, or 0 if it is truncated or
+// malformed.
+inline std::size_t validate_encoded(const unsigned char *p, std::size_t n, int depth = 0) noexcept
+{
+    if (n < 2)
+        return 0;
+    switch (load_little<std::uint16_t>(p)) {
+    case xltypeNum: return n >= 10 ? 10 : 0;
+    case xltypeStr: {
+        if (n < 6)
+            return 0;
+        const std::size_t len = load_little<std::uint32_t>(p + 2);
+        return len <= 32767 && n - 6 >= 2 * len ? 6 + 2 * len : 0;
+    }
+    case xltypeBool: return n >= 4 ? 4 : 0;
+    case xltypeErr:
+    case xltypeInt: return n >= 6 ? 6 : 0;
+    case xltypeMissing:
+    case xltypeNil: return 2;
+    case xltypeMulti: {
+        if (depth >= binary_max_depth || n < binary_multi_header)
+            return 0;
+        const std::uint64_t rows = load_little<std::uint32_t>(p + 2);
+        const std::uint64_t cols = load_little<std::uint32_t>(p + 6);
+        const std::uint64_t size = load_little<std::uint64_t>(p + 10);
+        if (size > n - binary_multi_header || (rows != 0 && cols > size / 2 / rows))
+            return 0;
+        const unsigned char *q = p + binary_multi_header;
+        std::size_t remaining = static_cast<std::size_t>(size);
+        for (std::uint64_t i = 0; i < rows * cols; ++i) {
+            const std::size_t k = validate_encoded(q, remaining, depth + 1);
+            if (k == 0)
+                return 0;
+            q += k;
+            remaining -= k;
+        }
+        return remaining == 0 ? binary_multi_header + static_cast<std::size_t>(size) : 0;
+    }
+    default:
+        return 0;
+    }
+}
+
+} // namespace detail
+
+/// Size in bytes of the serialization of v.
+inline std::size_t serialized_size(const variant& v) noexcept
+{
+    return detail::serialization_header + detail::encoded_size(v);
+}
+
+/// Writes v to p, which must have room for serialized_size(v) bytes. Returns
+/// the number of bytes written.
+inline std::size_t serialize(const variant& v, unsigned char *p) noexcept
+{
+    detail::binary_writer w(p);
+    detail::write_serialization_header(w);
+    detail::encode(w, v);
+    return static_cast<std::size_t>(w.data() - p);
+}
+
+inline std::vector<unsigned char> serialize(const variant& v)
+{
+    std::vector<unsigned char> buffer(serialized_size(v));
+    serialize(v, buffer.data());
+    return buffer;
+}
+
+/// Reads a value written by serialize(). Returns false if the data is
+/// truncated, malformed or of another version.
+inline bool deserialize(const unsigned char *p, std::size_t n, variant& v)
+{
+    detail::binary_reader r(p, n);
+    if (!detail::read_serialization_header(r))
+        return false;
+    return detail::decode(r, v);
+}
+
+/// Read-only view of a serialized value, referencing the serialized data.
+class serialized_view
+{
+public:
+    /// Type of the UTF-16 code units referenced by string_view(): wchar_t
+    /// where it is a 16-bit type, as on Windows, and char16_t elsewhere.
+    using char_type = std::conditional_t<sizeof(wchar_t) == 2, wchar_t, char16_t>;
+
+    class iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = serialized_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = serialized_view;
+
+        iterator() noexcept = default;
+        explicit iterator(const unsigned char *p) noexcept : p_(p) {}
+
+        serialized_view operator*() const noexcept { return serialized_view(p_); }
+        iterator& operator++() noexcept { p_ += serialized_view(p_).encoded_size(); return *this; }
+        iterator operator++(int) noexcept { iterator tmp = *this; ++*this; return tmp; }
+        bool operator==(const iterator& other) const noexcept { return p_ == other.p_; }
+        bool operator!=(const iterator& other) const noexcept { return p_ != other.p_; }
+
+    private:
+        const unsigned char *p_ = nullptr;
+    };
+
+    serialized_view() noexcept = default;
+
+    /// Validates the data written by serialize() and sets view to its value.
+    /// Returns false if the data is truncated, malformed or of another
+    /// version.
+    static bool parse(const unsigned char *p, std::size_t n, serialized_view& view) noexcept
+    {
+        detail::binary_reader r(p, n);
+        if (!detail::read_serialization_header(r))
+            return false;
+        if (detail::validate_encoded(r.data(), r.remaining()) == 0)
+            return false;
+        view = serialized_view(r.data());
+        return true;
+    }
+
+    int xltype() const noexcept { return detail::load_little<std::uint16_t>(p_); }
+
+    double number() const noexcept { return detail::load_little<double>(p_ + 2); }
+    bool boolean() const noexcept { return detail::load_little<std::uint16_t>(p_ + 2) != 0; }
+    error::excel_error error() const noexcept
+        { return static_cast<error::excel_error>(detail::load_little<std::int32_t>(p_ + 2)); }
+    std::int32_t integer() const noexcept { return detail::load_little<std::int32_t>(p_ + 2); }
+
+    /// Length of a string in UTF-16 code units.
+    std::size_t length() const noexcept { return detail::load_little<std::uint32_t>(p_ + 2); }
+
+    /// Copy of a string.
+    std::wstring string() const
+    {
+        std::wstring s(length(), L'\0');
+        for (std::size_t i = 0; i < s.size(); ++i)
+            s[i] = static_cast<wchar_t>(detail::load_little<std::uint16_t>(p_ + 6 + 2 * i));
+        return s;
+    }
+
+    /// String referencing the serialized data, which must be 2-byte aligned.
+    /// Available on little-endian hosts.
+    template<class CharT = char_type>
+    std::basic_string_view<CharT> string_view() const noexcept
+    {
+        static_assert(sizeof(CharT) == 2 && boost::endian::order::native == boost::endian::order::little,
+            "strings cannot be referenced in place on this platform");
+        return std::basic_string_view<CharT>(reinterpret_cast<const CharT *>(p_ + 6), length());
+    }
+
+    std::size_t rows() const noexcept { return detail::load_little<std::uint32_t>(p_ + 2); }
+    std::size_t columns() const noexcept { return detail::load_little<std::uint32_t>(p_ + 6); }
+
+    /// Number of elements of an array.
+    std::size_t size() const noexcept { return rows() * columns(); }
+
+    /// Elements of an array in row-major order.
+    iterator begin() const noexcept { return iterator(p_ + detail::binary_multi_header); }
+    iterator end() const noexcept
+    {
+        return iterator(p_ + detail::binary_multi_header +
+            static_cast<std::size_t>(detail::load_little<std::uint64_t>(p_ + 10)));
+    }
+
+    /// Size of the encoded value in bytes.
+    std::size_t encoded_size() const noexcept
+    {
+        switch (xltype()) {
+        case xltypeNum: return 10;
+        case xltypeStr: return 6 + 2 * length();
+        case xltypeBool: return 4;
+        case xltypeMissing:
+        case xltypeNil: return 2;
+        case xltypeMulti:
+            return detail::binary_multi_header +
+                static_cast<std::size_t>(detail::load_little<std::uint64_t>(p_ + 10));
+        default: return 6;
+        }
+    }
+
+    const unsigned char *data() const noexcept { return p_; }
+
+    /// Copies the value into a variant.
+    variant to_variant() const
+    {
+        variant result;
+        detail::binary_reader r(p_, encoded_size());
+        detail::decode(r, result);
+        return result;
+    }
+
+private:
+    explicit serialized_view(const unsigned char *p) noexcept : p_(p) {}
+
+    const unsigned char *p_ = nullptr;
+};
+
+} // namespace xll
@@ -0,0 +1,406 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file shared_memory.hpp
+ * Arrays in POSIX shared memory, returned to Excel without copying.
+ *
+ * A shared_multi is an XLOPER12 array whose cells and strings are stored in
+ * a named shared memory segment. A worker process creates the segment and
+ * fills it; the add-in opens it and returns it to Excel directly.
+ *
+ * \code
+ * // worker process
+ * auto m = xll::shared_multi::create("/xll.result.42", rows, cols, string_chars);
+ * for (std::size_t i = 0; i < m.size(); ++i)
+ *     m.set(i, compute(i));
+ *
+ * // add-in
+ * XLL_EXPORT xll::variant * __stdcall xl_result()
+ * {
+ *     auto m = xll::shared_multi::open("/xll.result.42");
+ *     xll::shared_multi::remove("/xll.result.42");
+ *     return m.release();
+ * }
+ *
+ * XLL_EXPORT void __stdcall xlAutoFree12(xll::variant *p)
+ * {
+ *     xll::shared_multi::free(p);
+ * }
+ * \endcode
+ *
+ * Strings are written to a heap in the segment, and cells refer to them by
+ * their offset from the start of the segment. open() rebases the offsets to
+ * pointers in the mapping, so that the cells are valid XLOPER12 values; the
+ * only other fixup is the lparray pointer of the array returned by
+ * release(). The writer and the reader must be builds of the same add-in.
+ */
+
+#include <xll/config.hpp>
+
+#if !BOOST_OS_WINDOWS
+
+#include <xll/constants.hpp>
+#include <xll/xloper.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_set>
+#include <utility>
+
+namespace xll {
+namespace detail {
+
+// Cell with the layout of an XLOPER12, written in place in the segment.
+struct shared_cell
+{
+    union {
+        double num;
+        std::uintptr_t str; // offset or pointer to a length-prefixed string
+        std::int32_t xbool;
+        std::int32_t err;
+        std::int32_t w;
+        struct {
+            std::uintptr_t lparray;
+            std::int32_t rows;
+            std::int32_t columns;
+        } array;
+        unsigned char storage[24];
+    } val;
+    std::uint32_t xltype;
+};
+
+static_assert(sizeof(shared_cell) == sizeof(variant), "invalid shared_cell layout");
+
+struct shared_multi_header
+{
+    static constexpr std::uint32_t signature = 0x4D534C58; // "XLSM"
+
+    std::uint32_t magic;
+    std::uint16_t version;
+    std::uint16_t char_size;
+    std::uint32_t rows;
+    std::uint32_t columns;
+    std::uint64_t size;       // of the segment in bytes
+    std::uint64_t cells;      // offset of the cells
+    std::uint64_t heap;       // offset of the string heap
+    std::uint64_t heap_chars; // capacity of the heap
+    std::atomic<std::uint64_t> heap_used;
+    std::uintptr_t base;      // address that string pointers are relative to
+    shared_cell result;       // array returned to Excel
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+    "shared memory requires address-free atomics");
+
+constexpr std::size_t shared_align(std::size_t n) noexcept
+    { return (n + 15) & ~std::size_t(15); }
+
+} // namespace detail
+
+/// XLOPER12 array stored in a named POSIX shared memory segment.
+///
+/// Owns a mapping of the segment, which is unmapped on destruction unless
+/// ownership is passed to Excel with release().
+class shared_multi
+{
+public:
+    static constexpr std::uint16_t version = 1;
+
+    shared_multi() noexcept = default;
+
+    shared_multi(shared_multi&& other) noexcept
+        : header_(std::exchange(other.header_, nullptr)) {}
+
+    shared_multi& operator=(shared_multi&& other) noexcept
+    {
+        if (this != &other) {
+            unmap();
+            header_ = std::exchange(other.header_, nullptr);
+        }
+        return *this;
+    }
+
+    ~shared_multi() { unmap(); }
+
+    /// Creates the segment name with rows x columns cells, initially nil, and
+    /// room for string_chars characters of strings, including one length
+    /// prefix per string. Throws std::system_error if the segment cannot be
+    /// created, including when it exists.
+    static shared_multi create(const std::string& name, unsigned rows, unsigned columns,
+        std::size_t string_chars = 0)
+    {
+        const std::size_t n = static_cast<std::size_t>(rows) * columns;
+        if ((rows != 0 && n / rows != columns) || n > std::size_t(INT32_MAX))
+            throw std::length_error("shared_multi too long");
+
+        const std::size_t cells = detail::shared_align(sizeof(detail::shared_multi_header));
+        const std::size_t heap = detail::shared_align(cells + n * sizeof(detail::shared_cell));
+        const std::size_t size = heap + string_chars * sizeof(wchar_t);
+
+        const int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "shm_open");
+        if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            const int e = errno;
+            ::close(fd);
+            ::shm_unlink(name.c_str());
+            throw std::system_error(e, std::generic_category(), "ftruncate");
+        }
+        void *p = map(fd, size);
+        if (p == nullptr) {
+            const int e = errno;
+            ::shm_unlink(name.c_str());
+            errno = e;
+        }
+        shared_multi result(check(p));
+
+        auto *h = new (result.header_) detail::shared_multi_header{};
+        h->magic = detail::shared_multi_header::signature;
+        h->version = version;
+        h->char_size = sizeof(wchar_t);
+        h->rows = rows;
+        h->columns = columns;
+        h->size = size;
+        h->cells = cells;
+        h->heap = heap;
+        h->heap_chars = string_chars;
+        h->heap_used.store(0, std::memory_order_relaxed);
+        h->base = 0;
+        detail::shared_cell *c = result.cells();
+        for (std::size_t i = 0; i < n; ++i)
+            c[i].xltype = xltypeNil;
+        return result;
+    }
+
+    /// Maps an existing segment and rebases its strings to the mapping.
+    /// Throws std::system_error if the segment cannot be opened, or
+    /// std::runtime_error if it was not written by a compatible build.
+    static shared_multi open(const std::string& name)
+    {
+        const int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "shm_open");
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            const int e = errno;
+            ::close(fd);
+            throw std::system_error(e, std::generic_category(), "fstat");
+        }
+        const auto size = static_cast<std::size_t>(st.st_size);
+        if (size < sizeof(detail::shared_multi_header)) {
+            ::close(fd);
+            throw std::runtime_error("invalid shared_multi segment");
+        }
+        shared_multi result(check(map(fd, size)));
+
+        const auto *h = result.header_;
+        const std::size_t n = static_cast<std::size_t>(h->rows) * h->columns;
+        if (h->magic != detail::shared_multi_header::signature || h->version != version ||
+            h->char_size != sizeof(wchar_t) || h->size != size ||
+            h->cells + n * sizeof(detail::shared_cell) > h->heap ||
+            h->heap + h->heap_chars * sizeof(wchar_t) > size)
+            throw std::runtime_error("invalid shared_multi segment");
+        result.rebase();
+        return result;
+    }
+
+    /// Removes the name of the segment. Mappings remain valid.
+    static bool remove(const std::string& name) noexcept
+        { return ::shm_unlink(name.c_str()) == 0; }
+
+    /// Unmaps the segment of an array returned by release(). Returns false if
+    /// p was not returned by release(), so it may be called for every value
+    /// passed to xlAutoFree12.
+    static bool free(variant *p) noexcept
+    {
+        {
+            std::lock_guard<std::mutex> lock(released_mutex_);
+            if (released_.erase(p) == 0)
+                return false;
+        }
+        auto *h = reinterpret_cast<detail::shared_multi_header *>(
+            reinterpret_cast<unsigned char *>(p) - offsetof(detail::shared_multi_header, result));
+        ::munmap(h, static_cast<std::size_t>(h->size));
+        return true;
+    }
+
+    explicit operator bool() const noexcept { return header_ != nullptr; }
+
+    unsigned rows() const noexcept { return header_->rows; }
+    unsigned columns() const noexcept { return header_->columns; }
+    std::size_t size() const noexcept { return static_cast<std::size_t>(header_->rows) * header_->columns; }
+
+    /// Characters of the string heap in use.
+    std::size_t string_chars() const noexcept
+    {
+        return static_cast<std::size_t>(std::min(header_->heap_chars,
+            header_->heap_used.load(std::memory_order_relaxed)));
+    }
+
+    void set(std::size_t i, double x) noexcept
+    {
+        detail::shared_cell& c = cells()[i];
+        c.val.num = x;
+        c.xltype = xltypeNum;
+    }
+
+    /// Writes a string to the heap and stores it in cell i. Returns false if
+    /// the heap is full. Cells of different indices may be set concurrently.
+    bool set(std::size_t i, std::wstring_view s) noexcept
+    {
+        const std::size_t n = std::min<std::size_t>(s.size(), 32767);
+        const std::uint64_t offset = header_->heap_used.fetch_add(n + 1, std::memory_order_relaxed);
+        if (offset + n + 1 > header_->heap_chars)
+            return false;
+        const std::size_t at = static_cast<std::size_t>(header_->heap + offset * sizeof(wchar_t));
+        auto *p = reinterpret_cast<wchar_t *>(bytes() + at);
+        p[0] = static_cast<wchar_t>(n);
+        std::memcpy(p + 1, s.data(), n * sizeof(wchar_t));
+        detail::shared_cell& c = cells()[i];
+        c.val.str = header_->base + at;
+        c.xltype = xltypeStr;
+        return true;
+    }
+
+    /// Copies a value into cell i. Values other than numbers, strings,
+    /// booleans, errors, integers, missing and nil are stored as #N/A.
+    /// Returns false if a string does not fit in the heap.
+    bool set(std::size_t i, const variant& v) noexcept
+    {
+        detail::shared_cell& c = cells()[i];
+        switch (v.xltype()) {
+        case xltypeNum:
+            set(i, static_cast<double>(v.get<xlnum>()));
+            return true;
+        case xltypeStr: {
+            const auto& s = v.get<xlstr>();
+            return set(i, std::wstring_view(s.data(), s.size()));
+        }
+        case xltypeBool:
+            c.val.xbool = static_cast<bool>(v.get<xlbool>()) ? 1 : 0;
+            c.xltype = xltypeBool;
+            return true;
+        case xltypeInt:
+            c.val.w = v.get<xlint>().w;
+            c.xltype = xltypeInt;
+            return true;
+        case xltypeErr:
+            c.val.err = v.get<xlerr>().err;
+            c.xltype = xltypeErr;
+            return true;
+        case xltypeMissing:
+        case xltypeNil:
+            c.xltype = v.xltype();
+            return true;
+        default:
+            c.val.err = error::xlerrNA;
+            c.xltype = xltypeErr;
+            return true;
+        }
+    }
+
+    /// Cells as XLOPER12 values. Strings are valid only in a mapping
+    /// returned by open().
+    const variant& operator[](std::size_t i) const noexcept
+        { return data()[i]; }
+
+    const variant *data() const noexcept
+        { return reinterpret_cast<const variant *>(const_cast<shared_multi *>(this)->cells()); }
+
+    /// Returns the array as an XLOPER12 with xlbitDLLFree set, and passes
+    /// ownership of the mapping to it. Release the mapping in xlAutoFree12
+    /// with free().
+    variant *release()
+    {
+        detail::shared_cell& r = header_->result;
+        r.val.array.lparray = reinterpret_cast<std::uintptr_t>(cells());
+        r.val.array.rows = static_cast<std::int32_t>(header_->rows);
+        r.val.array.columns = static_cast<std::int32_t>(header_->columns);
+        r.xltype = xltypeMulti | xlbitDLLFree;
+        auto *p = reinterpret_cast<variant *>(&r);
+        {
+            std::lock_guard<std::mutex> lock(released_mutex_);
+            released_.insert(p);
+        }
+        header_ = nullptr;
+        return p;
+    }
+
+private:
+    explicit shared_multi(detail::shared_multi_header *h) noexcept : header_(h) {}
+
+    // Maps and closes fd. Returns nullptr and preserves errno on failure.
+    static void *map(int fd, std::size_t size) noexcept
+    {
+        void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        const int e = errno;
+        ::close(fd);
+        errno = e;
+        return p != MAP_FAILED ? p : nullptr;
+    }
+
+    static detail::shared_multi_header *check(void *p)
+    {
+        if (p == nullptr)
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        return static_cast<detail::shared_multi_header *>(p);
+    }
+
+    void unmap() noexcept
+    {
+        if (header_ != nullptr)
+            ::munmap(header_, static_cast<std::size_t>(header_->size));
+        header_ = nullptr;
+    }
+
+    // Converts string references relative to the previous base to pointers
+    // in this mapping.
+    void rebase() noexcept
+    {
+        const auto base = reinterpret_cast<std::uintptr_t>(header_);
+        if (header_->base == base)
+            return;
+        detail::shared_cell *p = cells();
+        for (std::size_t i = 0, n = size(); i < n; ++i) {
+            if (p[i].xltype == xltypeStr)
+                p[i].val.str = p[i].val.str - header_->base + base;
+        }
+        header_->base = base;
+    }
+
+    unsigned char *bytes() noexcept { return reinterpret_cast<unsigned char *>(header_); }
+
+    detail::shared_cell *cells() noexcept
+        { return reinterpret_cast<detail::shared_cell *>(bytes() + header_->cells); }
+
+    detail::shared_multi_header *header_ = nullptr;
+
+    static inline std::mutex released_mutex_;
+    static inline std::unordered_set<const void *> released_;
+};
+
+} // namespace xll
+
+#endif // !BOOST_OS_WINDOWS
@@ -0,0 +1,226 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file startup.hpp
+ * Timing report of the registration of an add-in.
+ *
+ * Between begin() and end(), every call of register_function records the
+ * time spent building its argument array, converting its strings, waiting
+ * inside xlfRegister and updating the registry. The report also gives the
+ * time from begin() to the first successfully registered function, and
+ * from the static initialization of the add-in to begin().
+ *
+ * \code
+ * int __stdcall xlAutoOpen()
+ * {
+ *     xll::startup_profiler::begin();
+ *     xll::register_function(...);
+ *     ...
+ *     xll::startup_profiler::end();
+ *     return 1;
+ * }
+ * \endcode
+ *
+ * If the environment variable XLL_STARTUP_REPORT names a file, end() writes
+ * the report to it as JSON, so that load times can be tracked over releases
+ * by running xlAutoOpen against a host emulator in CI:
+ *
+ * \code
+ * {"version":1,"since_load_ns":..,"total_ns":..,"first_function_ns":..,
+ *  "functions":12,"failed":0,"build_ns":..,"strings_ns":..,"register_ns":..,
+ *  "registry_ns":..,"registrations":[{"name":"xl_price","function_text":"PRICE",
+ *  "rc":0,"start_ns":..,"build_ns":..,"strings_ns":..,"register_ns":..,
+ *  "registry_ns":..,"total_ns":..},...]}
+ * \endcode
+ *
+ * Times are in nanoseconds; start_ns is relative to begin().
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/detail/json.hpp>
+#include <xll/log.hpp>
+
+#include <boost/nowide/convert.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace xll {
+
+constexpr int startup_report_version = 1;
+
+/// Timing of one call of register_function.
+struct registration_timing
+{
+    std::wstring export_name;
+    std::wstring function_text;
+    int rc = 0;                     // return code of xlfRegister
+    bool registered = false;
+    std::uint64_t start_ns = 0;     // since startup_profiler::begin()
+    std::uint64_t build_ns = 0;     // argument array, other than strings
+    std::uint64_t strings_ns = 0;   // string arguments
+    std::uint64_t register_ns = 0;  // inside xlfRegister
+    std::uint64_t registry_ns = 0;  // registry::add
+
+    std::uint64_t total_ns() const noexcept
+        { return build_ns + strings_ns + register_ns + registry_ns; }
+};
+
+struct startup_report
+{
+    std::uint64_t since_load_ns = 0;     // static initialization to begin()
+    std::uint64_t total_ns = 0;          // begin() to end()
+    std::uint64_t first_function_ns = 0; // begin() to the first registered function, 0 if none
+    std::uint64_t failed = 0;
+    std::uint64_t build_ns = 0;
+    std::uint64_t strings_ns = 0;
+    std::uint64_t register_ns = 0;
+    std::uint64_t registry_ns = 0;
+    std::vector<registration_timing> registrations;
+
+    /// The report as a JSON object.
+    std::string json() const
+    {
+        std::string out;
+        auto field = [&](const char *name, std::uint64_t value) {
+            out += ",\"";
+            out += name;
+            out += "\":";
+            out += std::to_string(value);
+        };
+        out += "{\"version\":" + std::to_string(startup_report_version);
+        field("since_load_ns", since_load_ns);
+        field("total_ns", total_ns);
+        field("first_function_ns", first_function_ns);
+        field("functions", registrations.size());
+        field("failed", failed);
+        field("build_ns", build_ns);
+        field("strings_ns", strings_ns);
+        field("register_ns", register_ns);
+        field("registry_ns", registry_ns);
+        out += ",\"registrations\":[";
+        for (std::size_t i = 0; i < registrations.size(); ++i) {
+            const registration_timing& r = registrations[i];
+            out += i > 0 ? ",\n{\"name\":" : "\n{\"name\":";
+            detail::append_json_string(out, boost::nowide::narrow(r.export_name));
+            out += ",\"function_text\":";
+            detail::append_json_string(out, boost::nowide::narrow(r.function_text));
+            out += ",\"rc\":" + std::to_string(r.rc);
+            field("start_ns", r.start_ns);
+            field("build_ns", r.build_ns);
+            field("strings_ns", r.strings_ns);
+            field("register_ns", r.register_ns);
+            field("registry_ns", r.registry_ns);
+            field("total_ns", r.total_ns());
+            out += '}';
+        }
+        out += "]}\n";
+        return out;
+    }
+
+    /// Writes json() to path. Returns false on failure.
+    bool write(const std::filesystem::path& path) const
+    {
+        std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+        const std::string s = json();
+        stream.write(s.data(), static_cast<std::streamsize>(s.size()));
+        stream.close();
+        return !stream.fail();
+    }
+};
+
+/// Collects the registration timings of xlAutoOpen.
+struct startup_profiler
+{
+    using clock = std::chrono::steady_clock;
+
+    /// Starts a report, discarding the previous one.
+    static void begin()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        report_ = startup_report();
+        begin_ = clock::now();
+        report_.since_load_ns = nanoseconds(begin_ - loaded_);
+        active_ = true;
+    }
+
+    /// Completes the report and writes it to XLL_STARTUP_REPORT if set.
+    static startup_report end()
+    {
+        startup_report r;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (active_) {
+                report_.total_ns = nanoseconds(clock::now() - begin_);
+                active_ = false;
+            }
+            r = report_;
+        }
+        xll::log()->info("Registered {} functions in {} ms, first after {} ms ({} failed)",
+            r.registrations.size() - r.failed, r.total_ns / 1000000, r.first_function_ns / 1000000, r.failed);
+        if (const char *path = std::getenv("XLL_STARTUP_REPORT")) {
+            if (*path != '\0' && !r.write(path))
+                xll::log()->error("Startup report failed: cannot write {}", path);
+        }
+        return r;
+    }
+
+    static bool active() noexcept
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return active_;
+    }
+
+    /// The report so far.
+    static startup_report report()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return report_;
+    }
+
+    /// Adds a registration which started at start and ended now. Ignored
+    /// outside begin() and end(). Called by register_function.
+    static void record(registration_timing timing, clock::time_point start)
+    {
+        const auto now = clock::now();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!active_)
+            return;
+        timing.start_ns = start > begin_ ? nanoseconds(start - begin_) : 0;
+        if (timing.registered && report_.first_function_ns == 0)
+            report_.first_function_ns = nanoseconds(now - begin_);
+        if (!timing.registered)
+            ++report_.failed;
+        report_.build_ns += timing.build_ns;
+        report_.strings_ns += timing.strings_ns;
+        report_.register_ns += timing.register_ns;
+        report_.registry_ns += timing.registry_ns;
+        report_.registrations.push_back(std::move(timing));
+    }
+
+    static std::uint64_t nanoseconds(clock::duration d) noexcept
+        { return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()); }
+
+private:
+    static inline std::mutex mutex_;
+    static inline startup_report report_;
+    static inline clock::time_point begin_;
+    static inline const clock::time_point loaded_ = clock::now(); // static initialization
+    static inline bool active_ = false;
+};
+
+} // namespace xll
@@ -0,0 +1,424 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+/**
+ * \file tracer.hpp
+ * Timelines of exported functions, callbacks and async jobs in the Chrome
+ * trace event format.
+ *
+ * While the tracer is active, calls of functions exported with
+ * XLL_EXPORT_FUNCTION, callbacks made through Excel12v, and jobs of
+ * async_executor are written as events to a JSON file which can be opened
+ * in chrome://tracing or https://ui.perfetto.dev. Async jobs have a span
+ * from submission to the start of the job, showing how long they waited for
+ * a thread.
+ *
+ * \code
+ * // commands run by the user
+ * xll::tracer::start(path);
+ * xll::tracer::stop();
+ *
+ * // spans in user code
+ * void calibrate()
+ * {
+ *     xll::tracer::scope span("calibrate");
+ *     ...
+ * }
+ * \endcode
+ *
+ * Each thread appends events to its own ring buffer of fixed capacity,
+ * without locks or allocation after the first event. A background thread
+ * drains the buffers periodically and formats the events, so the cost on the
+ * traced thread is two clock reads and a copy of 32 bytes. Events which find
+ * their buffer full are dropped and counted. When the tracer is inactive an
+ * instrumented call pays for one relaxed load.
+ *
+ * Names passed to scope and record() must have static storage duration.
+ */
+
+#include <xll/config.hpp>
+
+#include <xll/detail/json.hpp>
+#include <xll/log.hpp>
+
+#include <boost/nowide/convert.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cwchar>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace xll {
+
+enum class trace_event_kind : std::uint8_t
+{
+    function,   // exported function; name is a const wchar_t *
+    callback,   // Excel12v; arg is the function number
+    async_wait, // async job from submission to start
+    async_job,  // async job
+    user        // tracer::scope; name is a const char *
+};
+
+struct trace_event
+{
+    const void *name;
+    std::uint64_t begin; // nanoseconds since tracer::start()
+    std::uint64_t end;
+    std::uint32_t arg;
+    trace_event_kind kind;
+};
+
+namespace detail {
+
+// Single-producer, single-consumer ring of events of one thread.
+class trace_buffer
+{
+public:
+    trace_buffer(std::size_t capacity, std::uint64_t session, std::size_t thread)
+        : events_(new trace_event[capacity]), mask_(capacity - 1), session_(session), thread_(thread) {}
+
+    // Called by the owning thread. Returns false if the buffer is full.
+    bool push(const trace_event& e) noexcept
+    {
+        const std::uint64_t h = head_.load(std::memory_order_relaxed);
+        if (h - tail_.load(std::memory_order_acquire) > mask_)
+            return false;
+        events_[h & mask_] = e;
+        head_.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Called by the consumer. Invokes fn(const trace_event&) for each event.
+    template<class Fn>
+    void drain(Fn&& fn)
+    {
+        std::uint64_t t = tail_.load(std::memory_order_relaxed);
+        const std::uint64_t h = head_.load(std::memory_order_acquire);
+        for (; t != h; ++t)
+            fn(events_[t & mask_]);
+        tail_.store(t, std::memory_order_release);
+    }
+
+    bool empty() const noexcept
+        { return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_relaxed); }
+
+    std::uint64_t session() const noexcept { return session_; }
+    std::size_t thread() const noexcept { return thread_; }
+
+    std::atomic<bool> detached{ false }; // owning thread has exited
+
+private:
+    std::unique_ptr<trace_event[]> events_;
+    const std::uint64_t mask_;
+    const std::uint64_t session_;
+    const std::size_t thread_;
+    alignas(64) std::atomic<std::uint64_t> head_{ 0 };
+    alignas(64) std::atomic<std::uint64_t> tail_{ 0 };
+};
+
+struct trace_buffer_ref
+{
+    std::shared_ptr<trace_buffer> buffer;
+    ~trace_buffer_ref()
+    {
+        if (buffer)
+            buffer->detached.store(true, std::memory_order_release);
+    }
+};
+
+} // namespace detail
+
+/// Writes events to a Chrome trace file.
+struct tracer
+{
+    using clock = std::chrono::steady_clock;
+
+    /// Starts tracing to path, replacing the file. Each thread buffers up to
+    /// capacity events, rounded up to a power of two, between flushes every
+    /// interval. Returns false if the tracer is active or the file cannot be
+    /// opened.
+    static bool start(const std::filesystem::path& path, std::size_t capacity = 16384,
+        std::chrono::milliseconds interval = std::chrono::milliseconds(100))
+    {
+        std::lock_guard<std::mutex> control(control_mutex_);
+        if (active())
+            return false;
+        std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+        if (!stream) {
+            xll::log()->error("Tracing failed: cannot open {}", path.string());
+            return false;
+        }
+        stream << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+        std::size_t n = 16;
+        while (n < capacity)
+            n *= 2;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stream_ = std::move(stream);
+            capacity_ = n;
+            interval_ = interval;
+            events_ = 0;
+            stop_ = false;
+            buffers_.clear();
+        }
+        dropped_.store(0, std::memory_order_relaxed);
+        // Timestamps start at 1 so that 0 can mean "not traced".
+        epoch_.store((clock::now() - std::chrono::microseconds(1)).time_since_epoch().count(),
+            std::memory_order_relaxed);
+        session_.fetch_add(1, std::memory_order_relaxed);
+        active_.store(true, std::memory_order_release);
+        thread_ = std::thread(&run);
+        return true;
+    }
+
+    /// Stops tracing, writes the remaining events and closes the file.
+    /// Returns false if a write failed.
+    static bool stop()
+    {
+        std::lock_guard<std::mutex> control(control_mutex_);
+        if (!active())
+            return true;
+        active_.store(false, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        stream_ << "],\"otherData\":{\"droppedEvents\":\"" << dropped() << "\"}}";
+        stream_.close();
+        const bool ok = !stream_.fail();
+        stream_ = std::ofstream();
+        buffers_.clear();
+        return ok;
+    }
+
+    static bool active() noexcept
+        { return active_.load(std::memory_order_relaxed); }
+
+    /// Nanoseconds since start().
+    static std::uint64_t now() noexcept
+    {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock::duration(clock::now().time_since_epoch().count() -
+                epoch_.load(std::memory_order_relaxed))).count());
+    }
+
+    /// now() if the tracer is active, otherwise 0.
+    static std::uint64_t timestamp() noexcept
+        { return active() ? now() : 0; }
+
+    /// Appends an event to the buffer of the calling thread.
+    static void record(trace_event_kind kind, const void *name, std::uint64_t begin,
+        std::uint64_t end, std::uint32_t arg = 0) noexcept
+    {
+        detail::trace_buffer *b = buffer();
+        if (b == nullptr || !b->push(trace_event{ name, begin, end, arg, kind }))
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// Number of events dropped because a buffer was full.
+    static std::uint64_t dropped() noexcept
+        { return dropped_.load(std::memory_order_relaxed); }
+
+    /// Number of events written since start().
+    static std::uint64_t events()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return events_;
+    }
+
+    /// Writes the buffered events now.
+    static void flush()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        drain();
+    }
+
+    /// Span of user code on the calling thread.
+    class scope
+    {
+    public:
+        explicit scope(const char *name) noexcept
+            : name_(name), begin_(timestamp()) {}
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+        ~scope()
+        {
+            if (begin_ != 0 && active())
+                record(trace_event_kind::user, name_, begin_, now());
+        }
+
+    private:
+        const char *name_;
+        std::uint64_t begin_;
+    };
+
+    /// Span of an async job, created when it starts; queued is the
+    /// timestamp() taken when it was submitted.
+    class async_scope
+    {
+    public:
+        explicit async_scope(std::uint64_t queued) noexcept
+            : begin_(queued != 0 && active() ? now() : 0)
+        {
+            if (begin_ != 0)
+                record(trace_event_kind::async_wait, nullptr, queued, begin_,
+                    next_async_.fetch_add(1, std::memory_order_relaxed));
+        }
+
+        async_scope(const async_scope&) = delete;
+        async_scope& operator=(const async_scope&) = delete;
+
+        ~async_scope()
+        {
+            if (begin_ != 0 && active())
+                record(trace_event_kind::async_job, nullptr, begin_, now());
+        }
+
+    private:
+        std::uint64_t begin_;
+    };
+
+private:
+    static detail::trace_buffer *buffer() noexcept
+    {
+        thread_local detail::trace_buffer_ref ref;
+        const std::uint64_t session = session_.load(std::memory_order_relaxed);
+        if (BOOST_LIKELY(ref.buffer && ref.buffer->session() == session))
+            return ref.buffer.get();
+
+        try {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!active() || session != session_.load(std::memory_order_relaxed))
+                return nullptr;
+            auto b = std::make_shared<detail::trace_buffer>(capacity_, session, thread_id());
+            buffers_.push_back(b);
+            if (ref.buffer)
+                ref.buffer->detached.store(true, std::memory_order_release);
+            ref.buffer = std::move(b);
+            return ref.buffer.get();
+        }
+        catch (...) {
+            return nullptr;
+        }
+    }
+
+    static void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            cv_.wait_for(lock, interval_, []() { return stop_; });
+            drain();
+            if (stop_)
+                return;
+        }
+    }
+
+    // Called with mutex_ held.
+    static void drain()
+    {
+        if (!stream_.is_open())
+            return;
+        const int pid = detail::current_process_id();
+        std::string out;
+        for (auto it = buffers_.begin(); it != buffers_.end();) {
+            auto& b = **it;
+            b.drain([&](const trace_event& e) { format(out, e, pid, b.thread()); });
+            if (b.detached.load(std::memory_order_acquire) && b.empty())
+                it = buffers_.erase(it);
+            else
+                ++it;
+        }
+        stream_ << out;
+    }
+
+    static void format(std::string& out, const trace_event& e, int pid, std::size_t tid)
+    {
+        char buf[160];
+        auto event = [&](std::string_view name, const char *cat, char ph, std::uint64_t ts) {
+            out += events_++ > 0 ? ",\n{\"name\":" : "\n{\"name\":";
+            detail::append_json_string(out, name);
+            std::snprintf(buf, sizeof(buf), ",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%llu",
+                cat, ph, static_cast<double>(ts) * 1e-3, pid, static_cast<unsigned long long>(tid));
+            out += buf;
+        };
+        auto duration = [&]() {
+            std::snprintf(buf, sizeof(buf), ",\"dur\":%.3f", static_cast<double>(e.end - e.begin) * 1e-3);
+            out += buf;
+        };
+
+        switch (e.kind) {
+        case trace_event_kind::function: {
+            const auto *name = static_cast<const wchar_t *>(e.name);
+            event(boost::nowide::narrow(name, std::wcslen(name)), "function", 'X', e.begin);
+            duration();
+            out += '}';
+            break;
+        }
+        case trace_event_kind::callback:
+            event("Excel12v", "callback", 'X', e.begin);
+            duration();
+            std::snprintf(buf, sizeof(buf), ",\"args\":{\"xlfn\":%u}}", e.arg);
+            out += buf;
+            break;
+        case trace_event_kind::async_wait:
+            for (int k = 0; k < 2; ++k) {
+                event("wait", "async", k == 0 ? 'b' : 'e', k == 0 ? e.begin : e.end);
+                std::snprintf(buf, sizeof(buf), ",\"id\":%u}", e.arg);
+                out += buf;
+            }
+            break;
+        case trace_event_kind::async_job:
+            event("async job", "async", 'X', e.begin);
+            duration();
+            out += '}';
+            break;
+        case trace_event_kind::user:
+            event(static_cast<const char *>(e.name), "user", 'X', e.begin);
+            duration();
+            out += '}';
+            break;
+        }
+    }
+
+    static inline std::mutex control_mutex_; // start and stop
+    static inline std::mutex mutex_;
+    static inline std::condition_variable cv_;
+    static inline std::thread thread_;
+    static inline std::ofstream stream_;
+    static inline std::vector<std::shared_ptr<detail::trace_buffer>> buffers_;
+    static inline std::size_t capacity_ = 16384;
+    static inline std::chrono::milliseconds interval_{ 100 };
+    static inline std::uint64_t events_ = 0;
+    static inline bool stop_ = false;
+    static inline std::atomic<bool> active_{ false };
+    static inline std::atomic<std::uint64_t> session_{ 0 };
+    static inline std::atomic<clock::rep> epoch_{ 0 };
+    static inline std::atomic<std::uint64_t> dropped_{ 0 };
+    static inline std::atomic<std::uint32_t> next_async_{ 1 };
+};
+
+} // namespace xll
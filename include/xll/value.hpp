@@ -150,7 +150,7 @@ struct xlbigdata
 
 namespace detail {
 
-template <class T, class Allocator = std::allocator<T>>
+template <class T, class Allocator = counting_allocator<T>>
 struct xlmulti_base : detail::alloc_holder<Allocator>
 {
     using xltype = std::integral_constant<XLTYPE, xltypeMulti>;
@@ -318,6 +318,27 @@ struct xlmulti : detail::xlmulti_base<
         return operator()(i, j);
     }
 
+    inline const_reference operator[](std::size_t n) const noexcept {
+        return *std::next(lparray, static_cast<std::ptrdiff_t>(n));
+    }
+
+    inline const_reference operator()(unsigned i, unsigned j) const noexcept {
+        auto n = static_cast<std::size_t>(i * cols_ + j);
+        return *std::next(lparray, static_cast<std::ptrdiff_t>(n));
+    }
+
+    inline const_reference at(std::size_t n) const {
+        if (n >= size())
+            throw std::out_of_range("invalid xlmulti subscript");
+        return operator[](n);
+    }
+
+    inline const_reference at(unsigned i, unsigned j) const {
+        if (i >= size1() || j >= size2())
+            throw std::out_of_range("invalid xlmulti subscript");
+        return operator()(i, j);
+    }
+
     inline const_iterator begin() const noexcept
         { return lparray; }
 
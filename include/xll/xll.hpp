@@ -19,4 +19,25 @@
 
 #include <xll/functions.hpp>
 #include <xll/callback.hpp>
+#include <xll/async.hpp>
+#include <xll/cluster.hpp>
+#include <xll/columnar.hpp>
+#include <xll/date.hpp>
+#include <xll/export.hpp>
+#include <xll/format.hpp>
+#include <xll/interrupt.hpp>
+#include <xll/log_file.hpp>
+#include <xll/memoize.hpp>
+#include <xll/multi_view.hpp>
+#include <xll/object.hpp>
+#include <xll/parse.hpp>
+#include <xll/persist.hpp>
+#include <xll/profile.hpp>
+#include <xll/range.hpp>
+#include <xll/record.hpp>
 #include <xll/registry.hpp>
+#include <xll/reload.hpp>
+#include <xll/serialize.hpp>
+#include <xll/shared_memory.hpp>
+#include <xll/startup.hpp>
+#include <xll/tracer.hpp>
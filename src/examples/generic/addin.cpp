@@ -93,6 +93,7 @@ XLL_EXPORT int __stdcall xlAutoOpen()
 /// Excel calls xlAutoClose when it unloads the XLL.
 XLL_EXPORT int __stdcall xlAutoClose()
 {
+    xll::unregister_functions();
     return 1;
 }
 
@@ -57,6 +57,7 @@ XLL_EXPORT int __stdcall xlAutoOpen()
 XLL_EXPORT int __stdcall xlAutoClose()
 {
     xll::log()->info("xlAutoClose");
+    xll::unregister_functions();
     return 1;
 }
 
@@ -0,0 +1,44 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+// Replays a trace recorded by xll::call_recorder through an add-in built for
+// this platform, without Excel:
+//
+//   xll-replay <add-in> <trace> [repeat]
+//
+// The add-in exports the entry point shown in record.hpp.
+
+#include <dlfcn.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+using replay_proc = int (*)(const char *path, int repeat);
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        std::fprintf(stderr, "usage: %s <add-in> <trace> [repeat]\n", argv[0]);
+        return 1;
+    }
+
+    void *module = ::dlopen(argv[1], RTLD_NOW | RTLD_LOCAL);
+    if (module == nullptr) {
+        std::fprintf(stderr, "%s\n", ::dlerror());
+        return 1;
+    }
+
+    auto pfn = reinterpret_cast<replay_proc>(::dlsym(module, "xll_replay"));
+    if (pfn == nullptr) {
+        std::fprintf(stderr, "%s does not export xll_replay\n", argv[1]);
+        return 1;
+    }
+
+    const int rc = pfn(argv[2], argc > 3 ? std::atoi(argv[3]) : 1);
+    std::printf("%s\n", rc == 0 ? "replay succeeded" : "replay failed");
+    return rc;
+}
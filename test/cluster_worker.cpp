@@ -0,0 +1,71 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+// Worker executable started by test_cluster.
+
+#include <xll/cluster.hpp>
+
+#include <unistd.h>
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace xll;
+
+namespace {
+
+double add(double x, double y) { return x + y; }
+
+std::wstring greet(std::wstring name) { return L"Hello, " + name; }
+
+double process_id(double delay)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int>(delay)));
+    return static_cast<double>(::getpid());
+}
+
+double fail(double) { throw std::runtime_error("failed"); }
+
+double crash(double) { ::_exit(3); }
+
+variant sum(const variant *args, std::size_t n)
+{
+    double total = 0.0;
+    for (std::size_t i = 0; i < n; ++i) {
+        if (args[i].xltype() == xltypeMulti) {
+            for (const auto& x : args[i].get<xlmulti>())
+                total += static_cast<double>(x.get<xlnum>());
+        }
+    }
+    return variant(total);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    cluster_functions::define<&add>(L"add");
+    cluster_functions::define<&greet>(L"greet");
+    cluster_functions::define<&process_id>(L"process_id");
+    cluster_functions::define<&fail>(L"fail");
+    cluster_functions::define<&crash>(L"crash");
+    cluster_functions::define(L"sum", sum);
+
+    // Arguments passed by the connector are defined as constant functions.
+    for (int i = 1; i < argc; ++i) {
+        const std::wstring arg(argv[i], argv[i] + std::char_traits<char>::length(argv[i]));
+        cluster_functions::define(arg, [arg](const variant *, std::size_t) {
+            variant v;
+            detail::to_variant(v, arg);
+            return v;
+        });
+    }
+
+    return cluster_worker::run();
+}
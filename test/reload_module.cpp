@@ -0,0 +1,19 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+// Replacement library loaded by test_reload, built once per version.
+
+#include <xll/config.hpp>
+
+#ifndef XLL_TEST_RELOAD_VERSION
+#define XLL_TEST_RELOAD_VERSION 1
+#endif
+
+XLL_EXPORT double __stdcall price_v2(double x)
+{
+    return x + XLL_TEST_RELOAD_VERSION;
+}
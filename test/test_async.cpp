@@ -0,0 +1,220 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/xll.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+using namespace xll;
+
+namespace {
+
+std::mutex results_mutex;
+std::map<void *, variant> results;
+std::size_t callbacks = 0;
+
+bool wait_for(std::size_t n)
+{
+    for (int i = 0; i < 500; ++i) {
+        {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            if (results.size() >= n)
+                return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    return false;
+}
+
+std::atomic<int> fetch_calls{ 0 };
+std::atomic<bool> fetch_release{ false };
+
+double fetch(const variant& name, double tenor)
+{
+    ++fetch_calls;
+    while (!fetch_release.load())
+        std::this_thread::yield();
+    return static_cast<double>(name.get<xlstr>().size()) * tenor;
+}
+
+} // namespace
+
+// Host emulation: records the values passed to xlAsyncReturn.
+XLL_EXPORT int __stdcall MdCallBack12(int xlfn, int coper, variant **opers, variant *result)
+{
+    if (xlfn == xlAsyncReturn && coper == 2) {
+        std::lock_guard<std::mutex> lock(results_mutex);
+        if (opers[0]->xltype() == xltypeMulti) {
+            const auto& handles = opers[0]->get<xlmulti>();
+            const auto& values = opers[1]->get<xlmulti>();
+            for (std::size_t i = 0; i < handles.size(); ++i)
+                results[handles[i].get<xlbigdata>().h] = values[i];
+        }
+        else {
+            results[opers[0]->get<xlbigdata>().h] = *opers[1];
+        }
+        ++callbacks;
+        if (result)
+            result->emplace<xlbool>(true);
+    }
+    return xlretSuccess;
+}
+
+int main()
+{
+    async_executor::start(4);
+
+    {
+        xlbigdata bd;
+        bd.h = reinterpret_cast<void *>(1);
+        handle h(bd);
+        variant arg(2.0);
+        async_executor::submit(&h, [](const variant& x) {
+            return static_cast<double>(x.get<xlnum>()) * 21.0;
+        }, &arg);
+        arg = 0.0; // argument is copied at submission
+
+        BOOST_TEST(wait_for(1));
+        std::lock_guard<std::mutex> lock(results_mutex);
+        BOOST_TEST_EQ(results[bd.h].get<xlnum>(), 42.0);
+    }
+    {
+        xlbigdata bd;
+        bd.h = reinterpret_cast<void *>(2);
+        handle h(bd);
+        async_executor::submit(&h, [](const std::wstring&) -> double {
+            throw std::runtime_error("failed");
+        }, L"text");
+
+        BOOST_TEST(wait_for(2));
+        std::lock_guard<std::mutex> lock(results_mutex);
+        BOOST_TEST_EQ(results[bd.h].get<xlerr>(), error::xlerrValue);
+    }
+    {
+        // canceled jobs do not return results
+        std::atomic<bool> release{ false };
+        for (std::uintptr_t i = 100; i < 200; ++i) {
+            xlbigdata bd;
+            bd.h = reinterpret_cast<void *>(i);
+            handle h(bd);
+            async_executor::submit(&h, [&release]() {
+                while (!release.load())
+                    std::this_thread::yield();
+                return 1.0;
+            });
+        }
+        async_executor::cancel();
+        release = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        BOOST_TEST_EQ(async_executor::pending(), 0);
+        std::lock_guard<std::mutex> lock(results_mutex);
+        BOOST_TEST_EQ(results.size(), 2);
+    }
+    {
+        // duplicate in-flight calls share one job
+        for (std::uintptr_t i = 200; i < 210; ++i) {
+            xlbigdata bd;
+            bd.h = reinterpret_cast<void *>(i);
+            handle h(bd);
+            variant name(L"USD");
+            async_executor::submit_coalesced(&h, &fetch, &name, i < 209 ? 2.0 : 3.0);
+        }
+        BOOST_TEST_EQ(async_executor::in_flight(), 2);
+        fetch_release = true;
+        BOOST_TEST(wait_for(12));
+        BOOST_TEST_EQ(fetch_calls.load(), 2);
+        BOOST_TEST_EQ(async_executor::in_flight(), 0);
+        std::lock_guard<std::mutex> lock(results_mutex);
+        BOOST_TEST_EQ(results[reinterpret_cast<void *>(200)].get<xlnum>(), 6.0);
+        BOOST_TEST_EQ(results[reinterpret_cast<void *>(208)].get<xlnum>(), 6.0);
+        BOOST_TEST_EQ(results[reinterpret_cast<void *>(209)].get<xlnum>(), 9.0);
+    }
+    {
+        // results are returned in batches of batch_size
+        async_completion_queue::start(16, std::chrono::seconds(10));
+        {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            callbacks = 0;
+        }
+        for (std::uintptr_t i = 300; i < 332; ++i) {
+            xlbigdata bd;
+            bd.h = reinterpret_cast<void *>(i);
+            handle h(bd);
+            async_executor::submit(&h, [](double x) { return x; }, static_cast<double>(i));
+        }
+        BOOST_TEST(wait_for(44));
+        std::lock_guard<std::mutex> lock(results_mutex);
+        BOOST_TEST_EQ(callbacks, 2);
+        BOOST_TEST_EQ(results[reinterpret_cast<void *>(317)].get<xlnum>(), 317.0);
+    }
+    {
+        // partial batches are returned after the latency bound
+        async_completion_queue::start(16, std::chrono::milliseconds(5));
+        for (std::uintptr_t i = 400; i < 403; ++i) {
+            xlbigdata bd;
+            bd.h = reinterpret_cast<void *>(i);
+            handle h(bd);
+            async_executor::submit(&h, []() { return true; });
+        }
+        BOOST_TEST(wait_for(47));
+        std::lock_guard<std::mutex> lock(results_mutex);
+        BOOST_TEST(results[reinterpret_cast<void *>(402)].get<xlbool>());
+    }
+
+    {
+        // a job running during stop() may submit; the new job is dropped
+        std::atomic<bool> running{ false };
+        std::atomic<bool> stopping{ false };
+        xlbigdata bd;
+        bd.h = reinterpret_cast<void *>(600);
+        handle h(bd);
+        async_executor::submit(&h, [&running, &stopping]() {
+            running = true;
+            while (!stopping.load())
+                std::this_thread::yield();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            xlbigdata inner;
+            inner.h = reinterpret_cast<void *>(601);
+            handle ih(inner);
+            async_executor::submit(&ih, []() { return 1.0; });
+            return 0.0;
+        });
+        while (!running.load())
+            std::this_thread::yield();
+        stopping = true;
+        async_executor::stop();
+        BOOST_TEST_EQ(async_executor::pending(), 0u);
+        std::lock_guard<std::mutex> lock(results_mutex);
+        BOOST_TEST(results.find(reinterpret_cast<void *>(601)) == results.end());
+    }
+    {
+        // restarts after stop()
+        std::size_t n;
+        {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            n = results.size();
+        }
+        BOOST_TEST(async_executor::start(2));
+        xlbigdata bd;
+        bd.h = reinterpret_cast<void *>(602);
+        handle h(bd);
+        async_executor::submit(&h, []() { return 2.0; });
+        BOOST_TEST(wait_for(n + 1));
+        std::lock_guard<std::mutex> lock(results_mutex);
+        BOOST_TEST_EQ(results[bd.h].get<xlnum>(), 2.0);
+    }
+
+    async_executor::stop();
+    return boost::report_errors();
+}
@@ -0,0 +1,196 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/xll.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <unistd.h>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace xll;
+
+namespace {
+
+std::mutex results_mutex;
+std::map<void *, variant> results;
+
+double twice(double x) { return 2.0 * x; }
+
+int code(std::future<variant>& f)
+{
+    try {
+        f.get();
+    }
+    catch (const cluster_error& e) {
+        return e.code();
+    }
+    return xlHpcRetSuccess;
+}
+
+} // namespace
+
+// Host emulation: records the values passed to xlAsyncReturn.
+XLL_EXPORT int __stdcall MdCallBack12(int xlfn, int coper, variant **opers, variant *result)
+{
+    if (xlfn == xlAsyncReturn && coper == 2) {
+        std::lock_guard<std::mutex> lock(results_mutex);
+        results[opers[0]->get<xlbigdata>().h] = *opers[1];
+        if (result)
+            result->emplace<xlbool>(true);
+        return xlretSuccess;
+    }
+    return xlretFailed;
+}
+
+// Usage: test_cluster [worker executable], by default cluster_worker in the
+// directory of test_cluster.
+int main(int argc, char *argv[])
+{
+    std::string worker = argc > 1 ? argv[1] : argv[0];
+    if (argc < 2)
+        worker.replace(worker.find_last_of('/') + 1, std::string::npos, "cluster_worker");
+
+    // The table of the coordinator is not used by the workers
+    cluster_functions::define<&twice>(L"twice");
+    cluster_functions::define<&twice>(L"double");
+    BOOST_TEST_EQ(cluster_functions::size(), 2u);
+    BOOST_TEST_EQ(cluster_functions::find(L"double"), 1u);
+    BOOST_TEST_EQ(cluster_functions::find(L"missing"), cluster_functions::npos);
+
+    cluster_connector connector;
+
+    // Not open
+    {
+        auto f = connector.call(L"add", 1.0, 2.0);
+        BOOST_TEST_EQ(code(f), xlHpcRetSessionIdInvalid);
+    }
+
+    // Not an executable
+    BOOST_TEST_EQ(connector.open(worker + ".missing", 2), xlHpcRetCallFailed);
+    BOOST_TEST(!connector.is_open());
+
+    BOOST_TEST_EQ(connector.open(worker, 2, { "constant" }), xlHpcRetSuccess);
+    BOOST_TEST(connector.is_open());
+    BOOST_TEST_EQ(connector.workers(), 2u);
+    BOOST_TEST_EQ(connector.session(), 1u);
+
+    // Results
+    {
+        auto f = connector.call(L"add", 1.5, 2.0);
+        variant v = f.get();
+        BOOST_TEST(v.xltype() == xltypeNum);
+        BOOST_TEST_EQ(static_cast<double>(v.get<xlnum>()), 3.5);
+
+        auto g = connector.call(L"greet", std::wstring(L"World"));
+        variant w = g.get();
+        BOOST_TEST(w.xltype() == xltypeStr);
+        BOOST_TEST(std::wstring(w.get<xlstr>()) == L"Hello, World");
+    }
+
+    // Calls are spread across worker processes
+    {
+        std::vector<std::future<variant>> futures;
+        for (int i = 0; i < 8; ++i)
+            futures.push_back(connector.call(L"process_id", 10.0));
+        std::set<double> pids;
+        for (auto& f : futures)
+            pids.insert(static_cast<double>(f.get().get<xlnum>()));
+        BOOST_TEST_EQ(pids.size(), 2u);
+        BOOST_TEST(pids.count(static_cast<double>(::getpid())) == 0);
+        BOOST_TEST_EQ(connector.pending(), 0u);
+    }
+
+    // Arrays
+    {
+        xlmulti m(2, 2);
+        for (std::size_t i = 0; i < m.size(); ++i)
+            m[i] = static_cast<double>(i + 1);
+        variant arg(std::move(m));
+        auto f = connector.call(L"sum", &arg);
+        BOOST_TEST_EQ(static_cast<double>(f.get().get<xlnum>()), 10.0);
+    }
+
+    // Errors
+    {
+        auto f = connector.call(L"fail", 1.0);
+        variant v = f.get();
+        BOOST_TEST(v.xltype() == xltypeErr);
+        BOOST_TEST(v.get<xlerr>() == error::xlerrValue);
+
+        auto g = connector.call(L"add", 1.0);
+        BOOST_TEST(g.get().xltype() == xltypeErr);
+
+        auto h = connector.call(L"missing", 1.0);
+        BOOST_TEST_EQ(code(h), xlHpcRetCallFailed);
+
+        auto t = connector.call(L"twice", 1.0);
+        BOOST_TEST_EQ(code(t), xlHpcRetCallFailed);
+    }
+
+    // Arguments of the worker executable
+    {
+        auto f = connector.call(L"constant");
+        BOOST_TEST(std::wstring(f.get().get<xlstr>()) == L"constant");
+    }
+
+    // Asynchronous functions
+    {
+        xlbigdata bd{};
+        bd.h = reinterpret_cast<void *>(0x10);
+        handle h(bd);
+        connector.submit(&h, L"add", 2.0, 3.0);
+        for (int i = 0; i < 500; ++i) {
+            {
+                std::lock_guard<std::mutex> lock(results_mutex);
+                if (!results.empty())
+                    break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        std::lock_guard<std::mutex> lock(results_mutex);
+        BOOST_TEST_EQ(results.size(), 1u);
+        BOOST_TEST_EQ(static_cast<double>(results[bd.h].get<xlnum>()), 5.0);
+    }
+
+    // A worker which exits fails its calls; the others continue
+    {
+        auto f = connector.call(L"crash", 0.0);
+        BOOST_TEST_EQ(code(f), xlHpcRetCallFailed);
+        BOOST_TEST_EQ(connector.workers(), 1u);
+        auto g = connector.call(L"add", 1.0, 1.0);
+        BOOST_TEST_EQ(static_cast<double>(g.get().get<xlnum>()), 2.0);
+    }
+
+    // Close waits for outstanding calls
+    {
+        auto f = connector.call(L"process_id", 20.0);
+        connector.close();
+        BOOST_TEST(!connector.is_open());
+        BOOST_TEST_EQ(code(f), xlHpcRetSuccess);
+        auto g = connector.call(L"add", 1.0, 1.0);
+        BOOST_TEST_EQ(code(g), xlHpcRetSessionIdInvalid);
+    }
+
+    BOOST_TEST_EQ(connector.open(worker, 1), xlHpcRetSuccess);
+    BOOST_TEST_EQ(connector.session(), 2u);
+    {
+        auto f = connector.call(L"add", 2.0, 2.0);
+        BOOST_TEST_EQ(static_cast<double>(f.get().get<xlnum>()), 4.0);
+    }
+    connector.close(false);
+    BOOST_TEST(!connector.is_open());
+
+    return boost::report_errors();
+}
@@ -0,0 +1,160 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/columnar.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <cmath>
+#include <string>
+
+using namespace xll;
+
+namespace {
+
+bool same_cell(const variant& x, const variant& y)
+{
+    if (x.xltype() != y.xltype())
+        return false;
+    switch (x.xltype()) {
+    case xltypeNum:
+        return static_cast<double>(x.get<xlnum>()) == static_cast<double>(y.get<xlnum>());
+    case xltypeStr:
+        return x.get<xlstr>() == y.get<xlstr>();
+    case xltypeBool:
+        return static_cast<bool>(x.get<xlbool>()) == static_cast<bool>(y.get<xlbool>());
+    case xltypeErr:
+        return static_cast<error::excel_error>(x.get<xlerr>()) == static_cast<error::excel_error>(y.get<xlerr>());
+    default:
+        return true;
+    }
+}
+
+std::size_t mismatches(const xlmulti& x, const xlmulti& y)
+{
+    if (x.size1() != y.size1() || x.size2() != y.size2())
+        return static_cast<std::size_t>(-1);
+    std::size_t n = 0;
+    for (std::size_t k = 0; k < x.size(); ++k)
+        n += !same_cell(x[k], y[k]);
+    return n;
+}
+
+} // namespace
+
+int main()
+{
+    // An accent and an emoji outside the BMP
+    const std::wstring accent = L"caf\u00e9";
+    const std::wstring emoji = L"\U0001F600!";
+    xlmulti m = {
+        { 1.5, xlstr(L"name"), xlbool(true) },
+        { xlerr(error::xlerrNA), xlnil(), xlstr(accent.c_str()) },
+        { xlint(7), xlstr(emoji.c_str()), xlbool(false) }
+    };
+
+    // UTF-8, column-major
+    {
+        const columnar c = to_columnar(m);
+        BOOST_TEST_EQ(c.rows, 3u);
+        BOOST_TEST_EQ(c.columns, 3u);
+        BOOST_TEST_EQ(c.has_number.count(), 2u);
+        BOOST_TEST_EQ(c.has_string.count(), 3u);
+        BOOST_TEST_EQ(c.has_bool.count(), 2u);
+        BOOST_TEST_EQ(c.has_error.count(), 1u);
+
+        const double *first = c.number_column(0);
+        BOOST_TEST_EQ(first[0], 1.5);
+        BOOST_TEST(std::isnan(first[1]));
+        BOOST_TEST_EQ(first[2], 7.0);
+        BOOST_TEST(c.has_error[c.index(1, 0)]);
+        BOOST_TEST_EQ(c.error(c.index(1, 0)), error::xlerrNA);
+        BOOST_TEST_EQ(c.errors[c.index(0, 0)], 0u);
+
+        BOOST_TEST(!c.has_number[c.index(1, 1)] && !c.has_string[c.index(1, 1)]);
+        BOOST_TEST(c.string(c.index(0, 1)) == "name");
+        BOOST_TEST(c.string(c.index(2, 1)) == "\xF0\x9F\x98\x80!");
+        BOOST_TEST(c.string(c.index(1, 2)) == "caf\xC3\xA9");
+        BOOST_TEST(c.string(c.index(0, 0)).empty());
+        BOOST_TEST_EQ(c.string_offsets.back(), 4u + 5u + 5u);
+
+        BOOST_TEST(c.bools[c.index(0, 2)]);
+        BOOST_TEST(!c.bools[c.index(2, 2)]);
+        BOOST_TEST(c.has_bool[c.index(2, 2)]);
+
+        // xltypeInt comes back as a number
+        xlmulti back = to_xlmulti(c);
+        BOOST_TEST_EQ(back(2, 0).xltype(), xltypeNum);
+        m(2, 0) = 7.0;
+        BOOST_TEST_EQ(mismatches(back, m), 0u);
+    }
+
+    // Wide strings are copied as they are
+    {
+        const wcolumnar c = to_columnar<wchar_t>(m);
+        BOOST_TEST(c.string(c.index(2, 1)) == emoji);
+        BOOST_TEST_EQ(mismatches(to_xlmulti(c), m), 0u);
+    }
+
+    // Strings longer than Excel allows are truncated on the way back
+    {
+        columnar c = to_columnar(xlmulti{ { xlstr(L"x") } });
+        c.string_data.assign(40000, 'y');
+        c.string_offsets.back() = 40000;
+        const xlmulti back = to_xlmulti(c);
+        BOOST_TEST_EQ(back[0].get<xlstr>().size(), 32767u);
+    }
+
+    // Threads give the same result as one
+    {
+        xlmulti big(1001, 131); // not a multiple of 64
+        for (std::size_t k = 0; k < big.size(); ++k) {
+            switch (k % 5) {
+            case 0: big[k] = static_cast<double>(k); break;
+            case 1: big[k] = xlstr(std::to_wstring(k).c_str()); break;
+            case 2: big[k] = xlbool(k % 3 == 0); break;
+            case 3: big[k] = xlerr(error::xlerrDiv0); break;
+            default: break;
+            }
+        }
+        columnar_options serial;
+        serial.threads = 1;
+        columnar_options parallel;
+        parallel.threads = 7;
+        parallel.parallel_threshold = 1;
+
+        const columnar a = to_columnar(big, serial);
+        const columnar b = to_columnar(big, parallel);
+        BOOST_TEST(a.string_offsets == b.string_offsets);
+        BOOST_TEST(a.string_data == b.string_data);
+        BOOST_TEST(a.errors == b.errors);
+        BOOST_TEST(std::equal(a.has_number.words(), a.has_number.words() + (big.size() + 63) / 64, b.has_number.words()));
+        BOOST_TEST(std::equal(a.bools.words(), a.bools.words() + (big.size() + 63) / 64, b.bools.words()));
+        BOOST_TEST_EQ(a.has_number.count(), (big.size() + 4) / 5);
+        BOOST_TEST_EQ(mismatches(to_xlmulti(b, parallel), big), 0u);
+
+        // the threads are shared between conversions and restart after a stop
+        columnar_options many;
+        many.threads = 1000;
+        many.parallel_threshold = 1;
+        for (int i = 0; i < 3; ++i)
+            BOOST_TEST(to_columnar(big, many).string_data == a.string_data);
+        columnar_stop();
+        BOOST_TEST(to_columnar(big, parallel).errors == a.errors);
+        columnar_stop();
+    }
+
+    // Empty
+    {
+        const columnar c = to_columnar(xlmulti(0, 0));
+        BOOST_TEST_EQ(c.size(), 0u);
+        BOOST_TEST_EQ(c.string_offsets.size(), 1u);
+        BOOST_TEST(to_xlmulti(c).empty());
+    }
+
+    return boost::report_errors();
+}
@@ -0,0 +1,142 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/date.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+using namespace xll;
+
+static_assert(days_from_civil(1970, 1, 1) == 0, "epoch");
+static_assert(civil_from_days(-1) == civil_date{ 1969, 12, 31 }, "before epoch");
+static_assert(to_serial(civil_date{ 2024, 3, 15 }) == 45366.0, "constexpr serial");
+
+int main()
+{
+    // 1900 date system, including the fictitious 1900-02-29
+    {
+        BOOST_TEST_EQ(to_serial(civil_date{ 1900, 1, 1 }), 1.0);
+        BOOST_TEST_EQ(to_serial(civil_date{ 1900, 2, 28 }), 59.0);
+        BOOST_TEST_EQ(to_serial(civil_date{ 1900, 2, 29 }), 60.0);
+        BOOST_TEST_EQ(to_serial(civil_date{ 1900, 3, 1 }), 61.0);
+        BOOST_TEST_EQ(to_serial(civil_date{ 9999, 12, 31 }), static_cast<double>(max_serial_1900));
+        BOOST_TEST(to_civil(1.0) == (civil_date{ 1900, 1, 1 }));
+        BOOST_TEST(to_civil(59.9) == (civil_date{ 1900, 2, 28 }));
+        BOOST_TEST(to_civil(60.0) == (civil_date{ 1900, 2, 29 }));
+        BOOST_TEST(to_civil(61.0) == (civil_date{ 1900, 3, 1 }));
+        BOOST_TEST(to_civil(45366.75) == (civil_date{ 2024, 3, 15 }));
+        BOOST_TEST(!valid_serial(-1.0));
+        BOOST_TEST(!valid_serial(max_serial_1900 + 1.0));
+        BOOST_TEST(!valid_serial(std::nan("")));
+
+        // Every day round trips
+        int errors = 0;
+        for (int s = 1; s <= max_serial_1900; ++s)
+            errors += to_serial(to_civil(s)) != s;
+        BOOST_TEST_EQ(errors, 0);
+    }
+
+    // 1904 date system
+    {
+        BOOST_TEST_EQ(to_serial(civil_date{ 1904, 1, 1 }, date_system::excel1904), 0.0);
+        BOOST_TEST_EQ(to_serial(civil_date{ 2024, 3, 15 }, date_system::excel1904), 43904.0);
+        BOOST_TEST(to_civil(43904.0, date_system::excel1904) == (civil_date{ 2024, 3, 15 }));
+
+        std::vector<double> serials = { 45366.25, 1462.0, 100.0, 60.0, -1.0 };
+        convert_date_system(serials.data(), serials.size(), date_system::excel1900, date_system::excel1904);
+        BOOST_TEST_EQ(serials[0], 43904.25);
+        BOOST_TEST_EQ(serials[1], 0.0);
+        BOOST_TEST(std::isnan(serials[2])); // before 1904
+        BOOST_TEST(std::isnan(serials[3]));
+        BOOST_TEST(std::isnan(serials[4]));
+
+        xlmulti m = { { 43904.5, xlbool(true), 10.0 } };
+        convert_date_system(m, date_system::excel1904, date_system::excel1900);
+        BOOST_TEST_EQ(static_cast<double>(m[0].get<xlnum>()), 45366.5);
+        BOOST_TEST_EQ(m[1].xltype(), xltypeBool);
+        BOOST_TEST_EQ(static_cast<double>(m[2].get<xlnum>()), 1472.0);
+        xlmulti early = { { 100.0 } };
+        convert_date_system(early, date_system::excel1900, date_system::excel1904);
+        BOOST_TEST_EQ(early[0].xltype(), xltypeErr);
+    }
+
+    // Time points
+    {
+        const date_time t = to_time_point(45366.5);
+        BOOST_TEST_EQ(t.time_since_epoch().count(),
+            (days_from_civil(2024, 3, 15) * 86400LL + 43200) * 1000000LL);
+        BOOST_TEST_EQ(to_serial(t), 45366.5);
+        BOOST_TEST_EQ(to_serial(to_time_point(1.25)), 1.25);
+        BOOST_TEST_EQ(to_serial(to_time_point(61.0)), 61.0);
+        BOOST_TEST_EQ(to_serial(date_time(std::chrono::microseconds(-1))), 25569.0 - 1 / 86400e6);
+        BOOST_TEST_EQ(weekday_from_days(0), 4u); // Thursday
+        BOOST_TEST_EQ(weekday_from_days(-5), 6u);
+    }
+
+    // Batches
+    {
+        const double serials[] = { 61.0, -3.0, 45366.0, 2958466.0 };
+        const std::vector<civil_date> dates = to_civil(fp12_view(serials, 2, 2));
+        BOOST_TEST(dates[0] == (civil_date{ 1900, 3, 1 }));
+        BOOST_TEST(dates[1] == civil_date{});
+        BOOST_TEST(dates[2] == (civil_date{ 2024, 3, 15 }));
+        BOOST_TEST(dates[3] == civil_date{});
+
+        double back[4];
+        to_serial(dates.data(), dates.size(), back);
+        BOOST_TEST_EQ(back[0], 61.0);
+        BOOST_TEST(std::isnan(back[1]));
+        BOOST_TEST_EQ(back[2], 45366.0);
+    }
+
+    // Business days: March 2024, 2024-03-15 is a Friday
+    {
+        const double fri = to_serial(civil_date{ 2024, 3, 15 });
+        const double mar1 = to_serial(civil_date{ 2024, 3, 1 });
+        const double mar31 = to_serial(civil_date{ 2024, 3, 31 });
+
+        business_calendar cal(to_serial(civil_date{ 2023, 1, 1 }), to_serial(civil_date{ 2025, 12, 31 }));
+        BOOST_TEST(cal.is_business_day(fri));
+        BOOST_TEST(!cal.is_business_day(fri + 1));
+        BOOST_TEST_EQ(cal.add_business_days(fri, 1), fri + 3);
+        BOOST_TEST_EQ(cal.add_business_days(fri, 6), fri + 10);
+        BOOST_TEST_EQ(cal.add_business_days(fri + 1.5, 1), fri + 3); // from Saturday
+        BOOST_TEST_EQ(cal.add_business_days(fri + 1, -1), fri);
+        BOOST_TEST_EQ(cal.add_business_days(fri, -5), fri - 7);
+        BOOST_TEST_EQ(cal.add_business_days(fri, 0), fri);
+        BOOST_TEST_EQ(cal.business_days(mar1, mar31), 21);
+        BOOST_TEST_EQ(cal.business_days(mar31, mar1), -21);
+        BOOST_TEST_EQ(cal.business_days(fri + 1, fri + 2), 0);
+        BOOST_TEST_EQ(cal.add_business_days(mar1, 260), to_serial(civil_date{ 2025, 2, 28 })); // 52 weeks
+
+        const std::vector<double> holidays = { fri + 3 };
+        business_calendar h(mar1, mar31, holidays);
+        BOOST_TEST_EQ(h.add_business_days(fri, 1), fri + 4);
+        BOOST_TEST_EQ(h.business_days(mar1, mar31), 20);
+        BOOST_TEST_THROWS(h.add_business_days(mar31, 1), std::out_of_range);
+        BOOST_TEST_THROWS(h.is_business_day(mar31 + 1), std::out_of_range);
+
+        // Friday and Saturday weekend
+        business_calendar fs(mar1, mar31, std::vector<double>(), 0x30);
+        BOOST_TEST(fs.is_business_day(fri + 2));
+        BOOST_TEST_EQ(fs.add_business_days(fri - 1, 1), fri + 2);
+
+        double a[] = { fri, fri + 1 };
+        cal.add_business_days(mutable_fp12_view(a, 1, 2), 2);
+        BOOST_TEST_EQ(a[0], fri + 4);
+        BOOST_TEST_EQ(a[1], fri + 4);
+
+        BOOST_TEST_THROWS(business_calendar(mar31, mar1), std::out_of_range);
+    }
+
+    return boost::report_errors();
+}
@@ -0,0 +1,224 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/xll.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+using namespace xll;
+
+enum class side { buy = 1, sell = -1 };
+
+double scale(double x, side s)
+{
+    return x * static_cast<int>(s);
+}
+
+double sum(fp12_view x, std::optional<double> offset)
+{
+    double result = offset.value_or(0.0);
+    for (double v : x)
+        result += v;
+    return result;
+}
+
+std::vector<double> cumsum(const std::vector<double>& x)
+{
+    std::vector<double> result(x.size());
+    double total = 0.0;
+    for (std::size_t i = 0; i < x.size(); ++i)
+        result[i] = (total += x[i]);
+    return result;
+}
+
+std::wstring greet(std::string_view name)
+{
+    if (name.empty())
+        throw std::invalid_argument("empty name");
+    return L"Hello, " + std::wstring(name.begin(), name.end());
+}
+
+std::tuple<double, std::wstring, bool> describe(std::wstring_view s)
+{
+    return { static_cast<double>(s.size()), std::wstring(s), s.empty() };
+}
+
+std::uint32_t halve(std::uint32_t x)
+{
+    return x / 2;
+}
+
+int digits(std::int64_t x)
+{
+    int n = 1;
+    while ((x /= 10) != 0)
+        ++n;
+    return n;
+}
+
+int power_calls = 0;
+
+double power(double x, std::wstring_view unit)
+{
+    ++power_calls;
+    return x * x * static_cast<double>(unit.size());
+}
+
+int trim_calls = 0;
+
+std::wstring_view trim(std::wstring_view s)
+{
+    ++trim_calls;
+    const std::size_t first = s.find_first_not_of(L' ');
+    if (first == std::wstring_view::npos)
+        return {};
+    return s.substr(first, s.find_last_not_of(L' ') - first + 1);
+}
+
+XLL_EXPORT_FUNCTION(xl_scale, scale, 2)
+XLL_EXPORT_PURE_FUNCTION(xl_power, power, 2)
+XLL_EXPORT_PURE_FUNCTION(xl_trim, trim, 1)
+XLL_EXPORT_FUNCTION(xl_sum, sum, 2)
+XLL_EXPORT_FUNCTION(xl_cumsum, cumsum, 1)
+XLL_EXPORT_FUNCTION(xl_greet, greet, 1)
+XLL_EXPORT_FUNCTION(xl_describe, describe, 1)
+XLL_EXPORT_FUNCTION(xl_halve, halve, 1)
+XLL_EXPORT_FUNCTION(xl_digits, digits, 1)
+
+int main()
+{
+    {
+        constexpr auto tt = detail::type_text(xl_scale, attribute_set<tag::thread_safe>());
+        constexpr std::array<wchar_t, 4> expected{{ L'B', L'B', L'J', L'$' }};
+        BOOST_TEST(tt == expected);
+        BOOST_TEST_EQ(xl_scale(2.0, -1), -2.0);
+    }
+    {
+        constexpr auto tt = detail::type_text(xl_sum, attribute_set<>());
+        constexpr std::array<wchar_t, 4> expected{{ L'B', L'K', L'%', L'Q' }};
+        BOOST_TEST(tt == expected);
+
+        static_fp12<3> x(1, 3);
+        x(0, 0) = 1.0; x(0, 1) = 2.0; x(0, 2) = 3.0;
+        auto *p = reinterpret_cast<const fp12 *>(&x);
+        variant missing;
+        BOOST_TEST_EQ(xl_sum(p, &missing), 6.0);
+        variant offset(10.0);
+        BOOST_TEST_EQ(xl_sum(p, &offset), 16.0);
+        variant invalid(L"text");
+        BOOST_TEST(std::isnan(xl_sum(p, &invalid)));
+    }
+    {
+        constexpr auto tt = detail::type_text(xl_cumsum, attribute_set<>());
+        constexpr std::array<wchar_t, 4> expected{{ L'K', L'%', L'K', L'%' }};
+        BOOST_TEST(tt == expected);
+
+        static_fp12<3> x(1, 3);
+        x(0, 0) = 1.0; x(0, 1) = 2.0; x(0, 2) = 3.0;
+        fp12 *result = xl_cumsum(reinterpret_cast<const fp12 *>(&x));
+        BOOST_TEST_EQ(result->rows, 3);
+        BOOST_TEST_EQ(result->columns, 1);
+        BOOST_TEST_EQ(result->array[2], 6.0);
+    }
+    {
+        constexpr auto tt = detail::type_text(xl_greet, attribute_set<>());
+        constexpr std::array<wchar_t, 4> expected{{ L'C', L'%', L'C', L'%' }};
+        BOOST_TEST(tt == expected);
+        BOOST_TEST(std::wstring(xl_greet(L"Excel")) == L"Hello, Excel");
+        BOOST_TEST(xl_greet(L"") == nullptr);
+    }
+    {
+        constexpr auto tt = detail::type_text(xl_describe, attribute_set<>());
+        constexpr std::array<wchar_t, 3> expected{{ L'Q', L'C', L'%' }};
+        BOOST_TEST(tt == expected);
+
+        variant *result = xl_describe(L"abc");
+        BOOST_TEST_EQ(result->xltype(), xltypeMulti);
+        auto& m = result->get<xlmulti>();
+        BOOST_TEST_EQ(m.size1(), 1);
+        BOOST_TEST_EQ(m.size2(), 3);
+        BOOST_TEST_EQ(m(0, 0).get<xlnum>(), 3.0);
+        BOOST_TEST_EQ(m(0, 1).get<xlstr>(), L"abc");
+        BOOST_TEST_EQ(m(0, 2).get<xlbool>(), false);
+    }
+    {
+        // unsigned 32 bit integers do not fit in J
+        constexpr auto tt = detail::type_text(xl_halve, attribute_set<>());
+        constexpr std::array<wchar_t, 2> expected{{ L'B', L'B' }};
+        BOOST_TEST(tt == expected);
+        BOOST_TEST_EQ(xl_halve(4000000000.0), 2000000000.0);
+        BOOST_TEST_EQ(xl_halve(4294967295.5), 2147483647.0);
+        BOOST_TEST(std::isnan(xl_halve(4294967296.0)));
+        BOOST_TEST_EQ(xl_halve(-0.5), 0.0);
+        BOOST_TEST(std::isnan(xl_halve(-1.0)));
+        BOOST_TEST(std::isnan(xl_halve(std::numeric_limits<double>::quiet_NaN())));
+    }
+    {
+        constexpr auto tt = detail::type_text(xl_digits, attribute_set<>());
+        constexpr std::array<wchar_t, 2> expected{{ L'Q', L'B' }};
+        BOOST_TEST(tt == expected);
+        BOOST_TEST_EQ(xl_digits(12345.0)->get<xlnum>(), 5.0);
+        BOOST_TEST_EQ(xl_digits(-9223372036854775808.0)->get<xlnum>(), 19.0);
+        BOOST_TEST_EQ(xl_digits(9223372036854775808.0)->get<xlerr>(), error::xlerrNum);
+        BOOST_TEST_EQ(xl_digits(1e300)->get<xlerr>(), error::xlerrNum);
+        BOOST_TEST_EQ(xl_digits(std::numeric_limits<double>::quiet_NaN())->get<xlerr>(), error::xlerrNum);
+    }
+
+    {
+        constexpr auto tt = detail::type_text(xl_power, attribute_set<tag::thread_safe>());
+        constexpr std::array<wchar_t, 5> expected{{ L'B', L'B', L'C', L'%', L'$' }};
+        BOOST_TEST(tt == expected);
+
+        memo_cache::clear();
+        BOOST_TEST_EQ(xl_power(3.0, L"ab"), 18.0);
+        BOOST_TEST_EQ(xl_power(3.0, L"ab"), 18.0);
+        BOOST_TEST_EQ(xl_power(3.0, L"abc"), 27.0);
+        BOOST_TEST_EQ(power_calls, 2);
+
+        memo_stats stats = memo_cache::stats();
+        BOOST_TEST_EQ(stats.hits, 1u);
+        BOOST_TEST_EQ(stats.misses, 2u);
+        BOOST_TEST_EQ(stats.entries, 2u);
+
+        memo_cache::invalidate();
+        BOOST_TEST_EQ(memo_cache::stats().entries, 0u); // freed
+        BOOST_TEST_EQ(memo_cache::stats().bytes, 0u);
+        BOOST_TEST_EQ(xl_power(3.0, L"ab"), 18.0);
+        BOOST_TEST_EQ(power_calls, 3);
+
+        memo_cache::configure(0); // evict all
+        BOOST_TEST_EQ(memo_cache::stats().entries, 0u);
+        BOOST_TEST_EQ(xl_power(3.0, L"ab"), 18.0);
+        BOOST_TEST_EQ(power_calls, 4);
+    }
+
+    {
+        // a cached view result does not refer to the argument of the first call
+        memo_cache::configure(std::size_t(64) << 20);
+        std::wstring first(L"  abc ");
+        BOOST_TEST(std::wstring(xl_trim(first.c_str())) == L"abc");
+        first.assign(first.size(), L'x');
+        first.clear();
+        first.shrink_to_fit();
+        const std::wstring second(L"  abc ");
+        BOOST_TEST(std::wstring(xl_trim(second.c_str())) == L"abc");
+        BOOST_TEST_EQ(trim_calls, 1);
+    }
+
+    return boost::report_errors();
+}
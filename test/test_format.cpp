@@ -0,0 +1,99 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/format.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <string>
+
+using namespace xll;
+
+namespace {
+
+std::wstring general(double x)
+{
+    return std::wstring(to_xlstr(x, number_format::general));
+}
+
+std::wstring shortest(double x)
+{
+    return std::wstring(to_xlstr(x));
+}
+
+} // namespace
+
+int main()
+{
+    // Shortest round trip
+    BOOST_TEST(shortest(0.1 + 0.2) == L"0.30000000000000004");
+    BOOST_TEST(shortest(1.0) == L"1");
+    BOOST_TEST(shortest(-2.5) == L"-2.5");
+    BOOST_TEST(shortest(1e21) == L"1e+21");
+    BOOST_TEST(shortest(5e-324) == L"5e-324");
+    {
+        std::mt19937_64 rng(42);
+        std::uniform_real_distribution<double> exponent(-300.0, 300.0);
+        bool roundtrip = true;
+        for (int i = 0; i < 10000; ++i) {
+            const double x = std::pow(10.0, exponent(rng)) * (i % 2 ? -1.0 : 1.0);
+            char buf[max_number_chars + 1];
+            buf[format_number(x, buf)] = '\0';
+            roundtrip = roundtrip && std::strtod(buf, nullptr) == x;
+        }
+        BOOST_TEST(roundtrip);
+    }
+
+    // Excel text coercion
+    BOOST_TEST(general(0.1 + 0.2) == L"0.3");
+    BOOST_TEST(general(1.0 / 3.0) == L"0.333333333333333");
+    BOOST_TEST(general(2.0 / 3.0) == L"0.666666666666667");
+    BOOST_TEST(general(0.0) == L"0");
+    BOOST_TEST(general(-0.0) == L"0");
+    BOOST_TEST(general(-1.5) == L"-1.5");
+    BOOST_TEST(general(100.0) == L"100");
+    BOOST_TEST(general(123456789012345.0) == L"123456789012345");
+    BOOST_TEST(general(999999999999999.0) == L"999999999999999");
+    BOOST_TEST(general(1e15) == L"1E+15");
+    BOOST_TEST(general(9999999999999999.0) == L"1E+16");
+    BOOST_TEST(general(123456789012345678.0) == L"1.23456789012346E+17");
+    BOOST_TEST(general(1e100) == L"1E+100");
+    BOOST_TEST(general(0.0001) == L"0.0001");
+    BOOST_TEST(general(1e-9) == L"0.000000001");
+    BOOST_TEST(general(1e-10) == L"1E-10");
+    BOOST_TEST(general(-1.25e-300) == L"-1.25E-300");
+    BOOST_TEST(general(std::numeric_limits<double>::quiet_NaN()) == L"#NUM!");
+    BOOST_TEST(general(-std::numeric_limits<double>::infinity()) == L"#NUM!");
+
+    // Buffer bound
+    {
+        const double values[] = { -1.2345678901234567e-300, -std::numeric_limits<double>::max(),
+            -std::numeric_limits<double>::denorm_min(), -0.00012345678901234567 };
+        for (double x : values) {
+            char narrow[max_number_chars];
+            BOOST_TEST_LE(format_number(x, narrow), max_number_chars);
+            wchar_t wide[max_number_chars];
+            BOOST_TEST_LE(format_number(x, wide, number_format::general), max_number_chars);
+        }
+    }
+
+    // Arrays
+    {
+        xlmulti m{ { 1.5, L"text" }, { xlbool(true), 0.25 } };
+        format_numbers(m, number_format::general);
+        BOOST_TEST(std::wstring(m(0, 0).get<xlstr>()) == L"1.5");
+        BOOST_TEST(std::wstring(m(0, 1).get<xlstr>()) == L"text");
+        BOOST_TEST(m(1, 0).xltype() == xltypeBool);
+        BOOST_TEST(std::wstring(m(1, 1).get<xlstr>()) == L"0.25");
+    }
+
+    return boost::report_errors();
+}
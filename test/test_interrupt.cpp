@@ -0,0 +1,98 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/xll.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+
+using namespace xll;
+
+namespace {
+
+std::mutex results_mutex;
+std::map<void *, variant> results;
+std::atomic<int> abort_calls{ 0 };
+std::atomic<bool> abort_result{ false };
+
+bool wait_for(void *h)
+{
+    for (int i = 0; i < 500; ++i) {
+        {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            if (results.count(h) != 0)
+                return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    return false;
+}
+
+} // namespace
+
+// Host emulation: answers xlAbort and records the values passed to
+// xlAsyncReturn.
+XLL_EXPORT int __stdcall MdCallBack12(int xlfn, int coper, variant **opers, variant *result)
+{
+    if (xlfn == xlAbort) {
+        ++abort_calls;
+        result->emplace<xlbool>(abort_result.load());
+        return xlretSuccess;
+    }
+    if (xlfn == xlAsyncReturn && coper == 2) {
+        std::lock_guard<std::mutex> lock(results_mutex);
+        results[opers[0]->get<xlbigdata>().h] = *opers[1];
+        if (result)
+            result->emplace<xlbool>(true);
+    }
+    return xlretSuccess;
+}
+
+int main()
+{
+    {
+        // xlAbort is polled at most once per interval, by the owning thread
+        interrupt_token token(std::chrono::hours(1));
+        token.set_owner();
+        for (int i = 0; i < 1000; ++i)
+            BOOST_TEST(!token.poll());
+        BOOST_TEST_EQ(abort_calls.load(), 1);
+        BOOST_TEST_EQ(token.polls(), 1u);
+
+        abort_result = true;
+        token.set_interval(std::chrono::microseconds(0));
+        std::thread([&token]() { BOOST_TEST(!token.poll()); }).join();
+        BOOST_TEST_EQ(abort_calls.load(), 1);
+        BOOST_TEST(token.poll());
+        BOOST_TEST_EQ(abort_calls.load(), 2);
+
+        // async jobs observe the flag without calling into Excel
+        async_executor::start(2);
+        xlbigdata bd;
+        bd.h = reinterpret_cast<void *>(500);
+        handle h(bd);
+        async_executor::submit(&h, [&token]() { return token.requested(); });
+        BOOST_TEST(wait_for(bd.h));
+        {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            BOOST_TEST(results[bd.h].get<xlbool>());
+        }
+        BOOST_TEST_EQ(abort_calls.load(), 2);
+        async_executor::stop();
+
+        token.reset();
+        abort_result = false;
+        BOOST_TEST(!token.poll());
+    }
+
+    return boost::report_errors();
+}
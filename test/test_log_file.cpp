@@ -0,0 +1,200 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/log_file.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace xll;
+
+namespace {
+
+std::string read_file(const std::filesystem::path& path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+}
+
+std::filesystem::path temp_path(const char *name)
+{
+    const auto path = std::filesystem::temp_directory_path() / name;
+    for (std::size_t i = 0; i < 8; ++i)
+        std::filesystem::remove(log_file::rotated_path(path, i));
+    return path;
+}
+
+} // namespace
+
+int main()
+{
+    // Queue
+    {
+        detail::log_queue q(16);
+        log_record r;
+        BOOST_TEST(!q.pop(r));
+        BOOST_TEST(q.push(1, 2, log_level::warn, "short"));
+        const std::string long_text(100, 'x'); // three cells
+        BOOST_TEST(q.push(3, 4, log_level::error, long_text));
+        BOOST_TEST(q.pop(r));
+        BOOST_TEST_EQ(r.time, 1);
+        BOOST_TEST_EQ(r.thread, 2u);
+        BOOST_TEST(r.level == log_level::warn);
+        BOOST_TEST_EQ(r.message, "short");
+        BOOST_TEST(q.pop(r));
+        BOOST_TEST_EQ(r.message, long_text);
+        BOOST_TEST(!q.pop(r));
+
+        // Full, wrapping around the end of the cells
+        int pushed = 0;
+        while (q.push(5, 6, log_level::info, std::string(40, 'y')))
+            ++pushed;
+        BOOST_TEST_EQ(pushed, 8);
+        int popped = 0;
+        while (q.pop(r)) {
+            BOOST_TEST_EQ(r.message, std::string(40, 'y'));
+            ++popped;
+        }
+        BOOST_TEST_EQ(popped, pushed);
+
+        // Truncated to a quarter of the queue
+        BOOST_TEST(q.push(7, 8, log_level::info, std::string(1000, 'z')));
+        BOOST_TEST(q.pop(r));
+        BOOST_TEST_EQ(r.message.size(), 32u + 3 * 56u);
+    }
+
+    BOOST_TEST(!log_file::active());
+    BOOST_TEST(!log_file::push(log_level::info, "inactive", 1));
+
+    // Text
+    {
+        const auto path = temp_path("xll_test_log.log");
+        log_file_options opts;
+        opts.path = path;
+        BOOST_TEST(log_file::start(opts));
+        BOOST_TEST(!log_file::start(opts));
+        BOOST_TEST(log_file::push(log_level::info, "hello", 42,
+            std::chrono::system_clock::time_point(std::chrono::seconds(86400))));
+        BOOST_TEST(log_file::push(log_level::warn, "world", 43));
+        BOOST_TEST(log_file::flush());
+        BOOST_TEST_EQ(log_file::written(), 2u);
+        BOOST_TEST(log_file::stop());
+        BOOST_TEST(!log_file::active());
+
+        const std::string text = read_file(path);
+        BOOST_TEST(text.find("1970-01-02T00:00:00.000000Z [42] [info] hello\n") == 0);
+        BOOST_TEST(text.find("[43] [warning] world\n") != std::string::npos);
+        std::filesystem::remove(path);
+    }
+
+    // JSON lines
+    {
+        const auto path = temp_path("xll_test_log.json");
+        log_file_options opts;
+        opts.path = path;
+        opts.format = log_format::json;
+        BOOST_TEST(log_file::start(opts));
+        BOOST_TEST(log_file::push(log_level::error, "say \"hi\"\n", 7,
+            std::chrono::system_clock::time_point(std::chrono::milliseconds(1500))));
+        BOOST_TEST(log_file::stop());
+        BOOST_TEST_EQ(read_file(path),
+            "{\"time\":\"1970-01-01T00:00:01.500000Z\",\"thread\":7,\"level\":\"error\",\"message\":\"say \\\"hi\\\"\\u000a\"}\n");
+        std::filesystem::remove(path);
+    }
+
+    // Binary, from many threads with a small queue
+    {
+        const auto path = temp_path("xll_test_log.bin");
+        log_file_options opts;
+        opts.path = path;
+        opts.format = log_format::binary;
+        opts.capacity = 64;
+        opts.max_size = 0;
+        opts.interval = std::chrono::milliseconds(1);
+        BOOST_TEST(log_file::start(opts));
+
+        constexpr int threads = 4;
+        constexpr int messages = 5000;
+        std::atomic<int> accepted{ 0 };
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threads; ++t) {
+            pool.emplace_back([t, &accepted]() {
+                for (int i = 0; i < messages; ++i) {
+                    const std::string text = std::to_string(t) + ":" + std::to_string(i);
+                    if (log_file::push(log_level::debug, text, static_cast<std::uint64_t>(t)))
+                        ++accepted;
+                }
+            });
+        }
+        for (auto& t : pool)
+            t.join();
+        BOOST_TEST(log_file::stop());
+        BOOST_TEST_EQ(log_file::written(), static_cast<std::uint64_t>(accepted.load()));
+        BOOST_TEST_EQ(log_file::written() + log_file::dropped(), static_cast<std::uint64_t>(threads * messages));
+
+        std::vector<log_record> records;
+        BOOST_TEST(read_log(path, records));
+        BOOST_TEST_EQ(records.size(), static_cast<std::size_t>(accepted.load()));
+
+        // Messages of each thread are in order
+        std::vector<int> last(threads, -1);
+        bool ordered = true;
+        for (const auto& r : records) {
+            const auto colon = r.message.find(':');
+            const int t = std::stoi(r.message.substr(0, colon));
+            const int i = std::stoi(r.message.substr(colon + 1));
+            ordered = ordered && static_cast<int>(r.thread) == t && i > last[t];
+            last[t] = i;
+        }
+        BOOST_TEST(ordered);
+        BOOST_TEST(!read_log(path.string() + ".missing", records));
+        std::filesystem::remove(path);
+    }
+
+    // Rotation
+    {
+        const auto path = temp_path("xll_test_log_rotate.log");
+        log_file_options opts;
+        opts.path = path;
+        opts.max_size = 1000;
+        opts.max_files = 3;
+        BOOST_TEST(log_file::start(opts));
+        for (int i = 0; i < 100; ++i) {
+            BOOST_TEST(log_file::push(log_level::info, std::string(50, 'a'), 1));
+            if (i % 10 == 9)
+                log_file::flush();
+        }
+        BOOST_TEST(log_file::stop());
+        BOOST_TEST(std::filesystem::exists(path));
+        BOOST_TEST(std::filesystem::exists(log_file::rotated_path(path, 1)));
+        BOOST_TEST(std::filesystem::exists(log_file::rotated_path(path, 2)));
+        BOOST_TEST(!std::filesystem::exists(log_file::rotated_path(path, 3)));
+        for (std::size_t i = 0; i < 3; ++i)
+            BOOST_TEST_LE(std::filesystem::file_size(log_file::rotated_path(path, i)), 1000u);
+        BOOST_TEST_EQ(log_file::rotated_path(path, 2).filename().string(), "xll_test_log_rotate.2.log");
+        for (std::size_t i = 0; i < 3; ++i)
+            std::filesystem::remove(log_file::rotated_path(path, i));
+    }
+
+    // Left running: stopped at exit rather than terminating the process
+    {
+        log_file_options opts;
+        opts.path = temp_path("xll_test_log_exit.log");
+        std::filesystem::remove(opts.path);
+        BOOST_TEST(log_file::start(opts));
+        BOOST_TEST(log_file::push(log_level::info, "at exit", 1));
+    }
+
+    return boost::report_errors();
+}
@@ -0,0 +1,140 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/multi_view.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <numeric>
+#include <vector>
+
+using namespace xll;
+
+namespace {
+
+double number(const variant& v)
+{
+    return static_cast<double>(v.get<xlnum>());
+}
+
+std::vector<double> numbers(multi_view v)
+{
+    std::vector<double> out;
+    for (const variant& x : v)
+        out.push_back(number(x));
+    return out;
+}
+
+} // namespace
+
+int main()
+{
+    // 3 x 4, cell (i, j) = 10 * i + j
+    xlmulti m(3, 4);
+    for (unsigned i = 0; i < 3; ++i)
+        for (unsigned j = 0; j < 4; ++j)
+            m(i, j) = 10.0 * i + j;
+
+    const multi_view table(m);
+    BOOST_TEST_EQ(table.rank(), 2u);
+    BOOST_TEST_EQ(table.extent(0), 3u);
+    BOOST_TEST_EQ(table.extent(1), 4u);
+    BOOST_TEST_EQ(table.stride(0), 4);
+    BOOST_TEST_EQ(table.stride(1), 1);
+    BOOST_TEST(table.data() == m.data());
+    BOOST_TEST(table.is_contiguous());
+    BOOST_TEST_EQ(number(table(2, 3)), 23.0);
+    BOOST_TEST_EQ(number(table[5]), 11.0);
+    BOOST_TEST_THROWS(table.at(3, 0), std::out_of_range);
+
+    // Rows, columns and blocks share the cells
+    {
+        const multi_view row = table.row(1);
+        BOOST_TEST(row.is_contiguous());
+        BOOST_TEST(numbers(row) == (std::vector<double>{ 10, 11, 12, 13 }));
+
+        const multi_view col = table.column(2);
+        BOOST_TEST_EQ(col.rows(), 3u);
+        BOOST_TEST(!col.is_contiguous());
+        BOOST_TEST(numbers(col) == (std::vector<double>{ 2, 12, 22 }));
+        BOOST_TEST(&col(1, 0) == &m(1, 2));
+
+        const multi_view block = table.block(1, 1, 2, 2);
+        BOOST_TEST(numbers(block) == (std::vector<double>{ 11, 12, 21, 22 }));
+        BOOST_TEST(numbers(block.column(1)) == (std::vector<double>{ 12, 22 }));
+        BOOST_TEST(!block.is_contiguous());
+        BOOST_TEST(table.block(1, 0, 2, 4).is_contiguous());
+        BOOST_TEST(table.block(2, 3, 0, 0).empty());
+    }
+
+    // Transpose
+    {
+        const multi_view t = table.transpose();
+        BOOST_TEST_EQ(t.rows(), 4u);
+        BOOST_TEST_EQ(t.columns(), 3u);
+        BOOST_TEST_EQ(number(t(3, 1)), 13.0);
+        BOOST_TEST(numbers(t.row(0)) == (std::vector<double>{ 0, 10, 20 }));
+        BOOST_TEST(!t.is_contiguous());
+        BOOST_TEST(t.transpose().is_contiguous());
+        BOOST_TEST(t.column(1).is_contiguous()); // row 1 of the table
+    }
+
+    // Random access iteration
+    {
+        const multi_view col = table.column(3);
+        auto first = col.begin();
+        BOOST_TEST_EQ(std::distance(first, col.end()), 3);
+        BOOST_TEST_EQ(number(first[2]), 23.0);
+        BOOST_TEST_EQ(number(*(first + 1)), 13.0);
+        BOOST_TEST_EQ(number(*(col.end() - 1)), 23.0);
+        const double sum = std::accumulate(col.begin(), col.end(), 0.0,
+            [](double s, const variant& v) { return s + number(v); });
+        BOOST_TEST_EQ(sum, 3.0 + 13.0 + 23.0);
+    }
+
+    // Writes through a mutable view
+    {
+        mutable_multi_view v(m);
+        for (variant& x : v.column(0))
+            x = xlbool(true);
+        BOOST_TEST_EQ(m(2, 0).xltype(), xltypeBool);
+        BOOST_TEST_EQ(m(2, 1).xltype(), xltypeNum);
+        const multi_view c = v.block(0, 1, 3, 3);
+        BOOST_TEST_EQ(number(c(0, 0)), 1.0);
+    }
+
+    // Returned to Excel only when contiguous
+    {
+        const variant *x = table.block(1, 0, 2, 4).as_xloper();
+        BOOST_TEST(x != nullptr);
+        if (x != nullptr) {
+            BOOST_TEST_EQ(x->xltype(), xltypeMulti);
+            BOOST_TEST_EQ(x->flags(), 0u);
+            const xlmulti& r = x->get<xlmulti>();
+            BOOST_TEST_EQ(r.size1(), 2u);
+            BOOST_TEST_EQ(r.size2(), 4u);
+            BOOST_TEST(r.data() == &m(1, 0));
+        }
+        BOOST_TEST(table.column(1).as_xloper() == nullptr);
+
+        // the type is where a variant keeps it
+        const variant owner(xlmulti(1, 1));
+        std::uint32_t type = 0;
+        std::memcpy(&type, reinterpret_cast<const unsigned char *>(&owner) + offsetof(detail::multi_ref, xltype), sizeof(type));
+        BOOST_TEST_EQ(type, static_cast<std::uint32_t>(owner.xltype()));
+
+        const xlmulti copy = table.column(1).copy();
+        BOOST_TEST_EQ(copy.size1(), 3u);
+        BOOST_TEST_EQ(copy.size2(), 1u);
+        BOOST_TEST_EQ(number(copy[2]), 21.0);
+    }
+
+    return boost::report_errors();
+}
@@ -0,0 +1,190 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/xll.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace xll;
+
+namespace {
+
+struct curve
+{
+    static inline int live = 0;
+    std::vector<double> rates;
+    explicit curve(std::vector<double> r) : rates(std::move(r)) { ++live; }
+    ~curve() { --live; }
+};
+
+using cell_address = std::tuple<uintptr_t, int32_t, int32_t>;
+
+// Contents of the cells read by object_store::sweep().
+std::map<cell_address, std::wstring> cells;
+std::set<cell_address> uncalced;
+
+} // namespace
+
+// Host emulation: xlCoerce of a reference to xltypeMulti and xlFree. There is
+// no calling cell.
+XLL_EXPORT int __stdcall MdCallBack12(int xlfn, int coper, variant **opers, variant *result)
+{
+    if (xlfn == xlFree) {
+        for (int i = 0; i < coper; ++i) {
+            opers[i]->reset_flags(xlbitXLFree);
+            opers[i]->release();
+        }
+        return xlretSuccess;
+    }
+    if (xlfn != xlCoerce || coper != 2 || opers[0]->xltype() != xltypeRef)
+        return xlretFailed;
+
+    const uintptr_t sheet = opers[0]->get<xlref>().idSheet;
+    const auto& r = opers[0]->get<xlref>().lpmref->reftbl[0];
+    xlmulti m(static_cast<unsigned>(r.rwLast - r.rwFirst + 1), static_cast<unsigned>(r.colLast - r.colFirst + 1));
+    for (int32_t rw = r.rwFirst; rw <= r.rwLast; ++rw) {
+        for (int32_t col = r.colFirst; col <= r.colLast; ++col) {
+            const cell_address a{ sheet, rw, col };
+            if (uncalced.count(a))
+                return xlretUncalced;
+            auto it = cells.find(a);
+            if (it != cells.end())
+                m(static_cast<unsigned>(rw - r.rwFirst), static_cast<unsigned>(col - r.colFirst)) = xlstr(it->second.c_str());
+        }
+    }
+    *result = variant(std::move(m));
+    return xlretSuccess;
+}
+
+int main()
+{
+    range_key a1{ 1, 0, 0, 0, 0 };
+    range_key b1{ 1, 0, 0, 1, 1 };
+    range_key c1{ 2, 0, 0, 2, 2 };
+    {
+        std::wstring h1 = object_store::insert(L"Curve",
+            std::make_shared<const curve>(std::vector<double>{ 0.01, 0.02 }), a1);
+        BOOST_TEST(h1 == L"Curve:0#1");
+        auto c = object_store::find<curve>(h1);
+        BOOST_TEST(c != nullptr);
+        BOOST_TEST_EQ(c->rates[1], 0.02);
+        BOOST_TEST(object_store::find<int>(h1) == nullptr); // wrong type
+        BOOST_TEST(object_store::find<curve>(L"Model:0#1") == nullptr); // wrong name
+        BOOST_TEST(object_store::find<curve>(L"Curve:0#") == nullptr);
+        BOOST_TEST(object_store::find<curve>(L"Curve:9999999#1") == nullptr);
+
+        // recalculating the owning cell replaces the object
+        std::wstring h2 = object_store::insert(L"Curve",
+            std::make_shared<const curve>(std::vector<double>{ 0.03 }), a1);
+        BOOST_TEST(h2 == L"Curve:0#2");
+        BOOST_TEST(object_store::find<curve>(h1) == nullptr);
+        BOOST_TEST_EQ(object_store::size(), 1u);
+
+        // retired objects are freed by collect() once no longer referenced
+        c.reset();
+        BOOST_TEST_EQ(curve::live, 2);
+        BOOST_TEST_EQ(object_store::collect(), 1u);
+        BOOST_TEST_EQ(curve::live, 1);
+
+        std::wstring h3 = object_store::create<curve>(L"Curve", std::vector<double>{ 0.04 });
+        std::wstring h4 = object_store::insert(L"Curve",
+            std::make_shared<const curve>(std::vector<double>{ 0.05 }), b1);
+        object_store::insert(L"Curve", std::make_shared<const curve>(std::vector<double>{ 0.06 }), c1);
+        BOOST_TEST_EQ(object_store::size(), 4u);
+        BOOST_TEST(object_store::erase(h3));
+        BOOST_TEST(!object_store::erase(h3));
+        BOOST_TEST_EQ(object_store::erase_sheet(1), 2u);
+        BOOST_TEST(!object_store::contains(h4));
+        BOOST_TEST_EQ(object_store::size(), 1u);
+
+        // freed slots are reused with the next generation
+        std::wstring h5 = object_store::insert(L"Curve",
+            std::make_shared<const curve>(std::vector<double>{ 0.07 }), a1);
+        BOOST_TEST(h5 != h2);
+        BOOST_TEST(object_store::find<curve>(h2) == nullptr);
+    }
+    {
+        // concurrent lookups while the owning cell is recalculated
+        std::wstring h = object_store::insert(L"Curve",
+            std::make_shared<const curve>(std::vector<double>{ 1.0 }), a1);
+        constexpr int reader_count = 4;
+        std::atomic<bool> done{ false };
+        std::atomic<int> found{ 0 };
+        std::mutex mutex;
+        std::condition_variable started;
+        int ready = 0;
+        std::vector<std::thread> readers;
+        for (int t = 0; t < reader_count; ++t) {
+            readers.emplace_back([&]() {
+                bool first = true;
+                while (!done.load()) {
+                    if (auto c = object_store::find<curve>(h))
+                        found += c->rates[0] == 1.0;
+                    if (first) {
+                        first = false;
+                        std::lock_guard<std::mutex> lock(mutex);
+                        ++ready;
+                        started.notify_one();
+                    }
+                }
+            });
+        }
+
+        // every reader has looked up the handle once before the writes start
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            started.wait(lock, [&]() { return ready == reader_count; });
+        }
+        BOOST_TEST(found.load() >= reader_count);
+        for (int i = 0; i < 1000; ++i)
+            object_store::insert(L"Curve", std::make_shared<const curve>(std::vector<double>{ 2.0 }), b1);
+        done = true;
+        for (auto& t : readers)
+            t.join();
+        BOOST_TEST(object_store::contains(h));
+    }
+    {
+        // objects of cleared cells are removed by sweep()
+        object_store::clear();
+        std::wstring h1 = object_store::insert(L"Curve",
+            std::make_shared<const curve>(std::vector<double>{ 0.01 }), a1);
+        std::wstring h2 = object_store::insert(L"Curve",
+            std::make_shared<const curve>(std::vector<double>{ 0.02 }), b1);
+        std::wstring h3 = object_store::insert(L"Curve",
+            std::make_shared<const curve>(std::vector<double>{ 0.03 }), c1);
+        std::wstring h4 = object_store::create<curve>(L"Curve", std::vector<double>{ 0.04 });
+        cells[{ 1, 0, 0 }] = h1;
+        cells[{ 1, 0, 1 }] = L"cleared";
+        uncalced.insert({ 2, 0, 2 });
+        BOOST_TEST_EQ(object_store::sweep(), 1u);
+        BOOST_TEST(object_store::contains(h1));
+        BOOST_TEST(!object_store::contains(h2));
+        BOOST_TEST(object_store::contains(h3)); // not calculated
+        BOOST_TEST(object_store::contains(h4)); // no owner
+
+        uncalced.clear();
+        BOOST_TEST_EQ(object_store::sweep(), 1u);
+        BOOST_TEST(!object_store::contains(h3));
+        BOOST_TEST_EQ(object_store::size(), 2u);
+    }
+
+    object_store::clear();
+    BOOST_TEST_EQ(object_store::size(), 0u);
+    BOOST_TEST_EQ(curve::live, 0);
+
+    return boost::report_errors();
+}
@@ -0,0 +1,133 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/parse.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <string>
+
+using namespace xll;
+
+namespace {
+
+parse_status parse(const std::wstring& s, double& x, const number_locale& loc = {})
+{
+    return parse_number(s.data(), s.size(), x, loc);
+}
+
+double value(const std::wstring& s, const number_locale& loc = {})
+{
+    double x = -999.0;
+    BOOST_TEST(parse(s, x, loc) == parse_status::ok);
+    return x;
+}
+
+parse_status status(const std::wstring& s, const number_locale& loc = {})
+{
+    double x;
+    return parse(s, x, loc);
+}
+
+} // namespace
+
+// Host emulation: GET.WORKSPACE(37) of a German installation.
+XLL_EXPORT int __stdcall MdCallBack12(int xlfn, int coper, variant **opers, variant *result)
+{
+    if (xlfn == xlFree) {
+        for (int i = 0; i < coper; ++i) {
+            opers[i]->reset_flags(xlbitXLFree);
+            opers[i]->release();
+        }
+        return xlretSuccess;
+    }
+    if (xlfn != xlfGetWorkspace)
+        return xlretFailed;
+    xlmulti m(1, 5);
+    m[0] = 49.0;
+    m[1] = 49.0;
+    m[2].emplace<xlstr>(L",");
+    m[3].emplace<xlstr>(L".");
+    m[4].emplace<xlstr>(L";");
+    *result = variant(std::move(m));
+    return xlretSuccess;
+}
+
+int main()
+{
+    // Accepted forms
+    BOOST_TEST_EQ(value(L"42"), 42.0);
+    BOOST_TEST_EQ(value(L"  -3.25 "), -3.25);
+    BOOST_TEST_EQ(value(L"+.5"), 0.5);
+    BOOST_TEST_EQ(value(L"7."), 7.0);
+    BOOST_TEST_EQ(value(L"1,234,567.5"), 1234567.5);
+    BOOST_TEST_EQ(value(L"1.5e3"), 1500.0);
+    BOOST_TEST_EQ(value(L"2E-2"), 0.02);
+    BOOST_TEST_EQ(value(L"(12.5)"), -12.5);
+    BOOST_TEST_EQ(value(L"50%"), 0.5);
+    BOOST_TEST_EQ(value(L" 1\t"), 1.0);
+    BOOST_TEST_EQ(value(L"0.1"), 0.1);
+    BOOST_TEST_EQ(value(L"1e-400"), 0.0);
+
+    // Rejected forms
+    BOOST_TEST(status(L"") == parse_status::empty);
+    BOOST_TEST(status(L"   ") == parse_status::empty);
+    BOOST_TEST(status(L"abc") == parse_status::invalid);
+    BOOST_TEST(status(L"1.2.3") == parse_status::invalid);
+    BOOST_TEST(status(L",123") == parse_status::invalid);
+    BOOST_TEST(status(L"123,") == parse_status::invalid);
+    BOOST_TEST(status(L"1.5,3") == parse_status::invalid);
+    BOOST_TEST(status(L"1e") == parse_status::invalid);
+    BOOST_TEST(status(L"e5") == parse_status::invalid);
+    BOOST_TEST(status(L"(-1)") == parse_status::invalid);
+    BOOST_TEST(status(L"--1") == parse_status::invalid);
+    BOOST_TEST(status(L"inf") == parse_status::invalid);
+    BOOST_TEST(status(L"1 2") == parse_status::invalid);
+    BOOST_TEST(status(L".") == parse_status::invalid);
+    BOOST_TEST(status(L"1e999") == parse_status::out_of_range);
+    BOOST_TEST(status(std::wstring(200, L'1')) == parse_status::invalid);
+    BOOST_TEST_EQ(value(L"1e-" + std::wstring(125, L'9')), 0.0); // fills the buffer
+    BOOST_TEST(status(L"1e" + std::wstring(126, L'9')) == parse_status::out_of_range);
+
+    // Other separators
+    {
+        number_locale de;
+        de.decimal = L',';
+        de.thousands = L'.';
+        BOOST_TEST_EQ(value(L"1.234,5", de), 1234.5);
+        BOOST_TEST(status(L"1,2,3", de) == parse_status::invalid);
+
+        number_locale fr;
+        fr.decimal = L',';
+        fr.thousands = L' ';
+        BOOST_TEST_EQ(value(L"1 234 567,25", fr), 1234567.25);
+
+        const number_locale host = number_locale::excel();
+        BOOST_TEST(host.decimal == L',');
+        BOOST_TEST(host.thousands == L'.');
+    }
+
+    // Arrays
+    {
+        xlmulti m{ { L"1.5", L"x" }, { 2.0, L"" }, { L"1,000", xlbool(true) } };
+        const parse_result r = parse_numbers(m);
+        BOOST_TEST_EQ(r.converted, 2u);
+        BOOST_TEST_EQ(static_cast<double>(m(0, 0).get<xlnum>()), 1.5);
+        BOOST_TEST_EQ(static_cast<double>(m(2, 0).get<xlnum>()), 1000.0);
+        BOOST_TEST(m(0, 1).xltype() == xltypeStr);
+        BOOST_TEST(m(2, 1).xltype() == xltypeBool);
+        BOOST_TEST_EQ(r.errors.size(), 2u);
+        if (r.errors.size() == 2) {
+            BOOST_TEST(r.errors[0].row == 0 && r.errors[0].column == 1);
+            BOOST_TEST(r.errors[0].status == parse_status::invalid);
+            BOOST_TEST(r.errors[1].row == 1 && r.errors[1].column == 1);
+            BOOST_TEST(r.errors[1].status == parse_status::empty);
+        }
+    }
+
+    return boost::report_errors();
+}
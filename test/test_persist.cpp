@@ -0,0 +1,198 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/xll.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace xll;
+
+namespace {
+
+std::map<std::wstring, std::vector<unsigned char>> binary_names;
+
+int memo_calls = 0;
+
+std::wstring label(double x, std::wstring_view unit)
+{
+    ++memo_calls;
+    return std::to_wstring(static_cast<int>(x)) + L" " + std::wstring(unit);
+}
+
+double total(fp12_view v, const variant& scale)
+{
+    ++memo_calls;
+    double sum = 0.0;
+    for (double x : v)
+        sum += x;
+    return sum * static_cast<double>(scale.get<xlnum>());
+}
+
+std::vector<double> series(double n)
+{
+    ++memo_calls;
+    return std::vector<double>(static_cast<std::size_t>(n), 1.0);
+}
+
+} // namespace
+
+XLL_EXPORT_PURE_FUNCTION(xl_label, label, 2)
+XLL_EXPORT_PURE_FUNCTION(xl_total, total, 2)
+XLL_EXPORT_PURE_FUNCTION(xl_series, series, 1)
+
+// Host emulation: stores the data passed to xlDefineBinaryName.
+XLL_EXPORT int __stdcall MdCallBack12(int xlfn, int coper, variant **opers, variant *result)
+{
+    if (xlfn == xlDefineBinaryName && coper == 2) {
+        const auto& name = opers[0]->get<xlstr>();
+        const auto& bd = opers[1]->get<xlbigdata>();
+        auto *p = static_cast<const unsigned char *>(bd.h);
+        binary_names[std::wstring(name.data(), name.size())].assign(p, p + bd.cbData);
+    }
+    else if (xlfn == xlGetBinaryName && coper == 1) {
+        const auto& name = opers[0]->get<xlstr>();
+        auto it = binary_names.find(std::wstring(name.data(), name.size()));
+        if (it == binary_names.end())
+            return xlretFailed;
+        xlbigdata bd;
+        bd.h = it->second.data();
+        bd.cbData = static_cast<long>(it->second.size());
+        result->emplace<xlbigdata>(bd);
+    }
+    return xlretSuccess;
+}
+
+int main()
+{
+    {
+        xlmulti m(2, 2);
+        m(0, 0) = 1.5;
+        m(0, 1) = L"text";
+        m(1, 0) = xlbool(true);
+        m(1, 1) = error::xlerrDiv0;
+
+        int calls = 0;
+        auto make = [&]() { ++calls; return variant(std::move(m)); };
+        persistent_cache::get_or_create(L"calibration/USD", make);
+        persistent_cache::get_or_create(L"calibration/USD", make);
+        persistent_cache::insert(L"scalar", variant(42.0));
+        BOOST_TEST_EQ(calls, 1);
+        BOOST_TEST(persistent_cache::dirty());
+
+        BOOST_TEST(persistent_cache::save());
+        BOOST_TEST(!persistent_cache::dirty());
+        persistent_cache::clear();
+        BOOST_TEST_EQ(persistent_cache::size(), 0u);
+
+        BOOST_TEST_EQ(persistent_cache::load(), 2u);
+        auto value = persistent_cache::find(L"calibration/USD");
+        BOOST_TEST(value != nullptr);
+        if (value) {
+            const auto& x = value->get<xlmulti>();
+            BOOST_TEST_EQ(x.size1(), 2u);
+            BOOST_TEST_EQ(x(0, 0).get<xlnum>(), 1.5);
+            const auto& s = x(0, 1).get<xlstr>();
+            BOOST_TEST(std::wstring(s.data(), s.size()) == L"text");
+            BOOST_TEST(x(1, 0).get<xlbool>());
+            BOOST_TEST_EQ(x(1, 1).get<xlerr>(), error::xlerrDiv0);
+        }
+        BOOST_TEST_EQ(persistent_cache::find(L"scalar")->get<xlnum>(), 42.0);
+    }
+    {
+        // truncated or foreign data is rejected
+        std::vector<unsigned char> data = persistent_cache::serialize();
+        persistent_cache::clear();
+        BOOST_TEST_EQ(persistent_cache::deserialize(data.data(), data.size() - 3), 1u);
+        data[0] = 'Y';
+        BOOST_TEST_EQ(persistent_cache::deserialize(data.data(), data.size()), 0u);
+        BOOST_TEST_EQ(persistent_cache::load(L"missing"), 0u);
+    }
+    {
+        // entries inserted before a load remain unsaved
+        BOOST_TEST(persistent_cache::save());
+        persistent_cache::insert(L"unsaved", variant(1.0));
+        BOOST_TEST(persistent_cache::load() > 0u);
+        BOOST_TEST(persistent_cache::dirty());
+        BOOST_TEST(persistent_cache::find(L"unsaved") != nullptr);
+        BOOST_TEST(persistent_cache::save());
+        BOOST_TEST(persistent_cache::load() > 0u);
+        BOOST_TEST(!persistent_cache::dirty());
+    }
+    {
+        // memo_cache entries round trip through the workbook
+        double data[3];
+        fp12 *column = reinterpret_cast<fp12 *>(data);
+        column->rows = 2;
+        column->columns = 1;
+        column->array[0] = 1.0;
+        column->array[1] = 2.0;
+        variant scale(10.0);
+
+        memo_cache::clear();
+        BOOST_TEST(std::wstring(xl_label(3.0, L"kg")) == L"3 kg");
+        BOOST_TEST_EQ(xl_total(column, &scale), 30.0);
+        xl_series(2.0);
+        BOOST_TEST_EQ(memo_calls, 3);
+        BOOST_TEST_EQ(memo_cache::stats().entries, 3u);
+        BOOST_TEST(persistent_cache::save_memo());
+
+        memo_cache::clear();
+        memo_calls = 0;
+        BOOST_TEST_EQ(persistent_cache::load_memo(), 2u); // vectors are not exported
+        BOOST_TEST(std::wstring(xl_label(3.0, L"kg")) == L"3 kg");
+        BOOST_TEST_EQ(xl_total(column, &scale), 30.0);
+        BOOST_TEST_EQ(memo_calls, 0);
+        BOOST_TEST_EQ(memo_cache::stats().hits, 2u);
+
+        // imported again, entries are replaced
+        BOOST_TEST_EQ(persistent_cache::load_memo(), 2u);
+        BOOST_TEST_EQ(memo_cache::stats().entries, 2u);
+        BOOST_TEST(std::wstring(xl_label(4.0, L"kg")) == L"4 kg");
+        BOOST_TEST_EQ(memo_calls, 1);
+
+        // unknown functions and mismatched arguments are skipped
+        BOOST_TEST_EQ(memo_cache::export_entries().size(), 3u);
+        std::vector<unsigned char> records = persistent_cache::serialize_memo();
+        std::size_t offset = 12;
+        for (int i = 0; i < 3; ++i) {
+            std::uint32_t len;
+            std::uint64_t size;
+            std::memcpy(&len, &records[offset], 4);
+            unsigned char *name = &records[offset + 4];
+            unsigned char *entry = name + 2 * len + 8;
+            std::memcpy(&size, name + 2 * len, 8);
+            if (i == 0)
+                name[0] = 'y'; // unknown function
+            else if (i == 1)
+                entry[0] = 1; // argument count
+            else
+                entry[4] = static_cast<unsigned char>(xltypeStr); // first argument
+            offset = static_cast<std::size_t>(entry - records.data() + size);
+        }
+        BOOST_TEST_EQ(offset, records.size());
+        BOOST_TEST_EQ(persistent_cache::deserialize_memo(records.data(), records.size()), 0u);
+        std::vector<unsigned char> valid = persistent_cache::serialize_memo();
+        BOOST_TEST_EQ(persistent_cache::deserialize_memo(valid.data(), valid.size()), 3u);
+        BOOST_TEST_EQ(memo_cache::stats().entries, 3u);
+
+        // expired entries are not exported
+        memo_cache::invalidate();
+        BOOST_TEST(memo_cache::export_entries().empty());
+        std::vector<unsigned char> data_memo = persistent_cache::serialize_memo();
+        BOOST_TEST_EQ(persistent_cache::deserialize_memo(data_memo.data(), data_memo.size()), 0u);
+        data_memo[3] = 'P';
+        BOOST_TEST_EQ(persistent_cache::deserialize_memo(data_memo.data(), data_memo.size()), 0u);
+        memo_cache::clear();
+    }
+
+    return boost::report_errors();
+}
@@ -0,0 +1,179 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/xll.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace xll;
+
+namespace {
+
+double sleep_for(double ms)
+{
+    std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(ms));
+    return ms;
+}
+
+double fail(double)
+{
+    throw std::runtime_error("failed");
+}
+
+std::wstring echo(std::wstring_view s)
+{
+    return std::wstring(s);
+}
+
+// n + 1 allocations for the array and its strings, and one user allocation.
+variant grid(double n)
+{
+    xlmulti m(static_cast<unsigned>(n), 1);
+    for (unsigned i = 0; i < m.size1(); ++i)
+        m(i, 0).emplace<xlstr>(L"abc");
+    std::vector<char, profiled_allocator<char>> buffer(100);
+    profiler::count_allocation(1000);
+    return variant(std::move(m));
+}
+
+const function_stats *find(const std::vector<function_stats>& stats, std::wstring_view name)
+{
+    for (const auto& s : stats) {
+        if (s.name == name)
+            return &s;
+    }
+    return nullptr;
+}
+
+} // namespace
+
+XLL_EXPORT_FUNCTION(xl_sleep, sleep_for, 1)
+XLL_EXPORT_FUNCTION(xl_fail, fail, 1)
+XLL_EXPORT_FUNCTION(xl_echo, echo, 1)
+XLL_EXPORT_FUNCTION(xl_grid, grid, 1)
+
+// Host emulation: xlGetName and xlfRegister.
+XLL_EXPORT int __stdcall MdCallBack12(int xlfn, int, variant **, variant *result)
+{
+    switch (xlfn) {
+    case xlGetName:
+        result->emplace<xlstr>(L"test_profile.xll");
+        return xlretSuccess;
+    case xlfRegister:
+        result->emplace<xlnum>(42.0);
+        return xlretSuccess;
+    case xlFree:
+        return xlretSuccess;
+    default:
+        return xlretFailed;
+    }
+}
+
+int main()
+{
+    // Buckets
+    {
+        BOOST_TEST_EQ(detail::profile_bucket(0), 0u);
+        BOOST_TEST_EQ(detail::profile_bucket(2), 2u);
+        BOOST_TEST_EQ(detail::profile_bucket(3), 3u);
+        BOOST_TEST_EQ(detail::profile_bucket(1024), 20u);
+        BOOST_TEST_EQ(detail::profile_bucket(1535), 20u);
+        BOOST_TEST_EQ(detail::profile_bucket(1536), 21u);
+        BOOST_TEST_EQ(detail::profile_bucket(~std::uint64_t(0)), profile_buckets - 1);
+        BOOST_TEST_EQ(detail::profile_bucket_limit(20), 1536.0);
+        BOOST_TEST_EQ(detail::profile_bucket_limit(21), 2048.0);
+        for (std::uint64_t ns = 2; ns < 100000; ns = ns * 3 / 2 + 1)
+            BOOST_TEST(ns < detail::profile_bucket_limit(detail::profile_bucket(ns)));
+    }
+
+    // Not recorded while disabled
+    BOOST_TEST(!profiler::enabled());
+    xl_sleep(0.0);
+    BOOST_TEST(profiler::stats().empty());
+
+    profiler::enable();
+    for (int i = 0; i < 4; ++i)
+        xl_sleep(2.0);
+    xl_sleep(20.0);
+    BOOST_TEST(std::isnan(xl_fail(1.0)));
+    BOOST_TEST(std::wstring(xl_echo(L"abcd")) == L"abcd");
+    BOOST_TEST_EQ(xl_grid(8.0)->get<xlmulti>().size(), 8u);
+
+    // Allocations outside exported functions are not counted
+    profiler::count_allocation(1000);
+    xlmulti outside(4, 4);
+
+    // Calls on other threads use other shards
+    std::thread([]() { xl_echo(L"ab"); }).join();
+
+    {
+        auto stats = profiler::stats();
+        BOOST_TEST_EQ(stats.size(), 4u);
+        BOOST_TEST(stats[0].name == L"xl_sleep"); // most total time first
+        const function_stats *s = find(stats, L"xl_sleep");
+        BOOST_TEST(s != nullptr);
+        if (s != nullptr) {
+            BOOST_TEST_EQ(s->calls, 5u);
+            BOOST_TEST_EQ(s->errors, 0u);
+            BOOST_TEST_EQ(s->argument_bytes, 5 * sizeof(double));
+            BOOST_TEST_EQ(s->allocations, 0u);
+            BOOST_TEST_EQ(s->allocated_bytes, 0u);
+            BOOST_TEST_GE(s->max_ns, 20000000u);
+            BOOST_TEST_GE(s->total_ns, 28000000u);
+            BOOST_TEST_GE(s->percentile_ns(0.5), 2000000.0);
+            BOOST_TEST_LT(s->percentile_ns(0.5), 20000000.0);
+            BOOST_TEST_LE(s->percentile_ns(0.5), s->percentile_ns(0.99));
+            BOOST_TEST_EQ(s->percentile_ns(1.0), static_cast<double>(s->max_ns));
+        }
+        const function_stats *f = find(stats, L"xl_fail");
+        BOOST_TEST(f != nullptr && f->calls == 1 && f->errors == 1);
+        const function_stats *e = find(stats, L"xl_echo");
+        BOOST_TEST(e != nullptr && e->calls == 2 && e->argument_bytes == 12);
+        const function_stats *g = find(stats, L"xl_grid");
+        BOOST_TEST(g != nullptr);
+        if (g != nullptr) {
+            BOOST_TEST_GE(g->allocations, 11u);
+            BOOST_TEST_GE(g->allocated_bytes, 8 * sizeof(variant) + 8 * 4 * sizeof(wchar_t) + 1100);
+        }
+    }
+
+    // Worksheet function
+    {
+        variant *v = xll_profile_stats();
+        BOOST_TEST(v->xltype() == xltypeMulti);
+        const auto& m = v->get<xlmulti>();
+        BOOST_TEST_EQ(m.size1(), 5u);
+        BOOST_TEST_EQ(m.size2(), 12u);
+        BOOST_TEST(std::wstring(m(0, 10).get<xlstr>()) == L"Allocations");
+        BOOST_TEST(std::wstring(m(0, 0).get<xlstr>()) == L"Function");
+        BOOST_TEST(std::wstring(m(1, 0).get<xlstr>()) == L"xl_sleep");
+        BOOST_TEST_EQ(static_cast<double>(m(1, 1).get<xlnum>()), 5.0);
+    }
+
+    // Registration
+    BOOST_TEST_EQ(profiler::register_stats(), 42.0);
+    {
+        const function_entry *e = registry::find(L"xll_profile_stats");
+        BOOST_TEST(e != nullptr);
+        if (e != nullptr)
+            BOOST_TEST(e->function_text == L"XLL.STATS");
+    }
+
+    profiler::reset();
+    BOOST_TEST(profiler::stats().empty());
+    profiler::enable(false);
+    xl_sleep(0.0);
+    BOOST_TEST(profiler::stats().empty());
+
+    return boost::report_errors();
+}
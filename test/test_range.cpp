@@ -0,0 +1,246 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/range.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <set>
+#include <utility>
+
+using namespace xll;
+
+namespace {
+
+// Sheet 1 calls the functions; the value of a cell is 100 * row + column on
+// sheet 1 and its negative on any other sheet.
+constexpr uintptr_t caller_sheet = 1;
+
+int coerce_calls = 0;
+std::set<std::pair<int32_t, int32_t>> uncalced;
+
+double cell_value(uintptr_t sheet, int32_t rw, int32_t col)
+{
+    const double x = 100.0 * rw + col;
+    return sheet == caller_sheet ? x : -x;
+}
+
+range_ref sref(int32_t rwFirst, int32_t rwLast, int32_t colFirst, int32_t colLast)
+{
+    xlsref r;
+    r.ref.rwFirst = rwFirst;
+    r.ref.rwLast = rwLast;
+    r.ref.colFirst = colFirst;
+    r.ref.colLast = colLast;
+    range_ref result;
+    result.emplace<xlsref>(r);
+    return result;
+}
+
+double number(const variant& v)
+{
+    return v.xltype() == xltypeNum ? static_cast<double>(v.get<xlnum>()) : -1.0;
+}
+
+} // namespace
+
+// Host emulation: xlCoerce of references to xltypeMulti or a single value,
+// xlfCaller and xlFree. Coercing an uncalculated cell fails.
+XLL_EXPORT int __stdcall MdCallBack12(int xlfn, int coper, variant **opers, variant *result)
+{
+    if (xlfn == xlFree) {
+        for (int i = 0; i < coper; ++i) {
+            opers[i]->reset_flags(xlbitXLFree);
+            opers[i]->release();
+        }
+        return xlretSuccess;
+    }
+    if (xlfn == xlfCaller) {
+        static std::remove_pointer_t<decltype(xlref::lpmref)> mref;
+        xlref r;
+        r.lpmref = &mref;
+        r.idSheet = caller_sheet;
+        result->emplace<xlref>(r);
+        return xlretSuccess;
+    }
+    if (xlfn != xlCoerce || coper != 2)
+        return xlretFailed;
+
+    ++coerce_calls;
+    uintptr_t sheet = caller_sheet;
+    int32_t rwFirst, rwLast, colFirst, colLast;
+    if (opers[0]->xltype() == xltypeSRef) {
+        const auto& r = opers[0]->get<xlsref>().ref;
+        rwFirst = r.rwFirst; rwLast = r.rwLast; colFirst = r.colFirst; colLast = r.colLast;
+    }
+    else if (opers[0]->xltype() == xltypeRef) {
+        const auto& r = opers[0]->get<xlref>().lpmref->reftbl[0];
+        sheet = opers[0]->get<xlref>().idSheet;
+        rwFirst = r.rwFirst; rwLast = r.rwLast; colFirst = r.colFirst; colLast = r.colLast;
+    }
+    else
+        return xlretFailed;
+
+    for (int32_t rw = rwFirst; rw <= rwLast; ++rw)
+        for (int32_t col = colFirst; col <= colLast; ++col)
+            if (uncalced.count({ rw, col }))
+                return xlretUncalced;
+
+    if (opers[1]->get<xlint>() & xltypeMulti) {
+        xlmulti m(static_cast<unsigned>(rwLast - rwFirst + 1), static_cast<unsigned>(colLast - colFirst + 1));
+        for (int32_t rw = rwFirst; rw <= rwLast; ++rw)
+            for (int32_t col = colFirst; col <= colLast; ++col)
+                m(static_cast<unsigned>(rw - rwFirst), static_cast<unsigned>(col - colFirst)) = cell_value(sheet, rw, col);
+        *result = variant(std::move(m));
+    }
+    else
+        *result = variant(cell_value(sheet, rwFirst, colFirst));
+    return xlretSuccess;
+}
+
+int main()
+{
+    const range_ref area = sref(10, 12, 1, 2);
+
+    // Values
+    {
+        int rc = -1;
+        auto v = area.values(&rc);
+        BOOST_TEST_EQ(rc, xlretSuccess);
+        BOOST_TEST_EQ(v->xltype(), xltypeMulti);
+        BOOST_TEST_EQ(v->flags(), 0u);
+        BOOST_TEST_EQ(v->get<xlmulti>().size1(), 3u);
+        BOOST_TEST_EQ(v->get<xlmulti>().size2(), 2u);
+        BOOST_TEST_EQ(number(v->get<xlmulti>()(2, 1)), 1202.0);
+        BOOST_TEST_EQ(coerce_calls, 1);
+
+        BOOST_TEST_EQ(number(area.cell(1, 0, &rc)), 1101.0);
+        BOOST_TEST_EQ(rc, xlretSuccess);
+        BOOST_TEST(area.cell(3, 0).get<xlerr>() == error::xlerrRef);
+
+        // Not cached
+        area.values();
+        BOOST_TEST_EQ(coerce_calls, 3);
+    }
+
+    // Uncalculated cells fail the coercion
+    {
+        uncalced.insert({ 11, 2 });
+        int rc = -1;
+        auto v = area.values(&rc);
+        BOOST_TEST_EQ(rc, xlretUncalced);
+        BOOST_TEST(v->get<xlerr>() == error::xlerrValue);
+
+        variant x = area.cell(1, 1, &rc);
+        BOOST_TEST_EQ(rc, xlretUncalced);
+        BOOST_TEST(x.get<xlerr>() == error::xlerrValue);
+        BOOST_TEST_EQ(number(area.cell(1, 0, &rc)), 1101.0);
+        BOOST_TEST_EQ(rc, xlretSuccess);
+        uncalced.clear();
+    }
+
+    range_cache::enable();
+    coerce_calls = 0;
+
+    // Cache hits within a calculation
+    {
+        auto v = area.values();
+        auto w = area.values();
+        BOOST_TEST_EQ(coerce_calls, 1);
+        BOOST_TEST(v == w);
+
+        int rc = -1;
+        BOOST_TEST_EQ(number(area.cell(2, 1, &rc)), 1202.0);
+        BOOST_TEST_EQ(rc, xlretSuccess);
+        BOOST_TEST_EQ(coerce_calls, 1);
+        BOOST_TEST(area.cell(3, 0).get<xlerr>() == error::xlerrRef); // as when not cached
+        BOOST_TEST(area.cell(0, 2).get<xlerr>() == error::xlerrRef);
+
+        // Same area on another sheet
+        xlref r;
+        std::remove_pointer_t<decltype(xlref::lpmref)> mref;
+        mref.reftbl[0].rwFirst = 10;
+        mref.reftbl[0].rwLast = 12;
+        mref.reftbl[0].colFirst = 1;
+        mref.reftbl[0].colLast = 2;
+        r.lpmref = &mref;
+        r.idSheet = 2;
+        range_ref other;
+        other.emplace<xlref>(r);
+        BOOST_TEST_EQ(number(other.values()->get<xlmulti>()(0, 0)), -1001.0);
+        BOOST_TEST_EQ(coerce_calls, 2);
+        other.values();
+        BOOST_TEST_EQ(coerce_calls, 2);
+
+        // Invalidated when calculation ends
+        range_cache::invalidate();
+        auto x = area.values();
+        BOOST_TEST_EQ(coerce_calls, 3);
+        BOOST_TEST(x != v);
+        BOOST_TEST_EQ(number(x->get<xlmulti>()(0, 0)), 1001.0);
+    }
+
+    // Failures are not cached
+    {
+        range_cache::invalidate();
+        coerce_calls = 0;
+        uncalced.insert({ 10, 1 });
+        int rc = -1;
+        area.values(&rc);
+        BOOST_TEST_EQ(rc, xlretUncalced);
+        uncalced.clear();
+        auto v = area.values(&rc);
+        BOOST_TEST_EQ(rc, xlretSuccess);
+        BOOST_TEST_EQ(v->xltype(), xltypeMulti);
+        BOOST_TEST_EQ(coerce_calls, 2);
+        area.values(&rc);
+        BOOST_TEST_EQ(coerce_calls, 2);
+    }
+
+    range_cache::invalidate();
+    range_cache::enable(false);
+
+    // Values are not coerced
+    {
+        int rc = -1;
+        range_ref r(2.5);
+        BOOST_TEST_EQ(number(*r.values(&rc)), 2.5);
+        BOOST_TEST_EQ(rc, xlretSuccess);
+        BOOST_TEST_EQ(number(r.cell(0, 0)), 2.5);
+        BOOST_TEST(r.cell(1, 0).get<xlerr>() == error::xlerrRef);
+
+        xlmulti m(2, 1);
+        m(1, 0) = 7.0;
+        range_ref a(std::move(m));
+        BOOST_TEST_EQ(number(a.cell(1, 0)), 7.0);
+        BOOST_TEST(a.cell(2, 0).get<xlerr>() == error::xlerrRef);
+        BOOST_TEST(a.cell(0, 1).get<xlerr>() == error::xlerrRef);
+    }
+
+    // A reference without areas has no cells
+    {
+        const int calls = coerce_calls;
+        xlref r;
+        r.lpmref = nullptr;
+        r.idSheet = caller_sheet;
+        range_ref empty;
+        empty.emplace<xlref>(r);
+        BOOST_TEST_EQ(empty.rows(), 0u);
+        BOOST_TEST_EQ(empty.columns(), 0u);
+        BOOST_TEST(empty.cell(0, 0).get<xlerr>() == error::xlerrRef);
+
+        std::remove_pointer_t<decltype(xlref::lpmref)> mref;
+        mref.count = 0;
+        r.lpmref = &mref;
+        empty.emplace<xlref>(r);
+        BOOST_TEST_EQ(empty.rows(), 0u);
+        BOOST_TEST(empty.cell(0, 0).get<xlerr>() == error::xlerrRef);
+        BOOST_TEST_EQ(coerce_calls, calls);
+    }
+
+    return boost::report_errors();
+}
@@ -0,0 +1,182 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/xll.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <cmath>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace xll;
+
+namespace {
+
+int host_calls = 0;
+bool host_available = true;
+
+double round2(double x)
+{
+    variant result, value(x), digits(2.0);
+    if (Excel12(xlfRound, &result, &value, &digits) != xlretSuccess)
+        throw std::runtime_error("xlfRound failed");
+    return static_cast<double>(result.get<xlnum>());
+}
+
+std::wstring greet(std::wstring_view name)
+{
+    variant result, hello(L"Hello, "), who{ std::wstring(name) };
+    if (Excel12(xlfConcatenate, &result, &hello, &who) != xlretSuccess)
+        throw std::runtime_error("xlfConcatenate failed");
+    return std::wstring(result.get<xlstr>());
+}
+
+double total(fp12_view x)
+{
+    double sum = 0.0;
+    for (double d : x)
+        sum += d;
+    return sum;
+}
+
+} // namespace
+
+XLL_EXPORT_FUNCTION(xl_round2, round2, 1)
+XLL_EXPORT_FUNCTION(xl_greet, greet, 1)
+XLL_EXPORT_PURE_FUNCTION(xl_total, total, 1)
+
+// Host emulation: xlfRound, xlfConcatenate and xlFree.
+XLL_EXPORT int __stdcall MdCallBack12(int xlfn, int coper, variant **opers, variant *result)
+{
+    if (!host_available)
+        return xlretFailed;
+    ++host_calls;
+    switch (xlfn) {
+    case xlfRound:
+        result->emplace<xlnum>(std::round(static_cast<double>(opers[0]->get<xlnum>()) * 100.0) / 100.0);
+        return xlretSuccess;
+    case xlfConcatenate: {
+        std::wstring s;
+        for (int i = 0; i < coper; ++i)
+            s += std::wstring(opers[i]->get<xlstr>());
+        result->emplace<xlstr>(s);
+        return xlretSuccess;
+    }
+    case xlFree:
+        for (int i = 0; i < coper; ++i) {
+            opers[i]->reset_flags(xlbitXLFree);
+            opers[i]->release();
+        }
+        return xlretSuccess;
+    default:
+        return xlretFailed;
+    }
+}
+
+int main()
+{
+    const auto path = std::filesystem::temp_directory_path() / "xll_test_record.trace";
+
+    BOOST_TEST(replay_functions::find(L"xl_round2") != nullptr);
+    BOOST_TEST(replay_functions::find(L"xl_total") != nullptr);
+    BOOST_TEST(replay_functions::find(L"xl_missing") == nullptr);
+
+    // Not recorded while inactive
+    BOOST_TEST_EQ(xl_round2(1.234), 1.23);
+
+    // Record
+    BOOST_TEST(call_recorder::start(path));
+    BOOST_TEST(call_recorder::active());
+    BOOST_TEST(!call_recorder::start(path));
+    {
+        BOOST_TEST_EQ(xl_round2(3.14159), 3.14);
+        BOOST_TEST(std::wstring(xl_greet(L"World")) == L"Hello, World");
+        BOOST_TEST_EQ(xl_round2(2.71828), 2.72);
+        double data[] = { 0.0, 1.0, 2.0, 3.0 };
+        auto *p = reinterpret_cast<fp12 *>(data);
+        p->rows = 1;
+        p->columns = 3;
+        BOOST_TEST_EQ(xl_total(p), 6.0);
+    }
+    BOOST_TEST_EQ(call_recorder::records(), 7u);
+    BOOST_TEST(call_recorder::stop());
+    BOOST_TEST(!call_recorder::active());
+    BOOST_TEST(call_recorder::stop());
+
+    // Read
+    std::vector<trace_record> records;
+    BOOST_TEST(read_trace(path, records));
+    BOOST_TEST_EQ(records.size(), 7u);
+    if (records.size() == 7) {
+        BOOST_TEST(records[0].kind == detail::trace_callback);
+        BOOST_TEST_EQ(records[0].xlfn, xlfRound);
+        BOOST_TEST_EQ(records[0].args.size(), 2u);
+        BOOST_TEST_EQ(static_cast<double>(records[0].result.get<xlnum>()), 3.14);
+        BOOST_TEST(records[1].kind == detail::trace_call);
+        BOOST_TEST(records[1].name == L"xl_round2");
+        BOOST_TEST_EQ(records[1].call, records[0].call);
+        BOOST_TEST_EQ(static_cast<double>(records[1].args[0].get<xlnum>()), 3.14159);
+        BOOST_TEST(records[3].name == L"xl_greet");
+        BOOST_TEST(std::wstring(records[3].result.get<xlstr>()) == L"Hello, World");
+        BOOST_TEST(records[6].name == L"xl_total");
+        BOOST_TEST_EQ(records[6].args[0].get<xlmulti>().size(), 3u);
+        BOOST_TEST(records[6].time >= records[1].time);
+    }
+
+    // Replay without the host
+    host_available = false;
+    const int calls = host_calls;
+    {
+        trace_replayer replayer;
+        BOOST_TEST(replayer.load(path));
+        BOOST_TEST_EQ(replayer.size(), 4u);
+        replay_report report = replayer.run(3);
+        BOOST_TEST_EQ(report.calls, 12u);
+        BOOST_TEST_EQ(report.mismatches, 0u);
+        BOOST_TEST_EQ(report.missing, 0u);
+        BOOST_TEST_EQ(report.failed_callbacks, 0u);
+        BOOST_TEST_EQ(trace_replayer::main(path.string().c_str(), 1), 0);
+    }
+    BOOST_TEST_EQ(host_calls, calls);
+
+    // Results which differ from the trace, and unknown functions
+    {
+        std::vector<trace_record> changed = records;
+        changed[0].result.emplace<xlnum>(3.0);
+        changed[6].name = L"xl_missing";
+        trace_replayer replayer(std::move(changed));
+        replay_report report = replayer.run();
+        BOOST_TEST_EQ(report.calls, 3u);
+        BOOST_TEST_EQ(report.mismatches, 1u);
+        BOOST_TEST_EQ(report.missing, 1u);
+    }
+
+    // Callbacks which were not recorded fail
+    {
+        std::vector<trace_record> changed = records;
+        changed.erase(changed.begin() + 2);
+        trace_replayer replayer(std::move(changed));
+        replay_report report = replayer.run();
+        BOOST_TEST_EQ(report.failed_callbacks, 1u);
+        BOOST_TEST_EQ(report.mismatches, 1u);
+    }
+    host_available = true;
+
+    // Invalid data
+    {
+        std::vector<trace_record> out;
+        const unsigned char bad[] = { 'X', 'L', 'L', 'T', 1, 0, 0, 0, 1, 0 };
+        BOOST_TEST(!parse_trace(bad, sizeof(bad), out));
+        BOOST_TEST(!parse_trace(bad, 4, out));
+        BOOST_TEST(!read_trace(path.string() + ".missing", out));
+    }
+
+    std::filesystem::remove(path);
+    return boost::report_errors();
+}
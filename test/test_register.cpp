@@ -10,6 +10,8 @@
 #include <boost/core/lightweight_test.hpp>
 
 #include <array>
+#include <string>
+#include <vector>
 
 using namespace xll;
 
@@ -33,6 +35,32 @@ const char * __stdcall func1(variant *)
     return "";
 }
 
+const char * __stdcall func2(variant *)
+{
+    return "";
+}
+
+variant * __stdcall func3(range_ref *)
+{
+    return nullptr;
+}
+
+namespace {
+
+std::vector<double> unregistered;
+
+} // namespace
+
+// Host emulation: records the IDs passed to xlfUnregister.
+XLL_EXPORT int __stdcall MdCallBack12(int xlfn, int coper, variant **opers, variant *result)
+{
+    if (xlfn != xlfUnregister || coper != 1)
+        return xlretFailed;
+    unregistered.push_back(opers[0]->get<xlnum>());
+    result->emplace<xlbool>(true);
+    return xlretSuccess;
+}
+
 int main()
 {
     {
@@ -53,6 +81,11 @@ int main()
         // expect static assertion failure: async functions must have void return type
         //constexpr auto tt = detail::type_text(error2, attribute_set<>());
     }
+    {
+        // expect static assertion failure: cluster-safe functions cannot take range references
+        //constexpr auto attrs = attribute_set<tag::cluster_safe>();
+        //constexpr auto tt = detail::type_text(func3, attrs);
+    }
     {
         // expect static assertion failure: async functions cannot be cluster-safe
         //constexpr auto attrs = attribute_set<tag::cluster_safe>();
@@ -76,6 +109,116 @@ int main()
         constexpr std::array<wchar_t, 3> expected{{ L'C', L'Q', L'&' }};
         BOOST_TEST(tt == expected);
     }
+    {
+        constexpr auto attrs = attribute_set<tag::thread_safe>();
+        constexpr auto tt = detail::type_text(func3, attrs);
+        constexpr std::array<wchar_t, 3> expected{{ L'Q', L'U', L'$' }};
+        BOOST_TEST(tt == expected);
+    }
+    {
+        range_ref r;
+        xlsref sref;
+        sref.ref.rwFirst = 2;
+        sref.ref.rwLast = 101;
+        sref.ref.colFirst = 1;
+        sref.ref.colLast = 3;
+        r.emplace<xlsref>(sref);
+        BOOST_TEST(r.is_reference());
+        BOOST_TEST_EQ(r.area_count(), 1);
+        BOOST_TEST_EQ(r.rows(), 100);
+        BOOST_TEST_EQ(r.columns(), 3);
+    }
+    {
+        range_ref r(2.5);
+        BOOST_TEST(!r.is_reference());
+        BOOST_TEST_EQ(r.values()->get<xlnum>(), 2.5);
+        BOOST_TEST_EQ(r.cell(0, 0).get<xlnum>(), 2.5);
+    }
+    {
+        // functions with identical signatures have distinct entries
+        registry::add(func1, L"func1", L"FUNC.1", L"CQ", function_options(), 1.0);
+        registry::add(func2, L"func2", L"FUNC.2", L"CQ", function_options(), 2.0);
+        BOOST_TEST_EQ(registry::size(), 2);
+        BOOST_TEST(registry::find(func1) != nullptr);
+        BOOST_TEST(registry::find(func2) != nullptr);
+        BOOST_TEST_EQ(registry::find(func1)->id.load(), 1.0);
+        BOOST_TEST_EQ(registry::find(func2)->id.load(), 2.0);
+        BOOST_TEST(registry::find(L"func2") == registry::find(func2));
+        BOOST_TEST(registry::find(L"func3") == nullptr);
+        BOOST_TEST(registry::find(async1) == nullptr);
+
+        // re-registration updates the register id; Excel keeps the old one
+        // registered if it differs
+        registry::add(func1, L"func1", L"FUNC.1", L"CQ", function_options(), 3.0);
+        BOOST_TEST_EQ(registry::size(), 2);
+        BOOST_TEST_EQ(registry::find(func1)->id.load(), 3.0);
+        BOOST_TEST(unregistered == std::vector<double>{ 1.0 });
+        registry::add(func1, L"func1", L"FUNC.1", L"CQ", function_options(), 3.0);
+        BOOST_TEST_EQ(unregistered.size(), 1u);
+
+        std::vector<std::wstring> names;
+        registry::for_each([&](const function_entry& e) { names.push_back(e.export_name); });
+        BOOST_TEST_EQ(names.size(), 2);
+        BOOST_TEST(names[0] == L"func1");
+        BOOST_TEST(names[1] == L"func2");
+
+        BOOST_TEST(registry::remove(func1));
+        BOOST_TEST(!registry::remove(func1));
+        BOOST_TEST(!registry::find(func1)->registered());
+        BOOST_TEST(registry::find(func2)->registered());
+
+        // a known name from a new address replaces the stale entry
+        const function_entry *stale = registry::find(func1);
+        const function_entry *e = registry::add(error2, L"func1", L"FUNC.1", L"CQ", function_options(), 4.0);
+        BOOST_TEST(e != stale);
+        BOOST_TEST_EQ(registry::size(), 2);
+        BOOST_TEST(registry::find(func1) == nullptr);
+        BOOST_TEST(registry::find(error2) == e);
+        BOOST_TEST(registry::find(L"func1") == e);
+        BOOST_TEST_EQ(e->id.load(), 4.0);
+        BOOST_TEST_EQ(stale->id.load(), 0.0);
+        BOOST_TEST(stale->export_name == L"func1"); // unchanged for readers holding it
+        BOOST_TEST_EQ(unregistered.size(), 1u); // removed before
+
+        // a reloaded export given a new id by Excel
+        const function_entry *reloaded = registry::add(error1, L"func1", L"FUNC.1", L"CQ", function_options(), 7.0);
+        BOOST_TEST(unregistered == (std::vector<double>{ 1.0, 4.0 }));
+        BOOST_TEST(registry::find(error2) == nullptr);
+        e = registry::add(error2, L"func1", L"FUNC.1", L"CQ", function_options(), 4.0);
+        BOOST_TEST(unregistered == (std::vector<double>{ 1.0, 4.0, 7.0 }));
+        BOOST_TEST(reloaded != e);
+
+        // a known address under a new name
+        e = registry::add(func2, L"func2b", L"FUNC.2B", L"CQ", function_options(), 5.0);
+        BOOST_TEST(unregistered == (std::vector<double>{ 1.0, 4.0, 7.0, 2.0 }));
+        BOOST_TEST_EQ(registry::size(), 2);
+        BOOST_TEST(registry::find(L"func2") == nullptr);
+        BOOST_TEST(registry::find(func2) == e);
+
+        names.clear();
+        registry::for_each([&](const function_entry& x) { names.push_back(x.export_name); });
+        BOOST_TEST_EQ(names.size(), 2);
+        BOOST_TEST(names[0] == L"func1");
+        BOOST_TEST(names[1] == L"func2b");
+
+        // many replacements leave tombstones which growth drops
+        for (int i = 0; i < 50; ++i) {
+            registry::add(func1, L"func1", L"FUNC.1", L"CQ", function_options(), 6.0 + i);
+            registry::add(error2, L"func1", L"FUNC.1", L"CQ", function_options(), 6.0 + i);
+        }
+        BOOST_TEST_EQ(registry::size(), 2);
+        BOOST_TEST(registry::find(error2) == registry::find(L"func1"));
+        BOOST_TEST(registry::find(func1) == nullptr);
+
+        // unregister_all reaches every live registration exactly once
+        unregistered.clear();
+        BOOST_TEST_EQ(registry::unregister_all(), 2u);
+        BOOST_TEST_EQ(unregistered.size(), 2u);
+
+        registry::clear();
+        BOOST_TEST_EQ(registry::size(), 0);
+        BOOST_TEST(registry::find(func2) == nullptr);
+    }
 
     return boost::report_errors();
 }
\ No newline at end of file
@@ -0,0 +1,93 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/reload.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <filesystem>
+#include <string>
+
+using namespace xll;
+
+namespace {
+
+double __stdcall price_builtin(double x) { return -x; }
+
+double __stdcall rate_builtin(double x) { return 10.0 * x; }
+
+double price(double x) { return implementation<&price_builtin>::call(x); }
+
+double rate(double x) { return implementation<&rate_builtin>::call(x); }
+
+// Copies of the library made by reload() which still exist.
+std::size_t copies(const std::filesystem::path& library)
+{
+    std::error_code ec;
+    const std::string prefix = library.stem().string() + ".";
+    std::size_t n = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(library.parent_path(), ec)) {
+        const std::filesystem::path name = entry.path().filename();
+        n += name != library.filename() && name.string().rfind(prefix, 0) == 0;
+    }
+    return n;
+}
+
+} // namespace
+
+// Usage: test_reload [version 1 library] [version 2 library], by default
+// reload_module_v1 and reload_module_v2 in the directory of test_reload.
+int main(int argc, char *argv[])
+{
+#if BOOST_OS_WINDOWS
+    const char *suffix = ".dll";
+#else
+    const char *suffix = ".so";
+#endif
+    const std::filesystem::path dir = std::filesystem::path(argv[0]).parent_path();
+    const std::filesystem::path v1 = argc > 2 ? std::filesystem::path(argv[1]) : dir / (std::string("reload_module_v1") + suffix);
+    const std::filesystem::path v2 = argc > 2 ? std::filesystem::path(argv[2]) : dir / (std::string("reload_module_v2") + suffix);
+
+    // The library is rebuilt in place between reloads.
+    const std::filesystem::path library = std::filesystem::temp_directory_path() / (std::string("xll_test_reload") + suffix);
+    const auto overwrite = std::filesystem::copy_options::overwrite_existing;
+
+    BOOST_TEST_EQ(implementations::bind<&price_builtin>("price_v2"), 0u);
+    BOOST_TEST_EQ(implementations::bind<&rate_builtin>("rate_v2"), 1u);
+    BOOST_TEST_EQ(price(1.0), -1.0);
+
+    std::filesystem::copy_file(v1, library, overwrite);
+    BOOST_TEST(implementations::reload(library.wstring()));
+    BOOST_TEST_EQ(price(1.0), 2.0);
+    BOOST_TEST_EQ(rate(1.0), 10.0); // not exported: built-in
+
+    // A rebuilt library at the same path is loaded again
+    std::filesystem::copy_file(v2, library, overwrite);
+    BOOST_TEST(implementations::reload(library.wstring()));
+    BOOST_TEST_EQ(price(1.0), 3.0);
+
+    std::filesystem::copy_file(v1, library, overwrite);
+    BOOST_TEST(implementations::reload(library.wstring()));
+    BOOST_TEST_EQ(price(1.0), 2.0);
+    BOOST_TEST_EQ(copies(library), 3u); // kept until clear()
+
+    // A failed reload keeps the current implementations
+    BOOST_TEST(!implementations::reload((library.parent_path() / "missing.so").wstring()));
+    BOOST_TEST_EQ(price(1.0), 2.0);
+
+    implementations::reset();
+    BOOST_TEST_EQ(price(1.0), -1.0);
+
+    // Copies are deleted when the libraries are unloaded
+    implementations::clear();
+    BOOST_TEST_EQ(copies(library), 0u);
+    BOOST_TEST_EQ(price(1.0), -1.0);
+
+    std::error_code ec;
+    std::filesystem::remove(library, ec);
+    return boost::report_errors();
+}
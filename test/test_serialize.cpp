@@ -0,0 +1,141 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/xll.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace xll;
+
+namespace {
+
+variant sample()
+{
+    xlmulti inner(1, 2);
+    inner[0] = 1.0;
+    inner[1] = L"inner";
+
+    xlmulti m(3, 2);
+    m[0] = 2.5;
+    m[1] = L"text";
+    m[2] = xlbool(true);
+    m[3] = error::xlerrDiv0;
+    m[4] = variant(std::move(inner));
+    m[5].emplace<xlnil>();
+    return variant(std::move(m));
+}
+
+} // namespace
+
+int main()
+{
+    // Scalars
+    {
+        for (variant v : { variant(-0.5), variant(L"abc"), variant(xlbool(false)),
+            variant(error::xlerrNA), variant(42), variant(L"") })
+        {
+            std::vector<unsigned char> data = serialize(v);
+            BOOST_TEST_EQ(data.size(), serialized_size(v));
+            variant copy;
+            BOOST_TEST(deserialize(data.data(), data.size(), copy));
+            BOOST_TEST(copy.xltype() == v.xltype());
+            BOOST_TEST(detail::variant_equal()(copy, v));
+        }
+    }
+
+    // Little-endian layout
+    {
+        std::vector<unsigned char> data = serialize(variant(1.0));
+        const unsigned char expected[] = { 'X', 'L', 'L', 'V', 1, 0, 0, 0,
+            xltypeNum, 0, 0, 0, 0, 0, 0, 0, 0xF0, 0x3F };
+        BOOST_TEST_EQ(data.size(), sizeof(expected));
+        BOOST_TEST(std::equal(data.begin(), data.end(), expected));
+    }
+
+    // Nested arrays
+    {
+        variant v = sample();
+        std::vector<unsigned char> data = serialize(v);
+        BOOST_TEST_EQ(data.size(), serialized_size(v));
+        variant copy;
+        BOOST_TEST(deserialize(data.data(), data.size(), copy));
+        BOOST_TEST(copy.xltype() == xltypeMulti);
+        const auto& m = copy.get<xlmulti>();
+        BOOST_TEST_EQ(m.size1(), 3u);
+        BOOST_TEST_EQ(m.size2(), 2u);
+        BOOST_TEST_EQ(static_cast<double>(m[0].get<xlnum>()), 2.5);
+        BOOST_TEST(std::wstring(m[1].get<xlstr>()) == L"text");
+        BOOST_TEST(m[2].get<xlbool>());
+        BOOST_TEST(m[3].get<xlerr>() == error::xlerrDiv0);
+        BOOST_TEST(m[4].xltype() == xltypeMulti);
+        BOOST_TEST(std::wstring(m[4].get<xlmulti>()[1].get<xlstr>()) == L"inner");
+        BOOST_TEST(m[5].xltype() == xltypeNil);
+    }
+
+    // Views
+    {
+        std::vector<unsigned char> data = serialize(sample());
+        serialized_view view;
+        BOOST_TEST(serialized_view::parse(data.data(), data.size(), view));
+        BOOST_TEST_EQ(view.xltype(), xltypeMulti);
+        BOOST_TEST_EQ(view.rows(), 3u);
+        BOOST_TEST_EQ(view.columns(), 2u);
+        BOOST_TEST_EQ(view.encoded_size(), data.size() - 8);
+
+        std::vector<int> types;
+        for (serialized_view x : view)
+            types.push_back(x.xltype());
+        BOOST_TEST((types == std::vector<int>{ xltypeNum, xltypeStr, xltypeBool, xltypeErr, xltypeMulti, xltypeNil }));
+
+        auto it = view.begin();
+        BOOST_TEST_EQ((*it).number(), 2.5);
+        ++it;
+        BOOST_TEST((*it).string() == L"text");
+        {
+            auto s = (*it).string_view();
+            BOOST_TEST_EQ(s.size(), 4u);
+            BOOST_TEST(s[0] == 't' && s[3] == 't');
+            BOOST_TEST(reinterpret_cast<const unsigned char *>(s.data()) > data.data());
+            BOOST_TEST(reinterpret_cast<const unsigned char *>(s.data()) < data.data() + data.size());
+        }
+        ++it;
+        BOOST_TEST((*it).boolean());
+        ++it;
+        BOOST_TEST((*it).error() == error::xlerrDiv0);
+        ++it;
+        BOOST_TEST_EQ((*it).size(), 2u);
+        BOOST_TEST((*(*it).begin()).number() == 1.0);
+        variant inner = (*it).to_variant();
+        BOOST_TEST(inner.xltype() == xltypeMulti);
+    }
+
+    // Invalid data
+    {
+        std::vector<unsigned char> data = serialize(sample());
+        for (std::size_t n = 0; n < data.size(); ++n) {
+            variant v;
+            serialized_view view;
+            BOOST_TEST(!deserialize(data.data(), n, v));
+            BOOST_TEST(!serialized_view::parse(data.data(), n, view));
+        }
+
+        std::vector<unsigned char> other = data;
+        other[4] = 2; // version
+        variant v;
+        BOOST_TEST(!deserialize(other.data(), other.size(), v));
+
+        other = data;
+        other[8] = 0xFF; // xltype
+        serialized_view view;
+        BOOST_TEST(!serialized_view::parse(other.data(), other.size(), view));
+    }
+
+    return boost::report_errors();
+}
@@ -0,0 +1,83 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/xll.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+using namespace xll;
+
+int main()
+{
+    const std::string name = "/xll.test." + std::to_string(::getpid());
+    constexpr unsigned rows = 1000, cols = 4;
+
+    // A worker process fills the array
+    const pid_t pid = ::fork();
+    if (pid == 0) {
+        int rc = 1;
+        try {
+            auto m = shared_multi::create(name, rows, cols, rows * 4);
+            for (unsigned i = 0; i < rows; ++i) {
+                m.set(i * cols, static_cast<double>(i));
+                m.set(i * cols + 1, std::wstring_view(L"row"));
+                m.set(i * cols + 2, variant(xlbool(i % 2 == 0)));
+            }
+            // The heap holds rows strings of three characters
+            rc = m.set(3, std::wstring_view(L"overflow")) ? 2 : 0;
+        }
+        catch (...) {
+        }
+        ::_exit(rc);
+    }
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    BOOST_TEST(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    BOOST_TEST_THROWS(shared_multi::create(name, 1, 1), std::system_error);
+
+    {
+        auto m = shared_multi::open(name);
+        BOOST_TEST(shared_multi::remove(name));
+        BOOST_TEST_EQ(m.rows(), rows);
+        BOOST_TEST_EQ(m.columns(), cols);
+        BOOST_TEST_EQ(m.string_chars(), rows * 4);
+
+        BOOST_TEST_EQ(static_cast<double>(m[4 * cols].get<xlnum>()), 4.0);
+        BOOST_TEST(m[999 * cols + 1].xltype() == xltypeStr);
+        BOOST_TEST(std::wstring(m[999 * cols + 1].get<xlstr>()) == L"row");
+        BOOST_TEST(m[2].get<xlbool>());
+        BOOST_TEST(!m[cols + 2].get<xlbool>());
+        BOOST_TEST(m[3].xltype() == xltypeNil);
+
+        // The array is returned to Excel without copying
+        const variant *cells = m.data();
+        variant *p = m.release();
+        BOOST_TEST(!m);
+        BOOST_TEST(p->xltype() == xltypeMulti);
+        BOOST_TEST(p->flags() & xlbitDLLFree);
+        const auto& a = p->get<xlmulti>();
+        BOOST_TEST_EQ(a.size1(), rows);
+        BOOST_TEST_EQ(a.size2(), cols);
+        BOOST_TEST(a.data() == cells);
+        BOOST_TEST(std::wstring(a(10, 1).get<xlstr>()) == L"row");
+
+        BOOST_TEST(shared_multi::free(p));
+        BOOST_TEST(!shared_multi::free(p));
+    }
+
+    BOOST_TEST_THROWS(shared_multi::open(name), std::system_error);
+
+    return boost::report_errors();
+}
@@ -0,0 +1,129 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/xll.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+
+using namespace xll;
+
+namespace {
+
+double register_calls = 0.0;
+
+double __stdcall fast(double x)
+{
+    return x;
+}
+
+double __stdcall slow(double x)
+{
+    return x;
+}
+
+double __stdcall broken(double x)
+{
+    return x;
+}
+
+} // namespace
+
+// Host emulation: xlfRegister takes 5 ms for SLOW and fails for BROKEN.
+XLL_EXPORT int __stdcall MdCallBack12(int xlfn, int, variant **opers, variant *result)
+{
+    switch (xlfn) {
+    case xlGetName:
+        result->emplace<xlstr>(L"test_startup.xll");
+        return xlretSuccess;
+    case xlfRegister: {
+        const std::wstring text(opers[3]->get<xlstr>());
+        if (text == L"BROKEN")
+            return xlretInvXloper;
+        if (text == L"SLOW")
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        result->emplace<xlnum>(++register_calls);
+        return xlretSuccess;
+    }
+    case xlFree:
+        return xlretSuccess;
+    default:
+        return xlretFailed;
+    }
+}
+
+int main()
+{
+    // Not recorded outside begin() and end()
+    BOOST_TEST(!startup_profiler::active());
+    BOOST_TEST_EQ(register_function(fast, L"fast", L"FAST"), 1.0);
+    BOOST_TEST(startup_profiler::report().registrations.empty());
+
+    startup_profiler::begin();
+    BOOST_TEST(startup_profiler::active());
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    function_options opts;
+    opts.function_help = L"Slow to register";
+    opts.argument_help = { L"x" };
+    BOOST_TEST_EQ(register_function(slow, L"slow", L"SLOW", opts), 2.0);
+    BOOST_TEST_EQ(register_function(broken, L"broken", L"BROKEN"), 0.0);
+    BOOST_TEST_EQ(register_function(fast, L"fast", L"FAST"), 3.0);
+    const startup_report report = startup_profiler::end();
+    BOOST_TEST(!startup_profiler::active());
+
+    BOOST_TEST_EQ(report.registrations.size(), 3u);
+    BOOST_TEST_EQ(report.failed, 1u);
+    BOOST_TEST_GE(report.first_function_ns, 7000000u);
+    BOOST_TEST_GE(report.total_ns, report.first_function_ns);
+    BOOST_TEST_GE(report.register_ns, 5000000u);
+    if (report.registrations.size() == 3) {
+        const registration_timing& s = report.registrations[0];
+        BOOST_TEST(s.export_name == L"slow");
+        BOOST_TEST(s.function_text == L"SLOW");
+        BOOST_TEST(s.registered);
+        BOOST_TEST_EQ(s.rc, xlretSuccess);
+        BOOST_TEST_GE(s.start_ns, 2000000u);
+        BOOST_TEST_GE(s.register_ns, 5000000u);
+        BOOST_TEST_GT(s.strings_ns, 0u);
+        BOOST_TEST_EQ(s.total_ns(), s.build_ns + s.strings_ns + s.register_ns + s.registry_ns);
+
+        const registration_timing& b = report.registrations[1];
+        BOOST_TEST(!b.registered);
+        BOOST_TEST_EQ(b.rc, xlretInvXloper);
+        BOOST_TEST_EQ(b.registry_ns, 0u);
+
+        BOOST_TEST(report.registrations[2].start_ns >= s.start_ns + s.total_ns());
+    }
+
+    // JSON
+    {
+        const std::string json = report.json();
+        BOOST_TEST(json.find("{\"version\":1,") == 0);
+        BOOST_TEST(json.find("\"functions\":3,\"failed\":1,") != std::string::npos);
+        BOOST_TEST(json.find("{\"name\":\"broken\",\"function_text\":\"BROKEN\",\"rc\":8,") != std::string::npos);
+
+        const auto path = std::filesystem::temp_directory_path() / "xll_test_startup.json";
+        BOOST_TEST(report.write(path));
+        std::ifstream stream(path, std::ios::binary);
+        BOOST_TEST(std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>()) == json);
+        stream.close();
+        std::filesystem::remove(path);
+    }
+
+    // A new report discards the previous one
+    startup_profiler::begin();
+    BOOST_TEST(startup_profiler::report().registrations.empty());
+    BOOST_TEST_EQ(startup_profiler::end().first_function_ns, 0u);
+
+    return boost::report_errors();
+}
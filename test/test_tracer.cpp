@@ -0,0 +1,148 @@
+//  Copyright 2024 John Buonagurio
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//
+//  See accompanying file LICENSE_1_0.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+
+#include <xll/xll.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if BOOST_OS_LINUX
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace xll;
+
+namespace {
+
+std::atomic<int> returned{ 0 };
+
+double square(double x)
+{
+    variant result;
+    Excel12(xlfNow, &result);
+    return x * x;
+}
+
+std::string read_file(const std::filesystem::path& path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+}
+
+std::size_t count(const std::string& s, const std::string& what)
+{
+    std::size_t n = 0;
+    for (auto pos = s.find(what); pos != std::string::npos; pos = s.find(what, pos + what.size()))
+        ++n;
+    return n;
+}
+
+} // namespace
+
+XLL_EXPORT_FUNCTION(xl_square, square, 1)
+
+// Host emulation: xlfNow and xlAsyncReturn.
+XLL_EXPORT int __stdcall MdCallBack12(int xlfn, int, variant **, variant *result)
+{
+    switch (xlfn) {
+    case xlfNow:
+        result->emplace<xlnum>(45000.0);
+        return xlretSuccess;
+    case xlAsyncReturn:
+        ++returned;
+        if (result)
+            result->emplace<xlbool>(true);
+        return xlretSuccess;
+    default:
+        return xlretFailed;
+    }
+}
+
+int main()
+{
+    // Thread identifiers
+    {
+        const std::size_t main_id = thread_id();
+        std::size_t other_id = 0;
+        std::thread([&]() { other_id = thread_id(); }).join();
+        BOOST_TEST_NE(main_id, 0u);
+        BOOST_TEST_NE(main_id, other_id);
+#if BOOST_OS_LINUX
+        BOOST_TEST_EQ(main_id, static_cast<std::size_t>(::syscall(SYS_gettid)));
+        BOOST_TEST_EQ(main_id, static_cast<std::size_t>(::getpid()));
+#endif
+    }
+
+    const auto path = std::filesystem::temp_directory_path() / "xll_test_tracer.json";
+
+    // Not traced while inactive
+    BOOST_TEST(!tracer::active());
+    BOOST_TEST_EQ(tracer::timestamp(), 0u);
+    xl_square(1.0);
+
+    BOOST_TEST(tracer::start(path, 1024, std::chrono::milliseconds(5)));
+    BOOST_TEST(tracer::active());
+    BOOST_TEST(!tracer::start(path));
+    {
+        tracer::scope span("main \"scope\"");
+        BOOST_TEST_EQ(xl_square(3.0), 9.0);
+        std::thread([]() { xl_square(2.0); }).join();
+
+        xlbigdata bd{};
+        bd.h = reinterpret_cast<void *>(0x10);
+        handle h(bd);
+        async_executor::submit(&h, [](double x) { return x + 1.0; }, 1.0);
+        for (int i = 0; i < 500 && returned.load() == 0; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20)); // background flush
+    BOOST_TEST_GT(tracer::events(), 0u);
+    BOOST_TEST(tracer::stop());
+    BOOST_TEST(!tracer::active());
+    BOOST_TEST(tracer::stop());
+    async_executor::stop();
+
+    {
+        const std::string json = read_file(path);
+        BOOST_TEST_EQ(json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0), 0u);
+        BOOST_TEST_EQ(json.substr(json.size() - 2), std::string("}}"));
+        BOOST_TEST_EQ(count(json, "\"name\":\"xl_square\""), 2u);
+        BOOST_TEST_EQ(count(json, "\"xlfn\":" + std::to_string(xlfNow)), 2u);
+        BOOST_TEST_EQ(count(json, "\"name\":\"main \\\"scope\\\"\""), 1u);
+        BOOST_TEST_EQ(count(json, "\"ph\":\"b\""), 1u);
+        BOOST_TEST_EQ(count(json, "\"ph\":\"e\""), 1u);
+        BOOST_TEST_EQ(count(json, "\"name\":\"async job\""), 1u);
+        BOOST_TEST_EQ(count(json, "\"tid\":" + std::to_string(thread_id())), 3u);
+        BOOST_TEST_EQ(count(json, "\"droppedEvents\":\"0\""), 1u);
+    }
+
+    // Full buffers drop events
+    BOOST_TEST(tracer::start(path, 16, std::chrono::seconds(10)));
+    for (int i = 0; i < 40; ++i)
+        xl_square(1.0);
+    BOOST_TEST_EQ(tracer::dropped(), 2 * 40 - 16u);
+    tracer::flush();
+    xl_square(1.0);
+    BOOST_TEST_EQ(tracer::events(), 16u);
+    BOOST_TEST(tracer::stop());
+    {
+        const std::string json = read_file(path);
+        BOOST_TEST_EQ(count(json, "\"ph\":\"X\""), 18u);
+    }
+
+    std::filesystem::remove(path);
+    return boost::report_errors();
+}